@@ -313,14 +313,16 @@
  *
  * The value should be an unsigned integer that represents the number
  * of milliseconds the fidi_app shall sleep on handling the request
- * before taking any other action.
+ * before taking any other action. It may instead be a quoted
+ * distribution, such as "lognormal:10,0.5", which each request draws
+ * its own delay from (see fidi::Distribution).
  *
  * \subsubsection k2 postdelay
  *
  * The value should be an unsigned integer that represents the number
  * of milliseconds the fidi_app shall sleep after all other actions
  * for the request have been performed, and just before the call
- * returns.
+ * returns. Like the predelay, it may be a distribution.
  *
  * \subsubsection k3 response
  *
@@ -450,6 +452,16 @@
  * make downstream HTTP calls, in series or in parallel, as requested.
  */
 
+/** \defgroup bench The load generator for fidi (φίδι)
+ *  \ingroup fidi
+ *
+ * The load generator sends a request to the first instance of a set
+ * of service mock application instances, over and over, either at a
+ * set rate or with a set number of requests outstanding, and reports
+ * the latency percentiles seen, measured from when each request was
+ * due to be sent.
+ */
+
 /* index.h ends here */
 
 #endif /* INDEX_H */
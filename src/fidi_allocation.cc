@@ -0,0 +1,113 @@
+// fidi_allocation.cc ---  -*- mode: c++; -*-
+
+// Copyright 2018-2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied.  See the License for the specific language governing
+// permissions and limitations under the License.
+
+/// \file
+/// \ingroup app
+///
+/// This file provides the implementation of the memory allocated by
+/// requests in the fidi (φίδι) HTTP server.
+
+// Code:
+
+#include "src/fidi_allocation.h"
+
+#include <sys/mman.h>
+#include <unistd.h>
+#include <chrono>
+#include <fstream>
+#include <new>
+#include <numeric>
+#include <random>
+
+namespace {
+  /// \brief The size of a page
+  /// \return size_t The page size, in bytes
+  std::size_t
+  PageSize(void) {
+    static const std::size_t page_size = [] {
+      long size = sysconf(_SC_PAGESIZE);
+      return size > 0 ? static_cast<std::size_t>(size) : std::size_t(4096);
+    }();
+    return page_size;
+  }
+}  // namespace
+
+fidi::Allocation::Allocation(std::size_t size, Pattern pattern,
+                             bool huge_pages) :
+    memory_(nullptr), size_(size), touch_usec_(0), rss_delta_(0) {
+  if (size_ == 0) { return; }
+  memory_ = mmap(nullptr, size_, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (memory_ == MAP_FAILED) {
+    memory_ = nullptr;
+    throw std::bad_alloc();
+  }
+#if defined(MADV_HUGEPAGE)
+  // Only a hint; the kernel may not have huge pages to give
+  if (huge_pages) { (void)madvise(memory_, size_, MADV_HUGEPAGE); }
+#else
+  (void)huge_pages;
+#endif
+
+  std::int64_t rss_before = ResidentBytes();
+  auto         start      = std::chrono::steady_clock::now();
+  Touch(pattern);
+  touch_usec_ = std::chrono::duration_cast<std::chrono::microseconds>(
+                    std::chrono::steady_clock::now() - start)
+                    .count();
+  rss_delta_ = ResidentBytes() - rss_before;
+}
+
+fidi::Allocation::~Allocation() {
+  if (memory_ != nullptr) { munmap(memory_, size_); }
+  memory_ = nullptr;
+}
+
+void
+fidi::Allocation::Touch(Pattern pattern) {
+  volatile unsigned char *bytes = static_cast<unsigned char *>(memory_);
+  std::size_t             page  = PageSize();
+  std::size_t             pages = (size_ + page - 1) / page;
+  if (pattern == Pattern::kSequential || pages < 2) {
+    for (std::size_t i = 0; i < pages; ++i) { bytes[i * page] = 1; }
+    return;
+  }
+  // Any stride that shares no factor with the number of pages visits
+  // each page exactly once, without having to keep a list of them
+  std::random_device                         seed;
+  std::mt19937_64                            random(seed());
+  std::uniform_int_distribution<std::size_t> pick(1, pages - 1);
+  std::size_t                                stride = pick(random);
+  while (std::gcd(stride, pages) != 1) { stride = pick(random); }
+  std::size_t index = pick(random);
+  for (std::size_t i = 0; i < pages; ++i) {
+    bytes[index * page] = 1;
+    index               = (index + stride) % pages;
+  }
+}
+
+std::int64_t
+fidi::Allocation::ResidentBytes(void) {
+  // The second field of statm is the resident set, in pages
+  std::ifstream statm("/proc/self/statm");
+  std::int64_t  total    = 0;
+  std::int64_t  resident = 0;
+  if (!(statm >> total >> resident)) { return 0; }
+  return resident * static_cast<std::int64_t>(PageSize());
+}
+
+//
+// fidi_allocation.cc ends here
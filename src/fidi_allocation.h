@@ -0,0 +1,113 @@
+// fidi_allocation.h ---  -*- mode: c++; -*-
+
+// Copyright 2018-2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied.  See the License for the specific language governing
+// permissions and limitations under the License.
+
+/// \file
+/// \ingroup app
+///
+/// This file contains the memory allocated by a request, with the
+/// memory attribute, in the fidi (φίδι) HTTP server.
+
+// Code:
+
+#ifndef FIDI_ALLOCATION_H
+#  define FIDI_ALLOCATION_H
+
+#  include <cstddef>
+#  include <cstdint>
+
+namespace fidi {
+
+  /// \brief Memory allocated, and touched, on behalf of a request
+  ///
+  /// The memory is mapped directly from the kernel, rather than taken
+  /// from the heap, so that every request pays for its own page
+  /// faults, and the memory goes back to the kernel as soon as the
+  /// request is done with it. Every page is written to, in the order
+  /// given, so the memory is really resident, and not just reserved.
+  ///
+  /// The resident set size of the process is sampled before and after
+  /// the pages are touched, to show how much of the allocation the
+  /// kernel actually had to provide.
+  class Allocation {
+   public:
+    /// The order in which the pages are first touched
+    enum class Pattern {
+      kSequential,  ///< From the first page to the last
+      kRandom,      ///< In a scattered order, with a random stride
+    };
+
+    /// \brief Constructor. Maps and touches the memory
+    ///
+    /// \param[in] size The number of bytes to allocate
+    /// \param[in] pattern The order in which to touch the pages
+    /// \param[in] huge_pages Ask for transparent huge pages
+    /// \throw std::bad_alloc if the memory can not be mapped
+    Allocation(std::size_t size, Pattern pattern, bool huge_pages);
+
+    /// The copy constructor is not used, so declutter.
+    Allocation(const Allocation &) = delete;
+    /// The assignment operator is also not used, so cleaned up.
+    Allocation &operator=(const Allocation &) = delete;
+    /// The move operations are unused, and cleaned up.
+    Allocation(Allocation &&) = delete;
+    Allocation &operator=(Allocation &&) = delete;
+
+    /// Destructor. Returns the memory to the kernel
+    ~Allocation();
+
+    /// \brief The number of bytes allocated
+    /// \return size_t The size of the allocation
+    std::size_t
+    get_size(void) const {
+      return size_;
+    }
+
+    /// \brief How long it took to touch every page
+    /// \return int64_t The time taken, in microseconds
+    std::int64_t
+    get_touch_usec(void) const {
+      return touch_usec_;
+    }
+
+    /// \brief How much the resident set grew while touching the pages
+    /// \return int64_t The growth, in bytes; may be negative
+    std::int64_t
+    get_rss_delta(void) const {
+      return rss_delta_;
+    }
+
+    /// \brief The current resident set size of the process
+    /// \return int64_t The resident set size in bytes, or 0 if unknown
+    static std::int64_t ResidentBytes(void);
+
+   private:
+    /// \brief Write to every page of the allocation
+    ///
+    /// \param[in] pattern The order in which to touch the pages
+    void Touch(Pattern pattern);
+
+    void *       memory_;      ///< The mapped memory
+    std::size_t  size_;        ///< The number of bytes mapped
+    std::int64_t touch_usec_;  ///< Time spent touching the pages
+    std::int64_t rss_delta_;   ///< Resident set growth while touching
+  };
+
+}  // namespace fidi
+
+#endif /* FIDI_ALLOCATION_H */
+
+//
+// fidi_allocation.h ends here
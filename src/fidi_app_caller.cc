@@ -24,44 +24,354 @@
 
 #include "src/fidi_app_caller.h"
 
+#include <Poco/Exception.h>
+#include <Poco/NullStream.h>
+#include <Poco/StreamCopier.h>
+
+#include <chrono>
+#include <utility>
+
+#include "src/fidi_async_client.h"
+#include "src/fidi_executor.h"
+#include "src/fidi_local_dispatch.h"
+#include "src/fidi_logging.h"
+#include "src/fidi_metrics.h"
+#include "src/fidi_node_table_cache.h"
+#include "src/fidi_session_pool.h"
+
 void
 fidi::AppCaller::runTask() {
-  Poco::Logger::get("ConsoleLogger")
-      .trace("Making call to " + url_ + "\n\t" + payload_);
+  Poco::Logger &console = fidi::Log::Console();
+  if (console.trace()) {
+    console.trace("Making call to " + url_ + "\n\t" + payload_.str());
+  }
+  fidi::SessionPool &        pool = fidi::SessionPool::instance();
+  fidi::NodeTableCache &     tables = fidi::NodeTableCache::instance();
+  Poco::URI                  uri;
+  fidi::SessionPool::Session session;
+  bool                       reusable = false;
+  std::string                destination(url_);
+  fidi::Tracer &             tracer = fidi::Tracer::instance();
+  fidi::TraceContext         span   = tracer.StartSpan(trace_);
+  int                        status = 0;
+  auto                       start  = std::chrono::steady_clock::now();
   try {
-    Poco::URI                    uri(url_);
-    Poco::Net::HTTPClientSession session(uri.getHost(), uri.getPort());
+    // Pooled sessions may carry an earlier caller's timeout; without
+    // one of our own, go back to the Poco default of 60 seconds
+    Poco::Timespan timeout(60, 0);
     if (timeout_sec_ > 0 || timeout_usec_ > 0) {
-      session.setTimeout(Poco::Timespan(timeout_sec_, timeout_usec_));
+      timeout = Poco::Timespan(timeout_sec_, timeout_usec_);
+    }
+    uri     = Poco::URI(url_);
+    session = pool.Acquire(uri.getHost(), uri.getPort());
+    session->setTimeout(timeout);
+    {
+      std::lock_guard<std::mutex> lock(cancel_mtx_);
+      // Cancelled before it started, so this call is not made
+      if (cancelled_) { throw Poco::IOException("Call cancelled"); }
+      active_ = session.get();
     }
 
     // prepare path
     std::string path(uri.getPathAndQuery());
     if (path.empty()) path = "/";
 
-    Poco::Net::HTTPRequest req(Poco::Net::HTTPRequest::HTTP_POST, path,
-                               Poco::Net::HTTPMessage::HTTP_1_1);
-    req.setContentType("application/x-www-form-urlencoded");
-    req.setChunkedTransferEncoding(true);
+    destination = uri.getHost();
+    destination.append(":").append(std::to_string(uri.getPort()));
+    bool shared = !nodes_hash_.empty();
+    bool omit   = shared && tables.WasSent(destination, nodes_hash_);
+
+    Poco::Net::HTTPResponse res;
+    for (;;) {
+      const fidi::Payload &body = omit ? short_payload_ : payload_;
+      Poco::Net::HTTPRequest req(Poco::Net::HTTPRequest::HTTP_POST, path,
+                                 Poco::Net::HTTPMessage::HTTP_1_1);
+      req.setContentType(content_type_);
+      req.setKeepAlive(true);
+      if (shared) { req.set(fidi::NodeTableCache::kHeader, nodes_hash_); }
+      if (span.valid()) { req.set(fidi::Tracer::kHeader, span.Header()); }
+      if (seeded_) { req.set(kSeedHeader, std::to_string(seed_)); }
 
-    req.setContentLength(payload_.length());
+      req.setContentLength(static_cast<std::streamsize>(body.size()));
 
 #if defined(DEBUG)
-    req.write(std::cout);  // print out request for debugging
+      req.write(std::cout);  // print out request for debugging
 #endif
 
-    std::ostream& os = session.sendRequest(req);
-    os << payload_;
-    Poco::Net::HTTPResponse res;
-    std::string             rbody;
-    session.receiveResponse(res) >> rbody;
+      std::ostream& os = session->sendRequest(req);
+      body.WriteTo(os);
+      std::istream& rs = session->receiveResponse(res);
+      // Drain the whole body, otherwise the connection can not be reused
+      Poco::NullOutputStream discard;
+      Poco::StreamCopier::copyStream(rs, discard);
+      reusable = res.getKeepAlive();
+
+      if (omit && res.getStatus() ==
+                      Poco::Net::HTTPResponse::HTTP_PRECONDITION_FAILED) {
+        // The destination no longer has the node table, send it again
+        tables.MarkSent(destination, nodes_hash_, false);
+        tables.CountResent();
+        omit = false;
+        if (!reusable) {
+          {
+            std::lock_guard<std::mutex> lock(cancel_mtx_);
+            active_ = nullptr;
+          }
+          pool.Release(uri.getHost(), uri.getPort(), std::move(session), false);
+          session = pool.Acquire(uri.getHost(), uri.getPort());
+          session->setTimeout(timeout);
+          std::lock_guard<std::mutex> lock(cancel_mtx_);
+          if (cancelled_) { throw Poco::IOException("Call cancelled"); }
+          active_ = session.get();
+        }
+        continue;
+      }
+      break;
+    }
+    if (shared && !omit) { tables.MarkSent(destination, nodes_hash_, true); }
+    status = static_cast<int>(res.getStatus());
+    fidi::Metrics::instance().RecordCall(
+        destination, status, std::chrono::steady_clock::now() - start);
 
-    Poco::Logger::get("FileLogger").debug(res.getReason());
-    Poco::Logger::get("ConsoleLogger").debug(res.getReason());
+    fidi::Log::File().debug(res.getReason());
+    fidi::Log::Console().debug(res.getReason());
   } catch (Poco::Exception& ex) {
-    Poco::Logger::get("FileLogger").error(ex.displayText());
-    Poco::Logger::get("ConsoleLogger").error(ex.displayText());
+    std::lock_guard<std::mutex> lock(cancel_mtx_);
+    if (cancelled_) {
+      // Closed under us by Cancel(); the other request answered first
+      reusable = false;
+      if (console.debug()) { console.debug("Cancelled call to " + url_); }
+    } else {
+      fidi::Metrics::instance().RecordCall(
+          destination, 0, std::chrono::steady_clock::now() - start);
+      fidi::Log::File().error(ex.displayText());
+      fidi::Log::Console().error(ex.displayText());
+    }
+  }
+  status_ = status;
+  RecordSpan(span, destination, start);
+  if (session) {
+    std::lock_guard<std::mutex> lock(cancel_mtx_);
+    active_ = nullptr;
+    // A session aborted after the answer was read can not be reused
+    pool.Release(uri.getHost(), uri.getPort(), std::move(session),
+                 reusable && !cancelled_);
+  }
+}
+
+/// A call started with Start(), and what its answer is handled with
+struct fidi::AppCaller::AsyncCall {
+  /// The default constructor, filled in by Start()
+  AsyncCall() :
+      host(), port(0), path(), local(nullptr), destination(), omit(false),
+      answered(false), span(), start(), done() {}
+
+  /// The copy constructor is not used, so declutter.
+  AsyncCall(const AsyncCall &) = delete;
+  /// The assignment operator is also not used, so cleaned up.
+  AsyncCall &operator=(const AsyncCall &) = delete;
+
+  std::string        host;         ///< The host called
+  std::uint16_t      port;         ///< The port called
+  std::string        path;         ///< The path and query
+  fidi::NodeState *  local;        ///< The node called, if in-process
+  std::string        destination;  ///< host:port
+  bool               omit;         ///< Leave out the node table
+  bool               answered;     ///< Answered, under cancel_mtx_
+  fidi::TraceContext span;         ///< The span of the call
+  std::chrono::steady_clock::time_point start;  ///< When it started
+  std::function<void()>                 done;   ///< Run once answered
+};
+
+void
+fidi::AppCaller::Start(std::function<void()> done) {
+  auto                 call     = std::make_shared<AsyncCall>();
+  fidi::LocalDispatch &dispatch = fidi::LocalDispatch::instance();
+  bool async = fidi::AsyncClient::instance().get_enabled();
+  if (async || dispatch.enabled()) {
+    try {
+      Poco::URI uri(url_);
+      call->host = uri.getHost();
+      call->port = uri.getPort();
+      call->path = uri.getPathAndQuery();
+      // A node hosted by this process is called without HTTP, and
+      // without holding a thread while it handles the request
+      call->local = dispatch.Find(call->host, call->port);
+      async       = async || call->local != nullptr;
+    } catch (Poco::Exception &) {
+      // runTask() reports the bad URL
+      async = false;
+    }
+  }
+  if (!async) {
+    fidi::Executor::instance().Submit([this, done] {
+      runTask();
+      done();
+    });
+    return;
+  }
+  if (fidi::Log::Console().trace()) {
+    fidi::Log::Console().trace("Making call to " + url_ + "\n\t" +
+                               payload_.str());
+  }
+  call->destination = call->host + ":" + std::to_string(call->port);
+  call->omit        = !nodes_hash_.empty() &&
+               fidi::NodeTableCache::instance().WasSent(call->destination,
+                                                        nodes_hash_);
+  call->span  = fidi::Tracer::instance().StartSpan(trace_);
+  call->start = std::chrono::steady_clock::now();
+  call->done  = std::move(done);
+  SendAsync(call);
+}
+
+void
+fidi::AppCaller::SendAsync(std::shared_ptr<AsyncCall> call) {
+  if (call->local != nullptr) {
+    SendLocal(call);
+    return;
+  }
+  fidi::AsyncClient::Request request;
+  request.host         = call->host;
+  request.port         = call->port;
+  request.path         = call->path;
+  request.content_type = content_type_;
+  request.body         = call->omit ? short_payload_ : payload_;
+  request.timeout      = std::chrono::microseconds(
+      std::chrono::seconds(timeout_sec_) +
+      std::chrono::microseconds(timeout_usec_));
+  if (!nodes_hash_.empty()) {
+    request.headers.emplace_back(fidi::NodeTableCache::kHeader, nodes_hash_);
   }
+  if (call->span.valid()) {
+    request.headers.emplace_back(fidi::Tracer::kHeader, call->span.Header());
+  }
+  if (seeded_) {
+    request.headers.emplace_back(kSeedHeader, std::to_string(seed_));
+  }
+  {
+    std::lock_guard<std::mutex> lock(cancel_mtx_);
+    call->answered = false;
+  }
+  if (Cancelled()) {
+    // Cancelled before it started, so this call is not made
+    Answered(call, 0, "Call cancelled");
+    return;
+  }
+  // Not under the lock: the answer may come before Send() returns,
+  // and Answered() takes the lock too
+  fidi::AsyncClient &client = fidi::AsyncClient::instance();
+  auto               id     = client.Send(
+      std::move(request), [this, call](int status, const std::string &error) {
+        Answered(call, status, error);
+      });
+  std::lock_guard<std::mutex> lock(cancel_mtx_);
+  if (call->answered) { return; }
+  async_call_ = id;
+  // Cancel() ran before the id was known, so could not stop it
+  if (cancelled_) { client.Cancel(id); }
+}
+
+bool
+fidi::AppCaller::Cancelled(void) {
+  std::lock_guard<std::mutex> lock(cancel_mtx_);
+  return cancelled_;
+}
+
+void
+fidi::AppCaller::SendLocal(std::shared_ptr<AsyncCall> call) {
+  if (Cancelled()) {
+    // Cancelled before it started, so this call is not made
+    Answered(call, 0, "Call cancelled");
+    return;
+  }
+  std::chrono::microseconds timeout(fidi::AsyncClient::kDefaultTimeout);
+  if (timeout_sec_ > 0 || timeout_usec_ > 0) {
+    timeout = std::chrono::seconds(timeout_sec_) +
+              std::chrono::microseconds(timeout_usec_);
+  }
+  fidi::LocalDispatch::instance().Call(
+      *call->local, call->omit ? short_payload_ : payload_, content_type_,
+      nodes_hash_, call->span, seeded_ ? std::to_string(seed_) : std::string(),
+      timeout, [this, call](int status) {
+        Answered(call, status,
+                 status == 0 ? "in-process call to " + call->destination +
+                                   " timed out"
+                             : std::string());
+      });
+}
+
+void
+fidi::AppCaller::Answered(std::shared_ptr<AsyncCall> call, int status,
+                          const std::string &error) {
+  fidi::NodeTableCache &tables = fidi::NodeTableCache::instance();
+  bool                  cancelled;
+  {
+    std::lock_guard<std::mutex> lock(cancel_mtx_);
+    async_call_    = 0;
+    call->answered = true;
+    cancelled      = cancelled_;
+  }
+  if (call->omit && !cancelled &&
+      status == Poco::Net::HTTPResponse::HTTP_PRECONDITION_FAILED) {
+    // The destination no longer has the node table, send it again
+    tables.MarkSent(call->destination, nodes_hash_, false);
+    tables.CountResent();
+    call->omit = false;
+    SendAsync(call);
+    return;
+  }
+  if (status > 0) {
+    if (!nodes_hash_.empty() && !call->omit) {
+      tables.MarkSent(call->destination, nodes_hash_, true);
+    }
+    fidi::Metrics::instance().RecordCall(
+        call->destination, status,
+        std::chrono::steady_clock::now() - call->start);
+    if (fidi::Log::File().debug() || fidi::Log::Console().debug()) {
+      const std::string &reason = Poco::Net::HTTPResponse::getReasonForStatus(
+          static_cast<Poco::Net::HTTPResponse::HTTPStatus>(status));
+      fidi::Log::File().debug(reason);
+      fidi::Log::Console().debug(reason);
+    }
+  } else if (cancelled) {
+    // Closed under us by Cancel(); the other request answered first
+    if (fidi::Log::Console().debug()) {
+      fidi::Log::Console().debug("Cancelled call to " + url_);
+    }
+  } else {
+    fidi::Metrics::instance().RecordCall(
+        call->destination, 0, std::chrono::steady_clock::now() - call->start);
+    fidi::Log::File().error("Call to " + url_ + " failed: " + error);
+    fidi::Log::Console().error("Call to " + url_ + " failed: " + error);
+  }
+  status_ = status;
+  RecordSpan(call->span, call->destination, call->start);
+  // The caller may go away with the done function
+  std::function<void()> done;
+  done.swap(call->done);
+  done();
+}
+
+void
+fidi::AppCaller::RecordSpan(const fidi::TraceContext &span,
+                            const std::string &       destination,
+                            std::chrono::steady_clock::time_point start) {
+  fidi::Tracer &tracer = fidi::Tracer::instance();
+  if (!tracer.enabled() || !span.valid()) { return; }
+  tracer.Record(origin_, span, trace_.span_id, "call " + node_, start,
+                std::chrono::steady_clock::now(),
+                {{"destination", destination},
+                 {"sequence", std::to_string(sequence_)},
+                 {"repeat", std::to_string(repeat_)},
+                 {"status", std::to_string(status_)}});
+}
+
+void
+fidi::AppCaller::Cancel(void) {
+  std::lock_guard<std::mutex> lock(cancel_mtx_);
+  cancelled_ = true;
+  if (active_ != nullptr) { active_->abort(); }
+  if (async_call_ != 0) { fidi::AsyncClient::instance().Cancel(async_call_); }
 }
 //
 // fidi_app_caller.cc ends here
@@ -35,7 +35,15 @@
 #  include <Poco/TaskManager.h>
 #  include <Poco/ThreadPool.h>
 #  include <Poco/URI.h>
+#  include <chrono>
+#  include <cstdint>
+#  include <functional>
 #  include <iostream>
+#  include <memory>
+#  include <mutex>
+
+#  include "src/fidi_payload.h"
+#  include "src/fidi_trace.h"
 
 namespace fidi {
   /// \brief A task manager task that makes HTTP client requests
@@ -54,14 +62,38 @@ namespace fidi {
     /// \param[in] dest The URL for the target server
     /// \param[in] timeout_sec Request timeout whole seconds
     /// \param[in] timeout_usec Request timeout fractional microseconds
-    /// \param[in] content The body of the post request
+    /// \param[in] content The body of the post request, shared with
+    ///            the other calls for the same edge
+    /// \param[in] content_type The Content-Type of the body
+    /// \param[in] nodes_hash The hash of the node table in the body,
+    ///            if the table may be left out (see
+    ///            fidi::NodeTableCache)
+    /// \param[in] short_content The body, without the node table
     AppCaller(std::string &name, const std::string &dest, long timeout_sec,
-              long timeout_usec, const std::string &content) :
+              long timeout_usec, const fidi::Payload &content,
+              const std::string &content_type,
+              const std::string & nodes_hash    = std::string(),
+              const fidi::Payload &short_content = fidi::Payload()) :
         Poco::Task(name),
         url_(dest),
         timeout_sec_(timeout_sec),
         timeout_usec_(timeout_usec),
-        payload_(content){};
+        payload_(content),
+        content_type_(content_type),
+        nodes_hash_(nodes_hash),
+        short_payload_(short_content),
+        trace_(),
+        origin_(),
+        node_(),
+        sequence_(0),
+        repeat_(0),
+        seeded_(false),
+        seed_(0),
+        status_(0),
+        cancel_mtx_(),
+        cancelled_(false),
+        active_(nullptr),
+        async_call_(0){};
 
     /// \brief Destructor
     ///
@@ -86,20 +118,138 @@ namespace fidi {
 
     /// \brief Handle making a single downstream requests
     ///
-    /// We make a single request per session for simplicity. So, currently,
-    /// making a downstream HTTP call means
-    /// + Create a new HTTP session
+    /// This is only for calls made over HTTP; in-process calls are
+    /// made by Start(). Making a downstream HTTP call means
+    /// + Get a keep-alive HTTP session from the fidi::SessionPool
     /// + Create a new request
-    /// + Make the call
+    /// + Make the call, and drain the response body
+    /// + If the call left out the node table, and the destination
+    ///   does not have it, make the call again with the table
     /// + Log the information
+    /// + Return the session to the pool, so the connection can be reused
     virtual void runTask();
 
+    /// \brief Start the call, without waiting for it
+    ///
+    /// With the fidi::AsyncClient enabled, the call is made by one of
+    /// its loops, the same way runTask() makes it, node table and
+    /// all, and no thread waits for the answer. A call to a node
+    /// hosted by this process is handed to the fidi::LocalDispatch,
+    /// and no thread waits for it either. Otherwise runTask() is run
+    /// on the fidi::Executor.
+    ///
+    /// \param[in] done Run once the call is answered, or fails; it
+    ///            should hold on to the caller until then
+    void Start(std::function<void()> done);
+
+    /// \brief Make the call part of a trace
+    ///
+    /// The call is recorded as a span, a child of the span handling
+    /// the request making it, and passes its own span on to the
+    /// destination in the traceparent header.
+    ///
+    /// \param[in] parent The span handling the request
+    /// \param[in] origin The node making the call, host:port
+    /// \param[in] node The name of the node called
+    /// \param[in] sequence The sequence number of the call
+    /// \param[in] repeat Which repetition of the call this is
+    void
+    set_trace(const fidi::TraceContext &parent, const std::string &origin,
+              const std::string &node, int sequence, int repeat) {
+      trace_    = parent;
+      origin_   = origin;
+      node_     = node;
+      sequence_ = sequence;
+      repeat_   = repeat;
+    }
+
+    /// \brief Pass a seed on to the destination
+    ///
+    /// The seed is sent in the kSeedHeader header, for the delays of
+    /// the request called (see fidi::AppDriver::set_seed).
+    ///
+    /// \param[in] seed The seed derived for this call
+    void
+    set_seed(std::uint64_t seed) {
+      seeded_ = true;
+      seed_   = seed;
+    }
+
+    /// The header a seed is passed on in
+    static constexpr const char *kSeedHeader = "X-Fidi-Seed";
+
+    /// \brief The status of the response, once runTask() returns
+    /// \return int The HTTP status, or 0 if the call failed
+    int
+    get_status(void) const {
+      return status_;
+    }
+
+    /// \brief Give up on the call
+    ///
+    /// This is for a hedged call (see fidi::HedgedCall) that lost:
+    /// a call not yet made is not made, and the connection of a call
+    /// in progress is closed, so it fails at once. A cancelled call
+    /// is not counted in the metrics. An in-process call can not be
+    /// stopped, but its answer is ignored.
+    void Cancel(void);
+
    private:
+    /// A call started with Start(), defined with it
+    struct AsyncCall;
+
+    /// \brief Send the call to the fidi::AsyncClient, or in-process
+    ///
+    /// \param[in] call The call
+    void SendAsync(std::shared_ptr<AsyncCall> call);
+
+    /// \brief Send the call to a node hosted by this process
+    ///
+    /// \param[in] call The call
+    void SendLocal(std::shared_ptr<AsyncCall> call);
+
+    /// \brief Whether Cancel() has been called
+    ///
+    /// \return True once the call is cancelled
+    bool Cancelled(void);
+
+    /// \brief Handle the answer to a call sent by SendAsync()
+    ///
+    /// \param[in] call The call
+    /// \param[in] status The HTTP status, or 0 if the call failed
+    /// \param[in] error What went wrong, if anything
+    void Answered(std::shared_ptr<AsyncCall> call, int status,
+                  const std::string &error);
+
+    /// \brief Record the span of the call, if tracing
+    ///
+    /// \param[in] span The span of the call
+    /// \param[in] destination The host:port called
+    /// \param[in] start When the call started
+    void RecordSpan(const fidi::TraceContext &span,
+                    const std::string &destination,
+                    std::chrono::steady_clock::time_point start);
+
     const std::string url_;  ///< The URL we are makeing the request to
 
     const long timeout_sec_;   ///< The timeout period (whole seconds)
     const long timeout_usec_;  ///< The timeout period (fractional microseconds)
-    const std::string payload_;  ///< The payload for the request
+    const fidi::Payload payload_;  ///< The payload for the request
+    const std::string content_type_;  ///< The Content-Type of the payload
+    const std::string nodes_hash_;  ///< Hash of the node table, if shared
+    const fidi::Payload short_payload_;  ///< The payload without the table
+    fidi::TraceContext  trace_;  ///< The span making the call, if tracing
+    std::string         origin_;    ///< The node making the call
+    std::string         node_;      ///< The node called, for the span
+    int                 sequence_;  ///< The sequence number of the call
+    int                 repeat_;    ///< The repetition of the call
+    bool                seeded_;    ///< Is there a seed to pass on?
+    std::uint64_t       seed_;      ///< The seed to pass on
+    int                 status_;    ///< The status of the response
+    std::mutex          cancel_mtx_;  ///< Protects the two below
+    bool                cancelled_;   ///< Set by Cancel()
+    Poco::Net::HTTPClientSession *active_;  ///< The session in use, if any
+    std::uint64_t async_call_;  ///< The call in the AsyncClient, if any
   };
 
 }  // namespace fidi
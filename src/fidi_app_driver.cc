@@ -25,19 +25,34 @@
 
 // Code:
 #include "src/fidi_app_driver.h"
+#include "src/fidi_bulkhead.h"
+#include "src/fidi_cpu_burn.h"
+#include "src/fidi_distribution.h"
+#include "src/fidi_hedge.h"
+#include "src/fidi_logging.h"
+#include "src/fidi_metrics.h"
+#include "src/fidi_node_table_cache.h"
+#include "src/fidi_plan_cache.h"
+#include "src/fidi_session_pool.h"
+#include "src/fidi_timer_wheel.h"
+#include "src/fidi_wire_format.h"
+#include <algorithm>
 #include <cassert>
 #include <cctype>
+#include <cmath>
 #include <chrono>  // std::chrono:
 #include <fstream>
 #include <iostream>
+#include <iterator>
+#include <memory>
 #include <sstream>
 #include <string>
 #include <thread>  // std::this_thread::sleep_for
+#include <vector>
 
-bool                                  fidi::AppDriver::healthy_ = true;
-std::mutex                            fidi::AppDriver::health_mtx_;
-std::chrono::steady_clock::time_point fidi::AppDriver::unresponsive_until_ =
-    std::chrono::steady_clock::now();
+bool              fidi::AppDriver::async_delays_ = false;
+bool              fidi::AppDriver::binary_calls_ = false;
+fidi::NodeState   fidi::AppDriver::default_node_("localhost");
 
 fidi::AppDriver::~AppDriver() {
   delete scanner_;
@@ -46,13 +61,65 @@ fidi::AppDriver::~AppDriver() {
   parser_ = nullptr;
 }
 
+void
+fidi::AppDriver::set_content_type(const std::string &content_type) {
+  // Ignore any parameters following the media type
+  binary_request_ =
+      content_type.compare(0, content_type.find(';'),
+                           fidi::WireFormat::kContentType) == 0;
+}
+
 void
 fidi::AppDriver::ParseHelper(std::istream &stream) {
-  Poco::Logger::get("FileLogger").trace("Start parsing");
+  if (binary_request_) {
+    // Decoding only looks at the top level of the request, which is
+    // cheaper than hashing the whole body for the plan cache
+    DecodeBody(std::string(std::istreambuf_iterator<char>(stream),
+                           std::istreambuf_iterator<char>()));
+    ResolveNodeTable();
+    return;
+  }
+
+  fidi::PlanCache &cache = fidi::PlanCache::instance();
+  if (!cache.enabled()) {
+    ParseBody(stream, false);
+    ResolveNodeTable();
+    return;
+  }
+
+  // Replayed bodies are common, so look for one we parsed before
+  body_.assign(std::istreambuf_iterator<char>(stream),
+               std::istreambuf_iterator<char>());
+  std::size_t body_size = body_.size();
+  if (!node_hash_.empty()) {
+    // The same body with a different node table is a different plan
+    body_.append(1, '\0').append(node_hash_);
+  }
+  body_hash_ = fidi::PlanCache::Hash(body_);
+  plan_      = cache.Lookup(body_hash_, body_);
+  if (plan_) {
+    fidi::Log::File().trace("Using cached plan");
+    LoadPlan(*plan_);
+    body_.clear();
+    // The node table may have been evicted since the plan was made;
+    // put it back, or callers sending only its hash get 412 for ever
+    ResolveNodeTable();
+    return;
+  }
+  std::istringstream body_stream(body_.substr(0, body_size));
+  ParseBody(body_stream, true);
+  ResolveNodeTable();
+  return;
+}
+
+void
+fidi::AppDriver::ParseBody(std::istream &stream, bool cacheable) {
+  fidi::Log::File().trace("Start parsing");
 
   delete parser_;
   parse_errors_.clear();
-  nerrors_ = 0;
+  nerrors_   = 0;
+  cacheable_ = cacheable;
 
   try {
     fidi::Driver::ParseHelper(stream);
@@ -62,17 +129,149 @@ fidi::AppDriver::ParseHelper(std::istream &stream) {
     parse_errors_.append("Failed to allocate parser: (")
         .append(ba.what())
         .append(")");
-    Poco::Logger::get("FileLogger").error(parse_errors_);
+    fidi::Log::File().error(parse_errors_);
     throw;
   }
   if (!parser_->parse() || nerrors_ != 0) {
-    Poco::Logger::get("FileLogger").error(parse_errors_);
+    fidi::Log::File().error(parse_errors_);
   }
   return;
 }
 
+void
+fidi::AppDriver::DecodeBody(const std::string &body) {
+  fidi::Log::File().trace("Start decoding");
+  parse_errors_.clear();
+  nerrors_ = 0;
+
+  fidi::WireFormat::Message message;
+  if (!fidi::WireFormat::Decode(body, &message, &parse_errors_)) {
+    nerrors_++;
+    fidi::Log::File().error(parse_errors_);
+    return;
+  }
+  HandleTop(message.attributes);
+  for (auto const &[name, attributes] : message.nodes) {
+    HandleNode(name, attributes);
+  }
+  // Forward the node table, and the sub-requests, without re-encoding
+  node_glob_.assign(message.prefix);
+  for (auto &edge : message.edges) {
+    destinations_.emplace(edge.name);
+    edge_attributes_.push(EdgeDetails{std::move(edge.name),
+                                      std::string(edge.request),
+                                      {edge.repeat, edge.sequence},
+                                      std::move(edge.options)});
+  }
+  wire_ = true;
+}
+
+void
+fidi::AppDriver::ResolveNodeTable(void) {
+  if (node_hash_.empty()) { return; }
+  fidi::NodeTableCache &tables = fidi::NodeTableCache::instance();
+  if (!nodes_.empty()) {
+    // The table is content addressed, so store it under its own hash
+    auto table = std::make_shared<fidi::NodeTableCache::Table>();
+    table->nodes = nodes_;
+    table->glob  = node_glob_;
+    tables.Insert(fidi::NodeTableCache::Hash(node_glob_), std::move(table));
+    return;
+  }
+
+  auto table = tables.Lookup(node_hash_);
+  if (!table) {
+    if (fidi::Log::File().debug()) {
+      fidi::Log::File().debug("Unknown node table " + node_hash_);
+    }
+    missing_nodes_ = true;
+    cacheable_     = false;
+    return;
+  }
+  nodes_     = table->nodes;
+  node_glob_ = table->glob;
+}
+
+void
+fidi::AppDriver::ConvertToWire(void) {
+  std::vector<EdgeDetails> edges;
+  while (!edge_attributes_.empty()) {
+    edges.push_back(edge_attributes_.top());
+    edge_attributes_.pop();
+  }
+
+  std::vector<std::string> requests(edges.size());
+  bool                     clean = true;
+  for (std::size_t i = 0; clean && i < edges.size(); ++i) {
+    clean = fidi::WireEncoder::EncodeBlob(edges[i].blob, &requests[i]);
+  }
+  for (std::size_t i = 0; i < edges.size(); ++i) {
+    if (clean) { edges[i].blob.swap(requests[i]); }
+    edge_attributes_.push(std::move(edges[i]));
+  }
+  if (clean) {
+    node_glob_ = fidi::WireFormat::EncodePrefix(nodes_);
+    wire_      = true;
+  } else {
+    fidi::Log::File()
+        .warning("Call payloads did not parse; forwarding them as text");
+  }
+}
+
+int
+fidi::AppDriver::SanityChecks(std::string *error_message) {
+  if (plan_) {
+    error_message->append(plan_->warnings);
+    return plan_->num_warnings;
+  }
+
+  std::size_t start  = error_message->size();
+  int         errors = fidi::Driver::SanityChecks(error_message);
+  // Each destination must have a URL the calls can be made to
+  for (auto const &name : destinations_) {
+    if (nodes_.find(name) == nodes_.end()) { continue; }
+    std::string url(GetUrl(name));
+    std::string problem;
+    try {
+      Poco::URI uri(url);
+      if (uri.getHost().empty()) {
+        problem = "has no host";
+      } else if (uri.getPort() == 0) {
+        problem = "has no port";
+      }
+    } catch (Poco::Exception &ex) {
+      problem = ex.displayText();
+    }
+    if (!problem.empty()) {
+      errors++;
+      error_message->append("// Node ")
+          .append(name)
+          .append(" url ")
+          .append(url)
+          .append(" is not valid\n//  ")
+          .append(problem)
+          .append("\n");
+    }
+  }
+  if (binary_calls_ && !wire_ && errors == 0 && nerrors_ == 0) {
+    ConvertToWire();
+  }
+  if (cacheable_) {
+    // Save the plan before Execute() consumes the calls
+    auto plan = std::make_shared<fidi::Driver::Plan>();
+    SavePlan(plan.get());
+    plan->num_warnings = errors;
+    plan->warnings     = error_message->substr(start);
+    fidi::PlanCache::instance().Insert(body_hash_, std::move(body_),
+                                       std::move(plan));
+    body_.clear();
+    cacheable_ = false;
+  }
+  return errors;
+}
+
 std::string
-fidi::AppDriver::GetUrl(std::string &node_name) {
+fidi::AppDriver::GetUrl(const std::string &node_name) {
   std::string url;
   auto        nodes_it = nodes_.find(node_name);
 
@@ -99,55 +298,98 @@ fidi::AppDriver::GetUrl(std::string &node_name) {
   return url;
 }
 
+void
+fidi::AppDriver::PrewarmNodes(void) {
+  for (auto const &[node_name, attributes] : nodes_) {
+    std::string name(node_name);
+    try {
+      Poco::URI uri(GetUrl(name));
+      fidi::SessionPool::instance().Prewarm(uri.getHost(), uri.getPort());
+    } catch (Poco::Exception &ex) {
+      if (fidi::Log::File().debug()) {
+        fidi::Log::File().debug(ex.displayText());
+      }
+    }
+  }
+}
+
+bool
+fidi::AppDriver::GetResponseSize(std::uint64_t *size) const {
+  auto it = top_attributes_.find("size");
+  if (it == top_attributes_.end()) { return false; }
+  // The sanity checks made sure this is an unsigned integer
+  *size = std::stoull(it->second);
+  return true;
+}
+
 bool
 fidi::AppDriver::get_health(void) {
-  bool is_healthy;
-  health_mtx_.lock();
-  is_healthy = healthy_;
-  health_mtx_.unlock();
-  return is_healthy;
+  return node_->get_health_state().get_healthy();
 }
 
 bool
 fidi::AppDriver::IsResponsive(void) {
-  std::chrono::steady_clock::time_point limit;
-  std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
-  health_mtx_.lock();
-  limit = unresponsive_until_;
-  health_mtx_.unlock();
-  return now > limit;
+  return node_->get_health_state().IsResponsive();
 }
 
-std::ostream &
-fidi::AppDriver::Execute(std::ostream &stream) {
-  long timeout_sec           = 0;
-  long timeout_usec          = 0;
+void
+fidi::AppDriver::Delay(const std::string &attribute,
+                       std::function<void()> next) {
+  std::chrono::microseconds delay(0);
+  auto                      it = top_attributes_.find(attribute);
+  if (it != top_attributes_.end()) {
+    // The sanity checks refuse a spec that does not parse, so this
+    // should never be skipped; say so if it is, rather than quietly
+    // leave out the modeled latency
+    fidi::Distribution distribution;
+    std::string        error;
+    if (fidi::Distribution::Parse(it->second, &distribution, &error)) {
+      // Samples are at most kMaxDelay, so this can not overflow
+      delay = std::chrono::microseconds(
+          std::llround(distribution.Sample(random_) * 1000.0));
+    } else {
+      fidi::Log::File().error("Request " + attribute + " " + it->second +
+                              " skipped: " + error);
+    }
+  }
+  if (delay.count() <= 0) {
+    next();
+    return;
+  }
+  modeled_delay_ += delay;
+  if (async_delays_) {
+    // Park the rest of the request on the timer wheel, rather than
+    // sleeping here; the handler thread still waits in Execute(). The
+    // wheel counts whole milliseconds
+    fidi::TimerWheel::instance().Schedule(
+        std::chrono::milliseconds((delay.count() + 999) / 1000),
+        std::move(next));
+  } else {
+    std::this_thread::sleep_for(delay);
+    next();
+  }
+}
+
+void
+fidi::AppDriver::StartCalls(void) {
   long unresponsive_for_sec  = 0;
   long unresponsive_for_usec = 0;
 
-  // Create a threadpool (FIXME: make max threads a config)
-  Poco::ThreadPool  tp(16,     // Min threads
-                      1024);  // Max threads
-  Poco::TaskManager tm(tp);
-  Poco::Logger::get("ConsoleLogger").trace("Handle request executing");
-
-  // The first thing is to handle the specific things for this request
-  if (top_attributes_.find("response") != top_attributes_.end()) {
-    int code = std::stoi(top_attributes_["response"]);
-    (*resp_).setStatus(static_cast<Poco::Net::HTTPResponse::HTTPStatus>(code));
-  }
-
-  if (top_attributes_.find("predelay") != top_attributes_.end()) {
-    std::this_thread::sleep_for(
-        std::chrono::milliseconds(std::stol(top_attributes_["predelay"])));
-  }
+  auto now = std::chrono::steady_clock::now();
+  fidi::Metrics::instance().RecordPhase(fidi::Metrics::Phase::kPredelay,
+                                        now - phase_start_);
+  predelay_time_ = now - phase_start_;
+  RecordDelay("predelay", now);
+  phase_start_ = now;
 
+  timeout_sec_  = 0;
+  timeout_usec_ = 0;
   if (top_attributes_.find("timeout_sec") != top_attributes_.end()) {
-    timeout_sec = std::stol(top_attributes_["timeout_sec"]);
+    timeout_sec_ = std::stol(top_attributes_["timeout_sec"]);
   }
 
   if (top_attributes_.find("timeout_usec") != top_attributes_.end()) {
-    timeout_usec = std::stol(top_attributes_["timeout_usec"]);
+    timeout_usec_ = std::stol(top_attributes_["timeout_usec"]);
   }
 
   if (top_attributes_.find("unresponsive_for_sec") != top_attributes_.end()) {
@@ -158,96 +400,414 @@ fidi::AppDriver::Execute(std::ostream &stream) {
     unresponsive_for_usec = std::stol(top_attributes_["unresponsive_for_usec"]);
   }
   if (unresponsive_for_sec > 0 || unresponsive_for_usec > 0) {
-    health_mtx_.lock();
-    unresponsive_until_ = std::chrono::steady_clock::now() +
-                          std::chrono::duration_cast<std::chrono::microseconds>(
-                              std::chrono::seconds(unresponsive_for_sec)) +
-                          std::chrono::microseconds(unresponsive_for_usec);
-    health_mtx_.unlock();
+    node_->get_health_state().SetUnresponsiveUntil(
+        std::chrono::steady_clock::now() +
+        std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::seconds(unresponsive_for_sec)) +
+        std::chrono::microseconds(unresponsive_for_usec));
   }
+
+  if (top_attributes_.find("memory_hold") != top_attributes_.end() &&
+      top_attributes_["memory_hold"].compare("false") == 0) {
+    allocation_.reset();
+  }
+  RunCalls();
+}
+
+void
+fidi::AppDriver::RunCalls(void) {
+  phase_start_ = std::chrono::steady_clock::now();
+
   // OK. Now to deal with all out calls
+  if (edge_attributes_.empty()) {
+    FinishRequest();
+    return;
+  }
   while (!edge_attributes_.empty()) {
-    auto downstream_call_sequence_number =
-        edge_attributes_.top().edge_attr.second;
-    Poco::Logger::get("ConsoleLogger")
-        .debug("Call sequence " +
-               std::to_string(downstream_call_sequence_number));
-    while (!edge_attributes_.empty() &&
-           downstream_call_sequence_number ==
-               edge_attributes_.top().edge_attr.second) {
-      struct fidi::AppDriver::EdgeDetails call_details(edge_attributes_.top());
-      // Sanity check passed, so we know the node details exist
-      std::string url = GetUrl(call_details.name);
-
-      // Handle multiple repetitions of the call
-      auto reps = edge_attributes_.top().edge_attr.first;
-      if (reps < 1) { reps = 1; }
+    calls_.push_back(edge_attributes_.top());
+    edge_attributes_.pop();
+  }
+  std::vector<std::vector<std::size_t>> after;
+  std::string                           error;
+  if (!Dependencies(calls_, &after, &error)) {
+    // The sanity checks should ensure this never happens
+    fidi::Log::File().error("Calls not made: " + error);
+    calls_.clear();
+    FinishRequest();
+    return;
+  }
+
+  // Each sequence number is a stage, for the metrics
+  dependents_.assign(calls_.size(), {});
+  waiting_on_.assign(calls_.size(), 0);
+  stage_of_.assign(calls_.size(), 0);
+  std::vector<std::size_t> ready;
+  for (std::size_t call = 0; call < calls_.size(); ++call) {
+    if (call > 0 &&
+        calls_[call].edge_attr.second != calls_[call - 1].edge_attr.second) {
+      stage_left_.push_back(0);
+    }
+    if (stage_left_.empty()) { stage_left_.push_back(0); }
+    stage_of_[call] = stage_left_.size() - 1;
+    stage_left_.back()++;
+    waiting_on_[call] = after[call].size();
+    for (auto prerequisite : after[call]) {
+      dependents_[prerequisite].push_back(call);
+    }
+    if (waiting_on_[call] == 0) { ready.push_back(call); }
+  }
+  stage_done_.assign(stage_left_.size(), phase_start_);
+  calls_left_ = calls_.size();
+
+  // With node table sharing, calls carry the hash of the table, and
+  // a short payload without it, for destinations that already have it
+  if (fidi::NodeTableCache::instance().get_share() && glob_hash_.empty()) {
+    glob_hash_ = fidi::NodeTableCache::Hash(node_glob_);
+  }
+  // The node table is the same for every call, so share one copy
+  if (!glob_buffer_) { glob_buffer_ = fidi::Payload::MakeBuffer(node_glob_); }
+
+  for (auto call : ready) { StartCall(call); }
+  if (async_delays_) { return; }
+
+  // Start the calls waiting on each call as it finishes, here
+  bool last = false;
+  while (!last) {
+    std::vector<std::size_t> finished;
+    {
+      std::unique_lock<std::mutex> lock(calls_mtx_);
+      calls_cv_.wait(lock, [this] { return !finished_.empty(); });
+      finished.swap(finished_);
+    }
+    for (auto call : finished) {
+      ready.clear();
+      last = CallDone(call, &ready);
+      for (auto next : ready) { StartCall(next); }
+    }
+  }
+  FinishCalls();
+}
+
+void
+fidi::AppDriver::StartCall(std::size_t call) {
+  const fidi::AppDriver::EdgeDetails &call_details(calls_[call]);
+  auto sequence_number = call_details.edge_attr.second;
+  if (fidi::Log::Console().debug()) {
+    fidi::Log::Console().debug("Call to " + call_details.name + " sequence " +
+                               std::to_string(sequence_number));
+  }
+  fidi::Bulkhead &bulkhead = fidi::Bulkhead::instance();
+  bool            share    = fidi::NodeTableCache::instance().get_share();
+  static const fidi::Payload::Buffer empty_prefix =
+      fidi::Payload::MakeBuffer(fidi::WireFormat::EncodePrefix({}));
+  const std::string content_type(wire_ ? fidi::WireFormat::kContentType
+                                       : "application/x-www-form-urlencoded");
+
+  // Sanity check passed, so we know the node details exist
+  std::string url = GetUrl(call_details.name);
+  // Every repetition of the call shares the same payload buffers
+  fidi::Payload::Buffer blob = fidi::Payload::MakeBuffer(call_details.blob);
+  fidi::Payload         payload(glob_buffer_, blob);
+  fidi::Payload         short_payload;
+  if (share) {
+    short_payload = fidi::Payload(wire_ ? empty_prefix : nullptr, blob);
+  }
+
+  // The node may limit the calls in flight to it; the sanity
+  // check passed, so the limit is a number
+  std::size_t limit         = bulkhead.get_default_limit();
+  auto const &node_details  = nodes_.find(call_details.name)->second;
+  auto        node_limit_it = node_details.find("max_in_flight");
+  if (node_limit_it != node_details.end()) {
+    limit = std::stoul(node_limit_it->second);
+  }
+
+  // Once every repetition is done, the calls waiting on this one
+  // may start
+  auto calls = std::make_shared<fidi::CallGroup>();
+  auto reps  = call_details.edge_attr.first;
+  if (reps < 1) { reps = 1; }
+
+  // A hedged call waits this long for an answer before sending a
+  // duplicate; the percentile is looked up once for all repetitions
+  std::string               destination;
+  std::chrono::milliseconds hedge_delay(0);
+  bool                      valid = true;
+  if (limit > 0 || !call_details.options.empty()) {
+    try {
+      Poco::URI uri(url);
+      destination = uri.getHost() + ":" + std::to_string(uri.getPort());
+    } catch (Poco::Exception &ex) {
+      // The sanity checks should catch this; fail every repetition
+      // rather than leave the calls waiting on this one stuck
+      fidi::Log::File().error("Call to " + url + " failed: " +
+                              ex.displayText());
       for (int i = 1; i <= reps; ++i) {
-        std::string taskname(call_details.name);
-        taskname.append("_").append(std::to_string(i));
-        tm.start(new AppCaller(
-            taskname, url, timeout_sec, timeout_usec,
-            node_glob_ + call_details.blob));  // Task Manager takes over
+        fidi::Metrics::instance().RecordCall(
+            url, 0, std::chrono::steady_clock::duration::zero());
       }
-      // Done with this call, on to the next one in this sequence
-      edge_attributes_.pop();
+      valid = false;
     }
-    // Done for this sequence point. Wait for all outstanding calls
-    tm.joinAll();
   }
+  if (valid && !call_details.options.empty()) {
+    hedge_delay = fidi::HedgedCall::Delay(call_details.options, destination);
+  }
+  if (valid) { calls->Add(static_cast<std::size_t>(reps)); }
+
+  // Handle multiple repetitions of the call
+  for (int i = 1; valid && i <= reps; ++i) {
+    std::string taskname(call_details.name);
+    taskname.append("_").append(std::to_string(i));
+    auto make_caller = [&](std::string task) {
+      auto caller = std::make_shared<AppCaller>(
+          task, url, timeout_sec_, timeout_usec_, payload, content_type,
+          share ? glob_hash_ : std::string(), short_payload);
+      if (trace_.valid()) {
+        caller->set_trace(trace_, node_->get_name(), call_details.name,
+                          sequence_number, i);
+      }
+      if (seeded_) {
+        caller->set_seed(fidi::Random::Derive(
+            seed_, call_details.name + "/" + std::to_string(sequence_number) +
+                       "/" + std::to_string(i)));
+      }
+      return caller;
+    };
+    auto caller = make_caller(taskname);
+    if (hedge_delay.count() > 0) {
+      // The duplicate is the same request, seed and all
+      auto hedged = std::make_shared<fidi::HedgedCall>(
+          caller, make_caller(taskname + "_hedge"), destination, limit,
+          calls);
+      hedged->Start(hedge_delay);
+      continue;
+    }
+    // Free the slot first, for any call started once this is done
+    bulkhead.Submit(destination, limit,
+                    [caller, calls](std::function<void()> finish) {
+                      caller->Start([caller, calls, finish] {
+                        finish();
+                        calls->Done();
+                      });
+                    });
+  }
+
+  calls->OnDone([this, call] {
+    if (!async_delays_) {
+      std::lock_guard<std::mutex> lock(calls_mtx_);
+      finished_.push_back(call);
+      calls_cv_.notify_one();
+      return;
+    }
+    std::vector<std::size_t> ready;
+    bool                     last = CallDone(call, &ready);
+    for (auto next : ready) { StartCall(next); }
+    if (last) { FinishCalls(); }
+  });
+}
+
+bool
+fidi::AppDriver::CallDone(std::size_t call, std::vector<std::size_t> *ready) {
+  std::lock_guard<std::mutex> lock(calls_mtx_);
+  if (--stage_left_[stage_of_[call]] == 0) {
+    stage_done_[stage_of_[call]] = std::chrono::steady_clock::now();
+  }
+  for (auto dependent : dependents_[call]) {
+    if (--waiting_on_[dependent] == 0) { ready->push_back(dependent); }
+  }
+  return --calls_left_ == 0;
+}
 
+void
+fidi::AppDriver::FinishCalls(void) {
+  auto stage_start = phase_start_;
+  for (std::size_t stage = 0; stage < stage_done_.size(); ++stage) {
+    auto stage_end = std::max(stage_done_[stage], stage_start);
+    fidi::Metrics::instance().RecordStage(static_cast<int>(stage + 1),
+                                          stage_end - stage_start);
+    stage_times_.push_back(stage_end - stage_start);
+    stage_start = stage_end;
+  }
+  FinishRequest();
+}
+
+void
+fidi::AppDriver::FinishRequest(void) {
   // All the calls are done. First, let us log messages
   if (top_attributes_.find("log_trace") != top_attributes_.end()) {
-    Poco::Logger::get("FileLogger").trace(top_attributes_["log_trace"]);
+    fidi::Log::File().trace(top_attributes_["log_trace"]);
   }
 
   if (top_attributes_.find("log_debug") != top_attributes_.end()) {
-    Poco::Logger::get("FileLogger").debug(top_attributes_["log_debug"]);
+    fidi::Log::File().debug(top_attributes_["log_debug"]);
   }
 
   if (top_attributes_.find("log_information") != top_attributes_.end()) {
-    Poco::Logger::get("FileLogger")
+    fidi::Log::File()
         .information(top_attributes_["log_information"]);
   }
 
   if (top_attributes_.find("log_notice") != top_attributes_.end()) {
-    Poco::Logger::get("FileLogger").notice(top_attributes_["log_notice"]);
+    fidi::Log::File().notice(top_attributes_["log_notice"]);
   }
 
   if (top_attributes_.find("log_warning") != top_attributes_.end()) {
-    Poco::Logger::get("FileLogger").warning(top_attributes_["log_warning"]);
+    fidi::Log::File().warning(top_attributes_["log_warning"]);
   }
 
   if (top_attributes_.find("log_error") != top_attributes_.end()) {
-    Poco::Logger::get("FileLogger").error(top_attributes_["log_error"]);
+    fidi::Log::File().error(top_attributes_["log_error"]);
   }
 
   if (top_attributes_.find("log_critical") != top_attributes_.end()) {
-    Poco::Logger::get("FileLogger").critical(top_attributes_["log_critical"]);
+    fidi::Log::File().critical(top_attributes_["log_critical"]);
   }
 
   if (top_attributes_.find("log_fatal") != top_attributes_.end()) {
-    Poco::Logger::get("FileLogger").fatal(top_attributes_["log_fatal"]);
+    fidi::Log::File().fatal(top_attributes_["log_fatal"]);
   }
 
   if (top_attributes_.find("healthy") != top_attributes_.end()) {
-    health_mtx_.lock();
-    if (top_attributes_["healthy"].compare("true") == 0) {
-      healthy_ = true;
-    } else {
-      healthy_ = false;
-    }
-    health_mtx_.unlock();
+    node_->get_health_state().set_healthy(
+        top_attributes_["healthy"].compare("true") == 0);
   }
 
   // Now for the second part of the delay
-  if (top_attributes_.find("postdelay") != top_attributes_.end()) {
-    std::this_thread::sleep_for(
-        std::chrono::milliseconds(std::stol(top_attributes_["postdelay"])));
+  phase_start_ = std::chrono::steady_clock::now();
+  Delay("postdelay", [this] {
+    auto now = std::chrono::steady_clock::now();
+    fidi::Metrics::instance().RecordPhase(fidi::Metrics::Phase::kPostdelay,
+                                          now - phase_start_);
+    postdelay_time_ = now - phase_start_;
+    RecordDelay("postdelay", now);
+    done_.Done();
+  });
+}
+
+void
+fidi::AppDriver::RecordDelay(const std::string &                   attribute,
+                             std::chrono::steady_clock::time_point end) {
+  fidi::Tracer &tracer = fidi::Tracer::instance();
+  if (!tracer.enabled() || !trace_.valid() ||
+      top_attributes_.find(attribute) == top_attributes_.end()) {
+    return;
+  }
+  tracer.Record(node_->get_name(), tracer.StartSpan(trace_), trace_.span_id,
+                attribute, phase_start_, end);
+}
+
+fidi::AppDriver::Duration
+fidi::AppDriver::GetModeledTime(void) const {
+  Duration modeled = modeled_delay_ + cpu_time_;
+  for (auto const &stage : stage_times_) { modeled += stage; }
+  return modeled;
+}
+
+std::ostream &
+fidi::AppDriver::Execute(std::ostream &stream) {
+  fidi::Log::Console().trace("Handle request executing");
+
+  // Start opening connections to the nodes we may call while we work
+  if (fidi::SessionPool::instance().get_prewarm()) { PrewarmNodes(); }
+
+  // The first thing is to handle the specific things for this request
+  if (top_attributes_.find("response") != top_attributes_.end()) {
+    status_ = std::stoi(top_attributes_["response"]);
+    if (resp_ != nullptr) {
+      resp_->setStatus(
+          static_cast<Poco::Net::HTTPResponse::HTTPStatus>(status_));
+    }
   }
+
+  SeedRandom();
+  AllocateMemory();
+  BurnCpu();
+
+  // The rest of the request runs as a chain of steps, each one
+  // started by the previous one once its delay or its calls are
+  // done. We just wait for the last one.
+  phase_start_ = std::chrono::steady_clock::now();
+  done_.Add();
+  Delay("predelay", [this] { StartCalls(); });
+  done_.Wait();
+  allocation_.reset();
+  stream << memory_report_;
   return (stream);
 }
 
+void
+fidi::AppDriver::AllocateMemory(void) {
+  auto it = top_attributes_.find("memory");
+  if (it == top_attributes_.end()) { return; }
+  std::size_t size = static_cast<std::size_t>(std::stoull(it->second));
+
+  fidi::Allocation::Pattern pattern = fidi::Allocation::Pattern::kSequential;
+  it = top_attributes_.find("memory_pattern");
+  if (it != top_attributes_.end() && it->second.compare("random") == 0) {
+    pattern = fidi::Allocation::Pattern::kRandom;
+  }
+  it              = top_attributes_.find("memory_hugepages");
+  bool huge_pages = it != top_attributes_.end() && it->second == "true";
+
+  allocation_.reset(new fidi::Allocation(size, pattern, huge_pages));
+  memory_report_ = "<p>Memory: " + std::to_string(allocation_->get_size()) +
+                   " bytes, touched in " +
+                   std::to_string(allocation_->get_touch_usec()) +
+                   " us, resident set grew by " +
+                   std::to_string(allocation_->get_rss_delta()) +
+                   " bytes</p>\n";
+  if (fidi::Log::File().debug()) {
+    fidi::Log::File().debug(
+        "Allocated " + std::to_string(size) + " bytes in " +
+        std::to_string(allocation_->get_touch_usec()) + " us; RSS delta " +
+        std::to_string(allocation_->get_rss_delta()));
+  }
+}
+
+void
+fidi::AppDriver::SeedRandom(void) {
+  // Sanity checks should ensure the seed attribute is a number
+  auto it = top_attributes_.find("seed");
+  if (it != top_attributes_.end()) {
+    seed_   = std::stoull(it->second);
+    seeded_ = true;
+  } else if (!seed_header_.empty()) {
+    // Only our callers send the header, but do not trust it blindly
+    try {
+      seed_   = std::stoull(seed_header_);
+      seeded_ = true;
+    } catch (const std::exception &) {
+      fidi::Log::File().warning("Ignoring bad seed " + seed_header_);
+    }
+  }
+  random_.Seed(seeded_ ? fidi::Random::Derive(seed_, "delays")
+                       : fidi::Random::ThreadLocal().Next());
+}
+
+void
+fidi::AppDriver::BurnCpu(void) {
+  auto it = top_attributes_.find("cpu_us");
+  if (it == top_attributes_.end()) { return; }
+  // The sanity checks should ensure this is at most kMaxMicroseconds
+  std::uint64_t requested = std::stoull(it->second);
+  auto          usec      = std::chrono::microseconds(
+      std::min(requested, fidi::CpuBurn::kMaxMicroseconds));
+
+  fidi::CpuBurn::Kind kind = fidi::CpuBurn::Kind::kHash;
+  it                       = top_attributes_.find("cpu_kind");
+  if (it != top_attributes_.end()) {
+    // The sanity checks should ensure this is a known kernel
+    (void)fidi::CpuBurn::ParseKind(it->second, &kind);
+  }
+
+  phase_start_ = std::chrono::steady_clock::now();
+  fidi::CpuBurn::instance().Burn(kind, usec);
+  auto now  = std::chrono::steady_clock::now();
+  cpu_time_ = now - phase_start_;
+  fidi::Metrics::instance().RecordPhase(fidi::Metrics::Phase::kCpu, cpu_time_);
+  RecordDelay("cpu_us", now);
+}
+
 void
 fidi::AppDriver::set_resp(Poco::Net::HTTPServerResponse &response) {
   resp_ = &response;
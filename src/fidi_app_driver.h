@@ -28,14 +28,26 @@
 #  define FIDI_APP_DRIVER_H
 
 #  include <chrono>
+#  include <condition_variable>
+#  include <cstddef>
+#  include <cstdint>
+#  include <functional>
+#  include <memory>
 #  include <mutex>
+#  include <string>
+#  include <vector>
 
 #  include <Poco/Net/HTTPServerResponse.h>
-#  include <Poco/TaskManager.h>
-#  include <Poco/ThreadPool.h>
 
+#  include "src/fidi_allocation.h"
 #  include "src/fidi_app_caller.h"
 #  include "src/fidi_driver.h"
+#  include "src/fidi_executor.h"
+#  include "src/fidi_health.h"
+#  include "src/fidi_payload.h"
+#  include "src/fidi_plan_cache.h"
+#  include "src/fidi_random.h"
+#  include "src/fidi_trace.h"
 
 namespace fidi {
 
@@ -56,7 +68,47 @@ namespace fidi {
   class AppDriver : public Driver {
    public:
     /// The default constructor
-    AppDriver() : Driver(), parser_(nullptr), resp_(nullptr) {}
+    AppDriver() :
+        Driver(),
+        parser_(nullptr),
+        resp_(nullptr),
+        status_(0),
+        timeout_sec_(0),
+        timeout_usec_(0),
+        done_(),
+        plan_(),
+        body_(),
+        body_hash_(0),
+        cacheable_(false),
+        binary_request_(false),
+        node_hash_(),
+        missing_nodes_(false),
+        glob_hash_(),
+        glob_buffer_(),
+        allocation_(),
+        memory_report_(),
+        phase_start_(),
+        calls_(),
+        dependents_(),
+        waiting_on_(),
+        stage_of_(),
+        stage_left_(),
+        stage_done_(),
+        calls_left_(0),
+        finished_(),
+        calls_mtx_(),
+        calls_cv_(),
+        node_(&default_node_),
+        trace_(),
+        cpu_time_(),
+        predelay_time_(),
+        postdelay_time_(),
+        stage_times_(),
+        modeled_delay_(),
+        seed_header_(),
+        seeded_(false),
+        seed_(0),
+        random_() {}
 
     /// The copy constructor is not used, so declutter.
     AppDriver(const AppDriver &src) = delete;
@@ -80,58 +132,378 @@ namespace fidi {
 
     /// \brief The method where the guts of the work is done.
     ///
-    /// The execute method creates a threadpool and a task manager to
-    /// handle making downstream calls.
+    /// The execute method hands the downstream calls to the process
+    /// wide fidi::Executor, tracking the repetitions of each call with
+    /// a fidi::CallGroup.
     ///
     /// + If there is a predelay attribute, sleep for the desgnated
     ///   number of millisecons
     /// + Set the response code
-    /// + If there are calls to make, walk down the priority queue, and
-    ///      - gather all requests at the same priority
+    /// + If there are calls to make, work out which calls each call
+    ///   waits for (see Driver::Dependencies()), and
+    ///      - start every call that waits for nothing
     ///      - if there is no utl attribute, create the url from the
     ///        hostname and port
-    ///      - Create a new AppCaller object, and pass it to the
-    ///        task manager
-    ///      - Wait for all tasks to complete
-    ///      - repeat until there are no more calls in queue
+    ///      - Create a new AppCaller object, and submit it to the
+    ///        executor
+    ///      - as each call completes, start the calls that were
+    ///        waiting for it alone
+    ///      - repeat until there are no more calls left
     /// + If there is a post delay, sleep for the specified
     ///   milliseconds
     ///
+    /// These steps are chained together, each one starting the next
+    /// when it is done, and this method waits for the last step. In
+    /// the asynchronous mode (see set_async_delays()) the delays are
+    /// parked on the fidi::TimerWheel, and the calls waiting on a
+    /// call are started by whichever repetition of it finishes last.
+    /// The thread that called this still waits for the last step, so
+    /// the mode changes which threads run the steps, not how many
+    /// server threads a request holds.
+    ///
     /// \param[in,out] stream output stream.
     std::ostream &Execute(std::ostream &stream);
 
     /// \brief run the parser in the input stream
     ///
-    /// This method first runs the super classes parse_helper method,
-    /// which creates a new scanner, and then deletes any existing
-    /// parser, and creates a new one using the just created
-    /// scanner. It then runs the parser, emitting diagnostics if
-    /// parsing did not complete without errors.
+    /// A request in the binary fidi::WireFormat (see
+    /// set_content_type()) is decoded, not parsed; only its top level
+    /// is looked at, and the payloads for the calls are forwarded
+    /// as they are.
+    ///
+    /// If the fidi::PlanCache is enabled, this reads the whole
+    /// request body, and if the same body has been seen before, sets
+    /// up the driver from the cached plan without parsing at all.
+    ///
+    /// Otherwise this method first runs the super classes
+    /// parse_helper method, which creates a new scanner, and then
+    /// deletes any existing parser, and creates a new one using the
+    /// just created scanner. It then runs the parser, emitting
+    /// diagnostics if parsing did not complete without errors.
     ///
     /// \param[in, out] stream the input stream with the request.
     void ParseHelper(std::istream &stream);
 
+    /// \brief Run the sanity checks, or reuse the cached results
+    ///
+    /// For a request set up from a cached plan this returns the
+    /// warnings found when the plan was first parsed. Otherwise it
+    /// runs the checks in the base class, and if the request body is
+    /// to be cached, saves the plan in the fidi::PlanCache.
+    ///
+    /// \param[out] error_message A string to append error messages to.
+    /// \return int The number of errors encountered.
+    int SanityChecks(std::string *error_message);
+
     /// set the response code
     void set_resp(Poco::Net::HTTPServerResponse &resp);
-    /// \brief Is the application healthy right now?
-    /// \return boolean true if the application is healthy
+
+    /// \brief The status the request asked to be answered with
+    ///
+    /// This is for requests with no HTTP response, made by a node
+    /// hosted by this same process (see fidi::LocalDispatch).
+    ///
+    /// \return int The response attribute, or 0 if there is none
+    int
+    get_status(void) const {
+      return status_;
+    }
+
+    /// \brief Note the Content-Type of the request, before parsing it
+    ///
+    /// \param[in] content_type The Content-Type header of the request
+    void set_content_type(const std::string &content_type);
+
+    /// \brief Note the node table hash sent with the request
+    ///
+    /// If the request leaves out its node table, the table is looked
+    /// up in the fidi::NodeTableCache by this hash; if it includes
+    /// the table, the table is added to the cache.
+    ///
+    /// \param[in] hash The X-Fidi-Nodes header of the request, if any
+    void
+    set_node_table(const std::string &hash) {
+      node_hash_ = hash;
+    }
+
+    /// \brief Note the node the request was sent to
+    ///
+    /// The health and responsiveness are those of this node, and
+    /// spans are recorded under its name. Without a node, requests go
+    /// to a default node shared by all of them.
+    ///
+    /// \param[in] node The node the request was sent to
+    void
+    set_node(fidi::NodeState *node) {
+      node_ = node;
+    }
+
+    /// \brief Note the seed the caller derived for this request
+    ///
+    /// A request may give a seed attribute, so that the delays drawn
+    /// from distributions (see fidi::Distribution) are the same on
+    /// every run. Each call it makes passes on a seed derived from
+    /// it, in the X-Fidi-Seed header, so that the whole tree of calls
+    /// is reproducible. A seed attribute of the request itself takes
+    /// precedence.
+    ///
+    /// \param[in] seed The value of the header, if any
+    void
+    set_seed(const std::string &seed) {
+      seed_header_ = seed;
+    }
+
+    /// \brief Note the trace the request belongs to
+    ///
+    /// The delays, and the downstream calls, are recorded as children
+    /// of this span (see fidi::Tracer).
+    ///
+    /// \param[in] span The span handling the request
+    void
+    set_trace(const fidi::TraceContext &span) {
+      trace_ = span;
+    }
+
+    /// A span of time, as measured by the steady clock
+    typedef std::chrono::steady_clock::duration Duration;
+
+    /// \brief How long the cpu_us work took, once Execute() returns
+    /// \return Duration The wall time of the work
+    Duration
+    get_cpu_time(void) const {
+      return cpu_time_;
+    }
+
+    /// \brief How long the predelay took, once Execute() returns
+    /// \return Duration The wall time of the predelay
+    Duration
+    get_predelay_time(void) const {
+      return predelay_time_;
+    }
+
+    /// \brief How long the postdelay took, once Execute() returns
+    /// \return Duration The wall time of the postdelay
+    Duration
+    get_postdelay_time(void) const {
+      return postdelay_time_;
+    }
+
+    /// \brief How long each sequence stage took, once Execute() returns
+    /// \return vector The wall time of each stage, in order
+    const std::vector<Duration> &
+    get_stage_times(void) const {
+      return stage_times_;
+    }
+
+    /// \brief The time the request asked to be spent
+    ///
+    /// This is the predelay and postdelay asked for, and the wall time
+    /// of the CPU work and of the stages, which is spent computing and
+    /// waiting on the instances called. What is left of the time taken
+    /// to handle a request is the overhead of fidi itself.
+    ///
+    /// \return Duration The modeled time
+    Duration GetModeledTime(void) const;
+
+    /// \brief Did the request leave out a node table we do not have?
+    ///
+    /// The caller should be told to send the request again, with the
+    /// node table, rather than the request being executed.
+    ///
+    /// \return bool true if the node table is missing
+    bool
+    get_missing_nodes(void) const {
+      return missing_nodes_;
+    }
+
+    /// \brief Get the size of the response body asked for
+    ///
+    /// \param[out] size The number of bytes of filler to respond with
+    /// \return bool true if the request has a size attribute
+    bool GetResponseSize(std::uint64_t *size) const;
+
+    /// \brief Is the node healthy right now?
+    /// \return boolean true if the node is healthy
     bool get_health(void);
 
-    /// \brief Is the application responding right now?
-    /// \return boolean true if the application is responsive
+    /// \brief Is the node responding right now?
+    /// \return boolean true if the node is responsive
     bool IsResponsive(void);
 
+    /// \brief Choose how delays and sequence points are waited for
+    ///
+    /// \param[in] async If true, park delays on the timer wheel and
+    ///            start each call from the completion of the calls it
+    ///            waits for, instead of sleeping and joining in the
+    ///            handler thread
+    static void
+    set_async_delays(bool async) {
+      async_delays_ = async;
+    }
+
+    /// \brief Choose the format of the payloads of downstream calls
+    ///
+    /// \param[in] binary If true, text requests are converted to the
+    ///            binary fidi::WireFormat once, here, so that the
+    ///            instances they call need not parse text at all
+    static void
+    set_binary_calls(bool binary) {
+      binary_calls_ = binary;
+    }
+
    private:
     fidi::Parser *parser_ = nullptr;  ///< A reference to the parser
                                       ///< created for handling this
                                       ///< request
-    static bool       healthy_;  ///< Whether application is currently healthy
-    static std::mutex health_mtx_;  ///< Lock for the shared boolean
-    static std::chrono::steady_clock::time_point
-        unresponsive_until_;  ///< Do not respond until this time
+    static bool async_delays_;  ///< Park delays on the timer wheel
+    static bool binary_calls_;  ///< Convert call payloads to binary
+    static fidi::NodeState default_node_;  ///< For requests to no node
 
     Poco::Net::HTTPServerResponse *resp_ =
         nullptr;  ///< The response code for the request
+    int status_ = 0;  ///< The response attribute, if any
+
+    long timeout_sec_  = 0;  ///< Downstream call timeout, whole seconds
+    long timeout_usec_ = 0;  ///< Downstream call timeout, microseconds
+    fidi::CallGroup done_;   ///< Completes when the last step is done
+
+    fidi::PlanCache::PlanPtr plan_;  ///< The cached plan in use, if any
+    std::string body_;  ///< The request body, until its plan is cached
+    std::size_t body_hash_ = 0;  ///< The plan cache key for the body
+    bool cacheable_ = false;     ///< Cache the plan once it is checked
+    bool binary_request_ = false;  ///< The request is in the wire format
+    std::string node_hash_;  ///< The node table hash sent with the request
+    bool missing_nodes_ = false;  ///< The node table was left out, and
+                                  ///< is not in the cache
+    std::string glob_hash_;  ///< The hash of our node table, once needed
+    fidi::Payload::Buffer glob_buffer_;  ///< Our node table, shared by
+                                         ///< all our calls
+    std::unique_ptr<fidi::Allocation>
+        allocation_;  ///< The memory asked for with the memory attribute
+    std::string memory_report_;  ///< What allocating the memory cost
+    std::chrono::steady_clock::time_point
+        phase_start_;  ///< When the current phase of the request began
+    std::vector<EdgeDetails> calls_;  ///< The calls, in sequence order
+    std::vector<std::vector<std::size_t>>
+        dependents_;  ///< The calls waiting for each call
+    std::vector<std::size_t> waiting_on_;  ///< Calls each call still
+                                           ///< waits for
+    std::vector<std::size_t> stage_of_;    ///< The stage of each call
+    std::vector<std::size_t> stage_left_;  ///< Calls unfinished, by stage
+    std::vector<std::chrono::steady_clock::time_point>
+        stage_done_;  ///< When the last call of each stage finished
+    std::size_t calls_left_ = 0;       ///< Calls not yet finished
+    std::vector<std::size_t> finished_;  ///< Calls finished, but not
+                                         ///< yet seen by the handler
+                                         ///< thread
+    std::mutex              calls_mtx_;  ///< Protects the call counts
+    std::condition_variable calls_cv_;   ///< Signalled as calls finish
+    fidi::NodeState *node_;     ///< The node the request was sent to
+    fidi::TraceContext trace_;  ///< The span handling the request
+    Duration cpu_time_;         ///< Wall time of the cpu_us work
+    Duration predelay_time_;    ///< Wall time of the predelay
+    Duration postdelay_time_;   ///< Wall time of the postdelay
+    std::vector<Duration> stage_times_;  ///< Wall time of each stage
+    Duration modeled_delay_;  ///< The delays asked for by the request
+    std::string   seed_header_;  ///< The seed passed on by the caller
+    bool          seeded_;       ///< Was a seed given?
+    std::uint64_t seed_;         ///< The seed of this request, if given
+    fidi::Random  random_;       ///< Draws the delays of this request
+
+    /// \brief Seed the generator of the request
+    ///
+    /// From the seed attribute, or the seed passed on by the caller,
+    /// or, without either, from the generator of this thread.
+    void SeedRandom(void);
+
+    /// \brief Record a span for a delay, if tracing
+    ///
+    /// \param[in] attribute The delay, predelay or postdelay
+    /// \param[in] end When the delay ended
+    void RecordDelay(const std::string &                   attribute,
+                     std::chrono::steady_clock::time_point end);
+
+    /// \brief Allocate the memory asked for by the request
+    ///
+    /// The memory is held until the request is done, or, if the
+    /// memory_hold attribute is false, until the calls start.
+    ///
+    /// \throw std::bad_alloc if the memory can not be mapped
+    void AllocateMemory(void);
+
+    /// \brief Do the CPU work asked for by the request
+    ///
+    /// This runs in the thread handling the request, before the
+    /// predelay.
+    void BurnCpu(void);
+
+    /// \brief Create a scanner and parser, and parse the stream
+    ///
+    /// \param[in, out] stream the input stream with the request.
+    /// \param[in] cacheable Whether to cache the plan once checked
+    void ParseBody(std::istream &stream, bool cacheable);
+
+    /// \brief Decode a request in the binary wire format
+    ///
+    /// \param[in] body The whole request body
+    void DecodeBody(const std::string &body);
+
+    /// \brief Fill in, or remember, the node table of the request
+    ///
+    /// If the request was sent with a node table hash, and without
+    /// the node table, fill it in from the fidi::NodeTableCache; if
+    /// it was sent with the table, or the table came with a cached
+    /// plan, add it to the cache.
+    void ResolveNodeTable(void);
+
+    /// \brief Convert the payloads of the calls to the wire format
+    ///
+    /// Each call payload is parsed, all the way down, and encoded. If
+    /// any of them fails to parse, the payloads are left as text, so
+    /// that the instance called reports the error as usual.
+    void ConvertToWire(void);
+
+    /// \brief Wait for the delay named by an attribute, then carry on
+    ///
+    /// If the attribute is missing or not positive, the next step is
+    /// run straight away.
+    ///
+    /// \param[in] attribute The name of the delay attribute
+    /// \param[in] next The step to run once the delay has expired
+    void Delay(const std::string &attribute, std::function<void()> next);
+
+    /// \brief Set up timeouts and unresponsiveness, and start the calls
+    void StartCalls(void);
+
+    /// \brief Start the calls that wait for nothing, and the rest as
+    ///        the calls they wait for finish
+    ///
+    /// Once there are no calls left, this finishes the request. In
+    /// the synchronous mode it waits for that on the handler thread.
+    void RunCalls(void);
+
+    /// \brief Make every repetition of a call
+    ///
+    /// \param[in] call The index of the call in calls_
+    void StartCall(std::size_t call);
+
+    /// \brief Note that every repetition of a call has finished
+    ///
+    /// \param[in] call The index of the call in calls_
+    /// \param[out] ready The calls no longer waiting for anything
+    /// \return bool true if that was the last call
+    bool CallDone(std::size_t call, std::vector<std::size_t> *ready);
+
+    /// \brief Record how long each stage of calls took, and finish
+    ///
+    /// Stage N lasts until every call with one of the N lowest
+    /// sequence numbers has finished, so that, as with strict
+    /// sequence barriers, the stages add up to the time spent
+    /// calling.
+    void FinishCalls(void);
+
+    /// \brief Log the requested messages, set health, and post delay
+    void FinishRequest(void);
 
     /// \brief Get the supplied URL or create one from host and port
     ///
@@ -140,7 +512,14 @@ namespace fidi {
     ///
     /// \param[in] node_name The node identifier to create a URL for
     /// \return string The URL to amke the call to
-    std::string GetUrl(std::string &node_name);
+    std::string GetUrl(const std::string &node_name);
+
+    /// \brief Pre-warm pooled connections to every node in the request
+    ///
+    /// Asks the fidi::SessionPool to open a connection, in the
+    /// background, to each node in the node table that it has no
+    /// connection to yet.
+    void PrewarmNodes(void);
   };
 
 }  // namespace fidi
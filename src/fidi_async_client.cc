@@ -0,0 +1,951 @@
+// fidi_async_client.cc ---  -*- mode: c++; -*-
+
+// Copyright 2018-2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied.  See the License for the specific language governing
+// permissions and limitations under the License.
+
+/// \file
+/// \ingroup app
+///
+/// This file provides the implementation of the event driven HTTP
+/// client of the fidi (φίδι) HTTP server.
+
+// Code:
+
+#include "src/fidi_async_client.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <limits>
+#include <set>
+#include <thread>
+
+#include "src/fidi_executor.h"
+
+std::size_t fidi::AsyncClient::configured_threads_ = 0;
+std::size_t fidi::AsyncClient::configured_idle_    = 8;
+
+constexpr std::chrono::seconds fidi::AsyncClient::kDefaultTimeout;
+
+namespace {
+  /// \brief Lower case a string, for comparing header names
+  ///
+  /// \param[in] text The string
+  /// \return string The string, in lower case
+  std::string
+  Lower(std::string text) {
+    for (auto &c : text) {
+      c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+    }
+    return text;
+  }
+
+  /// \brief Drop the blanks around a string
+  ///
+  /// \param[in] text The string
+  /// \return string The string, trimmed
+  std::string
+  Trim(const std::string &text) {
+    auto first = text.find_first_not_of(" \t");
+    if (first == std::string::npos) { return std::string(); }
+    auto last = text.find_last_not_of(" \t");
+    return text.substr(first, last - first + 1);
+  }
+
+  /// \brief The text of the error in errno
+  ///
+  /// \param[in] error The error number
+  /// \return string The text
+  std::string
+  ErrorText(int error) {
+    char buffer[256];
+    // The GNU strerror_r may return a static string instead
+    return std::string(strerror_r(error, buffer, sizeof(buffer)));
+  }
+}  // namespace
+
+void
+fidi::ResponseParser::Reset(void) {
+  state_      = State::kStatusLine;
+  line_.clear();
+  status_     = 0;
+  keep_alive_ = false;
+  chunked_    = false;
+  length_     = -1;
+  remaining_  = 0;
+  error_.clear();
+}
+
+std::size_t
+fidi::ResponseParser::Feed(const char *data, std::size_t size) {
+  std::size_t used = 0;
+  while (used < size && state_ != State::kDone && state_ != State::kFailed) {
+    if (state_ == State::kUntilClose) { return size; }
+    if (state_ == State::kBody || state_ == State::kChunkData) {
+      auto skip = static_cast<std::size_t>(
+          std::min<std::uint64_t>(remaining_, size - used));
+      used += skip;
+      remaining_ -= skip;
+      if (remaining_ == 0) {
+        state_ = state_ == State::kBody ? State::kDone : State::kChunkEnd;
+      }
+      continue;
+    }
+    // Everything else is read a line at a time
+    const char *start = data + used;
+    const char *end   = static_cast<const char *>(
+        std::memchr(start, '\n', size - used));
+    std::size_t take = end == nullptr ? size - used
+                                      : static_cast<std::size_t>(end - start);
+    if (line_.size() + take > kMaxLine) {
+      Fail("response line too long");
+      break;
+    }
+    line_.append(start, take);
+    used += take;
+    if (end == nullptr) { break; }
+    used++;  // The newline
+    if (!line_.empty() && line_.back() == '\r') { line_.pop_back(); }
+    std::string line;
+    line.swap(line_);
+    Line(line);
+  }
+  return used;
+}
+
+void
+fidi::ResponseParser::Line(const std::string &line) {
+  switch (state_) {
+    case State::kStatusLine: {
+      // HTTP/1.1 200 OK
+      if (line.empty()) { return; }  // Stray line ending before it
+      bool valid = line.compare(0, 7, "HTTP/1.") == 0 && line.size() >= 12 &&
+                   line[8] == ' ';
+      for (std::size_t i = 9; valid && i < 12; ++i) {
+        valid = std::isdigit(static_cast<unsigned char>(line[i])) != 0;
+      }
+      if (!valid) {
+        Fail("bad status line: " + line.substr(0, 64));
+        return;
+      }
+      status_     = std::stoi(line.substr(9, 3));
+      keep_alive_ = line[7] != '0';  // HTTP/1.0 closes by default
+      chunked_    = false;
+      length_     = -1;
+      state_      = State::kHeaders;
+      return;
+    }
+    case State::kHeaders: {
+      if (line.empty()) {
+        EndOfHeaders();
+        return;
+      }
+      auto colon = line.find(':');
+      if (colon == std::string::npos) {
+        Fail("bad header: " + line.substr(0, 64));
+        return;
+      }
+      std::string name  = Lower(Trim(line.substr(0, colon)));
+      std::string value = Lower(Trim(line.substr(colon + 1)));
+      if (name == "content-length") {
+        std::size_t idx = 0;
+        try {
+          length_ = std::stoll(value, &idx);
+        } catch (const std::exception &) {
+          idx = 0;
+        }
+        if (idx == 0 || idx != value.size() || length_ < 0) {
+          Fail("bad Content-Length: " + value);
+        }
+      } else if (name == "transfer-encoding") {
+        chunked_ = value.find("chunked") != std::string::npos;
+      } else if (name == "connection") {
+        if (value.find("close") != std::string::npos) {
+          keep_alive_ = false;
+        } else if (value.find("keep-alive") != std::string::npos) {
+          keep_alive_ = true;
+        }
+      }
+      return;
+    }
+    case State::kChunkSize: {
+      // The size is in hex, maybe followed by extensions
+      std::size_t idx = 0;
+      try {
+        remaining_ = std::stoull(line, &idx, 16);
+      } catch (const std::exception &) {
+        idx = 0;
+      }
+      if (idx == 0) {
+        Fail("bad chunk size: " + line.substr(0, 64));
+        return;
+      }
+      state_ = remaining_ == 0 ? State::kTrailers : State::kChunkData;
+      return;
+    }
+    case State::kChunkEnd:
+      if (!line.empty()) {
+        Fail("chunk longer than its size");
+        return;
+      }
+      state_ = State::kChunkSize;
+      return;
+    case State::kTrailers:
+      if (line.empty()) { state_ = State::kDone; }
+      return;
+    default:
+      return;
+  }
+}
+
+void
+fidi::ResponseParser::EndOfHeaders(void) {
+  // An interim response; the real one follows
+  if (status_ >= 100 && status_ < 200 && status_ != 101) {
+    state_ = State::kStatusLine;
+    return;
+  }
+  if (status_ == 204 || status_ == 304 || status_ == 101) {
+    state_ = State::kDone;
+  } else if (chunked_) {
+    state_ = State::kChunkSize;
+  } else if (length_ >= 0) {
+    remaining_ = static_cast<std::uint64_t>(length_);
+    state_     = remaining_ == 0 ? State::kDone : State::kBody;
+  } else {
+    keep_alive_ = false;
+    state_      = State::kUntilClose;
+  }
+}
+
+void
+fidi::ResponseParser::Close(void) {
+  if (state_ == State::kUntilClose) {
+    state_ = State::kDone;
+  } else if (state_ != State::kDone && state_ != State::kFailed) {
+    Fail(status_ == 0 ? "connection closed"
+                      : "connection closed before the end of the response");
+  }
+  keep_alive_ = false;
+}
+
+void
+fidi::ResponseParser::Fail(const std::string &error) {
+  state_      = State::kFailed;
+  keep_alive_ = false;
+  error_      = error;
+}
+
+/// A call in flight
+struct fidi::AsyncClient::Call {
+  /// The default constructor, filled in by Send()
+  Call() :
+      id(0), key(), addresses(), next_address(0), head(), body(), done(),
+      deadline(), retried(false) {}
+
+  CallId        id;            ///< Identifies the call
+  std::string   key;           ///< host:port, for reusing connections
+  std::vector<Address> addresses;     ///< Where to connect
+  std::size_t          next_address;  ///< The one to connect to next
+  std::string   head;          ///< The request line and headers
+  fidi::Payload body;          ///< The body
+  Callback      done;          ///< Run when answered
+  std::chrono::steady_clock::time_point deadline;  ///< When to give up
+  bool          retried;       ///< Already made once more
+};
+
+/// \brief A loop thread, and the connections and calls it drives
+///
+/// Everything but the inbox of new calls and cancellations is only
+/// ever touched by the loop thread, so needs no lock.
+class fidi::AsyncClient::Loop {
+ public:
+  /// \brief Constructor. Starts the loop thread
+  ///
+  /// \param[in] max_idle Idle connections kept per destination
+  explicit Loop(std::size_t max_idle);
+
+  /// The copy constructor is not used, so declutter.
+  Loop(const Loop &) = delete;
+  /// The assignment operator is also not used, so cleaned up.
+  Loop &operator=(const Loop &) = delete;
+  /// The move operations are unused, and cleaned up.
+  Loop(Loop &&) = delete;
+  Loop &operator=(Loop &&) = delete;
+
+  /// Destructor. Stops the thread, and closes every connection
+  ~Loop();
+
+  /// \brief Hand a call to the loop
+  ///
+  /// \param[in] call The call
+  void Post(std::unique_ptr<Call> call);
+
+  /// \brief Ask the loop to give up on a call
+  ///
+  /// \param[in] id The call
+  void PostCancel(CallId id);
+
+  /// \brief Stop the loop thread
+  void Stop(void);
+
+ private:
+  /// A connection, and the call using it, if any
+  struct Connection {
+    /// Where the connection is in a call
+    enum class State {
+      kConnecting,  ///< Waiting for the connection to open
+      kWriting,     ///< Sending the request
+      kReading,     ///< Reading the response
+      kIdle         ///< Waiting for the next call
+    };
+
+    /// \brief Constructor
+    ///
+    /// \param[in] socket The socket
+    /// \param[in] destination The host:port connected to
+    Connection(int socket, const std::string &destination) :
+        fd(socket), key(destination), state(State::kConnecting),
+        reused(false), answered(false), sent(0), call(nullptr), parser() {}
+
+    /// The copy constructor is not used, so declutter.
+    Connection(const Connection &) = delete;
+    /// The assignment operator is also not used, so cleaned up.
+    Connection &operator=(const Connection &) = delete;
+
+    int            fd;        ///< The socket, or -1 once closed
+    std::string    key;       ///< host:port
+    State          state;     ///< Where the connection is in a call
+    bool           reused;    ///< Has carried an earlier call
+    bool           answered;  ///< Some of the response has been read
+    std::size_t    sent;      ///< Bytes of the request sent
+    Call *         call;      ///< The call using the connection
+    fidi::ResponseParser parser;  ///< Reads the response
+  };
+
+  /// The body of the loop thread
+  void Run(void);
+
+  /// \brief Start a call, on an idle connection, or a new one
+  ///
+  /// \param[in] call The call
+  void Attach(Call *call);
+
+  /// \brief Open a new connection for a call
+  ///
+  /// If the address at hand will not connect, the next is tried.
+  ///
+  /// \param[in] call The call
+  void Connect(Call *call);
+
+  /// \brief Act on the events of a connection
+  ///
+  /// \param[in] connection The connection
+  /// \param[in] events The epoll events
+  void OnEvent(Connection *connection, std::uint32_t events);
+
+  /// \brief Send as much of the request as the socket takes
+  ///
+  /// \param[in] connection The connection
+  void Write(Connection *connection);
+
+  /// \brief Read as much of the response as has arrived
+  ///
+  /// \param[in] connection The connection
+  void Read(Connection *connection);
+
+  /// \brief The whole response is in
+  ///
+  /// \param[in] connection The connection
+  /// \param[in] leftover More was read than the response, so the
+  ///            connection can not be reused
+  void Complete(Connection *connection, bool leftover);
+
+  /// \brief The connection failed
+  ///
+  /// A call on a reused connection that failed before any answer is
+  /// made once more, on a new connection, since the server may have
+  /// closed the idle connection just as it was picked up.
+  ///
+  /// \param[in] connection The connection
+  /// \param[in] error What went wrong
+  void Broken(Connection *connection, const std::string &error);
+
+  /// \brief Give up on a call, and close its connection
+  ///
+  /// \param[in] id The call
+  /// \param[in] error Why
+  void Abort(CallId id, const std::string &error);
+
+  /// \brief Hand the result of a call to the executor, and forget it
+  ///
+  /// \param[in] call The call
+  /// \param[in] status The HTTP status, or 0
+  /// \param[in] error What went wrong, if anything
+  void Finish(Call *call, int status, const std::string &error);
+
+  /// \brief Close a connection
+  ///
+  /// The connection itself is freed once the events at hand have
+  /// been handled, since later ones may point at it.
+  ///
+  /// \param[in] connection The connection
+  void Close(Connection *connection);
+
+  /// \brief Give up on the calls past their deadline
+  void Expire(void);
+
+  /// \brief The milliseconds to the next deadline, for epoll_wait
+  /// \return int The time, or -1 if there is no deadline
+  int NextTimeout(void) const;
+
+  const std::size_t max_idle_;  ///< Idle connections per destination
+  int               epoll_fd_;  ///< The epoll instance
+  int               wake_fd_;   ///< An eventfd to wake the loop
+
+  std::mutex                         mtx_;  ///< Protects the inbox
+  std::vector<std::unique_ptr<Call>> incoming_;  ///< New calls
+  std::vector<CallId>                cancels_;   ///< Calls to give up
+  bool                               stopping_;  ///< Set by Stop()
+
+  std::unordered_map<CallId, std::unique_ptr<Call>> calls_;  ///< In flight
+  std::unordered_map<CallId, Connection *> attached_;  ///< Their connections
+  std::set<std::pair<std::chrono::steady_clock::time_point, CallId>>
+      deadlines_;  ///< When to give up on each call
+  std::unordered_map<Connection *, std::unique_ptr<Connection>>
+      connections_;  ///< Every open connection
+  std::unordered_map<std::string, std::vector<Connection *>>
+      idle_;  ///< Idle connections, by host:port
+  std::vector<std::unique_ptr<Connection>> closed_;  ///< To be freed
+  std::vector<char>                        buffer_;  ///< For reading
+  std::thread                              thread_;  ///< The loop thread
+};
+
+fidi::AsyncClient::Loop::Loop(std::size_t max_idle) :
+    max_idle_(max_idle),
+    epoll_fd_(epoll_create1(EPOLL_CLOEXEC)),
+    wake_fd_(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)),
+    mtx_(),
+    incoming_(),
+    cancels_(),
+    stopping_(false),
+    calls_(),
+    attached_(),
+    deadlines_(),
+    connections_(),
+    idle_(),
+    closed_(),
+    buffer_(64 * 1024),
+    thread_() {
+  // The wake up event has no connection
+  epoll_event event;
+  event.events   = EPOLLIN;
+  event.data.ptr = nullptr;
+  (void)epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, wake_fd_, &event);
+  thread_ = std::thread(&fidi::AsyncClient::Loop::Run, this);
+}
+
+fidi::AsyncClient::Loop::~Loop() {
+  Stop();
+  for (auto &entry : connections_) { ::close(entry.first->fd); }
+  ::close(wake_fd_);
+  ::close(epoll_fd_);
+}
+
+void
+fidi::AsyncClient::Loop::Post(std::unique_ptr<Call> call) {
+  bool wake = false;
+  {
+    std::lock_guard<std::mutex> lock(mtx_);
+    // Only the first post since the loop last looked needs a wake up
+    wake = incoming_.empty() && cancels_.empty();
+    incoming_.push_back(std::move(call));
+  }
+  if (wake) {
+    std::uint64_t one = 1;
+    (void)::write(wake_fd_, &one, sizeof(one));
+  }
+}
+
+void
+fidi::AsyncClient::Loop::PostCancel(CallId id) {
+  bool wake = false;
+  {
+    std::lock_guard<std::mutex> lock(mtx_);
+    wake = incoming_.empty() && cancels_.empty();
+    cancels_.push_back(id);
+  }
+  if (wake) {
+    std::uint64_t one = 1;
+    (void)::write(wake_fd_, &one, sizeof(one));
+  }
+}
+
+void
+fidi::AsyncClient::Loop::Stop(void) {
+  {
+    std::lock_guard<std::mutex> lock(mtx_);
+    if (stopping_) { return; }
+    stopping_ = true;
+  }
+  std::uint64_t one = 1;
+  (void)::write(wake_fd_, &one, sizeof(one));
+  if (thread_.joinable()) { thread_.join(); }
+}
+
+void
+fidi::AsyncClient::Loop::Run(void) {
+  std::vector<epoll_event>           events(256);
+  std::vector<std::unique_ptr<Call>> incoming;
+  std::vector<CallId>                cancels;
+  for (;;) {
+    {
+      std::lock_guard<std::mutex> lock(mtx_);
+      if (stopping_) { break; }
+      incoming.swap(incoming_);
+      cancels.swap(cancels_);
+    }
+    for (auto &call : incoming) {
+      Call *raw = call.get();
+      deadlines_.emplace(raw->deadline, raw->id);
+      calls_.emplace(raw->id, std::move(call));
+      Attach(raw);
+    }
+    incoming.clear();
+    for (auto id : cancels) { Abort(id, "cancelled"); }
+    cancels.clear();
+    closed_.clear();
+
+    int count = epoll_wait(epoll_fd_, events.data(),
+                           static_cast<int>(events.size()), NextTimeout());
+    for (int i = 0; i < count; ++i) {
+      auto *connection = static_cast<Connection *>(events[i].data.ptr);
+      if (connection == nullptr) {
+        std::uint64_t value = 0;
+        (void)::read(wake_fd_, &value, sizeof(value));
+        continue;
+      }
+      OnEvent(connection, events[i].events);
+    }
+    Expire();
+    closed_.clear();
+  }
+}
+
+int
+fidi::AsyncClient::Loop::NextTimeout(void) const {
+  if (deadlines_.empty()) { return -1; }
+  auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(
+      deadlines_.begin()->first - std::chrono::steady_clock::now());
+  // Round up, so the deadline has passed when the wait ends
+  return static_cast<int>(std::min<long long>(
+      std::max<long long>(wait.count() + 1, 0),
+      std::numeric_limits<int>::max()));
+}
+
+void
+fidi::AsyncClient::Loop::Attach(Call *call) {
+  auto idle_it = idle_.find(call->key);
+  if (idle_it != idle_.end() && !idle_it->second.empty()) {
+    Connection *connection = idle_it->second.back();
+    idle_it->second.pop_back();
+    connection->state    = Connection::State::kWriting;
+    connection->answered = false;
+    connection->sent     = 0;
+    connection->call     = call;
+    attached_[call->id]  = connection;
+    Write(connection);
+    return;
+  }
+  Connect(call);
+}
+
+void
+fidi::AsyncClient::Loop::Connect(Call *call) {
+  const Address &address = call->addresses[call->next_address];
+  int            fd      = ::socket(
+      address.first.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    // An IPv6 address on a host without IPv6, say
+    if (++call->next_address < call->addresses.size()) {
+      Connect(call);
+      return;
+    }
+    Finish(call, 0, "socket: " + ErrorText(errno));
+    return;
+  }
+  // Requests go out in one write; there is nothing to batch
+  int on = 1;
+  (void)setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+  auto  owned      = std::make_unique<Connection>(fd, call->key);
+  auto *connection = owned.get();
+  connections_.emplace(connection, std::move(owned));
+  connection->call    = call;
+  attached_[call->id] = connection;
+
+  epoll_event event;
+  event.events   = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+  event.data.ptr = connection;
+  if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &event) != 0) {
+    Broken(connection, "epoll_ctl: " + ErrorText(errno));
+    return;
+  }
+  if (::connect(fd, reinterpret_cast<const sockaddr *>(&address.first),
+                address.second) == 0) {
+    connection->state = Connection::State::kWriting;
+    Write(connection);
+  } else if (errno != EINPROGRESS) {
+    Broken(connection, "connect to " + call->key + ": " + ErrorText(errno));
+  }
+}
+
+void
+fidi::AsyncClient::Loop::OnEvent(Connection *connection,
+                                 std::uint32_t events) {
+  // Closed by an earlier event in the same batch
+  if (connection->fd < 0) { return; }
+  switch (connection->state) {
+    case Connection::State::kConnecting: {
+      int       error  = 0;
+      socklen_t length = sizeof(error);
+      if (getsockopt(connection->fd, SOL_SOCKET, SO_ERROR, &error,
+                     &length) != 0) {
+        error = errno;
+      }
+      if (error != 0) {
+        Broken(connection, "connect to " + connection->key + ": " +
+                               ErrorText(error));
+      } else if ((events & EPOLLOUT) != 0) {
+        connection->state = Connection::State::kWriting;
+        Write(connection);
+      }
+      break;
+    }
+    case Connection::State::kWriting:
+      Write(connection);
+      break;
+    case Connection::State::kReading:
+      Read(connection);
+      break;
+    case Connection::State::kIdle:
+      // The server closed it, or sent something unasked for; room
+      // in the send buffer is no reason to drop it
+      if ((events & (EPOLLIN | EPOLLRDHUP | EPOLLERR | EPOLLHUP)) != 0) {
+        Close(connection);
+      }
+      break;
+  }
+}
+
+void
+fidi::AsyncClient::Loop::Write(Connection *connection) {
+  const Call *call = connection->call;
+  const std::string *pieces[3] = {&call->head, call->body.get_prefix().get(),
+                                  call->body.get_body().get()};
+  for (;;) {
+    // Point the vector at what is left to send
+    iovec       vector[3];
+    int         used = 0;
+    std::size_t skip = connection->sent;
+    for (auto const *piece : pieces) {
+      if (piece == nullptr) { continue; }
+      if (skip >= piece->size()) {
+        skip -= piece->size();
+        continue;
+      }
+      vector[used].iov_base = const_cast<char *>(piece->data() + skip);
+      vector[used].iov_len  = piece->size() - skip;
+      skip                  = 0;
+      used++;
+    }
+    if (used == 0) {
+      connection->state = Connection::State::kReading;
+      Read(connection);
+      return;
+    }
+    msghdr message;
+    std::memset(&message, 0, sizeof(message));
+    message.msg_iov    = vector;
+    message.msg_iovlen = static_cast<std::size_t>(used);
+    // MSG_NOSIGNAL, so a closed connection is an error, not SIGPIPE
+    ssize_t sent = ::sendmsg(connection->fd, &message, MSG_NOSIGNAL);
+    if (sent < 0) {
+      if (errno == EINTR) { continue; }
+      if (errno == EAGAIN || errno == EWOULDBLOCK) { return; }
+      Broken(connection, "send to " + connection->key + ": " +
+                             ErrorText(errno));
+      return;
+    }
+    connection->sent += static_cast<std::size_t>(sent);
+  }
+}
+
+void
+fidi::AsyncClient::Loop::Read(Connection *connection) {
+  for (;;) {
+    ssize_t got = ::recv(connection->fd, buffer_.data(), buffer_.size(), 0);
+    if (got > 0) {
+      connection->answered = true;
+      auto        size     = static_cast<std::size_t>(got);
+      std::size_t used     = connection->parser.Feed(buffer_.data(), size);
+      if (connection->parser.done()) {
+        Complete(connection, used < size);
+        return;
+      }
+      if (connection->parser.failed()) {
+        Call *call       = connection->call;
+        connection->call = nullptr;
+        std::string error(connection->parser.get_error());
+        Close(connection);
+        Finish(call, 0, "response from " + call->key + ": " + error);
+        return;
+      }
+      continue;
+    }
+    if (got == 0) {
+      connection->parser.Close();
+      if (connection->parser.done()) {
+        Complete(connection, true);
+      } else {
+        Broken(connection, "response from " + connection->key + ": " +
+                               connection->parser.get_error());
+      }
+      return;
+    }
+    if (errno == EINTR) { continue; }
+    if (errno == EAGAIN || errno == EWOULDBLOCK) { return; }
+    Broken(connection, "receive from " + connection->key + ": " +
+                           ErrorText(errno));
+    return;
+  }
+}
+
+void
+fidi::AsyncClient::Loop::Complete(Connection *connection, bool leftover) {
+  Call *call       = connection->call;
+  int   status     = connection->parser.get_status();
+  auto &idle       = idle_[connection->key];
+  connection->call = nullptr;
+  if (!leftover && connection->parser.get_keep_alive() &&
+      idle.size() < max_idle_) {
+    connection->state  = Connection::State::kIdle;
+    connection->reused = true;
+    connection->parser.Reset();
+    idle.push_back(connection);
+  } else {
+    Close(connection);
+  }
+  Finish(call, status, std::string());
+}
+
+void
+fidi::AsyncClient::Loop::Broken(Connection *       connection,
+                                const std::string &error) {
+  Call *call  = connection->call;
+  bool  retry = call != nullptr && connection->reused &&
+               !connection->answered && !call->retried;
+  // Nothing was sent, so the call may go to the next address
+  bool next = call != nullptr &&
+              connection->state == Connection::State::kConnecting &&
+              call->next_address + 1 < call->addresses.size();
+  connection->call = nullptr;
+  Close(connection);
+  if (call == nullptr) { return; }
+  if (next) {
+    call->next_address++;
+    attached_.erase(call->id);
+    Connect(call);
+    return;
+  }
+  if (retry) {
+    call->retried = true;
+    attached_.erase(call->id);
+    Connect(call);
+    return;
+  }
+  Finish(call, 0, error);
+}
+
+void
+fidi::AsyncClient::Loop::Abort(CallId id, const std::string &error) {
+  auto call_it = calls_.find(id);
+  // Answered already
+  if (call_it == calls_.end()) { return; }
+  auto attached_it = attached_.find(id);
+  if (attached_it != attached_.end()) {
+    attached_it->second->call = nullptr;
+    Close(attached_it->second);
+  }
+  Finish(call_it->second.get(), 0, error);
+}
+
+void
+fidi::AsyncClient::Loop::Finish(Call *call, int status,
+                                const std::string &error) {
+  attached_.erase(call->id);
+  deadlines_.erase(std::make_pair(call->deadline, call->id));
+  auto call_it = calls_.find(call->id);
+  Callback done(std::move(call->done));
+  calls_.erase(call_it);
+  // Never wait for room in the queue; the whole loop would stall
+  fidi::Executor::instance().Post(
+      [done, status, error] { done(status, error); });
+}
+
+void
+fidi::AsyncClient::Loop::Close(Connection *connection) {
+  if (connection->state == Connection::State::kIdle) {
+    auto &idle = idle_[connection->key];
+    idle.erase(std::remove(idle.begin(), idle.end(), connection), idle.end());
+  }
+  (void)epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, connection->fd, nullptr);
+  ::close(connection->fd);
+  connection->fd = -1;
+  auto owned_it  = connections_.find(connection);
+  closed_.push_back(std::move(owned_it->second));
+  connections_.erase(owned_it);
+}
+
+void
+fidi::AsyncClient::Loop::Expire(void) {
+  auto now = std::chrono::steady_clock::now();
+  while (!deadlines_.empty() && deadlines_.begin()->first <= now) {
+    Abort(deadlines_.begin()->second, "timed out");
+  }
+}
+
+fidi::AsyncClient::AsyncClient(std::size_t threads, std::size_t max_idle) :
+    loops_(), next_id_(1), resolve_mtx_(), addresses_() {
+  for (std::size_t i = 0; i < threads; ++i) {
+    loops_.push_back(std::make_unique<Loop>(max_idle));
+  }
+}
+
+fidi::AsyncClient::~AsyncClient() { Shutdown(); }
+
+void
+fidi::AsyncClient::Configure(std::size_t threads, std::size_t max_idle) {
+  configured_threads_ = threads;
+  configured_idle_    = max_idle;
+}
+
+fidi::AsyncClient &
+fidi::AsyncClient::instance(void) {
+  static fidi::AsyncClient client(configured_threads_, configured_idle_);
+  return client;
+}
+
+bool
+fidi::AsyncClient::Resolve(const std::string &host, std::uint16_t port,
+                           std::vector<Address> *addresses,
+                           std::string *         error) {
+  std::string key(host + ":" + std::to_string(port));
+  {
+    std::lock_guard<std::mutex> lock(resolve_mtx_);
+    auto                        found = addresses_.find(key);
+    if (found != addresses_.end()) {
+      *addresses = found->second;
+      return true;
+    }
+  }
+  addrinfo hints;
+  std::memset(&hints, 0, sizeof(hints));
+  hints.ai_family   = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  addrinfo *result  = nullptr;
+  int       status  = getaddrinfo(host.c_str(), std::to_string(port).c_str(),
+                           &hints, &result);
+  if (status != 0 || result == nullptr) {
+    *error = "Can not resolve " + host + ": " + gai_strerror(status);
+    return false;
+  }
+  addresses->clear();
+  for (addrinfo *info = result; info != nullptr; info = info->ai_next) {
+    Address address;
+    std::memset(&address.first, 0, sizeof(address.first));
+    std::memcpy(&address.first, info->ai_addr, info->ai_addrlen);
+    address.second = info->ai_addrlen;
+    addresses->push_back(address);
+  }
+  freeaddrinfo(result);
+  std::lock_guard<std::mutex> lock(resolve_mtx_);
+  addresses_[key] = *addresses;
+  return true;
+}
+
+fidi::AsyncClient::CallId
+fidi::AsyncClient::Send(Request request, Callback done) {
+  CallId id   = next_id_.fetch_add(1, std::memory_order_relaxed);
+  auto   call = std::make_unique<Call>();
+  call->id      = id;
+  call->key     = request.host + ":" + std::to_string(request.port);
+  call->retried = false;
+  std::string error;
+  if (!Resolve(request.host, request.port, &call->addresses, &error)) {
+    // Never run the callback here, under the caller's locks
+    fidi::Executor::instance().Post([done, error] { done(0, error); });
+    return id;
+  }
+
+  std::string &head = call->head;
+  head.reserve(256);
+  head.append("POST ")
+      .append(request.path.empty() ? "/" : request.path)
+      .append(" HTTP/1.1\r\nHost: ")
+      .append(call->key)
+      .append("\r\nContent-Type: ")
+      .append(request.content_type)
+      .append("\r\nContent-Length: ")
+      .append(std::to_string(request.body.size()))
+      .append("\r\n");
+  for (auto const &[name, value] : request.headers) {
+    head.append(name).append(": ").append(value).append("\r\n");
+  }
+  head.append("\r\n");
+  call->body = std::move(request.body);
+  call->done = std::move(done);
+  auto timeout =
+      request.timeout.count() > 0
+          ? request.timeout
+          : std::chrono::duration_cast<std::chrono::microseconds>(
+                kDefaultTimeout);
+  call->deadline = std::chrono::steady_clock::now() + timeout;
+  loops_[id % loops_.size()]->Post(std::move(call));
+  return id;
+}
+
+void
+fidi::AsyncClient::Cancel(CallId id) {
+  if (loops_.empty()) { return; }
+  loops_[id % loops_.size()]->PostCancel(id);
+}
+
+void
+fidi::AsyncClient::Shutdown(void) {
+  for (auto &loop : loops_) { loop->Stop(); }
+}
+
+//
+// fidi_async_client.cc ends here
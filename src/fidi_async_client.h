@@ -0,0 +1,319 @@
+// fidi_async_client.h ---  -*- mode: c++; -*-
+
+// Copyright 2018-2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied.  See the License for the specific language governing
+// permissions and limitations under the License.
+
+/// \file
+/// \ingroup app
+///
+/// This file contains the event driven HTTP client the fidi (φίδι)
+/// HTTP server may make its downstream calls with.
+
+// Code:
+
+#ifndef FIDI_ASYNC_CLIENT_H
+#  define FIDI_ASYNC_CLIENT_H
+
+#  include <sys/socket.h>
+
+#  include <atomic>
+#  include <chrono>
+#  include <cstddef>
+#  include <cstdint>
+#  include <functional>
+#  include <memory>
+#  include <mutex>
+#  include <string>
+#  include <unordered_map>
+#  include <utility>
+#  include <vector>
+
+#  include "src/fidi_payload.h"
+
+namespace fidi {
+
+  /// \brief Reads an HTTP/1.1 response, as it arrives
+  ///
+  /// The parser is fed whatever a read from the socket returned, and
+  /// keeps its place between reads. It only looks at the status line
+  /// and the headers that frame the body: Content-Length,
+  /// Transfer-Encoding: chunked, and Connection. The body itself is
+  /// skipped. Interim 1xx responses are skipped too, and a body with
+  /// neither a length nor chunks runs until the connection closes.
+  class ResponseParser {
+   public:
+    /// The default constructor, ready for a response
+    ResponseParser() :
+        state_(State::kStatusLine), line_(), status_(0), keep_alive_(false),
+        chunked_(false), length_(-1), remaining_(0), error_() {}
+
+    /// The copy constructor is not used, so declutter.
+    ResponseParser(const ResponseParser &) = delete;
+    /// The assignment operator is also not used, so cleaned up.
+    ResponseParser &operator=(const ResponseParser &) = delete;
+    /// The move operations are unused, and cleaned up.
+    ResponseParser(ResponseParser &&) = delete;
+    ResponseParser &operator=(ResponseParser &&) = delete;
+
+    /// \brief Get ready for the next response on the connection
+    void Reset(void);
+
+    /// \brief Parse more of the response
+    ///
+    /// \param[in] data What was read
+    /// \param[in] size The number of bytes read
+    /// \return size_t The number of bytes used, which is less than
+    ///         size only if the response is complete, or broken
+    std::size_t Feed(const char *data, std::size_t size);
+
+    /// \brief Note that the connection has been closed
+    ///
+    /// This completes a body that runs until the connection closes,
+    /// and breaks any other unfinished response.
+    void Close(void);
+
+    /// \brief Is the whole response in?
+    /// \return bool true once the body has been read
+    bool
+    done(void) const {
+      return state_ == State::kDone;
+    }
+
+    /// \brief Is the response broken?
+    /// \return bool true if the response can not be parsed
+    bool
+    failed(void) const {
+      return state_ == State::kFailed;
+    }
+
+    /// \brief The status of the response
+    /// \return int The HTTP status, once the status line is in
+    int
+    get_status(void) const {
+      return status_;
+    }
+
+    /// \brief May the connection be used for another request?
+    /// \return bool true if the server keeps the connection open
+    bool
+    get_keep_alive(void) const {
+      return keep_alive_;
+    }
+
+    /// \brief What is wrong with the response
+    /// \return string The error, if failed()
+    const std::string &
+    get_error(void) const {
+      return error_;
+    }
+
+   private:
+    /// Where the parser is in the response
+    enum class State {
+      kStatusLine,  ///< Reading the status line
+      kHeaders,     ///< Reading the headers
+      kBody,        ///< Skipping a body of known length
+      kChunkSize,   ///< Reading the size line of a chunk
+      kChunkData,   ///< Skipping the data of a chunk
+      kChunkEnd,    ///< Reading the line ending a chunk
+      kTrailers,    ///< Reading the trailers after the last chunk
+      kUntilClose,  ///< Skipping a body that ends with the connection
+      kDone,        ///< The response is complete
+      kFailed       ///< The response is broken
+    };
+
+    /// The longest line accepted
+    static constexpr std::size_t kMaxLine = 8192;
+
+    /// \brief Handle a whole line, without its line ending
+    ///
+    /// \param[in] line The line
+    void Line(const std::string &line);
+
+    /// \brief Handle the end of the headers
+    void EndOfHeaders(void);
+
+    /// \brief Give up on the response
+    ///
+    /// \param[in] error What is wrong with it
+    void Fail(const std::string &error);
+
+    State         state_;       ///< Where the parser is
+    std::string   line_;        ///< The line read so far
+    int           status_;      ///< The HTTP status
+    bool          keep_alive_;  ///< The connection may be reused
+    bool          chunked_;     ///< The body comes in chunks
+    long long     length_;      ///< The Content-Length, -1 if none
+    std::uint64_t remaining_;   ///< Bytes left in the body, or chunk
+    std::string   error_;       ///< What is wrong, if failed
+  };
+
+  /// \brief An event driven HTTP client for downstream calls
+  ///
+  /// A blocking call holds a worker thread, and its stack, for as
+  /// long as it is in flight, so the number of calls in flight is
+  /// capped by the number of workers. This client instead drives
+  /// every call from a handful of loop threads, each multiplexing
+  /// its non-blocking sockets with epoll. A call is an HTTP/1.1
+  /// POST, written straight from the buffers of its fidi::Payload;
+  /// the response is read with a fidi::ResponseParser, and its body
+  /// thrown away. Each loop keeps idle keep-alive connections to
+  /// each destination for later calls, and a call that finds a
+  /// reused connection closed under it is made once more, on a new
+  /// connection.
+  ///
+  /// Calls are handed to the loops in turn. Callbacks are not run on
+  /// the loop threads; they are posted to the fidi::Executor, like
+  /// the timers of the fidi::TimerWheel, so a full queue never
+  /// stalls a loop.
+  ///
+  /// The client is created on first use, with the sizes set by
+  /// Configure(), which should be called during server
+  /// initialization. With no loop threads, the client is disabled,
+  /// and calls are made with blocking sessions (see
+  /// fidi::AppCaller::Start).
+  class AsyncClient {
+   public:
+    /// Identifies a call, for cancelling it
+    typedef std::uint64_t CallId;
+
+    /// \brief Run once a call is answered, or fails
+    ///
+    /// The arguments are the HTTP status, or 0 if the call failed,
+    /// and what went wrong, if it did.
+    typedef std::function<void(int, const std::string &)> Callback;
+
+    /// A call to be made
+    struct Request {
+      /// The default constructor, to be filled in
+      Request() :
+          host(), port(0), path(), content_type(), headers(), body(),
+          timeout(0) {}
+
+      std::string   host;  ///< The host called
+      std::uint16_t port;  ///< The port called
+      std::string   path;  ///< The path and query
+      std::string   content_type;  ///< The Content-Type of the body
+      std::vector<std::pair<std::string, std::string>>
+                    headers;  ///< Other headers to send
+      fidi::Payload body;     ///< The body
+      std::chrono::microseconds timeout;  ///< Zero for the default
+    };
+
+    /// The timeout of calls that do not set one
+    static constexpr std::chrono::seconds kDefaultTimeout{60};
+
+    /// The copy constructor is not used, so declutter.
+    AsyncClient(const AsyncClient &) = delete;
+    /// The assignment operator is also not used, so cleaned up.
+    AsyncClient &operator=(const AsyncClient &) = delete;
+    /// The move operations are unused, and cleaned up.
+    AsyncClient(AsyncClient &&) = delete;
+    AsyncClient &operator=(AsyncClient &&) = delete;
+
+    /// Destructor. Stops the loops; pending calls are never answered.
+    ~AsyncClient();
+
+    /// \brief Set the size of the client
+    ///
+    /// This only has effect if called before the first call to
+    /// instance().
+    ///
+    /// \param[in] threads The number of loop threads, 0 to disable
+    ///            the client
+    /// \param[in] max_idle Idle connections each loop keeps to each
+    ///            destination
+    static void Configure(std::size_t threads, std::size_t max_idle);
+
+    /// \brief Get the process wide client, creating it if needed
+    /// \return AsyncClient the shared client
+    static AsyncClient &instance(void);
+
+    /// \brief Are there loops to make calls with?
+    /// \return bool true if the client is enabled
+    bool
+    get_enabled(void) const {
+      return !loops_.empty();
+    }
+
+    /// \brief Make a call
+    ///
+    /// The callback is never run on the calling thread, though it may
+    /// run on another before this returns. The client must be enabled.
+    ///
+    /// \param[in] request The call
+    /// \param[in] done Run once the call is answered, or fails
+    /// \return CallId An identifier that may be passed to Cancel()
+    CallId Send(Request request, Callback done);
+
+    /// \brief Give up on a call
+    ///
+    /// The connection of the call is closed, and the callback is
+    /// run with a status of 0, unless the call has already been
+    /// answered.
+    ///
+    /// \param[in] id The identifier returned by Send()
+    void Cancel(CallId id);
+
+    /// \brief Stop the loop threads
+    void Shutdown(void);
+
+   private:
+    /// A socket address, and its length
+    using Address = std::pair<sockaddr_storage, socklen_t>;
+
+    /// A call in flight, defined with the loops
+    struct Call;
+
+    /// A loop thread, and the connections and calls it drives
+    class Loop;
+
+    /// \brief Constructor, only called by instance()
+    ///
+    /// \param[in] threads The number of loop threads
+    /// \param[in] max_idle Idle connections kept per destination
+    AsyncClient(std::size_t threads, std::size_t max_idle);
+
+    /// \brief Find the addresses of a destination
+    ///
+    /// Addresses are looked up once, on the calling thread, and
+    /// cached, so the loops never wait on the resolver. A host may
+    /// have several, localhost both ::1 and 127.0.0.1 say, so all
+    /// are kept, in the order the resolver prefers them, and tried
+    /// in turn until one connects.
+    ///
+    /// \param[in] host The host called
+    /// \param[in] port The port called
+    /// \param[out] addresses The addresses
+    /// \param[out] error What went wrong, if anything
+    /// \return bool false if no address could be found
+    bool Resolve(const std::string &host, std::uint16_t port,
+                 std::vector<Address> *addresses, std::string *error);
+
+    static std::size_t configured_threads_;  ///< Set by Configure()
+    static std::size_t configured_idle_;     ///< Set by Configure()
+
+    std::vector<std::unique_ptr<Loop>> loops_;    ///< The loop threads
+    std::atomic<CallId>                next_id_;  ///< The next identifier
+    std::mutex resolve_mtx_;  ///< Protects the addresses
+    std::unordered_map<std::string, std::vector<Address>>
+        addresses_;  ///< By host:port
+  };
+
+}  // namespace fidi
+
+#endif /* FIDI_ASYNC_CLIENT_H */
+
+//
+// fidi_async_client.h ends here
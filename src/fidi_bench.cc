@@ -0,0 +1,577 @@
+// fidi_bench.cc ---  -*- mode: c++; -*-
+
+// Copyright 2018-2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied.  See the License for the specific language governing
+// permissions and limitations under the License.
+
+/// \file
+/// \ingroup bench
+///
+/// This is the main file of the fidi (φίδι) load generator. It reads
+/// a request, checks it, and sends it to the first instance over and
+/// over, either open loop, at a set rate of arrivals, or closed loop,
+/// with a set number of requests outstanding, and then reports the
+/// latency percentiles seen.
+///
+/// In the open loop mode, the time each request is due to be sent is
+/// set in advance, and its latency is measured from then, rather
+/// than from when a connection was free to send it. A load generator
+/// that waits for a slow response before sending the next request
+/// sends fewer requests just when the service is slow, and so leaves
+/// out of its percentiles the very requests that would have waited
+/// the longest; this is known as coordinated omission. Both the
+/// corrected latency, and the time spent on the wire alone, are
+/// reported, so the difference between them shows the queueing.
+
+// Code:
+
+#include <getopt.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <Poco/Exception.h>
+#include <Poco/Net/HTTPClientSession.h>
+#include <Poco/Net/HTTPRequest.h>
+#include <Poco/Net/HTTPResponse.h>
+#include <Poco/NullStream.h>
+#include <Poco/StreamCopier.h>
+#include <Poco/Timespan.h>
+#include <Poco/URI.h>
+
+#include "src/fidi_bench_driver.h"
+
+namespace {
+  /// The clock all the timings are taken with
+  typedef std::chrono::steady_clock Clock;
+
+  /// How the arrival times of requests are spread, in the open loop
+  enum class Arrival {
+    kConstant,  ///< Evenly spaced
+    kPoisson    ///< Exponentially distributed gaps, at the same mean
+  };
+
+  /// The settings from the command line
+  struct Options {
+    std::string url;           ///< Where to send the request
+    std::string node;          ///< Or the node to send it to
+    double      rate;          ///< Requests per second, open loop
+    Arrival     arrival;       ///< How arrivals are spread
+    int         concurrency;   ///< Requests outstanding, closed loop
+    int         connections;   ///< Connections, open loop
+    double      duration;      ///< Seconds to run for, at each rate
+    int         timeout;       ///< Seconds to wait for a response
+    double      sweep_from;    ///< First rate of a sweep
+    double      sweep_to;      ///< Last rate of a sweep
+    double      sweep_step;    ///< Increment of the rate in a sweep
+    unsigned    seed;          ///< Seeds the Poisson arrivals
+    std::string request_file;  ///< The request, or - for stdin
+  };
+
+  /// Where and what to send
+  struct Target {
+    std::string    host;     ///< The host of the first node
+    unsigned       port;     ///< Its port
+    std::string    path;     ///< The path to post to
+    std::string    body;     ///< The request, in the text form
+    Poco::Timespan timeout;  ///< How long to wait for a response
+  };
+
+  /// What one thread saw
+  struct Samples {
+    std::vector<std::int64_t> corrected;  ///< Due to done, microseconds
+    std::vector<std::int64_t> service;    ///< Sent to done, microseconds
+    std::uint64_t             errors;     ///< Failed, or not 2xx
+  };
+
+  /// What a whole run saw
+  struct Result {
+    double  offered;  ///< Requests per second asked for, or 0
+    double  elapsed;  ///< Seconds from the start to the last response
+    Samples samples;  ///< Everything the threads saw, merged
+  };
+
+  /// \brief Microseconds between two times
+  ///
+  /// \param[in] from The earlier time
+  /// \param[in] to The later time
+  /// \return int64_t The microseconds between them
+  std::int64_t
+  Usec(Clock::time_point from, Clock::time_point to) {
+    return std::chrono::duration_cast<std::chrono::microseconds>(to - from)
+        .count();
+  }
+
+  /// \brief Post the request once
+  ///
+  /// \param[in] target What to send
+  /// \param[in,out] session The connection to send it on
+  /// \return bool true if the response was a 2xx
+  bool
+  Send(const Target &target, Poco::Net::HTTPClientSession *session) {
+    try {
+      Poco::Net::HTTPRequest req(Poco::Net::HTTPRequest::HTTP_POST,
+                                 target.path,
+                                 Poco::Net::HTTPMessage::HTTP_1_1);
+      req.setContentType("text/plain");
+      req.setKeepAlive(true);
+      req.setContentLength(static_cast<std::streamsize>(target.body.size()));
+      session->sendRequest(req) << target.body;
+
+      Poco::Net::HTTPResponse res;
+      std::istream &          rs = session->receiveResponse(res);
+      Poco::NullOutputStream  discard;
+      Poco::StreamCopier::copyStream(rs, discard);
+      int status = static_cast<int>(res.getStatus());
+      return status >= 200 && status < 300;
+    } catch (Poco::Exception &) {
+      // Start afresh on a new connection next time
+      session->reset();
+      return false;
+    }
+  }
+
+  /// \brief Set when each request is due, from the start of the run
+  ///
+  /// \param[in] options The rate, duration and arrival distribution
+  /// \param[in] rate Requests per second
+  /// \return vector The time each request is due
+  std::vector<Clock::duration>
+  Schedule(const Options &options, double rate) {
+    std::vector<Clock::duration>          schedule;
+    std::mt19937_64                       engine(options.seed);
+    std::exponential_distribution<double> gap(rate);
+    double                                at = 0;
+    while (at < options.duration) {
+      schedule.push_back(std::chrono::duration_cast<Clock::duration>(
+          std::chrono::duration<double>(at)));
+      at += options.arrival == Arrival::kPoisson ? gap(engine) : 1.0 / rate;
+    }
+    return schedule;
+  }
+
+  /// \brief Merge what the threads saw
+  ///
+  /// \param[in,out] per_thread What each thread saw, emptied
+  /// \return Samples All of it
+  Samples
+  Merge(std::vector<Samples> *per_thread) {
+    Samples all{{}, {}, 0};
+    for (auto &samples : *per_thread) {
+      all.corrected.insert(all.corrected.end(), samples.corrected.begin(),
+                           samples.corrected.end());
+      all.service.insert(all.service.end(), samples.service.begin(),
+                         samples.service.end());
+      all.errors += samples.errors;
+    }
+    per_thread->clear();
+    return all;
+  }
+
+  /// \brief Send requests at a set rate, whatever the responses do
+  ///
+  /// Each connection takes the next request due, waits until it is
+  /// due, if it is not late already, and sends it. When every
+  /// connection is busy the requests due meanwhile start late, and
+  /// the lateness is counted in their latency.
+  ///
+  /// \param[in] options The settings
+  /// \param[in] target What to send
+  /// \param[in] rate Requests per second
+  /// \return Result What was seen
+  Result
+  RunOpenLoop(const Options &options, const Target &target, double rate) {
+    const std::vector<Clock::duration> schedule(Schedule(options, rate));
+    std::atomic<std::size_t>           next(0);
+    std::vector<Samples>               per_thread(
+        static_cast<std::size_t>(options.connections), Samples{{}, {}, 0});
+    std::vector<std::thread> workers;
+    Clock::time_point        start = Clock::now();
+    for (auto &samples : per_thread) {
+      workers.emplace_back([&, samples_p = &samples] {
+        Poco::Net::HTTPClientSession session(
+            target.host, static_cast<Poco::UInt16>(target.port));
+        session.setTimeout(target.timeout);
+        for (;;) {
+          std::size_t i = next.fetch_add(1, std::memory_order_relaxed);
+          if (i >= schedule.size()) { break; }
+          Clock::time_point due = start + schedule[i];
+          std::this_thread::sleep_until(due);
+          Clock::time_point sent = Clock::now();
+          if (!Send(target, &session)) { samples_p->errors++; }
+          Clock::time_point done = Clock::now();
+          samples_p->corrected.push_back(Usec(due, done));
+          samples_p->service.push_back(Usec(sent, done));
+        }
+      });
+    }
+    for (auto &worker : workers) { worker.join(); }
+    std::chrono::duration<double> elapsed = Clock::now() - start;
+    return Result{rate, elapsed.count(), Merge(&per_thread)};
+  }
+
+  /// \brief Keep a set number of requests outstanding
+  ///
+  /// Each connection sends the next request as soon as it has the
+  /// response to the last one. The rate is whatever the service can
+  /// sustain, so there is no schedule to be late against, and the
+  /// latency is only the time on the wire.
+  ///
+  /// \param[in] options The settings
+  /// \param[in] target What to send
+  /// \return Result What was seen
+  Result
+  RunClosedLoop(const Options &options, const Target &target) {
+    std::vector<Samples> per_thread(
+        static_cast<std::size_t>(options.concurrency), Samples{{}, {}, 0});
+    std::vector<std::thread> workers;
+    Clock::time_point        start = Clock::now();
+    Clock::time_point        stop =
+        start + std::chrono::duration_cast<Clock::duration>(
+                    std::chrono::duration<double>(options.duration));
+    for (auto &samples : per_thread) {
+      workers.emplace_back([&, samples_p = &samples] {
+        Poco::Net::HTTPClientSession session(
+            target.host, static_cast<Poco::UInt16>(target.port));
+        session.setTimeout(target.timeout);
+        for (Clock::time_point sent = Clock::now(); sent < stop;) {
+          if (!Send(target, &session)) { samples_p->errors++; }
+          Clock::time_point done = Clock::now();
+          samples_p->corrected.push_back(Usec(sent, done));
+          samples_p->service.push_back(Usec(sent, done));
+          sent = done;
+        }
+      });
+    }
+    for (auto &worker : workers) { worker.join(); }
+    std::chrono::duration<double> elapsed = Clock::now() - start;
+    return Result{0, elapsed.count(), Merge(&per_thread)};
+  }
+
+  /// \brief A percentile of sorted samples
+  ///
+  /// \param[in] sorted The samples, in increasing order
+  /// \param[in] percentile The percentile, from 0 to 100
+  /// \return double The sample at that percentile, in milliseconds
+  double
+  Percentile(const std::vector<std::int64_t> &sorted, double percentile) {
+    if (sorted.empty()) { return 0; }
+    // The nearest rank: the smallest sample with at least this
+    // percentage of the samples at or below it
+    auto rank = static_cast<std::size_t>(
+        std::ceil(percentile / 100.0 * static_cast<double>(sorted.size())));
+    rank = std::min(std::max(rank, std::size_t(1)), sorted.size());
+    return static_cast<double>(sorted[rank - 1]) / 1000.0;
+  }
+
+  /// The percentiles reported
+  const double kPercentiles[] = {50, 90, 99, 99.9, 100};
+
+  /// \brief Print one row of latency percentiles
+  ///
+  /// \param[in] label What the latencies are
+  /// \param[in,out] usec The latencies, which are sorted
+  void
+  PrintLatency(const std::string &label, std::vector<std::int64_t> *usec) {
+    std::sort(usec->begin(), usec->end());
+    std::cout << std::left << std::setw(14) << label << std::right;
+    for (double percentile : kPercentiles) {
+      std::cout << std::setw(11) << std::fixed << std::setprecision(3)
+                << Percentile(*usec, percentile);
+    }
+    std::cout << "\n";
+  }
+
+  /// \brief Print what a run saw
+  ///
+  /// \param[in,out] result What was seen; the samples are sorted
+  void
+  Report(Result *result) {
+    std::size_t sent = result->samples.service.size();
+    std::cout << "Sent " << sent << " requests in " << std::fixed
+              << std::setprecision(2) << result->elapsed << " s: ";
+    if (result->offered > 0) {
+      std::cout << std::setprecision(1) << result->offered
+                << " requests/s offered, ";
+    }
+    std::cout << std::setprecision(1)
+              << static_cast<double>(sent) / result->elapsed
+              << " requests/s achieved, " << result->samples.errors
+              << " errors\n\n"
+              << std::left << std::setw(14) << "latency (ms)" << std::right
+              << std::setw(11) << "p50" << std::setw(11) << "p90"
+              << std::setw(11) << "p99" << std::setw(11) << "p99.9"
+              << std::setw(11) << "max"
+              << "\n";
+    if (result->offered > 0) {
+      PrintLatency("corrected", &result->samples.corrected);
+      PrintLatency("uncorrected", &result->samples.service);
+    } else {
+      PrintLatency("service", &result->samples.service);
+    }
+  }
+
+  /// \brief Run at each rate in turn, and print a row for each
+  ///
+  /// Once the offered load passes what the service can sustain, the
+  /// achieved rate levels off, and the corrected latencies climb
+  /// with the length of the run.
+  ///
+  /// \param[in] options The settings
+  /// \param[in] target What to send
+  void
+  Sweep(const Options &options, const Target &target) {
+    std::cout << std::setw(12) << "offered/s" << std::setw(12) << "achieved/s"
+              << std::setw(9) << "errors" << std::setw(11) << "p50 ms"
+              << std::setw(11) << "p99 ms" << std::setw(11) << "p99.9 ms"
+              << std::setw(11) << "max ms"
+              << "\n";
+    for (double rate = options.sweep_from;
+         rate <= options.sweep_to + options.sweep_step / 2;
+         rate += options.sweep_step) {
+      Result result = RunOpenLoop(options, target, rate);
+      auto & usec   = result.samples.corrected;
+      std::sort(usec.begin(), usec.end());
+      std::cout << std::setw(12) << std::fixed << std::setprecision(1) << rate
+                << std::setw(12)
+                << static_cast<double>(usec.size()) / result.elapsed
+                << std::setw(9) << result.samples.errors
+                << std::setprecision(3) << std::setw(11)
+                << Percentile(usec, 50) << std::setw(11)
+                << Percentile(usec, 99) << std::setw(11)
+                << Percentile(usec, 99.9) << std::setw(11)
+                << Percentile(usec, 100) << std::endl;
+    }
+  }
+
+  /// \brief Print the usage
+  ///
+  /// \param[in,out] stream Where to print it
+  void
+  Usage(std::ostream &stream) {
+    stream << PACKAGE_NAME << " bench usage\n\n"
+           << "    fidi_bench [options] input.txt\n"
+           << "    cat input.txt | fidi_bench [options]\n\n"
+           << "Where to send the request, one of:\n"
+           << "    -u, --url=<url>          the URL of the first instance\n"
+           << "    -n, --node=<name>        a node in the node table\n\n"
+           << "How to send it:\n"
+           << "    -r, --rate=<n>           n requests/s, open loop\n"
+           << "    -a, --arrival=<kind>     constant or poisson\n"
+           << "    -C, --connections=<n>    connections, open loop (64)\n"
+           << "    -c, --concurrency=<n>    n outstanding, closed loop\n"
+           << "    -s, --sweep=<from:to:step>  open loop at each rate\n"
+           << "    -d, --duration=<s>       seconds at each rate (10)\n"
+           << "    -t, --timeout=<s>        seconds to wait (10)\n"
+           << "    -S, --seed=<n>           seed for poisson arrivals\n\n"
+           << "Use -v or --version to get the version\n"
+           << "use -h or --help to get this menu\n";
+  }
+
+  /// \brief Parse a sweep, from:to:step
+  ///
+  /// \param[in] value The argument
+  /// \param[out] options Where to put the rates
+  /// \return bool false if the sweep does not make sense
+  bool
+  ParseSweep(const std::string &value, Options *options) {
+    std::istringstream iss(value);
+    char               colon1 = 0;
+    char               colon2 = 0;
+    iss >> options->sweep_from >> colon1 >> options->sweep_to >> colon2 >>
+        options->sweep_step;
+    return !iss.fail() && iss.eof() && colon1 == ':' && colon2 == ':' &&
+           options->sweep_from > 0 && options->sweep_step > 0 &&
+           options->sweep_to >= options->sweep_from;
+  }
+
+  /// \brief Parse the command line
+  ///
+  /// \param[in] argc number of arguments
+  /// \param[in] argv the arguments
+  /// \param[out] options The settings
+  /// \return int -1 to carry on, or the exit status
+  int
+  ParseOptions(int argc, char **argv, Options *options) {
+    static const struct option long_options[] = {
+        {"url", required_argument, nullptr, 'u'},
+        {"node", required_argument, nullptr, 'n'},
+        {"rate", required_argument, nullptr, 'r'},
+        {"arrival", required_argument, nullptr, 'a'},
+        {"connections", required_argument, nullptr, 'C'},
+        {"concurrency", required_argument, nullptr, 'c'},
+        {"sweep", required_argument, nullptr, 's'},
+        {"duration", required_argument, nullptr, 'd'},
+        {"timeout", required_argument, nullptr, 't'},
+        {"seed", required_argument, nullptr, 'S'},
+        {"help", no_argument, nullptr, 'h'},
+        {"version", no_argument, nullptr, 'v'},
+        {nullptr, 0, nullptr, 0}};
+    int opt;
+    while ((opt = getopt_long(argc, argv, "u:n:r:a:C:c:s:d:t:S:hv",
+                              long_options, nullptr)) != -1) {
+      std::string value(optarg != nullptr ? optarg : "");
+      switch (opt) {
+        case 'u': options->url = value; break;
+        case 'n': options->node = value; break;
+        case 'r': options->rate = std::atof(optarg); break;
+        case 'a':
+          if (value == "constant") {
+            options->arrival = Arrival::kConstant;
+          } else if (value == "poisson") {
+            options->arrival = Arrival::kPoisson;
+          } else {
+            std::cerr << "Unknown arrival: " << value << "\n";
+            return EXIT_FAILURE;
+          }
+          break;
+        case 'C': options->connections = std::atoi(optarg); break;
+        case 'c': options->concurrency = std::atoi(optarg); break;
+        case 's':
+          if (!ParseSweep(value, options)) {
+            std::cerr << "A sweep is from:to:step, in requests/s\n";
+            return EXIT_FAILURE;
+          }
+          break;
+        case 'd': options->duration = std::atof(optarg); break;
+        case 't': options->timeout = std::atoi(optarg); break;
+        case 'S':
+          options->seed =
+              static_cast<unsigned>(std::strtoul(optarg, nullptr, 10));
+          break;
+        case 'h': Usage(std::cout); return EXIT_SUCCESS;
+        case 'v':
+          std::cout << PACKAGE_NAME << " version " << PACKAGE_VERSION << "\n";
+          return EXIT_SUCCESS;
+        default: Usage(std::cerr); return EXIT_FAILURE;
+      }
+    }
+    if (optind < argc) { options->request_file = argv[optind++]; }
+    if (optind < argc) {
+      std::cerr << "Unknown arguments. We expect 0 or 1 files.\n";
+      return EXIT_FAILURE;
+    }
+
+    int modes = (options->rate > 0) + (options->concurrency > 0) +
+                (options->sweep_step > 0);
+    if (modes != 1) {
+      std::cerr << "Give exactly one of --rate, --concurrency or --sweep\n";
+      return EXIT_FAILURE;
+    }
+    if (options->url.empty() == options->node.empty()) {
+      std::cerr << "Give exactly one of --url or --node\n";
+      return EXIT_FAILURE;
+    }
+    if (options->connections < 1 || options->duration <= 0 ||
+        options->timeout < 1) {
+      std::cerr << "The connections, duration and timeout must be positive\n";
+      return EXIT_FAILURE;
+    }
+    return -1;
+  }
+}  // namespace
+
+/// \brief  Main function
+///
+/// \details Parse the command line, read and check the request, and
+/// work out where to send it. Then send it, at a rate, at a
+/// concurrency, or at each rate of a sweep, and report the latencies.
+///
+/// \param[in]  argc number of arguments
+/// \param[in]  argv An array of character pointers containing the arguments
+///
+/// \return an integer 0 upon exit success
+int
+main(int argc, char **argv) {
+  Options options{"",  "",  0, Arrival::kConstant, 0, 64, 10, 10,
+                  0,   0,   0, 1,                  "-"};
+  int     status = ParseOptions(argc, argv, &options);
+  if (status >= 0) { return status; }
+
+  // Read the request once; it is both checked, and sent as is
+  Target target{"", 0, "", "", Poco::Timespan(options.timeout, 0)};
+  if (options.request_file == "-") {
+    target.body.assign(std::istreambuf_iterator<char>(std::cin),
+                       std::istreambuf_iterator<char>());
+  } else {
+    std::ifstream file(options.request_file);
+    if (!file) {
+      std::cerr << "Unknown file: " << options.request_file << "\n";
+      return EXIT_FAILURE;
+    }
+    target.body.assign(std::istreambuf_iterator<char>(file),
+                       std::istreambuf_iterator<char>());
+  }
+
+  fidi::BenchDriver driver;
+  try {
+    std::istringstream iss(target.body);
+    driver.Parse(iss);
+  } catch (std::bad_alloc &ba) {
+    std::cerr << "Failed to allocate scanner: (" << ba.what() << ")\n";
+    return EXIT_FAILURE;
+  }
+  std::string errors;
+  if (driver.Validate(&errors) != 0) {
+    std::cerr << "The request has errors:\n" << errors;
+    return EXIT_FAILURE;
+  }
+
+  std::string url(options.url);
+  if (!options.node.empty() && !driver.GetUrl(options.node, &url)) {
+    std::cerr << "No node " << options.node << " in the request. Nodes:";
+    for (auto const &name : driver.get_node_names()) {
+      std::cerr << " " << name;
+    }
+    std::cerr << "\n";
+    return EXIT_FAILURE;
+  }
+  try {
+    Poco::URI uri(url);
+    target.host = uri.getHost();
+    target.port = uri.getPort();
+    target.path = uri.getPathAndQuery();
+    if (target.path.empty()) { target.path = "/"; }
+  } catch (Poco::Exception &ex) {
+    std::cerr << "Bad URL " << url << ": " << ex.displayText() << "\n";
+    return EXIT_FAILURE;
+  }
+  std::cout << "Sending " << url << " ";
+  driver.Execute(std::cout) << "\n";
+
+  if (options.sweep_step > 0) {
+    Sweep(options, target);
+    return EXIT_SUCCESS;
+  }
+  Result result = options.rate > 0
+                      ? RunOpenLoop(options, target, options.rate)
+                      : RunClosedLoop(options, target);
+  Report(&result);
+  return EXIT_SUCCESS;
+}
+
+//
+// fidi_bench.cc ends here
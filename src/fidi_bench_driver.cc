@@ -0,0 +1,92 @@
+// fidi_bench_driver.cc ---  -*- mode: c++; -*-
+
+// Copyright 2018-2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied.  See the License for the specific language governing
+// permissions and limitations under the License.
+
+/// \file
+/// \ingroup bench
+///
+/// This file provides the implementation of the parser driver for
+/// the fidi (φίδι) load generator.
+
+// Code:
+
+#include "src/fidi_bench_driver.h"
+
+#include <iostream>
+#include <string>
+
+fidi::BenchDriver::~BenchDriver() {
+  delete scanner_;
+  scanner_ = nullptr;
+  delete parser_;
+  parser_ = nullptr;
+}
+
+void
+fidi::BenchDriver::ParseHelper(std::istream &stream) {
+  delete parser_;
+  fidi::Driver::ParseHelper(stream);
+  parser_ = new fidi::Parser((*scanner_) /* scanner */, (*this) /* driver */);
+  const int accept(0);
+  parser_->set_debug_level(0);
+  if (parser_->parse() != accept && nerrors_ == 0) { nerrors_++; }
+}
+
+std::ostream &
+fidi::BenchDriver::Execute(std::ostream &stream) {
+  stream << nodes_.size() << " nodes, " << edge_attributes_.size()
+         << " calls from the first node";
+  return stream;
+}
+
+int
+fidi::BenchDriver::Validate(std::string *error_message) {
+  int errors = nerrors_;
+  error_message->append(parse_errors_);
+  if (errors == 0) { errors += SanityChecks(error_message); }
+  return errors;
+}
+
+bool
+fidi::BenchDriver::GetUrl(const std::string &node_name,
+                          std::string *      url) const {
+  auto nodes_it = nodes_.find(node_name);
+  if (nodes_it == nodes_.end()) { return false; }
+
+  // The same rules fidi_app uses to call a node
+  auto node_attr_it = nodes_it->second.find("url");
+  if (node_attr_it != nodes_it->second.end()) {
+    *url = node_attr_it->second;
+    return true;
+  }
+  url->assign("http://")
+      .append(nodes_it->second.find("hostname")->second)
+      .append(":")
+      .append(nodes_it->second.find("port")->second);
+  node_attr_it = nodes_it->second.find("path");
+  url->append(node_attr_it != nodes_it->second.end() ? node_attr_it->second
+                                                     : "/fidi");
+  return true;
+}
+
+std::vector<std::string>
+fidi::BenchDriver::get_node_names(void) const {
+  std::vector<std::string> names;
+  for (auto const &node : nodes_) { names.push_back(node.first); }
+  return names;
+}
+
+//
+// fidi_bench_driver.cc ends here
@@ -0,0 +1,94 @@
+// fidi_bench_driver.h ---  -*- mode: c++; -*-
+
+// Copyright 2018-2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied.  See the License for the specific language governing
+// permissions and limitations under the License.
+
+/// \file
+/// \ingroup bench
+///
+/// This file contains the parser driver class for the fidi (φίδι)
+/// load generator, derived from the base driver class. It checks the
+/// request to be sent, and finds the node to send it to.
+
+// Code:
+
+#ifndef FIDI_BENCH_DRIVER_H
+#  define FIDI_BENCH_DRIVER_H
+
+#  include <string>
+#  include <vector>
+
+#  include "src/fidi_driver.h"
+
+namespace fidi {
+
+  /// \brief fidi (φίδι) load generator parser driver class
+  ///
+  /// The load generator sends the same request over and over, so it
+  /// parses it just once, up front, to make sure the instance it is
+  /// sent to will not reject it, and to look up the node it is to be
+  /// sent to in the node table of the request.
+  class BenchDriver : public Driver {
+   public:
+    /// The default constructor
+    BenchDriver() : Driver(), parser_(nullptr) {}
+
+    /// The copy constructor is unused, and deleted
+    BenchDriver(const BenchDriver &) = delete;
+    /// The assignment operator is also not used.
+    BenchDriver &operator=(const BenchDriver &) = delete;
+    /// The move operations are unused, and cleaned up.
+    BenchDriver(BenchDriver &&) = delete;
+    BenchDriver &operator=(BenchDriver &&) = delete;
+
+    /// Destructor. Cleans up the scanner and the parser.
+    virtual ~BenchDriver();
+
+    /// \brief run the parser on the input stream
+    ///
+    /// \param[in, out] stream the input stream with the request.
+    void ParseHelper(std::istream &stream);
+
+    /// \brief Describe the request parsed
+    ///
+    /// \param[in,out] stream The stream to write the description to
+    std::ostream &Execute(std::ostream &stream);
+
+    /// \brief Check the request parsed
+    ///
+    /// \param[out] error_message The parse and sanity check errors
+    /// \return int The number of errors found
+    int Validate(std::string *error_message);
+
+    /// \brief Look up the URL of a node in the node table
+    ///
+    /// \param[in] node_name The name of the node
+    /// \param[out] url The URL requests to the node are sent to
+    /// \return bool false if the node table has no such node
+    bool GetUrl(const std::string &node_name, std::string *url) const;
+
+    /// \brief The names of the nodes in the node table
+    /// \return vector The node names, in order
+    std::vector<std::string> get_node_names(void) const;
+
+   private:
+    fidi::Parser *parser_ = nullptr;  ///< The parser for this request
+  };
+
+}  // namespace fidi
+
+#endif /* FIDI_BENCH_DRIVER_H */
+
+//
+// fidi_bench_driver.h ends here
@@ -0,0 +1,118 @@
+// fidi_bulkhead.cc ---  -*- mode: c++; -*-
+
+// Copyright 2018-2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied.  See the License for the specific language governing
+// permissions and limitations under the License.
+
+/// \file
+/// \ingroup app
+///
+/// This file provides the implementation of the per destination
+/// limits on the downstream calls of the fidi (φίδι) HTTP server.
+
+// Code:
+
+#include "src/fidi_bulkhead.h"
+
+#include <utility>
+#include <vector>
+
+#include "src/fidi_metrics.h"
+
+std::size_t fidi::Bulkhead::configured_limit_ = 0;
+
+fidi::Bulkhead::Bulkhead(std::size_t default_limit) :
+    default_limit_(default_limit), mtx_(), queues_() {}
+
+void
+fidi::Bulkhead::Configure(std::size_t default_limit) {
+  configured_limit_ = default_limit;
+}
+
+fidi::Bulkhead &
+fidi::Bulkhead::instance(void) {
+  static fidi::Bulkhead bulkhead(configured_limit_);
+  return bulkhead;
+}
+
+void
+fidi::Bulkhead::Submit(const std::string &destination, std::size_t limit,
+                       Job job) {
+  if (limit == 0) {
+    job([] {});
+    return;
+  }
+  std::vector<Job> ready;
+  bool             admitted = false;
+  {
+    std::lock_guard<std::mutex> lock(mtx_);
+    Queue &queue = queues_[destination];
+    queue.limit  = limit;
+    if (queue.in_flight < limit && queue.waiting.empty()) {
+      queue.in_flight++;
+      admitted = true;
+      ready.push_back(std::move(job));
+    } else {
+      // Calls already waiting go first, even if there is room now
+      queue.waiting.push_back(
+          Waiter{std::move(job), std::chrono::steady_clock::now()});
+      fidi::Metrics::instance().RecordQueued(destination, 1);
+      // A raised limit makes room for calls already waiting
+      while (queue.in_flight < limit && !queue.waiting.empty()) {
+        queue.in_flight++;
+        ready.push_back(TakeNext(destination, &queue));
+      }
+    }
+  }
+  // Calls let straight through count too, or the wait percentiles
+  // would only describe the calls that queued
+  if (admitted) {
+    fidi::Metrics::instance().RecordQueueWait(
+        destination, std::chrono::steady_clock::duration::zero());
+  }
+  for (auto &next : ready) { Start(destination, std::move(next)); }
+}
+
+void
+fidi::Bulkhead::Start(const std::string &destination, Job job) {
+  job([this, destination] {
+    Job next = Release(destination);
+    if (next) { Start(destination, std::move(next)); }
+  });
+}
+
+fidi::Bulkhead::Job
+fidi::Bulkhead::Release(const std::string &destination) {
+  std::lock_guard<std::mutex> lock(mtx_);
+  Queue &queue = queues_[destination];
+  // If the limit has been lowered, the slot is given up instead
+  if (queue.waiting.empty() || queue.in_flight > queue.limit) {
+    queue.in_flight--;
+    return Job();
+  }
+  return TakeNext(destination, &queue);
+}
+
+fidi::Bulkhead::Job
+fidi::Bulkhead::TakeNext(const std::string &destination, Queue *queue) {
+  Waiter next = std::move(queue->waiting.front());
+  queue->waiting.pop_front();
+  auto &metrics = fidi::Metrics::instance();
+  metrics.RecordQueued(destination, -1);
+  metrics.RecordQueueWait(destination,
+                          std::chrono::steady_clock::now() - next.queued);
+  return std::move(next.job);
+}
+
+//
+// fidi_bulkhead.cc ends here
@@ -0,0 +1,158 @@
+// fidi_bulkhead.h ---  -*- mode: c++; -*-
+
+// Copyright 2018-2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied.  See the License for the specific language governing
+// permissions and limitations under the License.
+
+/// \file
+/// \ingroup app
+///
+/// This file contains the per destination limits on the downstream
+/// calls in flight of the fidi (φίδι) HTTP server.
+
+// Code:
+
+#ifndef FIDI_BULKHEAD_H
+#  define FIDI_BULKHEAD_H
+
+#  include <chrono>
+#  include <cstddef>
+#  include <deque>
+#  include <functional>
+#  include <mutex>
+#  include <string>
+#  include <unordered_map>
+
+namespace fidi {
+
+  /// \brief Limit the downstream calls in flight to each destination
+  ///
+  /// Real clients call through connection pools of a fixed size, so
+  /// a burst of calls to one destination queues in the client rather
+  /// than opening hundreds of connections at once. This class
+  /// reproduces that: calls to a destination beyond its limit wait,
+  /// first in first out, and each call that finishes starts the next
+  /// one waiting. The limit is process wide, shared by every request
+  /// calling the destination.
+  ///
+  /// The limit of a destination is the max_in_flight attribute of its
+  /// node, or else the default set by Configure(), which should be
+  /// called during server initialization. A limit of zero lets every
+  /// call straight through. The depth of each queue, and the time
+  /// calls spend in it, are recorded by fidi::Metrics.
+  class Bulkhead {
+   public:
+    /// \brief A call, started once there is room for it
+    ///
+    /// The call may finish later, on any thread, so it is handed a
+    /// function to run once it has, which frees its slot.
+    typedef std::function<void(std::function<void()>)> Job;
+
+    /// The copy constructor is not used, so declutter.
+    Bulkhead(const Bulkhead &) = delete;
+    /// The assignment operator is also not used, so cleaned up.
+    Bulkhead &operator=(const Bulkhead &) = delete;
+    /// The move operations are unused, and cleaned up.
+    Bulkhead(Bulkhead &&) = delete;
+    Bulkhead &operator=(Bulkhead &&) = delete;
+
+    /// Destructor. The members clean themselves
+    ~Bulkhead() {}
+
+    /// \brief Set the default limit
+    ///
+    /// This only has effect if called before the first call to
+    /// instance().
+    ///
+    /// \param[in] default_limit Calls in flight to a destination whose
+    ///            node sets no limit, 0 for no limit
+    static void Configure(std::size_t default_limit);
+
+    /// \brief Get the process wide bulkhead, creating it if needed
+    /// \return Bulkhead the shared bulkhead
+    static Bulkhead &instance(void);
+
+    /// \brief The limit for destinations whose node sets none
+    /// \return size_t The limit, 0 for none
+    std::size_t
+    get_default_limit(void) const {
+      return default_limit_;
+    }
+
+    /// \brief Start a call to a destination, once it is under its limit
+    ///
+    /// The job is started now, on the calling thread, if the
+    /// destination has room, or else once the calls ahead of it have
+    /// finished, on the thread that finished the last of them. It
+    /// should only start the call, not wait for it.
+    ///
+    /// \param[in] destination The host:port called
+    /// \param[in] limit The most calls in flight to the destination,
+    ///            0 for no limit; the latest limit given holds
+    /// \param[in] job The call
+    void Submit(const std::string &destination, std::size_t limit, Job job);
+
+   private:
+    /// A call waiting for room, and when it started waiting
+    struct Waiter {
+      Job                                   job;     ///< The call
+      std::chrono::steady_clock::time_point queued;  ///< When it was queued
+    };
+
+    /// The calls to one destination
+    struct Queue {
+      std::size_t        in_flight = 0;   ///< Calls running
+      std::size_t        limit     = 0;   ///< The most calls running
+      std::deque<Waiter> waiting   = {};  ///< Calls waiting for room
+    };
+
+    /// \brief Constructor, only called by instance()
+    ///
+    /// \param[in] default_limit The limit for nodes that set none
+    explicit Bulkhead(std::size_t default_limit);
+
+    /// \brief Start a call that holds a slot
+    ///
+    /// \param[in] destination The host:port called
+    /// \param[in] job The call
+    void Start(const std::string &destination, Job job);
+
+    /// \brief Hand the slot of a finished call on
+    ///
+    /// \param[in] destination The host:port called
+    /// \return Job The next call, which takes over the slot, or an
+    ///         empty function if the slot is given up
+    Job Release(const std::string &destination);
+
+    /// \brief Take the first call waiting for a destination
+    ///
+    /// Must be called with the mutex held, and a call waiting.
+    ///
+    /// \param[in] destination The host:port called
+    /// \param[in,out] queue The calls to the destination
+    /// \return Job The call
+    Job TakeNext(const std::string &destination, Queue *queue);
+
+    static std::size_t configured_limit_;  ///< Set by Configure()
+
+    const std::size_t default_limit_;  ///< For nodes that set none
+    std::mutex        mtx_;            ///< Protects the queues
+    std::unordered_map<std::string, Queue> queues_;  ///< By destination
+  };
+
+}  // namespace fidi
+
+#endif /* FIDI_BULKHEAD_H */
+
+//
+// fidi_bulkhead.h ends here
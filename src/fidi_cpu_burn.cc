@@ -0,0 +1,167 @@
+// fidi_cpu_burn.cc ---  -*- mode: c++; -*-
+
+// Copyright 2018-2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied.  See the License for the specific language governing
+// permissions and limitations under the License.
+
+/// \file
+/// \ingroup app
+///
+/// This file provides the implementation of the compute kernels of
+/// the fidi (φίδι) HTTP server, and their calibration.
+
+// Code:
+
+#include "src/fidi_cpu_burn.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstddef>
+
+namespace {
+  /// Lanes of the hash kernel; a multiple of any vector width
+  constexpr std::size_t kLanes = 16;
+  /// Rounds of mixing each iteration of the hash kernel
+  constexpr int kRounds = 4;
+  /// Rows and columns of the matrices of the matrix kernel
+  constexpr std::size_t kDim = 8;
+
+  /// Somewhere to put the digests, so the work is not optimized away
+  std::atomic<std::uint32_t> sink{0};
+
+  /// \brief Mix 32 bit lanes, each on its own
+  ///
+  /// \param[in] iterations The number of iterations
+  /// \return uint32_t A digest of the lanes
+  std::uint32_t
+  HashKernel(std::uint64_t iterations) {
+    std::uint32_t lanes[kLanes];
+    for (std::size_t i = 0; i < kLanes; ++i) {
+      lanes[i] = static_cast<std::uint32_t>(i) * 0x9e3779b9U + 1;
+    }
+    for (std::uint64_t n = 0; n < iterations; ++n) {
+      for (int round = 0; round < kRounds; ++round) {
+        for (std::size_t i = 0; i < kLanes; ++i) {
+          std::uint32_t x = lanes[i];
+          x ^= x >> 15;
+          x *= 0x2c1b3c6dU;
+          x ^= x >> 12;
+          x *= 0x297a2d39U;
+          lanes[i] = x ^ (x >> 15);
+        }
+      }
+    }
+    std::uint32_t digest = 0;
+    for (std::size_t i = 0; i < kLanes; ++i) { digest ^= lanes[i]; }
+    return digest;
+  }
+
+  /// \brief Multiply small matrices, feeding each product back in
+  ///
+  /// \param[in] iterations The number of iterations
+  /// \return uint32_t A digest of the result
+  std::uint32_t
+  MatrixKernel(std::uint64_t iterations) {
+    float a[kDim][kDim];
+    float b[kDim][kDim];
+    float c[kDim][kDim];
+    for (std::size_t i = 0; i < kDim; ++i) {
+      for (std::size_t j = 0; j < kDim; ++j) {
+        a[i][j] = 1.0f / static_cast<float>(i + j + 1);
+        b[i][j] = (i == j) ? 0.5f : 0.01f;
+      }
+    }
+    for (std::uint64_t n = 0; n < iterations; ++n) {
+      for (std::size_t i = 0; i < kDim; ++i) {
+        for (std::size_t j = 0; j < kDim; ++j) { c[i][j] = 0.0f; }
+        // The innermost loop runs along rows, so it vectorizes
+        for (std::size_t k = 0; k < kDim; ++k) {
+          float scale = a[i][k];
+          for (std::size_t j = 0; j < kDim; ++j) {
+            c[i][j] += scale * b[k][j];
+          }
+        }
+      }
+      // Keep the values bounded, and the next product dependent
+      for (std::size_t i = 0; i < kDim; ++i) {
+        for (std::size_t j = 0; j < kDim; ++j) {
+          a[i][j] = c[i][j] * 0.5f + 0.25f;
+        }
+      }
+    }
+    float digest = 0.0f;
+    for (std::size_t i = 0; i < kDim; ++i) { digest += a[i][i]; }
+    return static_cast<std::uint32_t>(digest * 1000.0f);
+  }
+}  // namespace
+
+fidi::CpuBurn::CpuBurn() : rates_() {
+  // Time batches of iterations, doubling them until a batch takes a
+  // few milliseconds, then take the fastest of a few of those, as
+  // the rate on an idle core
+  for (std::size_t k = 0; k < rates_.size(); ++k) {
+    Kind          kind       = static_cast<Kind>(k);
+    std::uint64_t iterations = 16;
+    double        best       = 0.0;
+    for (int tries = 0; tries < 40; ++tries) {
+      auto start = std::chrono::steady_clock::now();
+      sink.fetch_xor(Run(kind, iterations), std::memory_order_relaxed);
+      auto usec = std::chrono::duration<double, std::micro>(
+                      std::chrono::steady_clock::now() - start)
+                      .count();
+      if (usec < 2000.0) {
+        iterations *= 2;
+        continue;
+      }
+      best = std::max(best, static_cast<double>(iterations) / usec);
+      if (tries >= 30) { break; }
+    }
+    rates_[k] = best > 0.0 ? best : 1.0;
+  }
+}
+
+const fidi::CpuBurn &
+fidi::CpuBurn::instance(void) {
+  static const fidi::CpuBurn burn;
+  return burn;
+}
+
+bool
+fidi::CpuBurn::ParseKind(const std::string &name, Kind *kind) {
+  if (name == "hash") {
+    *kind = Kind::kHash;
+  } else if (name == "matrix") {
+    *kind = Kind::kMatrix;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+std::uint32_t
+fidi::CpuBurn::Run(Kind kind, std::uint64_t iterations) {
+  return kind == Kind::kMatrix ? MatrixKernel(iterations)
+                               : HashKernel(iterations);
+}
+
+void
+fidi::CpuBurn::Burn(Kind kind, std::chrono::microseconds duration) const {
+  if (duration.count() <= 0) { return; }
+  auto iterations = static_cast<std::uint64_t>(
+      std::llround(get_rate(kind) * static_cast<double>(duration.count())));
+  sink.fetch_xor(Run(kind, iterations), std::memory_order_relaxed);
+}
+
+//
+// fidi_cpu_burn.cc ends here
@@ -0,0 +1,120 @@
+// fidi_cpu_burn.h ---  -*- mode: c++; -*-
+
+// Copyright 2018-2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied.  See the License for the specific language governing
+// permissions and limitations under the License.
+
+/// \file
+/// \ingroup app
+///
+/// This file contains the compute kernels the fidi (φίδι) HTTP server
+/// runs for requests with a cpu_us attribute.
+
+// Code:
+
+#ifndef FIDI_CPU_BURN_H
+#  define FIDI_CPU_BURN_H
+
+#  include <array>
+#  include <chrono>
+#  include <cstddef>
+#  include <cstdint>
+#  include <string>
+
+namespace fidi {
+
+  /// \brief Real work, calibrated to take a given CPU time
+  ///
+  /// The predelay and postdelay only sleep, so they never load the
+  /// CPU. This runs a compute kernel instead, for as many iterations
+  /// as take the time asked for on an idle core of this machine. The
+  /// rate of each kernel is measured once, when the process starts.
+  ///
+  /// The work is fixed, not the time: when the cores are busy, the
+  /// same number of iterations takes longer, just as the work of a
+  /// real service does, so a topology under load shows CPU
+  /// contention and queueing.
+  ///
+  /// The kernels are written as independent lanes over small fixed
+  /// arrays, which the compiler turns into SIMD code for whatever
+  /// instruction set it targets.
+  class CpuBurn {
+   public:
+    /// The kernels
+    enum class Kind {
+      kHash,    ///< Multiply and shift mixing of 32 bit lanes
+      kMatrix,  ///< Multiplying small matrices of floats
+      kCount    ///< The number of kernels
+    };
+
+    /// The most CPU time a request may ask for, a minute
+    static constexpr std::uint64_t kMaxMicroseconds = 60000000;
+
+    /// The copy constructor is not used, so declutter.
+    CpuBurn(const CpuBurn &) = delete;
+    /// The assignment operator is also not used, so cleaned up.
+    CpuBurn &operator=(const CpuBurn &) = delete;
+    /// The move operations are unused, and cleaned up.
+    CpuBurn(CpuBurn &&) = delete;
+    CpuBurn &operator=(CpuBurn &&) = delete;
+
+    /// Destructor. Nothing to clean up
+    ~CpuBurn() {}
+
+    /// \brief Get the process wide kernels, calibrating them if needed
+    /// \return CpuBurn the calibrated kernels
+    static const CpuBurn &instance(void);
+
+    /// \brief Parse the name of a kernel
+    ///
+    /// \param[in] name hash or matrix
+    /// \param[out] kind The kernel
+    /// \return bool false if the name is not known
+    static bool ParseKind(const std::string &name, Kind *kind);
+
+    /// \brief Run a kernel for the iterations that take a given time
+    ///
+    /// \param[in] kind The kernel
+    /// \param[in] duration The CPU time to take, on an idle core
+    void Burn(Kind kind, std::chrono::microseconds duration) const;
+
+    /// \brief The calibrated rate of a kernel
+    ///
+    /// \param[in] kind The kernel
+    /// \return double Iterations per microsecond
+    double
+    get_rate(Kind kind) const {
+      return rates_[static_cast<std::size_t>(kind)];
+    }
+
+   private:
+    /// \brief Constructor, only called by instance(). Calibrates
+    CpuBurn();
+
+    /// \brief Run a kernel
+    ///
+    /// \param[in] kind The kernel
+    /// \param[in] iterations The number of iterations
+    /// \return uint32_t A digest of the work, so it is not optimized away
+    static std::uint32_t Run(Kind kind, std::uint64_t iterations);
+
+    /// Iterations per microsecond of each kernel
+    std::array<double, static_cast<std::size_t>(Kind::kCount)> rates_;
+  };
+
+}  // namespace fidi
+
+#endif /* FIDI_CPU_BURN_H */
+
+//
+// fidi_cpu_burn.h ends here
@@ -0,0 +1,207 @@
+// fidi_distribution.cc ---  -*- mode: c++; -*-
+
+// Copyright 2018-2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied.  See the License for the specific language governing
+// permissions and limitations under the License.
+
+/// \file
+/// \ingroup app
+///
+/// This file provides the implementation of the delay distributions
+/// of the fidi (φίδι) HTTP server.
+
+// Code:
+
+#include "src/fidi_distribution.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdlib>
+
+namespace {
+  /// \brief Parse a number, the whole of a string
+  ///
+  /// \param[in] text The string
+  /// \param[out] number The number
+  /// \return bool false if the string is not a finite number
+  bool
+  ParseNumber(const std::string &text, double *number) {
+    if (text.empty()) { return false; }
+    char *end = nullptr;
+    *number   = std::strtod(text.c_str(), &end);
+    return end == text.c_str() + text.size() && std::isfinite(*number);
+  }
+
+  /// \brief Split a string at commas
+  ///
+  /// \param[in] text The string
+  /// \return vector The pieces, empty ones included
+  std::vector<std::string>
+  Split(const std::string &text) {
+    std::vector<std::string> pieces;
+    std::string::size_type   start = 0;
+    for (;;) {
+      auto comma = text.find(',', start);
+      pieces.push_back(text.substr(start, comma - start));
+      if (comma == std::string::npos) { break; }
+      start = comma + 1;
+    }
+    return pieces;
+  }
+}  // namespace
+
+bool
+fidi::Distribution::Parse(const std::string &spec,
+                          fidi::Distribution *distribution,
+                          std::string *       error) {
+  // Drop blanks, and the quotes of a string
+  std::string text;
+  for (char c : spec) {
+    if (c != '"' && !std::isspace(static_cast<unsigned char>(c))) {
+      text.push_back(c);
+    }
+  }
+  auto colon = text.find(':');
+  std::string name(colon == std::string::npos ? "constant"
+                                              : text.substr(0, colon));
+  std::vector<std::string> pieces =
+      Split(colon == std::string::npos ? text : text.substr(colon + 1));
+
+  Distribution result;
+  std::vector<double> params;
+  if (name == "empirical") {
+    result.kind_ = Kind::kEmpirical;
+    double total = 0;
+    for (auto const &piece : pieces) {
+      auto   equals = piece.find('=');
+      double bound  = 0;
+      double weight = 0;
+      if (equals == std::string::npos ||
+          !ParseNumber(piece.substr(0, equals), &bound) ||
+          !ParseNumber(piece.substr(equals + 1), &weight)) {
+        *error = "empirical buckets should be bound=weight, not " + piece;
+        return false;
+      }
+      if (bound <= 0 || weight < 0 ||
+          (!result.bounds_.empty() && bound <= result.bounds_.back())) {
+        *error = "empirical bounds should be positive and rising, and "
+                 "weights not negative: " + piece;
+        return false;
+      }
+      total += weight;
+      result.bounds_.push_back(bound);
+      result.cumulative_.push_back(total);
+    }
+    if (total <= 0) {
+      *error = "empirical weights should not all be zero";
+      return false;
+    }
+    *distribution = result;
+    return true;
+  }
+
+  for (auto const &piece : pieces) {
+    double param = 0;
+    if (!ParseNumber(piece, &param)) {
+      *error = "parameter " + piece + " of " + name + " is not a number";
+      return false;
+    }
+    params.push_back(param);
+  }
+  std::size_t wanted = 2;
+  bool        valid  = true;
+  if (name == "constant") {
+    result.kind_ = Kind::kConstant;
+    wanted       = 1;
+    valid        = params.size() == 1 && params[0] >= 0;
+  } else if (name == "uniform") {
+    result.kind_ = Kind::kUniform;
+    valid = params.size() == 2 && params[0] >= 0 && params[0] <= params[1];
+  } else if (name == "exponential") {
+    result.kind_ = Kind::kExponential;
+    wanted       = 1;
+    valid        = params.size() == 1 && params[0] > 0;
+  } else if (name == "lognormal") {
+    result.kind_ = Kind::kLognormal;
+    valid        = params.size() == 2 && params[0] > 0 && params[1] >= 0;
+  } else if (name == "pareto") {
+    result.kind_ = Kind::kPareto;
+    valid        = params.size() == 2 && params[0] > 0 && params[1] > 0;
+  } else {
+    *error = "unknown distribution " + name + ", should be one of "
+             "constant uniform exponential lognormal pareto empirical";
+    return false;
+  }
+  if (params.size() != wanted) {
+    *error = name + " takes " + std::to_string(wanted) + " parameter" +
+             (wanted == 1 ? "" : "s") + ", not " +
+             std::to_string(params.size());
+    return false;
+  }
+  if (!valid) {
+    *error = "parameters of " + name + " out of range: " + text;
+    return false;
+  }
+  result.first_ = params[0];
+  if (wanted > 1) { result.second_ = params[1]; }
+  // Sampling a log-normal works with the log of the median
+  if (result.kind_ == Kind::kLognormal) {
+    result.first_ = std::log(result.first_);
+  }
+  *distribution = result;
+  return true;
+}
+
+double
+fidi::Distribution::Sample(fidi::Random &random) const {
+  double value = first_;
+  switch (kind_) {
+    case Kind::kConstant:
+      break;
+    case Kind::kUniform:
+      value = first_ + (second_ - first_) * random.NextDouble();
+      break;
+    case Kind::kExponential:
+      value = -first_ * std::log1p(-random.NextDouble());
+      break;
+    case Kind::kLognormal: {
+      // Box-Muller; log1p(-u) keeps the log off zero
+      const double kTwoPi = 6.283185307179586;
+      double radius = std::sqrt(-2.0 * std::log1p(-random.NextDouble()));
+      double normal = radius * std::cos(kTwoPi * random.NextDouble());
+      value         = std::exp(first_ + second_ * normal);
+      break;
+    }
+    case Kind::kPareto:
+      value = first_ / std::pow(1.0 - random.NextDouble(), 1.0 / second_);
+      break;
+    case Kind::kEmpirical: {
+      double point  = random.NextDouble() * cumulative_.back();
+      auto   bucket = static_cast<std::size_t>(
+          std::upper_bound(cumulative_.begin(), cumulative_.end(), point) -
+          cumulative_.begin());
+      if (bucket >= bounds_.size()) { bucket = bounds_.size() - 1; }
+      double lower = bucket == 0 ? 0.0 : bounds_[bucket - 1];
+      value        = lower + (bounds_[bucket] - lower) * random.NextDouble();
+      break;
+    }
+  }
+  // A heavy tail may draw huge values, or even infinity; NaN fails
+  // both tests, and is taken as zero
+  if (!(value > 0)) { return 0; }
+  return value < kMaxDelay ? value : kMaxDelay;
+}
+
+//
+// fidi_distribution.cc ends here
@@ -0,0 +1,109 @@
+// fidi_distribution.h ---  -*- mode: c++; -*-
+
+// Copyright 2018-2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied.  See the License for the specific language governing
+// permissions and limitations under the License.
+
+/// \file
+/// \ingroup app
+///
+/// This file contains the distributions the delays of a fidi (φίδι)
+/// request are drawn from.
+
+// Code:
+
+#ifndef FIDI_DISTRIBUTION_H
+#  define FIDI_DISTRIBUTION_H
+
+#  include <string>
+#  include <vector>
+
+#  include "src/fidi_random.h"
+
+namespace fidi {
+
+  /// \brief The distribution of a delay, in milliseconds
+  ///
+  /// Real services have long tailed latency, and a fixed delay hides
+  /// how the tails of many calls add up. So a delay may be given as a
+  /// distribution, each request drawing its own value:
+  ///
+  /// + 12, or constant:12, always 12
+  /// + uniform:10,20, anywhere from 10 to 20
+  /// + exponential:15, with a mean of 15
+  /// + lognormal:10,0.5, with a median of 10, and a sigma of 0.5 for
+  ///   the logarithm
+  /// + pareto:5,2.5, at least 5, with a tail index of 2.5
+  /// + empirical:10=50,20=30,100=15,500=5, from a histogram: the
+  ///   upper bound of each bucket, and its weight. A value is spread
+  ///   evenly within its bucket, the first of which starts at zero.
+  ///
+  /// The spec may be quoted, as strings in a request are. No
+  /// parameter may be negative. Samples are kept from zero to
+  /// kMaxDelay, so that a heavy tail can not run away.
+  class Distribution {
+   public:
+    /// The longest delay drawn, in milliseconds: an hour
+    static constexpr double kMaxDelay = 3600000.0;
+
+    /// The kinds of distribution
+    enum class Kind {
+      kConstant,     ///< Always the same
+      kUniform,      ///< Even over a range
+      kExponential,  ///< Exponential, by its mean
+      kLognormal,    ///< Log-normal, by its median and sigma
+      kPareto,       ///< Pareto, by its scale and tail index
+      kEmpirical     ///< From the buckets of a histogram
+    };
+
+    /// The default constructor, always zero
+    Distribution() :
+        kind_(Kind::kConstant), first_(0), second_(0), bounds_(),
+        cumulative_() {}
+
+    /// \brief Parse the spec of a distribution
+    ///
+    /// \param[in] spec The spec, as in the request
+    /// \param[out] distribution The distribution
+    /// \param[out] error What is wrong with the spec, if anything
+    /// \return bool false if the spec is not valid
+    static bool Parse(const std::string &spec, Distribution *distribution,
+                      std::string *error);
+
+    /// \brief Draw a value
+    ///
+    /// \param[in,out] random The generator to draw with
+    /// \return double The value, in milliseconds, from 0 to kMaxDelay
+    double Sample(fidi::Random &random) const;
+
+    /// \brief The kind of the distribution
+    /// \return Kind The kind
+    Kind
+    get_kind(void) const {
+      return kind_;
+    }
+
+   private:
+    Kind   kind_;    ///< The kind of the distribution
+    double first_;   ///< The first parameter, if any
+    double second_;  ///< The second parameter, if any
+    std::vector<double> bounds_;      ///< Empirical bucket upper bounds
+    std::vector<double> cumulative_;  ///< Empirical cumulative weights
+  };
+
+}  // namespace fidi
+
+#endif /* FIDI_DISTRIBUTION_H */
+
+//
+// fidi_distribution.h ends here
@@ -24,11 +24,15 @@
 
 // Code:
 #include "src/fidi_driver.h"
+#include "src/fidi_cpu_burn.h"
+#include "src/fidi_distribution.h"
 #include <cassert>
 #include <cctype>
 #include <fstream>
+#include <iterator>
 #include <sstream>
 #include <string>
+#include <vector>
 
 fidi::Driver::~Driver() {
   delete scanner_;
@@ -90,10 +94,11 @@ fidi::Driver::HandleNode(const std::string &                       node_name,
 }
 
 void
-fidi::Driver::HandleEdge(const std::string &       edge_name,
-                         const std::pair<int, int> edge_list,
-                         const std::string &       new_blob) {
-  struct EdgeDetails new_edge = {edge_name, new_blob, edge_list};
+fidi::Driver::HandleEdge(const std::string &                       edge_name,
+                         const std::pair<int, int>                 edge_list,
+                         const std::map<std::string, std::string> &options,
+                         const std::string &                       new_blob) {
+  struct EdgeDetails new_edge = {edge_name, new_blob, edge_list, options};
   destinations_.emplace(edge_name);
   new_edge.blob.insert(0, "\n    [");
   edge_attributes_.push(new_edge);
@@ -174,10 +179,32 @@ fidi::Driver::SanityChecks(std::string *error_message) {
     }
     auto it = node_attributes.find("port");
     if (it != node_attributes.end()) {
-      (void)check_num(it->second, "// Port definition ");
+      std::string err_top("// Node " + id + " port ");
+      int         before = errors;
+      int         port   = check_num(it->second, err_top);
+      if (errors == before && (port < 1 || port > 65535)) {
+        errors++;
+        error_message->append(err_top)
+            .append(it->second)
+            .append(" should be from 1 to 65535\n");
+      }
+    }
+
+    it = node_attributes.find("max_in_flight");
+    if (it != node_attributes.end()) {
+      std::string err_top("// Node " + id + " max_in_flight ");
+      if (check_num(it->second, err_top) < 0) {
+        errors++;
+        error_message->append(err_top).append("should not be negative\n");
+      }
     }
 
     auto hostname_it = node_attributes.find("hostname");
+    if (hostname_it != node_attributes.end() && hostname_it->second.empty()) {
+      errors++;
+      error_message->append("// Node ").append(id).append(
+          " hostname should not be empty\n");
+    }
     if (hostname_it != node_attributes.end()) {
       std::size_t found = 0;
       found             = hostname_it->second.find('"', found);
@@ -215,15 +242,24 @@ fidi::Driver::SanityChecks(std::string *error_message) {
     error_message->append("//  Request response code specification missing\n");
   }
 
-  it = top_attributes_.find("predelay");
-  if (it != top_attributes_.end()) {
-    (void)check_num(it->second, "// Request pre-delay ");
-  }
-
-  it = top_attributes_.find("postdelay");
-  if (it != top_attributes_.end()) {
-    (void)check_num(it->second, "// Request post-delay ");
-  }
+  // Delays are a number of milliseconds, or a distribution
+  auto check_delay = [&](const std::string &attribute,
+                         const std::string &err_top) {
+    auto delay_it = top_attributes_.find(attribute);
+    if (delay_it == top_attributes_.end()) { return; }
+    fidi::Distribution distribution;
+    std::string        error;
+    if (!fidi::Distribution::Parse(delay_it->second, &distribution, &error)) {
+      errors++;
+      error_message->append(err_top)
+          .append(delay_it->second)
+          .append(" is not a valid delay\n//  ")
+          .append(error)
+          .append("\n");
+    }
+  };
+  check_delay("predelay", "// Request pre-delay ");
+  check_delay("postdelay", "// Request post-delay ");
 
   it = top_attributes_.find("timeout_sec");
   if (it != top_attributes_.end()) {
@@ -244,8 +280,219 @@ fidi::Driver::SanityChecks(std::string *error_message) {
     }
   }
 
+  // Sizes may be gigabytes, more than check_num can handle
+  auto check_size = [&](const std::string &attribute,
+                        const std::string &err_top) {
+    auto size_it = top_attributes_.find(attribute);
+    if (size_it == top_attributes_.end()) { return; }
+    std::size_t idx = 0;
+    try {
+      (void)std::stoull(size_it->second, &idx);
+    } catch (const std::exception &) {
+      idx = 0;
+    }
+    if (idx == 0 || idx != size_it->second.size() ||
+        size_it->second[0] == '-') {
+      errors++;
+      error_message->append(err_top)
+          .append(size_it->second)
+          .append(" is not a valid unsigned integer\n");
+    }
+  };
+  check_size("size", "// Response size ");
+  check_size("memory", "// Request memory ");
+  check_size("cpu_us", "// Request CPU time ");
+  it = top_attributes_.find("cpu_us");
+  if (it != top_attributes_.end() && it->second[0] != '-') {
+    // One request should not pin a core for hours
+    std::size_t idx = 0;
+    try {
+      if (std::stoull(it->second, &idx) > fidi::CpuBurn::kMaxMicroseconds) {
+        errors++;
+        error_message->append("// Request CPU time ")
+            .append(it->second)
+            .append(" is more than the most allowed, ")
+            .append(std::to_string(fidi::CpuBurn::kMaxMicroseconds))
+            .append("\n");
+      }
+    } catch (const std::exception &) {
+      // check_size has reported it
+    }
+  }
+  check_size("seed", "// Request seed ");
+
+  // Attributes that take one of a few words
+  auto check_word = [&](const std::string &             attribute,
+                        const std::vector<std::string> &words) {
+    auto word_it = top_attributes_.find(attribute);
+    if (word_it == top_attributes_.end()) { return; }
+    for (auto const &word : words) {
+      if (word_it->second == word) { return; }
+    }
+    errors++;
+    error_message->append("// ")
+        .append(attribute)
+        .append(" should be one of");
+    for (auto const &word : words) { error_message->append(" ").append(word); }
+    error_message->append("\n//  not ").append(word_it->second).append("\n");
+  };
+  check_word("memory_pattern", {"sequential", "random"});
+  check_word("memory_hugepages", {"true", "false"});
+  check_word("memory_hold", {"true", "false"});
+  check_word("cpu_kind", {"hash", "matrix"});
+
+  // The other attributes of the calls
+  for (auto const &edge : edge_attributes_.get_edges()) {
+    for (auto const &[option, value] : edge.options) {
+      std::string err_top("// Call to " + edge.name + " " + option + " ");
+      if (option == "hedge_ms") {
+        if (check_num(value, err_top) < 0) {
+          errors++;
+          error_message->append(err_top).append("should not be negative\n");
+        }
+      } else if (option == "hedge_percentile") {
+        auto percentile = check_num(value, err_top);
+        if (percentile < 1 || percentile > 99) {
+          errors++;
+          error_message->append(err_top).append(
+              "should be from 1 to 99\n");
+        }
+      } else if (option != "id" && option != "after") {
+        errors++;
+        error_message->append("// Call to ")
+            .append(edge.name)
+            .append(" has an unknown attribute ")
+            .append(option)
+            .append("\n");
+      }
+    }
+  }
+
+  std::vector<std::vector<std::size_t>> after;
+  std::string                           error;
+  if (!Dependencies(edge_attributes_.get_edges(), &after, &error)) {
+    errors++;
+    error_message->append(error);
+  }
+
   return errors;
 }
 
+bool
+fidi::Driver::Dependencies(const std::vector<struct EdgeDetails> &edges,
+                           std::vector<std::vector<std::size_t>> *after,
+                           std::string *                          error) {
+  assert(after != nullptr && error != nullptr);
+  // How a call is named in the error messages
+  auto describe = [&edges](std::size_t call) {
+    std::string text(edges[call].name);
+    auto        id_it = edges[call].options.find("id");
+    if (id_it != edges[call].options.end()) {
+      text.append(" (").append(id_it->second).append(")");
+    }
+    return text;
+  };
+
+  std::map<std::string, std::size_t>      ids;
+  std::map<int, std::vector<std::size_t>> sequences;
+  for (std::size_t call = 0; call < edges.size(); ++call) {
+    sequences[edges[call].edge_attr.second].push_back(call);
+    auto id_it = edges[call].options.find("id");
+    if (id_it == edges[call].options.end()) { continue; }
+    if (!ids.emplace(id_it->second, call).second) {
+      error->append("// Call id ")
+          .append(id_it->second)
+          .append(" is used by more than one call\n");
+      return false;
+    }
+  }
+
+  after->assign(edges.size(), {});
+  for (std::size_t call = 0; call < edges.size(); ++call) {
+    auto after_it = edges[call].options.find("after");
+    if (after_it == edges[call].options.end()) {
+      // Wait for the previous sequence number, if there is one
+      auto sequence_it = sequences.find(edges[call].edge_attr.second);
+      if (sequence_it != sequences.begin()) {
+        (*after)[call] = std::prev(sequence_it)->second;
+      }
+      continue;
+    }
+    std::string::size_type start = 0;
+    for (;;) {
+      auto        pipe = after_it->second.find('|', start);
+      std::string id(after_it->second.substr(start, pipe - start));
+      auto        id_it = ids.find(id);
+      if (id_it == ids.end()) {
+        error->append("// Call to ")
+            .append(describe(call))
+            .append(" waits for unknown call id ")
+            .append(id)
+            .append("\n");
+        return false;
+      }
+      (*after)[call].push_back(id_it->second);
+      if (pipe == std::string::npos) { break; }
+      start = pipe + 1;
+    }
+  }
+
+  // Take away calls that wait for nothing left; any remaining are in,
+  // or wait on, a cycle
+  std::vector<std::size_t>              waiting(edges.size());
+  std::vector<std::vector<std::size_t>> dependents(edges.size());
+  std::vector<std::size_t>              ready;
+  for (std::size_t call = 0; call < edges.size(); ++call) {
+    waiting[call] = (*after)[call].size();
+    for (auto prerequisite : (*after)[call]) {
+      dependents[prerequisite].push_back(call);
+    }
+    if (waiting[call] == 0) { ready.push_back(call); }
+  }
+  std::size_t settled = 0;
+  while (!ready.empty()) {
+    auto call = ready.back();
+    ready.pop_back();
+    settled++;
+    for (auto dependent : dependents[call]) {
+      if (--waiting[dependent] == 0) { ready.push_back(dependent); }
+    }
+  }
+  if (settled == edges.size()) { return true; }
+  error->append("// Calls wait for each other in a cycle:");
+  for (std::size_t call = 0; call < edges.size(); ++call) {
+    if (waiting[call] > 0) { error->append(" ").append(describe(call)); }
+  }
+  error->append("\n");
+  return false;
+}
+
+void
+fidi::Driver::SavePlan(Plan *plan) const {
+  assert(plan != nullptr);
+  plan->top_attributes = top_attributes_;
+  plan->nodes          = nodes_;
+  plan->node_glob      = node_glob_;
+  plan->edges          = edge_attributes_;
+  plan->destinations   = destinations_;
+  plan->nerrors        = nerrors_;
+  plan->parse_errors   = parse_errors_;
+  plan->wire           = wire_;
+}
+
+void
+fidi::Driver::LoadPlan(const Plan &plan) {
+  top_attributes_  = plan.top_attributes;
+  nodes_           = plan.nodes;
+  node_glob_       = plan.node_glob;
+  edge_attributes_ = plan.edges;
+  destinations_    = plan.destinations;
+  nerrors_         = plan.nerrors;
+  parse_errors_    = plan.parse_errors;
+  num_warnings_    = plan.num_warnings;
+  warnings_        = plan.warnings;
+  wire_            = plan.wire;
+}
+
 //
 // fidi_driver.cc ends here
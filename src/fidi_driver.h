@@ -33,6 +33,7 @@
 #  include <cstddef>
 #  include <functional>
 #  include <istream>
+#  include <map>
 #  include <queue>
 #  include <set>
 #  include <string>
@@ -59,6 +60,92 @@ namespace fidi {
   /// This also contains an instance of the scanner.
   class Driver {
    public:
+    /// The call/edge details. Used as nodes in the priority queue
+    struct EdgeDetails {
+      std::string         name;       ///< Name of the destination node
+      std::string         blob;       ///< Payload for the call
+      std::pair<int, int> edge_attr;  ///< Repeat count and sequence number
+      /// Other attributes of the call, such as hedge_ms
+      std::map<std::string, std::string> options;
+    };
+
+    /// \brief a class that compares struct EdgeDetails
+    ///
+    /// This class has a single method that can help order a set of
+    /// EdgeDetails structure instances based on the sequence number.
+    class EdgeComparison {
+     public:
+      /// Default constructor
+      EdgeComparison() = default;
+
+      /// \brief compare two struct EdgeDetails
+      ///
+      /// This method compares two struct EdgeDetails based on their
+      /// sequence numbers, and weakly orders them in reverse
+      /// sequence number order. The lower numbered sequences come
+      /// first in the list.
+      ///
+      /// \param[in] a The first struct to compare
+      /// \param[in] b The second struct to compare
+      /// \return bool True if a is sorted later than b
+      bool
+      operator()(const struct EdgeDetails &a,
+                 const struct EdgeDetails &b) const {
+        return a.edge_attr.second > b.edge_attr.second;
+      }
+    };
+
+    /// \brief The calls, ordered by sequence number
+    ///
+    /// The sanity checks need to see every call, without taking them
+    /// off the queue, so this lets them look at the container.
+    class EdgeQueue
+        : public std::priority_queue<struct EdgeDetails,
+                                     std::vector<struct EdgeDetails>,
+                                     EdgeComparison> {
+     public:
+      /// \brief All the calls, in no particular order
+      /// \return vector The calls
+      const std::vector<struct EdgeDetails> &
+      get_edges(void) const {
+        return c;
+      }
+    };
+
+    /// \brief The fully parsed and checked form of a request
+    ///
+    /// This holds everything that parsing and sanity checking a
+    /// request body produces, so that a driver can be set up for a
+    /// body seen before without running the scanner, the parser, or
+    /// the sanity checks again. See fidi::PlanCache.
+    struct Plan {
+      /// The default constructor, an empty plan
+      Plan() :
+          top_attributes(),
+          nodes(),
+          node_glob(),
+          edges(),
+          destinations(),
+          nerrors(0),
+          parse_errors(),
+          num_warnings(0),
+          warnings(),
+          wire(false) {}
+
+      /// The attributes pertaining to the top level request
+      std::map<std::string, std::string> top_attributes;
+      /// The set of nodes and attributes
+      std::map<std::string, std::map<std::string, std::string>> nodes;
+      std::string node_glob;  ///< The node definitions, as text
+      EdgeQueue   edges;      ///< The calls, in sequence order
+      std::set<std::string> destinations;  ///< The set of known destinations
+      int         nerrors;       ///< The number of parse errors seen
+      std::string parse_errors;  ///< The parse error messages
+      int         num_warnings;  ///< The number of sanity check warnings
+      std::string warnings;      ///< The sanity check warning messages
+      bool        wire;  ///< The payloads are in the binary wire format
+    };
+
     /// The default construvtor
     ///
     /// This takes no parameters, and just sets the data members to
@@ -75,7 +162,8 @@ namespace fidi {
         edge_attributes_(),
         destinations_(),
         num_warnings_(0),
-        warnings_() {}
+        warnings_(),
+        wire_(false) {}
 
     /// The copy constructor is not used, so decluttering
     Driver(const Driver &) = delete;
@@ -150,10 +238,12 @@ namespace fidi {
     ///
     /// \param[in] name The name of the destination node
     /// \param[in] edge_list the repeat count and the sequence number
+    /// \param[in] options The other attributes of the call
     /// \param[in] blob The call payload
-    void HandleEdge(const std::string &       name,
-                    const std::pair<int, int> edge_list,
-                    const std::string &       blob);
+    void HandleEdge(const std::string &                       name,
+                    const std::pair<int, int>                 edge_list,
+                    const std::map<std::string, std::string> &options,
+                    const std::string &                       blob);
 
     /// A virtual method instanciated by derived calsses to act on the parsed
     /// data
@@ -182,12 +272,46 @@ namespace fidi {
     /// + ensure that the request response code is specified
     /// + Validate that the request response code is numerical
     /// + Ansire that the request response code looks like a HTTP response
-    /// + ensure that the predelay amount is an integer
-    /// + ensure that the postdelay amount is an integer
+    /// + ensure that the predelay and postdelay are an integer, or a
+    ///   valid distribution (see fidi::Distribution)
+    /// + ensure that the attributes of each call are known, and in range
+    /// + ensure that the calls do not wait for each other in a cycle
     ///
     /// \param[out] error_message A string to append error messages to.
     /// \return int The number of errors encountered.
-    int SanityChecks(std::string *error_message);
+    virtual int SanityChecks(std::string *error_message);
+
+    /// \brief Work out which calls each call waits for
+    ///
+    /// A call named with the id attribute may be waited for by other
+    /// calls, which list it in their after attribute, separating the
+    /// ids with '|'. A call without an after attribute waits for all
+    /// the calls with the closest lower sequence number, as though
+    /// each sequence number were a barrier.
+    ///
+    /// \param[in] edges The calls, in any order
+    /// \param[out] after For each call, the indices of the calls it
+    ///             waits for
+    /// \param[out] error What is wrong, if anything
+    /// \return bool false if an id is repeated or unknown, or if the
+    ///         calls wait for each other in a cycle
+    static bool Dependencies(const std::vector<struct EdgeDetails> &edges,
+                             std::vector<std::vector<std::size_t>> *after,
+                             std::string *                          error);
+
+    /// \brief Copy the parsed request into a plan
+    ///
+    /// This must be called before Execute(), which consumes the
+    /// calls. The parse errors are copied too, but the warnings are
+    /// left for the caller to fill in.
+    ///
+    /// \param[out] plan The plan to fill in
+    void SavePlan(Plan *plan) const;
+
+    /// \brief Set up the driver from a plan, instead of parsing
+    ///
+    /// \param[in] plan A plan saved by SavePlan() for the same request
+    void LoadPlan(const Plan &plan);
 
     /// \brief return the list of parse errors encountered
     ///
@@ -218,39 +342,6 @@ namespace fidi {
     int nerrors_;               ///< The number of parse errors seen
 
    protected:
-    /// The call/edge details. Used as nodes in the priority queue
-    struct EdgeDetails {
-      std::string         name;       ///< Name of the destination node
-      std::string         blob;       ///< Payload for the call
-      std::pair<int, int> edge_attr;  ///< Repeat count and sequence number
-    };
-
-    /// \brief a class that compares struct EdgeDetails
-    ///
-    /// This class has a single method that can help order a set of
-    /// EdgeDetails structure instances based on the sequence number.
-    class EdgeComparison {
-     public:
-      /// Default constructor
-      EdgeComparison() = default;
-
-      /// \brief compare two struct EdgeDetails
-      ///
-      /// This method compares two struct EdgeDetails based on their
-      /// sequence numbers, and weakly orders them in reverse
-      /// sequence number order. The lower numbered sequences come
-      /// first in the list.
-      ///
-      /// \param[in] a The first struct to compare
-      /// \param[in] b The second struct to compare
-      /// \return bool True if a is sorted later than b
-      bool
-      operator()(const struct EdgeDetails &a,
-                 const struct EdgeDetails &b) const {
-        return a.edge_attr.second > b.edge_attr.second;
-      }
-    };
-
     // The next three are different for sub parsing the
     // payloads. These are useful inly to the linter, since it needs
     // to do a full parse.
@@ -280,14 +371,14 @@ namespace fidi {
     ///
     /// The calls are sorted into a priority queue, so they can be
     /// executeds in priority order.
-    std::priority_queue<struct EdgeDetails, std::vector<struct EdgeDetails>,
-                        EdgeComparison>
-                          edge_attributes_;
+    EdgeQueue             edge_attributes_;
     std::set<std::string> destinations_;  ///< The set of known destinations
 
     int         num_warnings_;  ///< The number of sanity check warnings found
     std::string warnings_;  ///< The warning messages associated with the sanity
                             ///< checking.
+    bool wire_;  ///< The node glob and the call payloads are in the
+                 ///< binary fidi::WireFormat, not text
   };
 
 } /* end namespace fidi */
@@ -0,0 +1,237 @@
+// fidi_executor.cc ---  -*- mode: c++; -*-
+
+// Copyright 2018-2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied.  See the License for the specific language governing
+// permissions and limitations under the License.
+
+/// \file
+/// \ingroup app
+///
+/// This file provides the implementation of the process wide
+/// executor used to make downstream calls for the fidi (φίδι) HTTP
+/// server, and of the call group completion tracker.
+
+// Code:
+
+#include "src/fidi_executor.h"
+#include <pthread.h>
+#include <sched.h>
+#include <algorithm>
+
+std::size_t fidi::Executor::configured_threads_ = 128;
+std::size_t fidi::Executor::configured_depth_   = 4096;
+
+/// Set on the executor's own worker threads
+static thread_local bool in_worker = false;
+
+void
+fidi::CallGroup::Add(std::size_t count) {
+  std::lock_guard<std::mutex> lock(mtx_);
+  pending_ += count;
+}
+
+void
+fidi::CallGroup::Done(void) {
+  std::function<void()> callback;
+  {
+    std::lock_guard<std::mutex> lock(mtx_);
+    if (pending_ > 0) { pending_--; }
+    if (pending_ != 0) { return; }
+    cv_.notify_all();
+    callback.swap(on_done_);
+  }
+  if (callback) { callback(); }
+}
+
+void
+fidi::CallGroup::Wait(void) {
+  std::unique_lock<std::mutex> lock(mtx_);
+  cv_.wait(lock, [this] { return pending_ == 0; });
+}
+
+void
+fidi::CallGroup::OnDone(std::function<void()> callback) {
+  {
+    std::lock_guard<std::mutex> lock(mtx_);
+    if (pending_ != 0) {
+      on_done_ = std::move(callback);
+      return;
+    }
+  }
+  callback();
+}
+
+fidi::Executor::Executor(std::size_t threads, std::size_t queue_depth) :
+    mtx_(),
+    not_empty_(),
+    not_full_(),
+    queue_(),
+    workers_(),
+    max_queue_(std::max<std::size_t>(queue_depth, 1)),
+    stopping_(false),
+    submitted_(0),
+    completed_(0),
+    queue_wait_usec_(0),
+    max_queue_wait_usec_(0) {
+  threads = std::max<std::size_t>(threads, 1);
+  workers_.reserve(threads);
+  for (std::size_t i = 0; i < threads; ++i) {
+    workers_.emplace_back(&fidi::Executor::WorkerLoop, this);
+  }
+}
+
+fidi::Executor::~Executor() { Shutdown(); }
+
+void
+fidi::Executor::Configure(std::size_t threads, std::size_t queue_depth) {
+  configured_threads_ = threads;
+  configured_depth_   = queue_depth;
+}
+
+fidi::Executor &
+fidi::Executor::instance(void) {
+  static fidi::Executor executor(configured_threads_, configured_depth_);
+  return executor;
+}
+
+void
+fidi::Executor::Submit(std::function<void()> job) {
+  std::unique_lock<std::mutex> lock(mtx_);
+  if (in_worker && queue_.size() >= max_queue_) {
+    // A worker blocking on a full queue could leave every worker
+    // waiting on every other; the worker runs the job itself instead.
+    lock.unlock();
+    try {
+      job();
+    } catch (...) {
+    }
+    return;
+  }
+  not_full_.wait(lock,
+                 [this] { return stopping_ || queue_.size() < max_queue_; });
+  if (stopping_) {
+    // No workers left to pick this up; run it here so that callers
+    // waiting on its completion are not left hanging.
+    lock.unlock();
+    try {
+      job();
+    } catch (...) {
+    }
+    return;
+  }
+  queue_.push_back(Job{std::move(job), std::chrono::steady_clock::now()});
+  submitted_++;
+  lock.unlock();
+  not_empty_.notify_one();
+}
+
+void
+fidi::Executor::Post(std::function<void()> job) {
+  std::unique_lock<std::mutex> lock(mtx_);
+  if (stopping_) {
+    // No workers left to pick this up
+    lock.unlock();
+    try {
+      job();
+    } catch (...) {
+    }
+    return;
+  }
+  queue_.push_back(Job{std::move(job), std::chrono::steady_clock::now()});
+  submitted_++;
+  lock.unlock();
+  not_empty_.notify_one();
+}
+
+void
+fidi::Executor::WorkerLoop(void) {
+  in_worker = true;
+  for (;;) {
+    std::function<void()>                 work;
+    std::chrono::steady_clock::time_point enqueued;
+    {
+      std::unique_lock<std::mutex> lock(mtx_);
+      not_empty_.wait(lock, [this] { return stopping_ || !queue_.empty(); });
+      if (queue_.empty()) { return; }  // stopping, and nothing left to do
+      work     = std::move(queue_.front().work);
+      enqueued = queue_.front().enqueued;
+      queue_.pop_front();
+    }
+    not_full_.notify_one();
+
+    auto waited = static_cast<std::uint64_t>(
+        std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - enqueued)
+            .count());
+    queue_wait_usec_ += waited;
+    auto max_wait = max_queue_wait_usec_.load();
+    while (waited > max_wait &&
+           !max_queue_wait_usec_.compare_exchange_weak(max_wait, waited)) {
+    }
+
+    try {
+      work();
+    } catch (...) {
+      // The jobs log their own errors; never let one kill a worker
+    }
+    completed_++;
+  }
+}
+
+fidi::Executor::Stats
+fidi::Executor::get_stats(void) {
+  Stats stats;
+  stats.submitted           = submitted_.load();
+  stats.completed           = completed_.load();
+  stats.queue_wait_usec     = queue_wait_usec_.load();
+  stats.max_queue_wait_usec = max_queue_wait_usec_.load();
+  stats.threads             = workers_.size();
+  std::lock_guard<std::mutex> lock(mtx_);
+  stats.queue_depth = queue_.size();
+  return stats;
+}
+
+void
+fidi::Executor::Shutdown(void) {
+  {
+    std::lock_guard<std::mutex> lock(mtx_);
+    if (stopping_) { return; }
+    stopping_ = true;
+  }
+  not_empty_.notify_all();
+  not_full_.notify_all();
+  for (auto &worker : workers_) {
+    if (worker.joinable()) { worker.join(); }
+  }
+}
+
+bool
+fidi::Executor::PinThread(int cpu) {
+  static thread_local int pinned = -1;
+  if (pinned == cpu) { return true; }
+#if defined(__linux__)
+  cpu_set_t cpus;
+  CPU_ZERO(&cpus);
+  CPU_SET(static_cast<std::size_t>(cpu), &cpus);
+  if (pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) != 0) {
+    return false;
+  }
+  pinned = cpu;
+  return true;
+#else
+  return false;
+#endif
+}
+
+//
+// fidi_executor.cc ends here
@@ -0,0 +1,215 @@
+// fidi_executor.h ---  -*- mode: c++; -*-
+
+// Copyright 2018-2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied.  See the License for the specific language governing
+// permissions and limitations under the License.
+
+/// \file
+/// \ingroup app
+///
+/// This file contains the process wide executor that runs the
+/// downstream calls made by the fidi (φίδι) HTTP server, and a small
+/// helper class used to track the completion of a group of calls
+/// that belong to a single request.
+
+// Code:
+
+#ifndef FIDI_EXECUTOR_H
+#  define FIDI_EXECUTOR_H
+
+#  include <atomic>
+#  include <chrono>
+#  include <condition_variable>
+#  include <cstddef>
+#  include <cstdint>
+#  include <deque>
+#  include <functional>
+#  include <mutex>
+#  include <thread>
+#  include <vector>
+
+namespace fidi {
+
+  /// \brief Track completion of a group of jobs
+  ///
+  /// Each request creates one of these for every sequence stage, and
+  /// adds one to the count for each downstream call it submits. The
+  /// job marks itself done when it completes, and the request waits
+  /// for the count to drop back to zero, or asks to be called back
+  /// when it does. This replaces joining all the tasks in a per
+  /// request task manager.
+  class CallGroup {
+   public:
+    /// The default constructor. Nothing is pending.
+    CallGroup() : mtx_(), cv_(), pending_(0), on_done_() {}
+
+    /// The copy constructor is not used, so declutter.
+    CallGroup(const CallGroup &) = delete;
+    /// The assignment operator is also not used, so cleaned up.
+    CallGroup &operator=(const CallGroup &) = delete;
+    /// The move operations are unused, and cleaned up.
+    CallGroup(CallGroup &&) = delete;
+    CallGroup &operator=(CallGroup &&) = delete;
+
+    /// Destructor. The members clean themselves
+    ~CallGroup() {}
+
+    /// \brief Note that more jobs are outstanding
+    ///
+    /// \param[in] count The number of jobs to add to the group
+    void Add(std::size_t count = 1);
+
+    /// \brief Note that a single job has finished
+    void Done(void);
+
+    /// \brief Block until all the jobs in the group have finished
+    void Wait(void);
+
+    /// \brief Run a callback once all the jobs have finished
+    ///
+    /// Instead of blocking, the callback is run by the thread that
+    /// finishes the last job, or straight away if nothing is pending.
+    ///
+    /// \param[in] callback The work to do once the group is done
+    void OnDone(std::function<void()> callback);
+
+   private:
+    std::mutex              mtx_;      ///< Protects the pending count
+    std::condition_variable cv_;       ///< Signalled when pending hits 0
+    std::size_t             pending_;  ///< Jobs not yet finished
+    std::function<void()>   on_done_;  ///< Run when pending hits 0
+  };
+
+  /// \brief A process wide executor for downstream calls
+  ///
+  /// Creating a thread pool for every incoming request means that a
+  /// few hundred concurrent requests spawn thousands of threads. This
+  /// class provides a single executor, shared by all the request
+  /// handlers, made up of a fixed number of worker threads pulling
+  /// jobs off a bounded queue. When the queue is full, submitters
+  /// block until there is room, which applies back pressure to the
+  /// request handlers rather than growing without bounds.
+  ///
+  /// The executor is created on first use, with the sizes set by
+  /// Configure(), which should be called during server
+  /// initialization.
+  class Executor {
+   public:
+    /// A snapshot of the executor counters
+    struct Stats {
+      std::uint64_t submitted;          ///< Jobs submitted so far
+      std::uint64_t completed;          ///< Jobs that have finished
+      std::uint64_t queue_wait_usec;    ///< Total time jobs spent queued
+      std::uint64_t max_queue_wait_usec;  ///< Longest time a job was queued
+      std::size_t   queue_depth;        ///< Jobs queued right now
+      std::size_t   threads;            ///< Number of worker threads
+    };
+
+    /// The copy constructor is not used, so declutter.
+    Executor(const Executor &) = delete;
+    /// The assignment operator is also not used, so cleaned up.
+    Executor &operator=(const Executor &) = delete;
+    /// The move operations are unused, and cleaned up.
+    Executor(Executor &&) = delete;
+    Executor &operator=(Executor &&) = delete;
+
+    /// Destructor. Stops and joins the workers.
+    ~Executor();
+
+    /// \brief Set the size of the executor
+    ///
+    /// This only has effect if called before the first call to
+    /// instance().
+    ///
+    /// \param[in] threads The number of worker threads
+    /// \param[in] queue_depth The maximum number of queued jobs
+    static void Configure(std::size_t threads, std::size_t queue_depth);
+
+    /// \brief Get the process wide executor, creating it if needed
+    /// \return Executor the shared executor
+    static Executor &instance(void);
+
+    /// \brief Queue a job to be run by one of the workers
+    ///
+    /// Blocks the caller if the queue is full, unless the caller is
+    /// itself one of the workers, in which case it runs the job
+    /// inline. Exceptions thrown by the job are caught and discarded.
+    ///
+    /// \param[in] job The work to be done
+    void Submit(std::function<void()> job);
+
+    /// \brief Queue a job without ever blocking
+    ///
+    /// For threads that drive other work, such as the timer thread,
+    /// and must not stall behind a full queue. The job is queued even
+    /// if that takes the queue past its maximum depth; submitters
+    /// still block until the queue is back below it.
+    ///
+    /// \param[in] job The work to be done
+    void Post(std::function<void()> job);
+
+    /// \brief Return a snapshot of the executor counters
+    /// \return Stats the current counter values
+    Stats get_stats(void);
+
+    /// \brief Stop accepting jobs, drain the queue, and join the workers
+    void Shutdown(void);
+
+    /// \brief Pin the calling thread to a CPU
+    ///
+    /// A thread that is already pinned to the CPU is left alone, so
+    /// this is cheap enough to call for every request.
+    ///
+    /// \param[in] cpu The CPU, counting from 0
+    /// \return bool false if the thread could not be pinned
+    static bool PinThread(int cpu);
+
+   private:
+    /// A queued job, and when it was queued
+    struct Job {
+      std::function<void()>                 work;      ///< The job itself
+      std::chrono::steady_clock::time_point enqueued;  ///< When it was queued
+    };
+
+    /// \brief Constructor, only called by instance()
+    ///
+    /// \param[in] threads The number of worker threads
+    /// \param[in] queue_depth The maximum number of queued jobs
+    Executor(std::size_t threads, std::size_t queue_depth);
+
+    /// The body of each worker thread
+    void WorkerLoop(void);
+
+    static std::size_t configured_threads_;  ///< Set by Configure()
+    static std::size_t configured_depth_;    ///< Set by Configure()
+
+    std::mutex               mtx_;        ///< Protects the queue
+    std::condition_variable  not_empty_;  ///< Signalled when a job is queued
+    std::condition_variable  not_full_;   ///< Signalled when a job is taken
+    std::deque<Job>          queue_;      ///< The bounded job queue
+    std::vector<std::thread> workers_;    ///< The worker threads
+    std::size_t              max_queue_;  ///< Maximum queue depth
+    bool                     stopping_;   ///< Set once Shutdown() is called
+
+    std::atomic<std::uint64_t> submitted_;        ///< Jobs submitted
+    std::atomic<std::uint64_t> completed_;        ///< Jobs finished
+    std::atomic<std::uint64_t> queue_wait_usec_;  ///< Total queue wait
+    std::atomic<std::uint64_t> max_queue_wait_usec_;  ///< Max queue wait
+  };
+
+}  // namespace fidi
+
+#endif /* FIDI_EXECUTOR_H */
+
+//
+// fidi_executor.h ends here
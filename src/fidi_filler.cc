@@ -0,0 +1,71 @@
+// fidi_filler.cc ---  -*- mode: c++; -*-
+
+// Copyright 2018-2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied.  See the License for the specific language governing
+// permissions and limitations under the License.
+
+/// \file
+/// \ingroup app
+///
+/// This file provides the implementation of the response filler for
+/// the fidi (φίδι) HTTP server.
+
+// Code:
+
+#include "src/fidi_filler.h"
+
+#include <unistd.h>
+#include <algorithm>
+#include <cstdlib>
+#include <new>
+
+fidi::Filler::Filler() : buffer_(nullptr) {
+  long page = sysconf(_SC_PAGESIZE);
+  if (page <= 0) { page = 4096; }
+  void *memory = nullptr;
+  if (posix_memalign(&memory, static_cast<std::size_t>(page), kBufferSize) !=
+      0) {
+    throw std::bad_alloc();
+  }
+  buffer_ = static_cast<char *>(memory);
+  // Printable, so a response can be looked at, with a line break
+  // every 64 bytes
+  for (std::size_t i = 0; i < kBufferSize; ++i) {
+    buffer_[i] = (i % 64 == 63) ? '\n' : static_cast<char>('a' + i % 26);
+  }
+}
+
+fidi::Filler::~Filler() {
+  std::free(buffer_);
+  buffer_ = nullptr;
+}
+
+const fidi::Filler &
+fidi::Filler::instance(void) {
+  static const fidi::Filler filler;
+  return filler;
+}
+
+std::ostream &
+fidi::Filler::Write(std::ostream &stream, std::uint64_t size) const {
+  while (size > 0 && stream.good()) {
+    std::size_t chunk =
+        static_cast<std::size_t>(std::min<std::uint64_t>(size, kBufferSize));
+    stream.write(buffer_, static_cast<std::streamsize>(chunk));
+    size -= chunk;
+  }
+  return stream;
+}
+
+//
+// fidi_filler.cc ends here
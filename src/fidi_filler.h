@@ -0,0 +1,80 @@
+// fidi_filler.h ---  -*- mode: c++; -*-
+
+// Copyright 2018-2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied.  See the License for the specific language governing
+// permissions and limitations under the License.
+
+/// \file
+/// \ingroup app
+///
+/// This file contains the filler used for the response bodies of a
+/// given size, requested with the size attribute, by the fidi (φίδι)
+/// HTTP server.
+
+// Code:
+
+#ifndef FIDI_FILLER_H
+#  define FIDI_FILLER_H
+
+#  include <cstddef>
+#  include <cstdint>
+#  include <ostream>
+
+namespace fidi {
+
+  /// \brief A read only buffer of filler, shared by all responses
+  ///
+  /// A response of a given size is made by writing this buffer over
+  /// and over, and then as much of it as is left over. The buffer is
+  /// allocated, page aligned, and filled just once, so a response of
+  /// any size, even gigabytes, costs no allocation and no formatting.
+  class Filler {
+   public:
+    /// The size of the buffer; a whole number of pages
+    static constexpr std::size_t kBufferSize = 1 << 20;
+
+    /// The copy constructor is not used, so declutter.
+    Filler(const Filler &) = delete;
+    /// The assignment operator is also not used, so cleaned up.
+    Filler &operator=(const Filler &) = delete;
+    /// The move operations are unused, and cleaned up.
+    Filler(Filler &&) = delete;
+    Filler &operator=(Filler &&) = delete;
+
+    /// Destructor. Frees the buffer
+    ~Filler();
+
+    /// \brief Get the process wide filler, creating it if needed
+    /// \return Filler the shared filler
+    static const Filler &instance(void);
+
+    /// \brief Write filler to a stream
+    ///
+    /// \param[in,out] stream The stream to write to
+    /// \param[in] size The number of bytes to write
+    /// \return ostream The stream
+    std::ostream &Write(std::ostream &stream, std::uint64_t size) const;
+
+   private:
+    /// \brief Constructor, only called by instance()
+    Filler();
+
+    char *buffer_;  ///< The page aligned filler
+  };
+
+}  // namespace fidi
+
+#endif /* FIDI_FILLER_H */
+
+//
+// fidi_filler.h ends here
@@ -0,0 +1,153 @@
+// fidi_health.h ---  -*- mode: c++; -*-
+
+// Copyright 2018-2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied.  See the License for the specific language governing
+// permissions and limitations under the License.
+
+/// \file
+/// \ingroup app
+///
+/// This file contains the health and responsiveness state shared by
+/// all requests to each node hosted by the fidi (φίδι) HTTP server.
+
+// Code:
+
+#ifndef FIDI_HEALTH_H
+#  define FIDI_HEALTH_H
+
+#  include <atomic>
+#  include <chrono>
+#  include <limits>
+#  include <string>
+
+namespace fidi {
+
+  /// \brief Whether the application is healthy, and responsive
+  ///
+  /// Every request, and every health check, reads this state, while
+  /// only the rare request with a healthy or unresponsive_for
+  /// attribute changes it. So it is kept in atomics, and reading it
+  /// takes no lock. The two values are independent, so relaxed
+  /// ordering is enough.
+  class HealthState {
+   public:
+    /// The clock the responsiveness deadline is measured on
+    typedef std::chrono::steady_clock Clock;
+
+    /// The default constructor, healthy and responsive
+    HealthState() : healthy_(true), unresponsive_until_(kNever) {}
+
+    /// The copy constructor is not used, so declutter.
+    HealthState(const HealthState &) = delete;
+    /// The assignment operator is also not used, so cleaned up.
+    HealthState &operator=(const HealthState &) = delete;
+    /// The move operations are unused, and cleaned up.
+    HealthState(HealthState &&) = delete;
+    HealthState &operator=(HealthState &&) = delete;
+
+    /// \brief Is the application healthy right now?
+    /// \return bool true if the application is healthy
+    bool
+    get_healthy(void) const {
+      return healthy_.load(std::memory_order_relaxed);
+    }
+
+    /// \brief Set whether health checks should pass
+    ///
+    /// \param[in] healthy true if the application is healthy
+    void
+    set_healthy(bool healthy) {
+      healthy_.store(healthy, std::memory_order_relaxed);
+    }
+
+    /// \brief Is the application responding right now?
+    ///
+    /// Unless the application has been made unresponsive, this does
+    /// not even read the clock.
+    ///
+    /// \return bool true if the application is responsive
+    bool
+    IsResponsive(void) const {
+      Clock::rep until = unresponsive_until_.load(std::memory_order_relaxed);
+      if (until == kNever) { return true; }
+      return Clock::now().time_since_epoch().count() > until;
+    }
+
+    /// \brief Drop all requests until a given time
+    ///
+    /// \param[in] until The time to start responding again
+    void
+    SetUnresponsiveUntil(Clock::time_point until) {
+      unresponsive_until_.store(until.time_since_epoch().count(),
+                                std::memory_order_relaxed);
+    }
+
+   private:
+    /// The deadline when the application has never been unresponsive
+    static constexpr Clock::rep kNever = std::numeric_limits<Clock::rep>::min();
+
+    static_assert(std::atomic<Clock::rep>::is_always_lock_free,
+                  "Clock ticks must be lock free to read");
+
+    std::atomic<bool>       healthy_;  ///< Whether health checks pass
+    std::atomic<Clock::rep> unresponsive_until_;  ///< Ticks of Clock to
+                                                  ///< drop requests until
+  };
+
+  /// \brief One logical node of the topology, hosted by this process
+  ///
+  /// A process may listen on many ports, each one a node of the
+  /// service being mocked. The nodes share the worker threads, the
+  /// downstream call executor, the connection pool and the logs, but
+  /// each has its own health and responsiveness, so that a request
+  /// making one node unhealthy leaves the others alone.
+  class NodeState {
+   public:
+    /// \brief Constructor
+    ///
+    /// \param[in] name The name spans are recorded under, host:port
+    explicit NodeState(const std::string &name) : name_(name), health_() {}
+
+    /// The copy constructor is not used, so declutter.
+    NodeState(const NodeState &) = delete;
+    /// The assignment operator is also not used, so cleaned up.
+    NodeState &operator=(const NodeState &) = delete;
+    /// The move operations are unused, and cleaned up.
+    NodeState(NodeState &&) = delete;
+    NodeState &operator=(NodeState &&) = delete;
+
+    /// \brief The name of the node
+    /// \return string The host name and port of the node
+    const std::string &
+    get_name(void) const {
+      return name_;
+    }
+
+    /// \brief The health of the node
+    /// \return HealthState The health and responsiveness of the node
+    HealthState &
+    get_health_state(void) {
+      return health_;
+    }
+
+   private:
+    const std::string name_;    ///< The host name and port of the node
+    HealthState       health_;  ///< Shared by all requests to the node
+  };
+
+}  // namespace fidi
+
+#endif /* FIDI_HEALTH_H */
+
+//
+// fidi_health.h ends here
@@ -0,0 +1,176 @@
+// fidi_hedge.cc ---  -*- mode: c++; -*-
+
+// Copyright 2018-2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied.  See the License for the specific language governing
+// permissions and limitations under the License.
+
+/// \file
+/// \ingroup app
+///
+/// This file provides the implementation of the hedged downstream
+/// calls of the fidi (φίδι) HTTP server.
+
+// Code:
+
+#include "src/fidi_hedge.h"
+
+#include <utility>
+
+#include "src/fidi_bulkhead.h"
+#include "src/fidi_metrics.h"
+
+fidi::HedgedCall::HedgedCall(std::shared_ptr<fidi::AppCaller> original,
+                             std::shared_ptr<fidi::AppCaller> hedge,
+                             const std::string &destination,
+                             std::size_t        limit,
+                             std::shared_ptr<fidi::CallGroup> calls) :
+    mtx_(),
+    callers_{std::move(original), std::move(hedge)},
+    destination_(destination),
+    limit_(limit),
+    calls_(std::move(calls)),
+    timer_(0),
+    timer_pending_(false),
+    settled_(false),
+    done_(false),
+    launched_(0),
+    finished_(0) {}
+
+std::chrono::milliseconds
+fidi::HedgedCall::Delay(const std::map<std::string, std::string> &options,
+                        const std::string &destination) {
+  // The sanity checks should ensure these are integers
+  auto it = options.find("hedge_percentile");
+  if (it != options.end()) {
+    auto observed = fidi::Metrics::instance().CallPercentile(
+        destination, std::stod(it->second), kMinCalls);
+    if (observed.count() > 0) {
+      return std::chrono::milliseconds((observed.count() + 999) / 1000);
+    }
+  }
+  // Too few calls to go by, or no percentile asked for
+  it = options.find("hedge_ms");
+  if (it != options.end()) {
+    return std::chrono::milliseconds(std::stol(it->second));
+  }
+  return std::chrono::milliseconds(0);
+}
+
+void
+fidi::HedgedCall::Start(std::chrono::milliseconds delay) {
+  {
+    std::lock_guard<std::mutex> lock(mtx_);
+    launched_      = 1;
+    timer_pending_ = true;
+  }
+  auto self = shared_from_this();
+  Launch(0);
+  auto id = fidi::TimerWheel::instance().Schedule(
+      delay, [self] { self->OnTimer(); });
+  bool answered = false;
+  {
+    std::lock_guard<std::mutex> lock(mtx_);
+    timer_   = id;
+    answered = finished_ > 0 && timer_pending_;
+  }
+  // The original may have been answered before the timer was set
+  if (answered) { CancelTimer(id); }
+}
+
+void
+fidi::HedgedCall::CancelTimer(fidi::TimerWheel::TimerId timer) {
+  if (!fidi::TimerWheel::instance().Cancel(timer)) { return; }
+  bool done = false;
+  {
+    std::lock_guard<std::mutex> lock(mtx_);
+    timer_pending_ = false;
+    done           = TakeDone();
+  }
+  if (done) { calls_->Done(); }
+}
+
+void
+fidi::HedgedCall::Launch(int which) {
+  auto self = shared_from_this();
+  fidi::Bulkhead::instance().Submit(
+      destination_, limit_, [self, which](std::function<void()> finish) {
+        self->callers_[which]->Start([self, which, finish] {
+          finish();
+          self->Finished(which);
+        });
+      });
+}
+
+void
+fidi::HedgedCall::Finished(int which) {
+  int  status       = callers_[which]->get_status();
+  bool good         = status > 0 && status < 500;
+  bool cancel_loser = false;
+  bool cancel_timer = false;
+  bool done         = false;
+  fidi::TimerWheel::TimerId timer = 0;
+  {
+    std::lock_guard<std::mutex> lock(mtx_);
+    finished_++;
+    if (good && !settled_) {
+      settled_     = true;
+      cancel_loser = launched_ > 1;
+      if (which == 1) {
+        fidi::Metrics::instance().RecordHedgeWon(destination_);
+      }
+    }
+    // Once the original is answered, good or bad, there is no
+    // reason to send the duplicate
+    if (which == 0 && timer_pending_ && timer_ != 0) {
+      cancel_timer = true;
+      timer        = timer_;
+    }
+    done = TakeDone();
+  }
+  if (done) { calls_->Done(); }
+  if (cancel_loser) { callers_[1 - which]->Cancel(); }
+  if (cancel_timer) { CancelTimer(timer); }
+}
+
+void
+fidi::HedgedCall::OnTimer(void) {
+  bool hedge = false;
+  bool done  = false;
+  {
+    std::lock_guard<std::mutex> lock(mtx_);
+    timer_pending_ = false;
+    if (!settled_ && finished_ == 0) {
+      hedge = true;
+      launched_++;
+    }
+    done = TakeDone();
+  }
+  if (done) { calls_->Done(); }
+  if (hedge) {
+    fidi::Metrics::instance().RecordHedgeSent(destination_);
+    Launch(1);
+  }
+}
+
+bool
+fidi::HedgedCall::TakeDone(void) {
+  if (done_) { return false; }
+  if (settled_ || (finished_ == launched_ && !timer_pending_)) {
+    done_ = true;
+    return true;
+  }
+  return false;
+}
+
+//
+// fidi_hedge.cc ends here
@@ -0,0 +1,153 @@
+// fidi_hedge.h ---  -*- mode: c++; -*-
+
+// Copyright 2018-2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied.  See the License for the specific language governing
+// permissions and limitations under the License.
+
+/// \file
+/// \ingroup app
+///
+/// This file contains the hedged downstream calls of the fidi (φίδι)
+/// HTTP server.
+
+// Code:
+
+#ifndef FIDI_HEDGE_H
+#  define FIDI_HEDGE_H
+
+#  include <chrono>
+#  include <cstddef>
+#  include <functional>
+#  include <map>
+#  include <memory>
+#  include <mutex>
+#  include <string>
+
+#  include "src/fidi_app_caller.h"
+#  include "src/fidi_executor.h"
+#  include "src/fidi_timer_wheel.h"
+
+namespace fidi {
+
+  /// \brief A downstream call, and a duplicate sent if it is slow
+  ///
+  /// Hedging trades extra load for a shorter tail: if the original
+  /// request has not been answered after a delay, a duplicate is
+  /// sent, the first good answer is taken, and the other request is
+  /// cancelled. A good answer is any HTTP status below 500. If the
+  /// original is answered badly before the delay, no duplicate is
+  /// sent; hedging is for slow calls, not failed ones.
+  ///
+  /// The delay is given with the hedge_ms attribute of the call, or
+  /// found from the latency of earlier calls to the same destination
+  /// with hedge_percentile, so that only the slowest calls are
+  /// hedged. Hedges sent, and hedges answered first, are counted by
+  /// fidi::Metrics.
+  ///
+  /// The call is one job of its fidi::CallGroup, done as soon as
+  /// there is a good answer, or once both requests are answered
+  /// badly. The duplicate is started by the fidi::TimerWheel, so no
+  /// thread waits for the delay.
+  class HedgedCall : public std::enable_shared_from_this<HedgedCall> {
+   public:
+    /// The fewest calls to a destination to estimate a percentile from
+    static constexpr std::uint64_t kMinCalls = 20;
+
+    /// \brief Constructor
+    ///
+    /// \param[in] original The request sent first
+    /// \param[in] hedge The duplicate, sent after the delay
+    /// \param[in] destination The host:port called, for the metrics
+    /// \param[in] limit The most calls in flight to the destination,
+    ///            which the duplicate counts against too
+    /// \param[in] calls The group the call is a job of; it should
+    ///            already count the call
+    HedgedCall(std::shared_ptr<fidi::AppCaller> original,
+               std::shared_ptr<fidi::AppCaller> hedge,
+               const std::string &destination, std::size_t limit,
+               std::shared_ptr<fidi::CallGroup> calls);
+
+    /// The copy constructor is not used, so declutter.
+    HedgedCall(const HedgedCall &) = delete;
+    /// The assignment operator is also not used, so cleaned up.
+    HedgedCall &operator=(const HedgedCall &) = delete;
+    /// The move operations are unused, and cleaned up.
+    HedgedCall(HedgedCall &&) = delete;
+    HedgedCall &operator=(HedgedCall &&) = delete;
+
+    /// Destructor. The members clean themselves
+    ~HedgedCall() {}
+
+    /// \brief Find how long to wait before hedging a call
+    ///
+    /// \param[in] options The attributes of the call
+    /// \param[in] destination The host:port called
+    /// \return milliseconds The delay, or zero if the call is not
+    ///         hedged
+    static std::chrono::milliseconds Delay(
+        const std::map<std::string, std::string> &options,
+        const std::string &                       destination);
+
+    /// \brief Send the original request, and schedule the duplicate
+    ///
+    /// \param[in] delay How long to wait for an answer before hedging
+    void Start(std::chrono::milliseconds delay);
+
+   private:
+    /// \brief Run one of the requests, through the fidi::Bulkhead
+    ///
+    /// \param[in] which 0 for the original, 1 for the duplicate
+    void Launch(int which);
+
+    /// \brief Note that one of the requests has been answered
+    ///
+    /// \param[in] which 0 for the original, 1 for the duplicate
+    void Finished(int which);
+
+    /// \brief The hedging delay has passed
+    void OnTimer(void);
+
+    /// \brief Stop the duplicate being sent
+    ///
+    /// If the timer has already fired, OnTimer() sees the original
+    /// has been answered, and does not send the duplicate.
+    ///
+    /// \param[in] timer The timer that would send it
+    void CancelTimer(fidi::TimerWheel::TimerId timer);
+
+    /// \brief Should the group be told the call is done?
+    ///
+    /// Must be called with the mutex held. Only ever true once.
+    ///
+    /// \return bool true if the caller should mark the job done
+    bool TakeDone(void);
+
+    std::mutex                       mtx_;  ///< Protects everything below
+    std::shared_ptr<fidi::AppCaller> callers_[2];  ///< Original and hedge
+    const std::string                destination_;  ///< host:port called
+    const std::size_t                limit_;  ///< Calls in flight to it
+    std::shared_ptr<fidi::CallGroup> calls_;  ///< The group to tell
+    fidi::TimerWheel::TimerId timer_;  ///< Sends the duplicate, 0 until set
+    bool timer_pending_;  ///< The duplicate may yet be sent
+    bool settled_;        ///< A good answer has been taken
+    bool done_;           ///< The group has been told
+    int  launched_;       ///< Requests sent
+    int  finished_;       ///< Requests answered, or failed
+  };
+
+}  // namespace fidi
+
+#endif /* FIDI_HEDGE_H */
+
+//
+// fidi_hedge.h ends here
@@ -120,6 +120,9 @@ main(const int argc, const char **argv) {
   }
   driver.Execute(std::cout) << std::endl;
   if (driver.nerrors_ != 0) { return (EXIT_FAILURE); }
+  // A request that fails the sanity checks, say with calls waiting
+  // for each other in a cycle, would be rejected by fidi_app too
+  if (driver.get_warnings().first != 0) { return (EXIT_FAILURE); }
 
   return (EXIT_SUCCESS);
 }
@@ -32,6 +32,7 @@
 #include <iostream>
 #include <sstream>
 #include <string>
+#include <vector>
 
 fidi::LintDriver::~LintDriver() {
   delete scanner_;
@@ -91,6 +92,41 @@ HandleBlob(std::ostream &stream, const std::string &caller,
   return stream;
 }
 
+std::ostream &
+fidi::LintDriver::RenderCalls(std::ostream &                  stream,
+                              const std::vector<EdgeDetails> &calls) {
+  // Each cluster needs a name of its own, across all the sub parsers
+  static int clusters = 0;
+
+  std::vector<std::vector<std::size_t>> after;
+  std::string                           error;
+  // A lone call waits for nothing; a cycle is reported as a warning
+  if (calls.size() < 2 || !Dependencies(calls, &after, &error)) {
+    return stream;
+  }
+  std::string prefix("call_" + std::to_string(++clusters) + "_");
+  stream << "  subgraph cluster_" << clusters << " {\n";
+  stream << "    label=\"calls by " << name_ << " at " << global_sequence_
+         << "\";\n    node [shape=box];\n";
+  for (std::size_t call = 0; call < calls.size(); ++call) {
+    stream << "    " << prefix << call << " [ label=\"" << calls[call].name
+           << "\\nsequence=" << calls[call].edge_attr.second;
+    auto id_it = calls[call].options.find("id");
+    if (id_it != calls[call].options.end()) {
+      stream << "\\nid=" << id_it->second;
+    }
+    stream << "\" ];\n";
+  }
+  for (std::size_t call = 0; call < calls.size(); ++call) {
+    for (auto prerequisite : after[call]) {
+      stream << "    " << prefix << prerequisite << " -> " << prefix << call
+             << ";\n";
+    }
+  }
+  stream << "  }\n";
+  return stream;
+}
+
 std::ostream &
 fidi::LintDriver::Execute(std::ostream &stream) {
   // Run sanity checks
@@ -127,24 +163,24 @@ fidi::LintDriver::Execute(std::ostream &stream) {
   }
   stream << std::endl;
 
-  // We now walk through the calls we have to make
+  std::vector<EdgeDetails> calls;
   while (!edge_attributes_.empty()) {
-    auto current_sequence = edge_attributes_.top().edge_attr.second;
-
-    while (!edge_attributes_.empty() &&
-           current_sequence == edge_attributes_.top().edge_attr.second) {
-      // Handle the edge, and call handle blob to process the payload
-      std::pair<int, std::string> sub_warnings;
-      auto                        node = edge_attributes_.top();
-      std::string                 new_sequence(global_sequence_);
-      new_sequence.append(".").append(std::to_string(current_sequence));
-      HandleBlob(stream, name_, node.name, node_glob_ + node.blob, new_sequence,
-                 sub_warnings);
-      if (sub_warnings.first) {
-        num_warnings_ += sub_warnings.first;
-        warnings_.append(sub_warnings.second);
-      }
-      edge_attributes_.pop();
+    calls.push_back(edge_attributes_.top());
+    edge_attributes_.pop();
+  }
+  RenderCalls(stream, calls);
+
+  // We now walk through the calls we have to make
+  for (auto const &node : calls) {
+    // Handle the edge, and call handle blob to process the payload
+    std::pair<int, std::string> sub_warnings;
+    std::string                 new_sequence(global_sequence_);
+    new_sequence.append(".").append(std::to_string(node.edge_attr.second));
+    HandleBlob(stream, name_, node.name, node_glob_ + node.blob, new_sequence,
+               sub_warnings);
+    if (sub_warnings.first) {
+      num_warnings_ += sub_warnings.first;
+      warnings_.append(sub_warnings.second);
     }
   }
   if (caller_.compare("Source") == 0) { stream << "\n}\n"; }
@@ -120,6 +120,18 @@ namespace fidi {
     void ParseHelper(std::istream &stream);
 
    private:
+    /// \brief Draw the calls of this request, and what they wait for
+    ///
+    /// With more than one call, the calls are drawn as a cluster of
+    /// their own, with an arrow from each call to the calls that wait
+    /// for it (see Driver::Dependencies()). Calls that wait for each
+    /// other in a cycle are not drawn; the sanity checks report them.
+    ///
+    /// \param[in,out] stream output stream the dot graph is written to.
+    /// \param[in] calls The calls, in sequence order
+    std::ostream &RenderCalls(std::ostream &                  stream,
+                              const std::vector<EdgeDetails> &calls);
+
     fidi::Parser *parser_ = nullptr;  ///< A reference to the parser
                                       ///< created for handling this
                                       ///< request
@@ -0,0 +1,279 @@
+// fidi_local_dispatch.cc ---  -*- mode: c++; -*-
+
+// Copyright 2018-2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied.  See the License for the specific language governing
+// permissions and limitations under the License.
+
+/// \file
+/// \ingroup app
+///
+/// This file provides the implementation of the in-process transport
+/// of the fidi (φίδι) HTTP server.
+
+// Code:
+
+#include "src/fidi_local_dispatch.h"
+
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <sstream>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <utility>
+
+#include "src/fidi_app_driver.h"
+#include "src/fidi_executor.h"
+#include "src/fidi_logging.h"
+#include "src/fidi_metrics.h"
+#include "src/fidi_timer_wheel.h"
+
+bool                      fidi::LocalDispatch::configured_enabled_ = false;
+std::chrono::microseconds fidi::LocalDispatch::configured_delay_(0);
+std::size_t               fidi::LocalDispatch::configured_max_threads_ = 256;
+
+fidi::LocalDispatch::LocalDispatch(bool                      enabled,
+                                   std::chrono::microseconds delay,
+                                   std::size_t               max_threads) :
+    enabled_(enabled),
+    delay_(delay),
+    max_threads_(max_threads),
+    hosts_({"localhost", "127.0.0.1", "::1", "[::1]"}),
+    nodes_(),
+    mtx_(),
+    work_cv_(),
+    exit_cv_(),
+    jobs_(),
+    threads_(0),
+    idle_(0),
+    capped_(false),
+    stopping_(false) {}
+
+fidi::LocalDispatch::~LocalDispatch() {
+  std::unique_lock<std::mutex> lock(mtx_);
+  stopping_ = true;
+  work_cv_.notify_all();
+  exit_cv_.wait(lock, [this] { return threads_ == 0; });
+}
+
+void
+fidi::LocalDispatch::Configure(bool enabled, std::chrono::microseconds delay,
+                               std::size_t max_threads) {
+  configured_enabled_     = enabled;
+  configured_delay_       = delay;
+  configured_max_threads_ = max_threads;
+}
+
+fidi::LocalDispatch &
+fidi::LocalDispatch::instance(void) {
+  static fidi::LocalDispatch dispatch(configured_enabled_, configured_delay_,
+                                      configured_max_threads_);
+  return dispatch;
+}
+
+void
+fidi::LocalDispatch::Register(const std::string &host, std::uint16_t port,
+                              fidi::NodeState *node) {
+  hosts_.insert(host);
+  nodes_[port] = node;
+}
+
+fidi::NodeState *
+fidi::LocalDispatch::Find(const std::string &host, std::uint16_t port) const {
+  if (!enabled_ || hosts_.count(host) == 0) { return nullptr; }
+  auto it = nodes_.find(port);
+  return it == nodes_.end() ? nullptr : it->second;
+}
+
+void
+fidi::LocalDispatch::Call(fidi::NodeState &node, const fidi::Payload &payload,
+                          const std::string &       content_type,
+                          const std::string &       nodes_hash,
+                          const fidi::TraceContext &parent,
+                          const std::string &       seed,
+                          std::chrono::microseconds timeout,
+                          Callback                  answered) {
+  // Whichever of the answer and the timeout comes first settles the
+  // call; the other is ignored
+  struct Pending {
+    explicit Pending(Callback callback) :
+        settled(false), timer(0), answered(std::move(callback)) {}
+    std::atomic<bool>                      settled;
+    std::atomic<fidi::TimerWheel::TimerId> timer;
+    Callback                               answered;
+  };
+  auto pending = std::make_shared<Pending>(std::move(answered));
+  auto settle  = [pending](int status) {
+    if (pending->settled.exchange(true)) { return false; }
+    fidi::Executor::instance().Post(
+        [pending, status] { pending->answered(status); });
+    return true;
+  };
+
+  if (timeout.count() > 0) {
+    // The wheel counts whole milliseconds; never time out early
+    std::chrono::milliseconds wait((timeout.count() + 999) / 1000);
+    pending->timer = fidi::TimerWheel::instance().Schedule(
+        wait, [settle] { settle(0); });
+  }
+  if (!node.get_health_state().IsResponsive()) {
+    // No answer is coming, so the call times out
+    if (timeout.count() <= 0) { settle(0); }
+    return;
+  }
+
+  Run([this, &node, payload, content_type, nodes_hash, parent, seed,
+       settle, pending] {
+    if (delay_.count() > 0) { std::this_thread::sleep_for(delay_); }
+    int status = 0;
+    try {
+      status = Handle(node, payload, content_type, nodes_hash, parent, seed);
+    } catch (std::exception &ex) {
+      fidi::Log::File().error("In-process call to " + node.get_name() +
+                              " failed: " + ex.what());
+    } catch (...) {
+      fidi::Log::File().error("In-process call to " + node.get_name() +
+                              " failed");
+    }
+    // A failed call is answered at once, not left to time out
+    if (settle(status)) {
+      auto timer = pending->timer.load();
+      if (timer != 0) { fidi::TimerWheel::instance().Cancel(timer); }
+    }
+  });
+}
+
+void
+fidi::LocalDispatch::Run(std::function<void()> job) {
+  std::lock_guard<std::mutex> lock(mtx_);
+  jobs_.push_back(std::move(job));
+  if (jobs_.size() <= idle_) {
+    work_cv_.notify_one();
+    return;
+  }
+  if (threads_ >= max_threads_) {
+    // The job waits for a thread to finish the one it has
+    if (!capped_) {
+      capped_ = true;
+      fidi::Log::File().warning(
+          "In-process calls are using all " + std::to_string(max_threads_) +
+          " threads; calls are queued");
+    }
+    return;
+  }
+  // Every thread is busy, and may be waiting on this very job. The
+  // new thread waits for the lock, so counts itself only after this
+  try {
+    std::thread(&fidi::LocalDispatch::Worker, this).detach();
+  } catch (std::system_error &ex) {
+    // Left for the threads there are, or to time out
+    fidi::Log::File().error(std::string("In-process call thread: ") +
+                            ex.what());
+    return;
+  }
+  threads_++;
+}
+
+void
+fidi::LocalDispatch::Worker(void) {
+  std::unique_lock<std::mutex> lock(mtx_);
+  for (;;) {
+    idle_++;
+    bool woken = work_cv_.wait_for(lock, kIdleTimeout, [this] {
+      return stopping_ || !jobs_.empty();
+    });
+    idle_--;
+    if (jobs_.empty()) {
+      if (!woken || stopping_) { break; }
+      continue;
+    }
+    std::function<void()> job(std::move(jobs_.front()));
+    jobs_.pop_front();
+    if (jobs_.empty()) { capped_ = false; }
+    lock.unlock();
+    try {
+      job();
+    } catch (...) {
+      // The job settles its own call; never let one kill a thread
+    }
+    lock.lock();
+  }
+  threads_--;
+  exit_cv_.notify_all();
+}
+
+int
+fidi::LocalDispatch::Handle(fidi::NodeState &node, const fidi::Payload &payload,
+                            const std::string &       content_type,
+                            const std::string &       nodes_hash,
+                            const fidi::TraceContext &parent,
+                            const std::string &       seed) const {
+  // The same steps as the request handler, without the HTTP
+  auto               start   = std::chrono::steady_clock::now();
+  fidi::Metrics &    metrics = fidi::Metrics::instance();
+  fidi::Tracer &     tracer  = fidi::Tracer::instance();
+  fidi::AppDriver    driver;
+  int                status = 200;
+  fidi::TraceContext span   = tracer.StartSpan(parent);
+  driver.set_node(&node);
+  driver.set_trace(span);
+  driver.set_seed(seed);
+  try {
+    driver.set_content_type(content_type);
+    driver.set_node_table(nodes_hash);
+    fidi::Payload::Reader reader(payload);
+    std::istream          stream(&reader);
+    driver.Parse(stream);
+    metrics.RecordPhase(fidi::Metrics::Phase::kParse,
+                        std::chrono::steady_clock::now() - start);
+
+    std::string errors;
+    if (driver.get_missing_nodes()) {
+      status = 412;
+    } else if (driver.get_errors().first != 0) {
+      errors = driver.get_errors().second;
+      status = 400;
+    } else {
+      auto checked = std::chrono::steady_clock::now();
+      int  warning = driver.SanityChecks(&errors);
+      metrics.RecordPhase(fidi::Metrics::Phase::kSanityCheck,
+                          std::chrono::steady_clock::now() - checked);
+      if (warning) { status = 400; }
+    }
+    if (status == 400) { fidi::Log::File().error("Errors " + errors); }
+    if (status == 200) {
+      // The response body is not wanted, only its status
+      std::ostringstream discard;
+      driver.Execute(discard);
+      if (driver.get_status() != 0) { status = driver.get_status(); }
+    }
+  } catch (std::bad_alloc &ba) {
+    std::cerr << "Got memory error: " << ba.what() << "\n";
+    std::cerr.flush();
+    return 0;
+  }  // Fail fast on OOM
+
+  auto end = std::chrono::steady_clock::now();
+  metrics.RecordRequest(end - start);
+  if (tracer.enabled()) {
+    tracer.Record(node.get_name(), span, parent.span_id, "handle", start, end,
+                  {{"status", std::to_string(status)}});
+  }
+  return status;
+}
+
+//
+// fidi_local_dispatch.cc ends here
@@ -0,0 +1,218 @@
+// fidi_local_dispatch.h ---  -*- mode: c++; -*-
+
+// Copyright 2018-2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied.  See the License for the specific language governing
+// permissions and limitations under the License.
+
+/// \file
+/// \ingroup app
+///
+/// This file contains the in-process transport of the fidi (φίδι)
+/// HTTP server, for downstream calls to nodes hosted by the same
+/// process.
+
+// Code:
+
+#ifndef FIDI_LOCAL_DISPATCH_H
+#  define FIDI_LOCAL_DISPATCH_H
+
+#  include <chrono>
+#  include <condition_variable>
+#  include <cstddef>
+#  include <cstdint>
+#  include <deque>
+#  include <functional>
+#  include <map>
+#  include <mutex>
+#  include <set>
+#  include <string>
+
+#  include "src/fidi_health.h"
+#  include "src/fidi_payload.h"
+#  include "src/fidi_trace.h"
+
+namespace fidi {
+
+  /// \brief Calls to nodes hosted by this process, without HTTP
+  ///
+  /// When a process hosts many nodes (see fidi::NodeState), most
+  /// downstream calls go to a node in the same process. Made over
+  /// HTTP, each of these writes the payload to a loopback socket, and
+  /// parses the HTTP messages at both ends. With in-process calls,
+  /// the payload buffers are handed straight to the parser of the
+  /// node called.
+  ///
+  /// The request is handled on a thread of the dispatcher's own,
+  /// not on the thread making the call, which is free as soon as the
+  /// call is made. The node called may well make in-process calls of
+  /// its own, and wait for them, so a thread is started whenever
+  /// none is idle, up to a limit; past it, requests queue for the
+  /// next free thread, and a call that waits too long times out
+  /// like any other. Threads left idle for a while go away.
+  ///
+  /// What the request models is kept: its delays and calls, the
+  /// status it answers with, 400 for bad requests and 412 for a
+  /// missing node table. An unresponsive node is not answered, so the
+  /// call times out, after its timeout, which the fidi::TimerWheel
+  /// enforces; an answer that comes later is ignored. A modeled
+  /// network delay may be added to each call, in place of the time
+  /// taken by the network.
+  class LocalDispatch {
+   public:
+    /// \brief Run once a call is answered, or times out
+    ///
+    /// The argument is the status of the response, or 0 if the call
+    /// timed out.
+    typedef std::function<void(int)> Callback;
+
+    /// How long a thread waits for another request before going away
+    static constexpr std::chrono::seconds kIdleTimeout{30};
+
+    /// The copy constructor is not used, so declutter.
+    LocalDispatch(const LocalDispatch &) = delete;
+    /// The assignment operator is also not used, so cleaned up.
+    LocalDispatch &operator=(const LocalDispatch &) = delete;
+    /// The move operations are unused, and cleaned up.
+    LocalDispatch(LocalDispatch &&) = delete;
+    LocalDispatch &operator=(LocalDispatch &&) = delete;
+
+    /// \brief Destructor
+    ///
+    /// Waits for the requests being handled. The nodes are not ours
+    /// to clean up.
+    ~LocalDispatch();
+
+    /// \brief Set whether calls are made in-process, and their delay
+    ///
+    /// This only has effect if called before the first call to
+    /// instance().
+    ///
+    /// \param[in] enabled Make calls to local nodes in-process
+    /// \param[in] delay The modeled network delay added to each call
+    /// \param[in] max_threads The most threads handling requests
+    static void Configure(bool enabled, std::chrono::microseconds delay,
+                          std::size_t max_threads);
+
+    /// \brief Get the process wide dispatcher, creating it if needed
+    /// \return LocalDispatch the shared dispatcher
+    static LocalDispatch &instance(void);
+
+    /// \brief Are calls to local nodes made in-process?
+    /// \return bool true if they are
+    bool
+    enabled(void) const {
+      return enabled_;
+    }
+
+    /// \brief Add a node hosted by this process
+    ///
+    /// All nodes are added before the servers start, and so before
+    /// any call is made; after that the nodes are only read, and
+    /// need no lock.
+    ///
+    /// \param[in] host The name of this host
+    /// \param[in] port The port the node listens on
+    /// \param[in] node The node, which must outlive the calls
+    void Register(const std::string &host, std::uint16_t port,
+                  fidi::NodeState *node);
+
+    /// \brief Find the node hosted by this process at an address
+    ///
+    /// \param[in] host The host called
+    /// \param[in] port The port called
+    /// \return NodeState The node, or nullptr if it is not local, or
+    ///         calls are not made in-process
+    fidi::NodeState *Find(const std::string &host, std::uint16_t port) const;
+
+    /// \brief Make a call to a local node, without waiting for it
+    ///
+    /// The callback is run once, on the fidi::Executor, with the
+    /// status of the response, or with 0 once the timeout has
+    /// passed, whichever comes first.
+    ///
+    /// \param[in] node The node called
+    /// \param[in] payload The request
+    /// \param[in] content_type The Content-Type of the request
+    /// \param[in] nodes_hash The hash of the node table, if shared
+    /// \param[in] parent The span making the call, if tracing
+    /// \param[in] seed The seed passed on by the caller, if any
+    /// \param[in] timeout How long the caller waits for an answer,
+    ///            zero for ever
+    /// \param[in] answered Run with the answer
+    void Call(fidi::NodeState &node, const fidi::Payload &payload,
+              const std::string &content_type, const std::string &nodes_hash,
+              const fidi::TraceContext &parent, const std::string &seed,
+              std::chrono::microseconds timeout, Callback answered);
+
+   private:
+    /// \brief Handle a request to a local node, in this thread
+    ///
+    /// \param[in] node The node called
+    /// \param[in] payload The request
+    /// \param[in] content_type The Content-Type of the request
+    /// \param[in] nodes_hash The hash of the node table, if shared
+    /// \param[in] parent The span making the call, if tracing
+    /// \param[in] seed The seed passed on by the caller, if any
+    /// \return int The status of the response, or 0 if it failed
+    int Handle(fidi::NodeState &node, const fidi::Payload &payload,
+               const std::string &content_type, const std::string &nodes_hash,
+               const fidi::TraceContext &parent,
+               const std::string &       seed) const;
+
+    /// \brief Run a job on a thread of the dispatcher
+    ///
+    /// An idle thread takes the job, or a new one is started, unless
+    /// there are already as many as allowed; then the job waits for
+    /// a thread to be done with its own.
+    ///
+    /// \param[in] job The work to do
+    void Run(std::function<void()> job);
+
+    /// The body of each thread
+    void Worker(void);
+
+    /// \brief Constructor, only called by instance()
+    ///
+    /// \param[in] enabled Make calls to local nodes in-process
+    /// \param[in] delay The modeled network delay added to each call
+    /// \param[in] max_threads The most threads handling requests
+    LocalDispatch(bool enabled, std::chrono::microseconds delay,
+                  std::size_t max_threads);
+
+    static bool configured_enabled_;  ///< Set by Configure()
+    static std::chrono::microseconds configured_delay_;  ///< Ditto
+    static std::size_t configured_max_threads_;          ///< Ditto
+
+    const bool                      enabled_;  ///< Make calls in-process
+    const std::chrono::microseconds delay_;    ///< Modeled network delay
+    const std::size_t max_threads_;  ///< The most threads at once
+    std::set<std::string> hosts_;  ///< The names this host is called by
+    std::map<std::uint16_t, fidi::NodeState *>
+        nodes_;  ///< The nodes hosted, by port
+
+    std::mutex              mtx_;       ///< Protects everything below
+    std::condition_variable work_cv_;   ///< Signalled when a job is queued
+    std::condition_variable exit_cv_;   ///< Signalled as threads end
+    std::deque<std::function<void()>> jobs_;  ///< Jobs not yet taken
+    std::size_t threads_;   ///< Threads running
+    std::size_t idle_;      ///< Threads waiting for a job
+    bool        capped_;    ///< At the limit, and logged so
+    bool        stopping_;  ///< Set by the destructor
+  };
+
+}  // namespace fidi
+
+#endif /* FIDI_LOCAL_DISPATCH_H */
+
+//
+// fidi_local_dispatch.h ends here
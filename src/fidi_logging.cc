@@ -0,0 +1,204 @@
+// fidi_logging.cc ---  -*- mode: c++; -*-
+
+// Copyright 2018-2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied.  See the License for the specific language governing
+// permissions and limitations under the License.
+
+/// \file
+/// \ingroup app
+///
+/// This file provides the implementation of the cached loggers, and
+/// of the asynchronous logging backend, of the fidi (φίδι) HTTP
+/// server.
+
+// Code:
+
+#include "src/fidi_logging.h"
+
+#include <Poco/Timestamp.h>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <string>
+
+Poco::Logger *fidi::Log::file_    = nullptr;
+Poco::Logger *fidi::Log::console_ = nullptr;
+
+std::size_t fidi::AsyncLog::configured_ring_size_ = 256;
+
+void
+fidi::Log::CacheLoggers(void) {
+  file_    = &Poco::Logger::get("FileLogger");
+  console_ = &Poco::Logger::get("ConsoleLogger");
+}
+
+fidi::AsyncLog::AsyncLog(std::size_t ring_size) :
+    ring_size_(ring_size),
+    mtx_(),
+    cv_(),
+    rings_(),
+    stopping_(false),
+    stopped_(false),
+    written_(0),
+    thread_() {
+  thread_ = std::thread(&fidi::AsyncLog::Run, this);
+}
+
+fidi::AsyncLog::~AsyncLog() { Shutdown(); }
+
+void
+fidi::AsyncLog::Configure(std::size_t ring_size) {
+  // The rings wrap their indices with a mask
+  std::size_t size = 2;
+  while (size < ring_size) { size <<= 1; }
+  configured_ring_size_ = size;
+}
+
+fidi::AsyncLog &
+fidi::AsyncLog::instance(void) {
+  static fidi::AsyncLog async_log(configured_ring_size_);
+  return async_log;
+}
+
+fidi::AsyncLog::Ring &
+fidi::AsyncLog::ThisThreadRing(void) {
+  thread_local std::shared_ptr<Ring> ring;
+  if (!ring) {
+    // Only the first message from each thread takes the lock
+    ring = std::make_shared<Ring>(ring_size_);
+    std::lock_guard<std::mutex> lock(mtx_);
+    rings_.push_back(ring);
+  }
+  return *ring;
+}
+
+void
+fidi::AsyncLog::Push(Poco::Channel *target, const Poco::Message &message) {
+  Ring &ring = ThisThreadRing();
+  // Shutdown() waits for a push it may have missed before the last
+  // drain; either it sees the flag, or the push sees stopped_
+  ring.pushing.store(true);
+  if (stopped_.load()) {
+    ring.pushing.store(false, std::memory_order_release);
+    // Nothing drains the rings any more
+    target->log(message);
+    return;
+  }
+  std::uint64_t head = ring.head.load(std::memory_order_relaxed);
+  if (head - ring.tail.load(std::memory_order_acquire) >= ring.records.size()) {
+    ring.pushing.store(false, std::memory_order_release);
+    ring.dropped.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+
+  Record &record     = ring.records[head & ring.mask];
+  record.target      = target;
+  record.time        = message.getTime().epochMicroseconds();
+  record.priority    = static_cast<int>(message.getPriority());
+  const std::string &source = message.getSource();
+  const std::string &text   = message.getText();
+  record.source_size = static_cast<std::uint16_t>(
+      std::min(source.size(), kSourceSize));
+  record.text_size =
+      static_cast<std::uint16_t>(std::min(text.size(), kTextSize));
+  std::memcpy(record.source, source.data(), record.source_size);
+  std::memcpy(record.text, text.data(), record.text_size);
+  ring.head.store(head + 1, std::memory_order_release);
+  ring.pushing.store(false, std::memory_order_release);
+}
+
+std::size_t
+fidi::AsyncLog::Drain(void) {
+  std::vector<std::shared_ptr<Ring>> rings;
+  {
+    std::lock_guard<std::mutex> lock(mtx_);
+    rings = rings_;
+  }
+  std::size_t drained = 0;
+  for (auto &ring : rings) {
+    std::uint64_t tail = ring->tail.load(std::memory_order_relaxed);
+    std::uint64_t head = ring->head.load(std::memory_order_acquire);
+    for (; tail != head; ++tail) {
+      const Record &record = ring->records[tail & ring->mask];
+      Poco::Message message(
+          std::string(record.source, record.source_size),
+          std::string(record.text, record.text_size),
+          static_cast<Poco::Message::Priority>(record.priority));
+      message.setTime(Poco::Timestamp(record.time));
+      record.target->log(message);
+      drained++;
+    }
+    // Hand the whole batch back to the writer at once
+    ring->tail.store(tail, std::memory_order_release);
+  }
+  written_.fetch_add(drained, std::memory_order_relaxed);
+  return drained;
+}
+
+void
+fidi::AsyncLog::Run(void) {
+  std::unique_lock<std::mutex> lock(mtx_);
+  while (!stopping_) {
+    lock.unlock();
+    std::size_t drained = Drain();
+    lock.lock();
+    // Sleep a little while the rings are quiet
+    if (drained == 0 && !stopping_) {
+      cv_.wait_for(lock, std::chrono::milliseconds(2));
+    }
+  }
+}
+
+void
+fidi::AsyncLog::Shutdown(void) {
+  {
+    std::lock_guard<std::mutex> lock(mtx_);
+    if (stopping_) { return; }
+    stopping_ = true;
+  }
+  // From here on, pushes go straight to the channels
+  stopped_.store(true);
+  cv_.notify_all();
+  if (thread_.joinable()) { thread_.join(); }
+  std::vector<std::shared_ptr<Ring>> rings;
+  {
+    std::lock_guard<std::mutex> lock(mtx_);
+    rings = rings_;
+  }
+  // Pushes that began before stopped_ was set finish into the rings
+  for (auto &ring : rings) {
+    while (ring->pushing.load()) { std::this_thread::yield(); }
+  }
+  Drain();
+}
+
+fidi::AsyncLog::Stats
+fidi::AsyncLog::get_stats(void) {
+  Stats stats;
+  stats.written = written_.load();
+  stats.dropped = 0;
+  std::lock_guard<std::mutex> lock(mtx_);
+  for (auto const &ring : rings_) { stats.dropped += ring->dropped.load(); }
+  return stats;
+}
+
+fidi::RingChannel::RingChannel(Poco::Channel *target) :
+    Poco::Channel(), target_(target, true) {}
+
+void
+fidi::RingChannel::log(const Poco::Message &message) {
+  fidi::AsyncLog::instance().Push(target_.get(), message);
+}
+
+//
+// fidi_logging.cc ends here
@@ -0,0 +1,232 @@
+// fidi_logging.h ---  -*- mode: c++; -*-
+
+// Copyright 2018-2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied.  See the License for the specific language governing
+// permissions and limitations under the License.
+
+/// \file
+/// \ingroup app
+///
+/// This file contains the cached loggers, and the asynchronous
+/// logging backend, of the fidi (φίδι) HTTP server.
+
+// Code:
+
+#ifndef FIDI_LOGGING_H
+#  define FIDI_LOGGING_H
+
+#  include <atomic>
+#  include <condition_variable>
+#  include <cstddef>
+#  include <cstdint>
+#  include <memory>
+#  include <mutex>
+#  include <thread>
+#  include <vector>
+
+#  include <Poco/AutoPtr.h>
+#  include <Poco/Channel.h>
+#  include <Poco/Logger.h>
+#  include <Poco/Message.h>
+
+namespace fidi {
+
+  /// \brief The two loggers used by fidi_app, looked up just once
+  ///
+  /// Poco::Logger::get() looks the logger up by name, under a global
+  /// lock, every time it is called. These return references cached
+  /// once the loggers have been created.
+  class Log {
+   public:
+    /// \brief Look up the loggers, once they have been created
+    static void CacheLoggers(void);
+
+    /// \brief The logger for the log file
+    /// \return Logger The FileLogger
+    static Poco::Logger &
+    File(void) {
+      return file_ != nullptr ? *file_ : Poco::Logger::get("FileLogger");
+    }
+
+    /// \brief The logger for the console
+    /// \return Logger The ConsoleLogger
+    static Poco::Logger &
+    Console(void) {
+      return console_ != nullptr ? *console_
+                                 : Poco::Logger::get("ConsoleLogger");
+    }
+
+   private:
+    static Poco::Logger *file_;     ///< The cached FileLogger
+    static Poco::Logger *console_;  ///< The cached ConsoleLogger
+  };
+
+  /// \brief Hands log messages to a background thread to write out
+  ///
+  /// Each thread that logs gets its own ring buffer of fixed size
+  /// records, which only it writes to, and only the background thread
+  /// reads from, so logging takes no lock, and never waits for the
+  /// disk. The background thread drains the rings in batches, and
+  /// passes the messages on to their channels. If a ring is full, the
+  /// message is dropped, and counted, rather than the caller made to
+  /// wait. Messages longer than a record are cut short.
+  class AsyncLog {
+   public:
+    /// The most bytes of the text of a message kept
+    static constexpr std::size_t kTextSize = 448;
+    /// The most bytes of the source of a message kept
+    static constexpr std::size_t kSourceSize = 32;
+
+    /// A snapshot of the logging counters
+    struct Stats {
+      std::uint64_t written;  ///< Messages written out
+      std::uint64_t dropped;  ///< Messages dropped, with the ring full
+    };
+
+    /// The copy constructor is not used, so declutter.
+    AsyncLog(const AsyncLog &) = delete;
+    /// The assignment operator is also not used, so cleaned up.
+    AsyncLog &operator=(const AsyncLog &) = delete;
+    /// The move operations are unused, and cleaned up.
+    AsyncLog(AsyncLog &&) = delete;
+    AsyncLog &operator=(AsyncLog &&) = delete;
+
+    /// Destructor. Writes out what is left, and stops the thread
+    ~AsyncLog();
+
+    /// \brief Set the size of the per-thread rings
+    ///
+    /// This only has effect if called before the first call to
+    /// instance().
+    ///
+    /// \param[in] ring_size Records in each ring, rounded up to a
+    ///            power of two
+    static void Configure(std::size_t ring_size);
+
+    /// \brief Get the process wide backend, creating it if needed
+    /// \return AsyncLog the shared backend
+    static AsyncLog &instance(void);
+
+    /// \brief Queue a message to be written to a channel
+    ///
+    /// \param[in] target The channel to write the message to
+    /// \param[in] message The message
+    void Push(Poco::Channel *target, const Poco::Message &message);
+
+    /// \brief Write out every message queued, and stop the thread
+    ///
+    /// Messages pushed once this has begun are written straight to
+    /// their channel, by the thread pushing them.
+    void Shutdown(void);
+
+    /// \brief Return a snapshot of the logging counters
+    /// \return Stats the current counter values
+    Stats get_stats(void);
+
+   private:
+    /// A message, copied into a fixed size record
+    struct Record {
+      Poco::Channel *target;                ///< Where to write it
+      std::int64_t   time;                  ///< Epoch microseconds
+      int            priority;              ///< Poco::Message priority
+      std::uint16_t  source_size;           ///< Bytes used in source
+      std::uint16_t  text_size;             ///< Bytes used in text
+      char           source[kSourceSize];   ///< The logger name
+      char           text[kTextSize];       ///< The message text
+    };
+
+    /// A single producer, single consumer ring of records
+    struct Ring {
+      /// \brief Constructor
+      ///
+      /// \param[in] capacity The number of records, a power of two
+      explicit Ring(std::size_t capacity) :
+          records(capacity), mask(capacity - 1), head(0), tail(0),
+          pushing(false), dropped(0) {}
+
+      std::vector<Record> records;  ///< The records
+      const std::size_t   mask;     ///< capacity - 1, to wrap indices
+      alignas(64) std::atomic<std::uint64_t> head;  ///< Next to write
+      alignas(64) std::atomic<std::uint64_t> tail;  ///< Next to read
+      std::atomic<bool>          pushing;  ///< A Push() is under way
+      std::atomic<std::uint64_t> dropped;  ///< Records not written
+    };
+
+    /// \brief Constructor, only called by instance()
+    ///
+    /// \param[in] ring_size Records in each ring, a power of two
+    explicit AsyncLog(std::size_t ring_size);
+
+    /// \brief The ring of the calling thread, created on first use
+    /// \return Ring the ring for this thread
+    Ring &ThisThreadRing(void);
+
+    /// \brief Write out the records in every ring
+    /// \return size_t The number of records written
+    std::size_t Drain(void);
+
+    /// The background thread, draining the rings
+    void Run(void);
+
+    static std::size_t configured_ring_size_;  ///< Set by Configure()
+
+    const std::size_t ring_size_;  ///< Records in each ring
+
+    std::mutex              mtx_;  ///< Protects the members below
+    std::condition_variable cv_;   ///< Wakes the thread to stop
+    std::vector<std::shared_ptr<Ring>> rings_;  ///< One per thread
+    bool                               stopping_;  ///< Shutdown() called
+
+    std::atomic<bool>          stopped_;  ///< No more records queued
+    std::atomic<std::uint64_t> written_;  ///< Records written out
+    std::thread                thread_;   ///< Drains the rings
+  };
+
+  /// \brief A channel that writes through the fidi::AsyncLog
+  ///
+  /// This wraps the channel a logger would otherwise write to, and
+  /// has the background thread write to it instead.
+  class RingChannel : public Poco::Channel {
+   public:
+    /// \brief Constructor
+    ///
+    /// \param[in] target The channel to write messages to
+    explicit RingChannel(Poco::Channel *target);
+
+    /// The copy constructor is not used, so declutter.
+    RingChannel(const RingChannel &) = delete;
+    /// The assignment operator is also not used, so cleaned up.
+    RingChannel &operator=(const RingChannel &) = delete;
+    /// The move operations are unused, and cleaned up.
+    RingChannel(RingChannel &&) = delete;
+    RingChannel &operator=(RingChannel &&) = delete;
+
+    /// \brief Queue a message for the target channel
+    ///
+    /// \param[in] message The message
+    void log(const Poco::Message &message) override;
+
+   protected:
+    /// Destructor; channels are reference counted
+    ~RingChannel() {}
+
+   private:
+    Poco::AutoPtr<Poco::Channel> target_;  ///< Where messages go
+  };
+
+}  // namespace fidi
+
+#endif /* FIDI_LOGGING_H */
+
+//
+// fidi_logging.h ends here
@@ -0,0 +1,433 @@
+// fidi_metrics.cc ---  -*- mode: c++; -*-
+
+// Copyright 2018-2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied.  See the License for the specific language governing
+// permissions and limitations under the License.
+
+/// \file
+/// \ingroup app
+///
+/// This file provides the implementation of the metrics kept by the
+/// fidi (φίδι) HTTP server.
+
+// Code:
+
+#include "src/fidi_metrics.h"
+
+#include <cmath>
+#include <cstdio>
+#include <functional>
+
+namespace {
+  /// \brief The shard the calling thread records into
+  ///
+  /// Threads are handed out shards in turn, the first time they
+  /// record anything.
+  ///
+  /// \return size_t The index of the shard
+  std::size_t
+  ThisShard(void) {
+    static std::atomic<std::size_t> next_shard(0);
+    thread_local std::size_t        shard =
+        next_shard.fetch_add(1, std::memory_order_relaxed);
+    return shard % fidi::kMetricShards;
+  }
+
+  /// \brief Convert a duration to whole microseconds, never negative
+  ///
+  /// \param[in] duration The duration
+  /// \return uint64_t The duration in microseconds
+  std::uint64_t
+  Microseconds(std::chrono::steady_clock::duration duration) {
+    auto usec =
+        std::chrono::duration_cast<std::chrono::microseconds>(duration).count();
+    return usec > 0 ? static_cast<std::uint64_t>(usec) : 0;
+  }
+
+  /// \brief Format microseconds as seconds, for Prometheus
+  ///
+  /// \param[in] usec The value in microseconds
+  /// \return string The value in seconds
+  std::string
+  Seconds(std::uint64_t usec) {
+    char buffer[32];
+    std::snprintf(buffer, sizeof(buffer), "%.6f",
+                  static_cast<double>(usec) / 1e6);
+    return buffer;
+  }
+
+  /// The names of the phases, in the order of fidi::Metrics::Phase
+  const char *const kPhaseNames[] = {"parse", "sanity_check", "cpu",
+                                     "predelay", "postdelay"};
+
+  /// The labels of the status classes of calls
+  const char *const kStatusNames[] = {"failed", "1xx", "2xx",
+                                      "3xx",    "4xx", "5xx"};
+}  // namespace
+
+fidi::ShardedCounter::ShardedCounter() : cells_() {
+  for (auto &cell : cells_) { cell.value.store(0); }
+}
+
+void
+fidi::ShardedCounter::Add(std::uint64_t value) {
+  cells_[ThisShard()].value.fetch_add(value, std::memory_order_relaxed);
+}
+
+std::uint64_t
+fidi::ShardedCounter::Value(void) const {
+  std::uint64_t total = 0;
+  for (auto const &cell : cells_) {
+    total += cell.value.load(std::memory_order_relaxed);
+  }
+  return total;
+}
+
+fidi::Histogram::Histogram() : shards_() {
+  for (auto &shard : shards_) {
+    for (auto &bucket : shard.buckets) { bucket.store(0); }
+    shard.count.store(0);
+    shard.sum.store(0);
+  }
+}
+
+std::size_t
+fidi::Histogram::BucketFor(std::uint64_t usec) {
+  if (usec < kSubBuckets) { return static_cast<std::size_t>(usec); }
+  const std::uint64_t largest = (std::uint64_t(1) << kMaxExponent) - 1;
+  if (usec > largest) { usec = largest; }
+  int exponent = 63 - __builtin_clzll(usec);
+  int shift    = exponent - kSubBucketBits;
+  return static_cast<std::size_t>(
+      static_cast<std::uint64_t>(shift + 1) * kSubBuckets + (usec >> shift) -
+      kSubBuckets);
+}
+
+std::uint64_t
+fidi::Histogram::LowerBound(std::size_t bucket) {
+  if (bucket < kSubBuckets) { return bucket; }
+  std::uint64_t group = bucket / kSubBuckets;
+  std::uint64_t sub   = bucket % kSubBuckets;
+  return (kSubBuckets + sub) << (group - 1);
+}
+
+void
+fidi::Histogram::Record(std::chrono::steady_clock::duration duration) {
+  std::uint64_t usec  = Microseconds(duration);
+  Shard &       shard = shards_[ThisShard()];
+  shard.buckets[BucketFor(usec)].fetch_add(1, std::memory_order_relaxed);
+  shard.count.fetch_add(1, std::memory_order_relaxed);
+  shard.sum.fetch_add(usec, std::memory_order_relaxed);
+}
+
+std::uint64_t
+fidi::Histogram::Count(void) const {
+  std::uint64_t total = 0;
+  for (auto const &shard : shards_) {
+    total += shard.count.load(std::memory_order_relaxed);
+  }
+  return total;
+}
+
+std::uint64_t
+fidi::Histogram::Percentile(double percentile, std::uint64_t *count) const {
+  std::array<std::uint64_t, kBuckets> buckets{};
+  std::uint64_t                       total = 0;
+  for (std::size_t i = 0; i < kBuckets; ++i) {
+    for (auto const &shard : shards_) {
+      buckets[i] += shard.buckets[i].load(std::memory_order_relaxed);
+    }
+    total += buckets[i];
+  }
+  *count = total;
+  if (total == 0) { return 0; }
+  // The rank of the percentile, counting from 1
+  auto rank = static_cast<std::uint64_t>(
+      std::ceil(percentile / 100.0 * static_cast<double>(total)));
+  if (rank < 1) { rank = 1; }
+  std::uint64_t cumulative = 0;
+  for (std::size_t i = 0; i < kBuckets; ++i) {
+    cumulative += buckets[i];
+    if (cumulative >= rank) { return LowerBound(i + 1); }
+  }
+  return LowerBound(kBuckets);
+}
+
+void
+fidi::Histogram::Export(const std::string &name, const std::string &labels,
+                        std::string *out) const {
+  std::uint64_t count = 0;
+  std::uint64_t sum   = 0;
+  for (auto const &shard : shards_) {
+    count += shard.count.load(std::memory_order_relaxed);
+    sum += shard.sum.load(std::memory_order_relaxed);
+  }
+  std::uint64_t cumulative = 0;
+  for (std::size_t i = 0; i < kBuckets; ++i) {
+    std::uint64_t in_bucket = 0;
+    for (auto const &shard : shards_) {
+      in_bucket += shard.buckets[i].load(std::memory_order_relaxed);
+    }
+    if (in_bucket == 0) { continue; }
+    cumulative += in_bucket;
+    out->append(name)
+        .append("_bucket{")
+        .append(labels)
+        .append("le=\"")
+        .append(Seconds(LowerBound(i + 1)))
+        .append("\"} ")
+        .append(std::to_string(cumulative))
+        .append("\n");
+  }
+  // The shards are read one after another, so the total may have
+  // moved on since the buckets were read
+  if (count < cumulative) { count = cumulative; }
+  out->append(name)
+      .append("_bucket{")
+      .append(labels)
+      .append("le=\"+Inf\"} ")
+      .append(std::to_string(count))
+      .append("\n");
+  std::string bare;
+  if (!labels.empty()) {
+    bare = "{" + labels.substr(0, labels.size() - 1) + "}";
+  }
+  out->append(name)
+      .append("_sum")
+      .append(bare)
+      .append(" ")
+      .append(Seconds(sum))
+      .append("\n");
+  out->append(name)
+      .append("_count")
+      .append(bare)
+      .append(" ")
+      .append(std::to_string(count))
+      .append("\n");
+}
+
+fidi::Metrics::Metrics() :
+    requests_(),
+    request_latency_(),
+    phases_(),
+    stages_(),
+    destinations_(),
+    other_("other") {
+  for (auto &slot : destinations_) { slot.store(nullptr); }
+}
+
+fidi::Metrics::~Metrics() {
+  for (auto &slot : destinations_) {
+    delete slot.load();
+    slot.store(nullptr);
+  }
+}
+
+fidi::Metrics &
+fidi::Metrics::instance(void) {
+  static fidi::Metrics metrics;
+  return metrics;
+}
+
+void
+fidi::Metrics::RecordRequest(std::chrono::steady_clock::duration duration) {
+  requests_.Add();
+  request_latency_.Record(duration);
+}
+
+void
+fidi::Metrics::RecordPhase(Phase                               phase,
+                           std::chrono::steady_clock::duration duration) {
+  phases_[static_cast<std::size_t>(phase)].Record(duration);
+}
+
+void
+fidi::Metrics::RecordStage(int                                 stage,
+                           std::chrono::steady_clock::duration duration) {
+  if (stage < 1) { stage = 1; }
+  if (stage > kMaxStages) { stage = kMaxStages; }
+  stages_[static_cast<std::size_t>(stage - 1)].Record(duration);
+}
+
+void
+fidi::Metrics::RecordCall(const std::string &destination, int status,
+                          std::chrono::steady_clock::duration duration) {
+  Destination &metrics = FindDestination(destination);
+  metrics.latency.Record(duration);
+  std::size_t status_class = 0;
+  if (status >= 100 && status < 600) {
+    status_class = static_cast<std::size_t>(status / 100);
+  }
+  metrics.status[status_class].Add();
+}
+
+std::chrono::microseconds
+fidi::Metrics::CallPercentile(const std::string &destination,
+                              double percentile, std::uint64_t min_calls) {
+  std::uint64_t count = 0;
+  std::uint64_t usec =
+      FindDestination(destination).latency.Percentile(percentile, &count);
+  if (count < min_calls) { return std::chrono::microseconds(0); }
+  return std::chrono::microseconds(usec);
+}
+
+void
+fidi::Metrics::RecordHedgeSent(const std::string &destination) {
+  FindDestination(destination).hedges_sent.Add();
+}
+
+void
+fidi::Metrics::RecordHedgeWon(const std::string &destination) {
+  FindDestination(destination).hedges_won.Add();
+}
+
+void
+fidi::Metrics::RecordQueued(const std::string &destination, int delta) {
+  Destination &metrics = FindDestination(destination);
+  metrics.queued.fetch_add(delta, std::memory_order_relaxed);
+  if (delta > 0) { metrics.queued_calls.Add(); }
+}
+
+void
+fidi::Metrics::RecordQueueWait(const std::string &destination,
+                               std::chrono::steady_clock::duration duration) {
+  FindDestination(destination).queue_wait.Record(duration);
+}
+
+fidi::Metrics::Destination &
+fidi::Metrics::FindDestination(const std::string &destination) {
+  std::size_t start = std::hash<std::string>{}(destination) % kMaxDestinations;
+  for (std::size_t probe = 0; probe < kMaxDestinations; ++probe) {
+    auto &       slot  = destinations_[(start + probe) % kMaxDestinations];
+    Destination *found = slot.load(std::memory_order_acquire);
+    if (found == nullptr) {
+      // Claim the empty slot; if another thread got there first, it
+      // may have been for this same destination
+      Destination *added = new Destination(destination);
+      if (slot.compare_exchange_strong(found, added,
+                                       std::memory_order_acq_rel)) {
+        return *added;
+      }
+      delete added;
+    }
+    if (found->name == destination) { return *found; }
+  }
+  return other_;
+}
+
+std::string
+fidi::Metrics::Export(void) const {
+  std::string out;
+  out.append("# HELP fidi_requests_total Requests handled.\n")
+      .append("# TYPE fidi_requests_total counter\n")
+      .append("fidi_requests_total ")
+      .append(std::to_string(requests_.Value()))
+      .append("\n");
+
+  out.append("# HELP fidi_request_duration_seconds Latency of requests.\n")
+      .append("# TYPE fidi_request_duration_seconds histogram\n");
+  request_latency_.Export("fidi_request_duration_seconds", "", &out);
+
+  out.append("# HELP fidi_phase_duration_seconds Latency of each phase of ")
+      .append("requests.\n")
+      .append("# TYPE fidi_phase_duration_seconds histogram\n");
+  for (std::size_t i = 0; i < phases_.size(); ++i) {
+    phases_[i].Export("fidi_phase_duration_seconds",
+                      std::string("phase=\"") + kPhaseNames[i] + "\",", &out);
+  }
+  for (std::size_t i = 0; i < stages_.size(); ++i) {
+    stages_[i].Export("fidi_phase_duration_seconds",
+                      "phase=\"stage\",stage=\"" + std::to_string(i + 1) +
+                          (i + 1 == stages_.size() ? "+" : "") + "\",",
+                      &out);
+  }
+
+  std::string calls;
+  std::string latency;
+  std::string hedges;
+  std::string depth;
+  std::string queue_wait;
+  auto        export_destination = [&](const Destination &metrics) {
+    std::string label = "destination=\"" + metrics.name + "\",";
+    // Calls may be queued before any call has been answered
+    if (metrics.queue_wait.Count() > 0) {
+      depth.append("fidi_call_queue_depth{")
+          .append(label, 0, label.size() - 1)
+          .append("} ")
+          .append(std::to_string(metrics.queued.load()))
+          .append("\n");
+      metrics.queue_wait.Export("fidi_call_queue_wait_seconds", label,
+                                &queue_wait);
+    }
+    std::uint64_t total = 0;
+    for (auto const &counter : metrics.status) { total += counter.Value(); }
+    if (total == 0) { return; }
+    metrics.latency.Export("fidi_call_duration_seconds", label, &latency);
+    for (std::size_t i = 0; i < metrics.status.size(); ++i) {
+      std::uint64_t value = metrics.status[i].Value();
+      if (value == 0) { continue; }
+      calls.append("fidi_calls_total{")
+          .append(label)
+          .append("status=\"")
+          .append(kStatusNames[i])
+          .append("\"} ")
+          .append(std::to_string(value))
+          .append("\n");
+    }
+    std::uint64_t sent = metrics.hedges_sent.Value();
+    if (sent == 0) { return; }
+    hedges.append("fidi_call_hedges_total{")
+        .append(label)
+        .append("outcome=\"sent\"} ")
+        .append(std::to_string(sent))
+        .append("\nfidi_call_hedges_total{")
+        .append(label)
+        .append("outcome=\"won\"} ")
+        .append(std::to_string(metrics.hedges_won.Value()))
+        .append("\n");
+  };
+  for (auto const &slot : destinations_) {
+    Destination *metrics = slot.load(std::memory_order_acquire);
+    if (metrics != nullptr) { export_destination(*metrics); }
+  }
+  export_destination(other_);
+  out.append("# HELP fidi_calls_total Downstream calls, by destination and ")
+      .append("status class.\n")
+      .append("# TYPE fidi_calls_total counter\n")
+      .append(calls)
+      .append("# HELP fidi_call_duration_seconds Latency of downstream ")
+      .append("calls.\n")
+      .append("# TYPE fidi_call_duration_seconds histogram\n")
+      .append(latency);
+  if (!hedges.empty()) {
+    out.append("# HELP fidi_call_hedges_total Hedged downstream calls ")
+        .append("sent, and those answered before the original.\n")
+        .append("# TYPE fidi_call_hedges_total counter\n")
+        .append(hedges);
+  }
+  if (!depth.empty()) {
+    out.append("# HELP fidi_call_queue_depth Downstream calls waiting for ")
+        .append("room under the limit of their destination.\n")
+        .append("# TYPE fidi_call_queue_depth gauge\n")
+        .append(depth)
+        .append("# HELP fidi_call_queue_wait_seconds Time downstream calls ")
+        .append("waited for room under the limit of their destination, ")
+        .append("zero for calls let straight through.\n")
+        .append("# TYPE fidi_call_queue_wait_seconds histogram\n")
+        .append(queue_wait);
+  }
+  return out;
+}
+
+//
+// fidi_metrics.cc ends here
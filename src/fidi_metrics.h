@@ -0,0 +1,326 @@
+// fidi_metrics.h ---  -*- mode: c++; -*-
+
+// Copyright 2018-2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied.  See the License for the specific language governing
+// permissions and limitations under the License.
+
+/// \file
+/// \ingroup app
+///
+/// This file contains the counters and latency histograms kept by the
+/// fidi (φίδι) HTTP server, and exported at /metrics.
+
+// Code:
+
+#ifndef FIDI_METRICS_H
+#  define FIDI_METRICS_H
+
+#  include <array>
+#  include <atomic>
+#  include <chrono>
+#  include <cstddef>
+#  include <cstdint>
+#  include <string>
+
+namespace fidi {
+
+  /// \brief The number of shards each counter is split into
+  ///
+  /// Each thread updates the shard it was given the first time it
+  /// recorded anything, so threads rarely share a cache line.
+  constexpr std::size_t kMetricShards = 16;
+
+  /// \brief A counter, split into per-thread shards
+  ///
+  /// Adding to the counter is a relaxed atomic add on the shard of
+  /// the calling thread; reading it sums the shards.
+  class ShardedCounter {
+   public:
+    /// The default constructor, all zeros
+    ShardedCounter();
+
+    /// The copy constructor is not used, so declutter.
+    ShardedCounter(const ShardedCounter &) = delete;
+    /// The assignment operator is also not used, so cleaned up.
+    ShardedCounter &operator=(const ShardedCounter &) = delete;
+    /// The move operations are unused, and cleaned up.
+    ShardedCounter(ShardedCounter &&) = delete;
+    ShardedCounter &operator=(ShardedCounter &&) = delete;
+
+    /// \brief Add to the counter
+    ///
+    /// \param[in] value The amount to add
+    void Add(std::uint64_t value = 1);
+
+    /// \brief Read the counter
+    /// \return uint64_t The sum over all the shards
+    std::uint64_t Value(void) const;
+
+   private:
+    /// A shard, on its own cache line
+    struct alignas(64) Cell {
+      std::atomic<std::uint64_t> value;  ///< The count in this shard
+    };
+
+    std::array<Cell, kMetricShards> cells_;  ///< The shards
+  };
+
+  /// \brief A log-linear latency histogram, split into shards
+  ///
+  /// Like an HDR histogram, every power of two is split into eight
+  /// linear buckets, so any value is placed within 12.5% of its true
+  /// value, over the whole range from a microsecond to days, in a
+  /// few hundred buckets. Shards, like whole histograms, merge by
+  /// adding bucket counts.
+  class Histogram {
+   public:
+    /// Bits of each value kept, below its leading one
+    static constexpr int kSubBucketBits = 3;
+    /// Linear buckets in each power of two
+    static constexpr std::uint64_t kSubBuckets = 1 << kSubBucketBits;
+    /// Values are clamped below 2 to this power, in microseconds
+    static constexpr int kMaxExponent = 40;
+    /// The number of buckets
+    static constexpr std::size_t kBuckets =
+        (kMaxExponent - kSubBucketBits + 1) * kSubBuckets;
+
+    /// The default constructor, an empty histogram
+    Histogram();
+
+    /// The copy constructor is not used, so declutter.
+    Histogram(const Histogram &) = delete;
+    /// The assignment operator is also not used, so cleaned up.
+    Histogram &operator=(const Histogram &) = delete;
+    /// The move operations are unused, and cleaned up.
+    Histogram(Histogram &&) = delete;
+    Histogram &operator=(Histogram &&) = delete;
+
+    /// \brief Record a value
+    ///
+    /// \param[in] duration The latency to record
+    void Record(std::chrono::steady_clock::duration duration);
+
+    /// \brief The bucket a value falls in
+    ///
+    /// \param[in] usec The value, in microseconds
+    /// \return size_t The index of the bucket
+    static std::size_t BucketFor(std::uint64_t usec);
+
+    /// \brief The smallest value in a bucket
+    ///
+    /// \param[in] bucket The index of the bucket, up to kBuckets
+    /// \return uint64_t The lower bound, in microseconds
+    static std::uint64_t LowerBound(std::size_t bucket);
+
+    /// \brief Estimate a percentile of the values recorded
+    ///
+    /// The estimate is the upper bound of the bucket the percentile
+    /// falls in, so it errs on the high side, by up to 12.5%.
+    ///
+    /// \param[in] percentile The percentile, from 0 to 100
+    /// \param[out] count The number of values recorded
+    /// \return uint64_t The percentile, in microseconds, or 0 if
+    ///         nothing has been recorded
+    std::uint64_t Percentile(double percentile, std::uint64_t *count) const;
+
+    /// \brief The number of values recorded
+    /// \return uint64_t The count
+    std::uint64_t Count(void) const;
+
+    /// \brief Append the histogram in the Prometheus text format
+    ///
+    /// Only the buckets that have been used are written, along with
+    /// the +Inf bucket, the sum and the count.
+    ///
+    /// \param[in] name The name of the metric
+    /// \param[in] labels Labels for every sample, like `a="b",`
+    /// \param[in,out] out The text to append to
+    void Export(const std::string &name, const std::string &labels,
+                std::string *out) const;
+
+   private:
+    /// A shard, on its own cache lines
+    struct alignas(64) Shard {
+      std::array<std::atomic<std::uint64_t>, kBuckets> buckets;  ///< Counts
+      std::atomic<std::uint64_t> count;  ///< The number of values
+      std::atomic<std::uint64_t> sum;    ///< Their sum, in microseconds
+    };
+
+    std::array<Shard, kMetricShards> shards_;  ///< The shards
+  };
+
+  /// \brief The metrics of the fidi_app process
+  ///
+  /// Recording a metric never takes a lock. Even the destinations of
+  /// calls, which are only known as requests arrive, are kept in a
+  /// fixed size table whose slots are filled in with a compare and
+  /// swap, and never emptied. Destinations beyond the size of the
+  /// table are counted together.
+  class Metrics {
+   public:
+    /// The phases of a request, each with its own histogram
+    enum class Phase {
+      kParse,        ///< Reading and parsing the request
+      kSanityCheck,  ///< Checking the parsed request
+      kCpu,          ///< The CPU work asked for with cpu_us
+      kPredelay,     ///< The predelay
+      kPostdelay,    ///< The postdelay
+      kCount         ///< The number of phases
+    };
+
+    /// Sequence stages with their own histogram; later ones share
+    /// the last
+    static constexpr int kMaxStages = 8;
+
+    /// Destinations with their own metrics
+    static constexpr std::size_t kMaxDestinations = 64;
+
+    /// The Content-Type of the exported metrics
+    static constexpr const char *kContentType =
+        "text/plain; version=0.0.4; charset=utf-8";
+
+    /// The copy constructor is not used, so declutter.
+    Metrics(const Metrics &) = delete;
+    /// The assignment operator is also not used, so cleaned up.
+    Metrics &operator=(const Metrics &) = delete;
+    /// The move operations are unused, and cleaned up.
+    Metrics(Metrics &&) = delete;
+    Metrics &operator=(Metrics &&) = delete;
+
+    /// Destructor. Frees the destinations
+    ~Metrics();
+
+    /// \brief Get the process wide metrics, creating them if needed
+    /// \return Metrics the shared metrics
+    static Metrics &instance(void);
+
+    /// \brief Record a request handled
+    ///
+    /// \param[in] duration From receiving the request to responding
+    void RecordRequest(std::chrono::steady_clock::duration duration);
+
+    /// \brief Record a phase of a request
+    ///
+    /// \param[in] phase The phase
+    /// \param[in] duration How long the phase took
+    void RecordPhase(Phase phase, std::chrono::steady_clock::duration duration);
+
+    /// \brief Record a sequence stage of a request
+    ///
+    /// \param[in] stage The stage, counting from 1
+    /// \param[in] duration How long the calls in the stage took
+    void RecordStage(int stage, std::chrono::steady_clock::duration duration);
+
+    /// \brief Record a downstream call
+    ///
+    /// \param[in] destination The host:port called
+    /// \param[in] status The HTTP status of the response, or 0 if the
+    ///            call failed
+    /// \param[in] duration How long the call took
+    void RecordCall(const std::string &destination, int status,
+                    std::chrono::steady_clock::duration duration);
+
+    /// \brief Estimate a percentile of the latency of calls
+    ///
+    /// \param[in] destination The host:port called
+    /// \param[in] percentile The percentile, from 0 to 100
+    /// \param[in] min_calls The fewest calls to estimate from
+    /// \return duration The percentile, or zero if fewer calls than
+    ///         min_calls have been made
+    std::chrono::microseconds CallPercentile(const std::string &destination,
+                                             double             percentile,
+                                             std::uint64_t      min_calls);
+
+    /// \brief Record a hedged request sent to a destination
+    ///
+    /// \param[in] destination The host:port called
+    void RecordHedgeSent(const std::string &destination);
+
+    /// \brief Record a hedged request answering before the original
+    ///
+    /// \param[in] destination The host:port called
+    void RecordHedgeWon(const std::string &destination);
+
+    /// \brief Record calls joining, or leaving, the queue of a
+    /// destination at its limit
+    ///
+    /// \param[in] destination The host:port called
+    /// \param[in] delta 1 for a call queued, -1 for one let through
+    void RecordQueued(const std::string &destination, int delta);
+
+    /// \brief Record how long a call waited for room at a destination
+    ///
+    /// Every call under a limit is recorded, calls let straight
+    /// through with a wait of zero.
+    ///
+    /// \param[in] destination The host:port called
+    /// \param[in] duration How long the call was queued
+    void RecordQueueWait(const std::string &                 destination,
+                         std::chrono::steady_clock::duration duration);
+
+    /// \brief Write out all the metrics
+    /// \return string The metrics, in the Prometheus text format
+    std::string Export(void) const;
+
+   private:
+    /// The metrics for calls to one destination
+    struct Destination {
+      /// \brief Constructor
+      ///
+      /// \param[in] destination_name The host:port called
+      explicit Destination(const std::string &destination_name) :
+          name(destination_name),
+          latency(),
+          status(),
+          hedges_sent(),
+          hedges_won(),
+          queued(0),
+          queued_calls(),
+          queue_wait() {}
+
+      const std::string name;     ///< The host:port called
+      Histogram         latency;  ///< Latency of the calls
+      /// Calls by status class: failed, 1xx, 2xx, 3xx, 4xx, and 5xx
+      std::array<ShardedCounter, 6> status;
+      ShardedCounter hedges_sent;  ///< Hedged requests sent
+      ShardedCounter hedges_won;   ///< Hedged requests answered first
+      std::atomic<std::int64_t> queued;  ///< Calls waiting for room now
+      ShardedCounter queued_calls;  ///< Calls that have had to wait
+      Histogram      queue_wait;    ///< How long they waited
+    };
+
+    /// Constructor, only called by instance()
+    Metrics();
+
+    /// \brief Find, or add, the metrics for a destination
+    ///
+    /// \param[in] destination The host:port called
+    /// \return Destination The metrics for the destination
+    Destination &FindDestination(const std::string &destination);
+
+    ShardedCounter requests_;  ///< Requests handled
+    Histogram      request_latency_;  ///< Latency of whole requests
+    std::array<Histogram, static_cast<std::size_t>(Phase::kCount)>
+        phases_;  ///< Latency of each phase
+    std::array<Histogram, kMaxStages> stages_;  ///< Latency of each stage
+    std::array<std::atomic<Destination *>, kMaxDestinations>
+                destinations_;  ///< Open addressed, by hash of name
+    Destination other_;         ///< Destinations beyond the table
+  };
+
+}  // namespace fidi
+
+#endif /* FIDI_METRICS_H */
+
+//
+// fidi_metrics.h ends here
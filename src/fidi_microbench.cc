@@ -0,0 +1,510 @@
+// fidi_microbench.cc ---  -*- mode: c++; -*-
+
+// Copyright 2018-2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied.  See the License for the specific language governing
+// permissions and limitations under the License.
+
+/// \file
+/// \ingroup inputhandling
+///
+/// This is a set of micro benchmarks for the fidi (φίδι) request
+/// handling code. They are not built by default; use
+/// `make fidi_microbench` to build them.
+
+// Code:
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <new>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "src/fidi_app_driver.h"
+#include "src/fidi_health.h"
+#include "src/fidi_lint_driver.h"
+#include "src/fidi_plan_cache.h"
+#include "src/fidi_wire_format.h"
+
+namespace {
+  /// Calls to operator new, counted for the parse benchmark
+  std::atomic<std::uint64_t> allocations(0);
+  /// Bytes asked of operator new, counted for the parse benchmark
+  std::atomic<std::uint64_t> allocated_bytes(0);
+}  // namespace
+
+/// \brief Count allocations, on the way to malloc
+///
+/// The array and nothrow forms end up here too.
+///
+/// \param[in] size The bytes wanted
+/// \return void* The memory
+void *
+operator new(std::size_t size) {
+  allocations.fetch_add(1, std::memory_order_relaxed);
+  allocated_bytes.fetch_add(size, std::memory_order_relaxed);
+  void *memory = std::malloc(size != 0 ? size : 1);
+  if (memory == nullptr) { throw std::bad_alloc(); }
+  return memory;
+}
+
+/// \brief Free memory from the counting operator new
+///
+/// \param[in] memory The memory
+void
+operator delete(void *memory) noexcept {
+  std::free(memory);
+}
+
+/// \brief Free memory from the counting operator new
+///
+/// \param[in] memory The memory
+void
+operator delete(void *memory, std::size_t) noexcept {
+  std::free(memory);
+}
+
+/// \brief Create the node table for a chain of instances
+///
+/// \param[in] depth The number of hops in the chain
+/// \return string The node definitions, in the text form
+static std::string
+NodeTable(int depth) {
+  std::string nodes;
+  for (int i = 0; i <= depth; ++i) {
+    nodes.append("n")
+        .append(std::to_string(i))
+        .append(" [ hostname = \"127.0.0.1\", port = ")
+        .append(std::to_string(9000 + i))
+        .append(", ]\n");
+  }
+  return nodes;
+}
+
+/// \brief Create the request received by one instance in a chain
+///
+/// Every instance but the last makes a call to the next one in the
+/// chain, which carries the rest of the chain, and then a cheap call
+/// that goes no further.
+///
+/// \param[in] level How far down the chain this instance is
+/// \param[in] depth The number of hops in the chain
+/// \return string The request, in the text form
+static std::string
+Request(int level, int depth) {
+  std::string request("[\n  predelay = 1,\n  postdelay = 2,\n"
+                      "  response = 200,\n");
+  if (level < depth) {
+    std::string next("n" + std::to_string(level + 1));
+    request.append("  -> ")
+        .append(next)
+        .append(" repeat = 1 sequence = 1 ")
+        .append(Request(level + 1, depth))
+        .append("  -> ")
+        .append(next)
+        .append(" repeat = 2 sequence = 2 [ response = 200, ]\n");
+  }
+  request.append("]\n");
+  return request;
+}
+
+/// \brief Create a request with a large node table
+///
+/// \param[in] count The number of nodes
+/// \return string The request, in the text form
+static std::string
+ManyNodesRequest(int count) {
+  return NodeTable(count) + "[\n  response = 200,\n]\n";
+}
+
+/// \brief Create a request with a wide fan-out
+///
+/// \param[in] width The number of calls the request makes
+/// \return string The request, in the text form
+static std::string
+WideRequest(int width) {
+  std::string request(NodeTable(width));
+  request.append("[\n  response = 200,\n");
+  for (int i = 1; i <= width; ++i) {
+    request.append("  -> n")
+        .append(std::to_string(i))
+        .append(" repeat = 1 sequence = ")
+        .append(std::to_string(i))
+        .append(" [ response = 200, ]\n");
+  }
+  return request.append("]\n");
+}
+
+/// \brief Create a request with a long comment before every node
+///
+/// \param[in] count The number of nodes, and comments
+/// \param[in] length The length of each comment
+/// \return string The request, in the text form
+static std::string
+CommentedRequest(int count, int length) {
+  std::string request;
+  for (int i = 0; i < count; ++i) {
+    request.append("/* ")
+        .append(static_cast<std::size_t>(length), 'c')
+        .append(" */\nn")
+        .append(std::to_string(i))
+        .append(" [ hostname = \"127.0.0.1\", port = ")
+        .append(std::to_string(9000 + i))
+        .append(", ]\n");
+  }
+  return request.append("[\n  response = 200,\n]\n");
+}
+
+/// \brief Create a request with many large string values
+///
+/// \param[in] count The number of attributes
+/// \param[in] length The length of each value
+/// \return string The request, in the text form
+static std::string
+LongStringsRequest(int count, int length) {
+  std::string request(NodeTable(1));
+  request.append("[\n  response = 200,\n");
+  for (int i = 0; i < count; ++i) {
+    request.append("  note")
+        .append(std::to_string(i))
+        .append(" = \"")
+        .append(static_cast<std::size_t>(length), 's')
+        .append("\",\n");
+  }
+  return request.append("]\n");
+}
+
+/// \brief Count the tokens the scanner finds in a request
+///
+/// \param[in] request The request, in the text form
+/// \return long The number of tokens, not counting the end
+static long
+CountTokens(const std::string &request) {
+  typedef fidi::Parser::token token;
+  std::istringstream          iss(request);
+  fidi::FidiFlexLexer         scanner(&iss);
+  fidi::Parser::semantic_type value;
+  fidi::Parser::location_type location;
+  long                        tokens = 0;
+  for (;;) {
+    int kind = scanner.yylex(&value, &location);
+    if (kind == token::END) { break; }
+    tokens++;
+    // The parser would have taken these values over
+    if (kind == token::IDENT || kind == token::STRING || kind == token::BLOB) {
+      value.destroy<std::string>();
+    } else if (kind == token::NUMBER) {
+      value.destroy<int>();
+    }
+  }
+  return tokens;
+}
+
+/// \brief Time a piece of work, run once per payload, many times over
+///
+/// \param[in] payloads The payloads to run the work on
+/// \param[in] iterations How many times to go over all the payloads
+/// \param[in] work The work to time
+/// \return double The mean nanoseconds per payload
+template <typename Work>
+static double
+TimePerPayload(const std::vector<std::string> &payloads, int iterations,
+               Work work) {
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < iterations; ++i) {
+    for (auto const &payload : payloads) { work(payload); }
+  }
+  std::chrono::duration<double, std::nano> elapsed =
+      std::chrono::steady_clock::now() - start;
+  return elapsed.count() /
+         (static_cast<double>(iterations) *
+          static_cast<double>(payloads.size()));
+}
+
+/// \brief Compare the cost per hop of the text and binary formats
+///
+/// For chains of 5 to 20 hops, this creates the payload each
+/// instance in the chain receives, in both formats, and times what
+/// fidi_app does with it: parsing the top level of a text request
+/// (which still has to scan all of the nested payloads), or decoding
+/// the top level of a binary one and slicing out the payloads to
+/// forward.
+///
+/// \param[in] iterations How many times to handle each payload
+/// \return int The exit status
+static int
+WireBenchmark(int iterations) {
+  std::cout << std::setw(6) << "depth" << std::setw(12) << "text bytes"
+            << std::setw(12) << "wire bytes" << std::setw(14) << "text ns/hop"
+            << std::setw(14) << "wire ns/hop" << std::setw(10) << "speedup"
+            << "\n";
+  for (int depth = 5; depth <= 20; ++depth) {
+    std::string              nodes(NodeTable(depth));
+    std::vector<std::string> text;
+    for (int level = 0; level < depth; ++level) {
+      text.push_back(nodes + Request(level, depth));
+    }
+
+    // Encode the first hop, and follow the slices down the chain, the
+    // same way fidi_app forwards them
+    std::vector<std::string> wire;
+    {
+      fidi::WireEncoder  encoder;
+      std::istringstream iss(text.front());
+      encoder.Parse(iss);
+      if (encoder.nerrors_ != 0) {
+        std::cerr << "Parse failed: " << encoder.parse_errors_;
+        return EXIT_FAILURE;
+      }
+      std::ostringstream oss;
+      encoder.Execute(oss);
+      wire.push_back(oss.str());
+    }
+    while (static_cast<int>(wire.size()) < depth) {
+      fidi::WireFormat::Message message;
+      std::string               error;
+      if (!fidi::WireFormat::Decode(wire.back(), &message, &error)) {
+        std::cerr << "Decode failed: " << error;
+        return EXIT_FAILURE;
+      }
+      wire.push_back(std::string(message.prefix) +
+                     std::string(message.edges.front().request));
+    }
+
+    double text_ns = TimePerPayload(text, iterations, [](auto &payload) {
+      fidi::WireEncoder  driver;
+      std::istringstream iss(payload);
+      driver.Parse(iss);
+    });
+    double wire_ns = TimePerPayload(wire, iterations, [](auto &payload) {
+      fidi::WireFormat::Message message;
+      std::string               error;
+      fidi::WireFormat::Decode(payload, &message, &error);
+      for (auto const &edge : message.edges) {
+        std::string forward(message.prefix);
+        forward.append(edge.request);
+      }
+    });
+
+    std::cout << std::setw(6) << depth << std::setw(12) << text.front().size()
+              << std::setw(12) << wire.front().size() << std::setw(14)
+              << std::fixed << std::setprecision(0) << text_ns
+              << std::setw(14) << wire_ns << std::setw(9)
+              << std::setprecision(1) << text_ns / wire_ns << "x\n";
+  }
+  return EXIT_SUCCESS;
+}
+
+/// \brief The health state as it was, behind one global mutex
+///
+/// This is kept here only to compare against fidi::HealthState.
+class LockedHealthState {
+ public:
+  /// The default constructor, healthy and responsive
+  LockedHealthState() :
+      mtx_(),
+      healthy_(true),
+      unresponsive_until_(std::chrono::steady_clock::now()) {}
+
+  /// \brief Is the application healthy right now?
+  /// \return bool true if the application is healthy
+  bool
+  get_healthy(void) {
+    std::lock_guard<std::mutex> lock(mtx_);
+    return healthy_;
+  }
+
+  /// \brief Is the application responding right now?
+  /// \return bool true if the application is responsive
+  bool
+  IsResponsive(void) {
+    auto                        now = std::chrono::steady_clock::now();
+    std::lock_guard<std::mutex> lock(mtx_);
+    return now > unresponsive_until_;
+  }
+
+ private:
+  std::mutex mtx_;     ///< Lock for the state
+  bool       healthy_;  ///< Whether health checks pass
+  std::chrono::steady_clock::time_point
+      unresponsive_until_;  ///< Do not respond until this time
+};
+
+/// \brief Run the per request health checks on many threads at once
+///
+/// Each thread does what the start of every request, or a health
+/// check, does: ask whether the application is responsive, and then
+/// whether it is healthy.
+///
+/// \param[in] state The health state to check
+/// \param[in] threads The number of threads to run
+/// \param[in] checks The number of checks each thread makes
+/// \return double The total checks per microsecond, over all threads
+template <typename State>
+static double
+ChecksPerMicrosecond(State *state, unsigned threads, long checks) {
+  std::vector<std::thread> workers;
+  std::atomic<long>        passed(0);
+  auto                     start = std::chrono::steady_clock::now();
+  for (unsigned i = 0; i < threads; ++i) {
+    workers.emplace_back([state, checks, &passed] {
+      long ok = 0;
+      for (long j = 0; j < checks; ++j) {
+        if (state->IsResponsive() && state->get_healthy()) { ok++; }
+      }
+      passed += ok;
+    });
+  }
+  for (auto &worker : workers) { worker.join(); }
+  std::chrono::duration<double, std::micro> elapsed =
+      std::chrono::steady_clock::now() - start;
+  return static_cast<double>(passed.load()) / elapsed.count();
+}
+
+/// \brief Compare the locked and lock free health state
+///
+/// For 1 thread, and then for twice as many each time up to the
+/// number of cores, this times how many health checks all the
+/// threads together get through, with the old global mutex, and with
+/// fidi::HealthState.
+///
+/// \param[in] iterations Thousands of checks for each thread to make
+/// \return int The exit status
+static int
+HealthBenchmark(int iterations) {
+  unsigned cores = std::max(1U, std::thread::hardware_concurrency());
+  long     checks = 1000L * iterations;
+  std::cout << std::setw(8) << "threads" << std::setw(16) << "mutex Mchk/s"
+            << std::setw(16) << "atomic Mchk/s" << std::setw(10) << "speedup"
+            << "\n";
+  for (unsigned threads = 1;; threads = std::min(cores, threads * 2)) {
+    LockedHealthState locked;
+    fidi::HealthState lock_free;
+    double before = ChecksPerMicrosecond(&locked, threads, checks);
+    double after  = ChecksPerMicrosecond(&lock_free, threads, checks);
+    std::cout << std::setw(8) << threads << std::setw(16) << std::fixed
+              << std::setprecision(1) << before << std::setw(16) << after
+              << std::setw(9) << after / before << "x\n";
+    if (threads == cores) { break; }
+  }
+  return EXIT_SUCCESS;
+}
+
+/// \brief Measure the scanner and the parser on synthetic requests
+///
+/// For each shape of request, this times the scanner on its own, and
+/// then Driver::Parse() as done by fidi_lint and by fidi_app (with
+/// the plan cache off, so that every parse is real), and counts the
+/// allocations made. The results are written as comma separated
+/// values, one row per shape and driver, to be kept and compared
+/// against later runs.
+///
+/// \param[in] iterations How many times to parse each request
+/// \return int The exit status
+static int
+ParseBenchmark(int iterations) {
+  fidi::PlanCache::Configure(0);
+  const std::vector<std::pair<std::string, std::string>> shapes = {
+      {"nodes", ManyNodesRequest(500)},
+      {"deep", NodeTable(20) + Request(0, 20)},
+      {"wide", WideRequest(200)},
+      {"comments", CommentedRequest(100, 1024)},
+      {"strings", LongStringsRequest(64, 4096)},
+  };
+  const std::vector<
+      std::pair<std::string, std::function<void(const std::string &)>>>
+      drivers = {
+          {"scanner", [](const std::string &request) { CountTokens(request); }},
+          {"lint",
+           [](const std::string &request) {
+             fidi::LintDriver   driver;
+             std::istringstream iss(request);
+             driver.Parse(iss);
+           }},
+          {"app",
+           [](const std::string &request) {
+             fidi::AppDriver    driver;
+             std::istringstream iss(request);
+             driver.Parse(iss);
+           }},
+      };
+
+  std::cout << "shape,driver,bytes,tokens,parses,ns_per_parse,mb_per_s,"
+               "mtokens_per_s,allocs_per_parse,alloc_bytes_per_parse\n";
+  for (auto const &[shape, request] : shapes) {
+    const std::vector<std::string> payloads{request};
+    long                           tokens = CountTokens(request);
+    for (auto const &[name, parse] : drivers) {
+      std::uint64_t allocs_before = allocations.load();
+      std::uint64_t bytes_before  = allocated_bytes.load();
+      double        ns     = TimePerPayload(payloads, iterations, parse);
+      auto          parses = static_cast<double>(iterations);
+      std::cout << shape << "," << name << "," << request.size() << ","
+                << tokens << "," << iterations << "," << std::fixed
+                << std::setprecision(0) << ns << "," << std::setprecision(2)
+                << static_cast<double>(request.size()) * 1e3 / ns << ","
+                << static_cast<double>(tokens) * 1e3 / ns << ","
+                << std::setprecision(1)
+                << static_cast<double>(allocations.load() - allocs_before) /
+                       parses
+                << ","
+                << static_cast<double>(allocated_bytes.load() - bytes_before) /
+                       parses
+                << "\n";
+    }
+  }
+  return EXIT_SUCCESS;
+}
+
+/// \brief  Main function
+///
+/// \details Run the benchmark named on the command line.
+///
+/// \param[in]  argc number of arguments
+/// \param[in]  argv An array of character pointers containing the arguments
+///
+/// \return an integer 0 upon exit success
+int
+main(const int argc, const char **argv) {
+  if (argc < 2 || std::strncmp(argv[1], "-h", 2) == 0 ||
+      std::strncmp(argv[1], "--h", 3) == 0) {
+    std::cout << "Usage: fidi_microbench <benchmark> [iterations]\n\n"
+              << "Benchmarks:\n"
+              << "    wire    parse cost per hop, text against binary\n"
+              << "    health  health check throughput, by thread count\n"
+              << "    parse   scanner and parser cost, as CSV\n";
+    return argc < 2 ? EXIT_FAILURE : EXIT_SUCCESS;
+  }
+  int iterations = 1000;
+  if (argc > 2) { iterations = std::max(1, std::atoi(argv[2])); }
+
+  if (std::strcmp(argv[1], "wire") == 0) { return WireBenchmark(iterations); }
+  if (std::strcmp(argv[1], "health") == 0) {
+    return HealthBenchmark(iterations);
+  }
+  if (std::strcmp(argv[1], "parse") == 0) { return ParseBenchmark(iterations); }
+  std::cerr << "Unknown benchmark: " << argv[1] << "\n";
+  return EXIT_FAILURE;
+}
+
+//
+// fidi_microbench.cc ends here
@@ -0,0 +1,143 @@
+// fidi_node_table_cache.cc ---  -*- mode: c++; -*-
+
+// Copyright 2018-2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied.  See the License for the specific language governing
+// permissions and limitations under the License.
+
+/// \file
+/// \ingroup app
+///
+/// This file provides the implementation of the cache of content
+/// addressed node tables for the fidi (φίδι) HTTP server.
+
+// Code:
+
+#include "src/fidi_node_table_cache.h"
+#include <utility>
+
+std::size_t fidi::NodeTableCache::configured_capacity_ = 64;
+bool        fidi::NodeTableCache::configured_share_    = false;
+
+namespace {
+  /// The most tables remembered as sent to any one destination
+  constexpr std::size_t kMaxSentPerDestination = 64;
+}  // namespace
+
+fidi::NodeTableCache::NodeTableCache(std::size_t capacity, bool share) :
+    capacity_(capacity),
+    share_(share),
+    mtx_(),
+    lru_(),
+    index_(),
+    sent_(),
+    hits_(0),
+    misses_(0),
+    omitted_(0),
+    resent_(0) {}
+
+void
+fidi::NodeTableCache::Configure(std::size_t capacity, bool share) {
+  configured_capacity_ = capacity;
+  configured_share_    = share;
+}
+
+fidi::NodeTableCache &
+fidi::NodeTableCache::instance(void) {
+  static fidi::NodeTableCache cache(configured_capacity_, configured_share_);
+  return cache;
+}
+
+std::string
+fidi::NodeTableCache::Hash(std::string_view glob) {
+  std::uint64_t hash = 14695981039346656037ULL;
+  for (unsigned char c : glob) {
+    hash ^= c;
+    hash *= 1099511628211ULL;
+  }
+  static const char digits[] = "0123456789abcdef";
+  std::string       hex(16, '0');
+  for (int i = 15; i >= 0; --i) {
+    hex[static_cast<std::size_t>(i)] = digits[hash & 0xf];
+    hash >>= 4;
+  }
+  return hex;
+}
+
+void
+fidi::NodeTableCache::Insert(const std::string &hash, TablePtr table) {
+  if (capacity_ == 0 || !table) { return; }
+  std::lock_guard<std::mutex> lock(mtx_);
+  auto                        it = index_.find(hash);
+  if (it != index_.end()) {
+    lru_.splice(lru_.begin(), lru_, it->second);
+    return;
+  }
+  while (lru_.size() >= capacity_) {
+    index_.erase(lru_.back().hash);
+    lru_.pop_back();
+  }
+  lru_.push_front(Entry{hash, std::move(table)});
+  index_.emplace(hash, lru_.begin());
+}
+
+fidi::NodeTableCache::TablePtr
+fidi::NodeTableCache::Lookup(const std::string &hash) {
+  std::lock_guard<std::mutex> lock(mtx_);
+  auto                        it = index_.find(hash);
+  if (it == index_.end()) {
+    misses_++;
+    return nullptr;
+  }
+  lru_.splice(lru_.begin(), lru_, it->second);
+  hits_++;
+  return it->second->table;
+}
+
+bool
+fidi::NodeTableCache::WasSent(const std::string &destination,
+                              const std::string &hash) {
+  if (!share_) { return false; }
+  std::lock_guard<std::mutex> lock(mtx_);
+  auto                        it = sent_.find(destination);
+  if (it == sent_.end() || it->second.count(hash) == 0) { return false; }
+  omitted_++;
+  return true;
+}
+
+void
+fidi::NodeTableCache::MarkSent(const std::string &destination,
+                               const std::string &hash, bool sent) {
+  if (!share_) { return; }
+  std::lock_guard<std::mutex> lock(mtx_);
+  auto &                      hashes = sent_[destination];
+  if (!sent) {
+    hashes.erase(hash);
+    return;
+  }
+  // The destination forgets tables too; start over rather than grow
+  if (hashes.size() >= kMaxSentPerDestination) { hashes.clear(); }
+  hashes.insert(hash);
+}
+
+fidi::NodeTableCache::Stats
+fidi::NodeTableCache::get_stats(void) {
+  Stats stats;
+  stats.hits    = hits_.load();
+  stats.misses  = misses_.load();
+  stats.omitted = omitted_.load();
+  stats.resent  = resent_.load();
+  return stats;
+}
+
+//
+// fidi_node_table_cache.cc ends here
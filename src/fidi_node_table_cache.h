@@ -0,0 +1,201 @@
+// fidi_node_table_cache.h ---  -*- mode: c++; -*-
+
+// Copyright 2018-2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied.  See the License for the specific language governing
+// permissions and limitations under the License.
+
+/// \file
+/// \ingroup app
+///
+/// This file contains the cache of content addressed node tables used
+/// by the fidi (φίδι) HTTP server, so that a node table need only be
+/// sent once to each instance, rather than with every call.
+
+// Code:
+
+#ifndef FIDI_NODE_TABLE_CACHE_H
+#  define FIDI_NODE_TABLE_CACHE_H
+
+#  include <atomic>
+#  include <cstddef>
+#  include <cstdint>
+#  include <list>
+#  include <map>
+#  include <memory>
+#  include <mutex>
+#  include <set>
+#  include <string>
+#  include <string_view>
+#  include <unordered_map>
+
+namespace fidi {
+
+  /// \brief Node tables sent and received, keyed by their hash
+  ///
+  /// Every downstream call used to carry the whole node table, which
+  /// for large topologies is most of the bytes of each request. With
+  /// node table sharing, each call carries the hash of the table in
+  /// the X-Fidi-Nodes header, and the table itself only the first
+  /// time it is sent to a destination.
+  ///
+  /// On the receiving side, this keeps a bounded LRU cache of the
+  /// node tables received, keyed by hash, to fill in the tables that
+  /// were left out. If the table has been evicted, or the instance
+  /// restarted, the request is answered with 412 (Precondition
+  /// Failed), and the caller sends it again with the table.
+  ///
+  /// On the sending side, this remembers which tables each
+  /// destination has been sent.
+  class NodeTableCache {
+   public:
+    /// The name of the header carrying the hash of the node table
+    static constexpr const char *kHeader = "X-Fidi-Nodes";
+
+    /// A node table, parsed and as text
+    struct Table {
+      /// The default constructor, an empty table
+      Table() : nodes(), glob() {}
+
+      /// The nodes and their attributes
+      std::map<std::string, std::map<std::string, std::string>> nodes;
+      std::string glob;  ///< The table, as prepended to payloads
+    };
+
+    /// Cached tables are shared, and never modified
+    typedef std::shared_ptr<const Table> TablePtr;
+
+    /// A snapshot of the cache counters
+    struct Stats {
+      std::uint64_t hits;     ///< Tables filled in from the cache
+      std::uint64_t misses;   ///< Tables asked for but not found
+      std::uint64_t omitted;  ///< Calls sent without the table
+      std::uint64_t resent;   ///< Calls sent again with the table
+    };
+
+    /// The copy constructor is not used, so declutter.
+    NodeTableCache(const NodeTableCache &) = delete;
+    /// The assignment operator is also not used, so cleaned up.
+    NodeTableCache &operator=(const NodeTableCache &) = delete;
+    /// The move operations are unused, and cleaned up.
+    NodeTableCache(NodeTableCache &&) = delete;
+    NodeTableCache &operator=(NodeTableCache &&) = delete;
+
+    /// Destructor. The members clean themselves
+    ~NodeTableCache() {}
+
+    /// \brief Set the size of the cache, and whether to share tables
+    ///
+    /// This only has effect if called before the first call to
+    /// instance().
+    ///
+    /// \param[in] capacity The maximum number of tables kept
+    /// \param[in] share Whether to leave the table out of calls to
+    ///            destinations that have already been sent it
+    static void Configure(std::size_t capacity, bool share);
+
+    /// \brief Get the process wide cache, creating it if needed
+    /// \return NodeTableCache the shared cache
+    static NodeTableCache &instance(void);
+
+    /// \brief Hash a node table
+    ///
+    /// This is a 64 bit FNV-1a hash, in hexadecimal, which does not
+    /// depend on the build or the platform, unlike std::hash.
+    ///
+    /// \param[in] glob The node table, as prepended to payloads
+    /// \return string The hash of the table
+    static std::string Hash(std::string_view glob);
+
+    /// \brief Should node tables be left out of calls?
+    /// \return bool true if sharing was configured
+    bool
+    get_share(void) const {
+      return share_;
+    }
+
+    /// \brief Remember a node table received
+    ///
+    /// \param[in] hash The hash of the table
+    /// \param[in] table The table
+    void Insert(const std::string &hash, TablePtr table);
+
+    /// \brief Look up a node table received earlier
+    ///
+    /// \param[in] hash The hash of the table
+    /// \return TablePtr The table, or null if it is not cached
+    TablePtr Lookup(const std::string &hash);
+
+    /// \brief Has a destination been sent a node table?
+    ///
+    /// \param[in] destination The host:port of the destination
+    /// \param[in] hash The hash of the table
+    /// \return bool true if the table may be left out
+    bool WasSent(const std::string &destination, const std::string &hash);
+
+    /// \brief Note whether a destination has a node table
+    ///
+    /// \param[in] destination The host:port of the destination
+    /// \param[in] hash The hash of the table
+    /// \param[in] sent true once the destination has accepted the
+    ///            table, false if it has asked for it again
+    void MarkSent(const std::string &destination, const std::string &hash,
+                  bool sent);
+
+    /// \brief Count a call sent again, with the table, after a 412
+    void
+    CountResent(void) {
+      resent_++;
+    }
+
+    /// \brief Return a snapshot of the cache counters
+    /// \return Stats the current counter values
+    Stats get_stats(void);
+
+   private:
+    /// A cached table, and its hash
+    struct Entry {
+      std::string hash;   ///< The hash of the table
+      TablePtr    table;  ///< The table
+    };
+
+    /// \brief Constructor, only called by instance()
+    ///
+    /// \param[in] capacity The maximum number of tables kept
+    /// \param[in] share Whether to leave tables out of calls
+    NodeTableCache(std::size_t capacity, bool share);
+
+    static std::size_t configured_capacity_;  ///< Set by Configure()
+    static bool        configured_share_;     ///< Set by Configure()
+
+    const std::size_t capacity_;  ///< Maximum number of tables kept
+    const bool        share_;     ///< Leave tables out of calls
+
+    std::mutex       mtx_;  ///< Protects the members below
+    std::list<Entry> lru_;  ///< Tables, most recently used first
+    std::unordered_map<std::string, std::list<Entry>::iterator>
+        index_;  ///< Tables by hash
+    std::map<std::string, std::set<std::string>>
+        sent_;  ///< Hashes sent, by destination
+
+    std::atomic<std::uint64_t> hits_;     ///< Tables found
+    std::atomic<std::uint64_t> misses_;   ///< Tables not found
+    std::atomic<std::uint64_t> omitted_;  ///< Calls sent without a table
+    std::atomic<std::uint64_t> resent_;   ///< Calls sent twice
+  };
+
+}  // namespace fidi
+
+#endif /* FIDI_NODE_TABLE_CACHE_H */
+
+//
+// fidi_node_table_cache.h ends here
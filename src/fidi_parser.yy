@@ -93,8 +93,10 @@
 /*** BEGIN FIDI - Change the fidi grammar's tokens below ***/
 %type  <std::string>                        name
 %type  <std::string>                        value
-%type  <std::pair<int,int>>                 edgeattr
+%type  <std::pair<std::pair<int,int>,std::map<std::string,std::string>>> edgeattr
 %type  <std::pair<std::string,std::string>> attr
+%type  <std::pair<std::string,std::string>> edgeoption
+%type  <std::string>                        namelist
 %type  <std::map<std::string,std::string>>  attrlist
 %type  <std::map<std::string,std::string>>  inputlist
 %type  <int>                                sequencerule
@@ -110,6 +112,7 @@
 %token                                      SOURCE
 %token                                      REPEAT
 %token                                      SEQUENCE
+%token                                      PIPE
 %token <std::string>                        IDENT
 %token <std::string>                        STRING
 %token <std::string>                        BLOB
@@ -137,14 +140,21 @@ inputlist:      %empty                  {}
         |       inputlist attr          {$1.insert($2); $$ = $1;}
         |       inputlist edgerule      {$$ = $1;}
         |       inputlist error         {$$ = $1; driver.nerrors_++;};
-edgerule:       DASH ARROW name edgeattr BLOB { driver.HandleEdge($3, $4, $5);};
+edgerule:       DASH ARROW name edgeattr BLOB {
+                  driver.HandleEdge($3, $4.first, $4.second, $5);};
 edgeattr:       %empty                  {}
-        |       edgeattr  repeatrule    {$$.first  = $2;
-                                         if($1.second){$$.second = $1.second;};}
-        |       edgeattr  sequencerule  {$$.second = $2;
-                                         if($1.first){$$.first = $1.first;};};
+        |       edgeattr  repeatrule    {$$ = $1; $$.first.first  = $2;}
+        |       edgeattr  sequencerule  {$$ = $1; $$.first.second = $2;}
+        |       edgeattr  edgeoption    {$$ = $1;
+                                         $$.second[$2.first] = $2.second;};
 repeatrule:     REPEAT    EQUALS NUMBER {$$ = $3;};
 sequencerule:   SEQUENCE  EQUALS NUMBER {$$ = $3;};
+edgeoption:     IDENT     EQUALS NUMBER {$$.first  = $1;
+                                         $$.second = std::to_string($3);}
+        |       IDENT     EQUALS namelist {$$.first  = $1;
+                                         $$.second = $3;};
+namelist:       IDENT                   {$$ = $1;}
+        |       namelist  PIPE   IDENT  {$$ = $1; $$.append("|").append($3);};
 %%
 
 void
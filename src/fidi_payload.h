@@ -0,0 +1,198 @@
+// fidi_payload.h ---  -*- mode: c++; -*-
+
+// Copyright 2018-2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied.  See the License for the specific language governing
+// permissions and limitations under the License.
+
+/// \file
+/// \ingroup app
+///
+/// This file contains the immutable, shared payload buffers used for
+/// the downstream calls made by the fidi (φίδι) HTTP server.
+
+// Code:
+
+#ifndef FIDI_PAYLOAD_H
+#  define FIDI_PAYLOAD_H
+
+#  include <cstddef>
+#  include <memory>
+#  include <ostream>
+#  include <streambuf>
+#  include <string>
+#  include <utility>
+
+namespace fidi {
+
+  /// \brief The body of a downstream call, as two shared segments
+  ///
+  /// The payload for a call is the node table, which is the same for
+  /// every call a request makes, followed by the payload of the edge,
+  /// which is the same for every repetition of the edge. Rather than
+  /// concatenate them into a new string for every call, each segment
+  /// is built once into an immutable, reference counted buffer, and
+  /// every call holds on to the buffers it needs. The segments are
+  /// written out one after the other when the call is made.
+  ///
+  /// Payloads are cheap to copy, and safe to share between threads,
+  /// since the buffers are never modified.
+  class Payload {
+   public:
+    /// An immutable, shared segment
+    typedef std::shared_ptr<const std::string> Buffer;
+
+    /// The default constructor, an empty payload
+    Payload() : prefix_(), body_() {}
+
+    /// \brief Constructor
+    ///
+    /// \param[in] prefix The first segment, may be null
+    /// \param[in] body The second segment, may be null
+    Payload(Buffer prefix, Buffer body) :
+        prefix_(std::move(prefix)), body_(std::move(body)) {}
+
+    /// \brief Make a segment from a string
+    ///
+    /// \param[in] contents The contents of the segment
+    /// \return Buffer The new segment
+    static Buffer
+    MakeBuffer(std::string contents) {
+      return std::make_shared<const std::string>(std::move(contents));
+    }
+
+    /// \brief The total size of the segments
+    /// \return size_t the number of bytes in the payload
+    std::size_t
+    size(void) const {
+      return (prefix_ ? prefix_->size() : 0) + (body_ ? body_->size() : 0);
+    }
+
+    /// \brief Write the segments, in order, without joining them
+    ///
+    /// \param[in,out] stream The stream to write to
+    /// \return ostream The stream
+    std::ostream &
+    WriteTo(std::ostream &stream) const {
+      if (prefix_) {
+        stream.write(prefix_->data(),
+                     static_cast<std::streamsize>(prefix_->size()));
+      }
+      if (body_) {
+        stream.write(body_->data(),
+                     static_cast<std::streamsize>(body_->size()));
+      }
+      return stream;
+    }
+
+    /// \brief The first segment, for writing it out as it is
+    /// \return Buffer The segment, which may be null
+    const Buffer &
+    get_prefix(void) const {
+      return prefix_;
+    }
+
+    /// \brief The second segment, for writing it out as it is
+    /// \return Buffer The segment, which may be null
+    const Buffer &
+    get_body(void) const {
+      return body_;
+    }
+
+    /// \brief Join the segments into one string
+    ///
+    /// This copies the payload, so is only meant for logging.
+    ///
+    /// \return string The payload
+    std::string
+    str(void) const {
+      std::string joined;
+      joined.reserve(size());
+      if (prefix_) { joined.append(*prefix_); }
+      if (body_) { joined.append(*body_); }
+      return joined;
+    }
+
+    /// Reads the segments as a stream, without joining them
+    class Reader;
+
+   private:
+    Buffer prefix_;  ///< The node table, usually
+    Buffer body_;    ///< The payload of the edge
+  };
+
+  /// \brief Reads a payload as a stream, in place
+  ///
+  /// This is how a call to a node hosted by this same process hands
+  /// the payload to the parser, without writing it to a socket, or
+  /// joining the segments.
+  class Payload::Reader : public std::streambuf {
+   public:
+    /// \brief Constructor
+    ///
+    /// \param[in] payload The payload to read, which is kept alive
+    explicit Reader(const Payload &payload) :
+        std::streambuf(), payload_(payload), second_(false) {
+      if (!Start(payload_.prefix_)) { Next(); }
+    }
+
+    /// The copy constructor is not used, so declutter.
+    Reader(const Reader &) = delete;
+    /// The assignment operator is also not used, so cleaned up.
+    Reader &operator=(const Reader &) = delete;
+    /// The move operations are unused, and cleaned up.
+    Reader(Reader &&) = delete;
+    Reader &operator=(Reader &&) = delete;
+
+   protected:
+    /// \brief Move on to the second segment, once the first is read
+    /// \return int_type The next character, or eof
+    int_type
+    underflow() override {
+      if (gptr() == egptr() && !Next()) { return traits_type::eof(); }
+      return traits_type::to_int_type(*gptr());
+    }
+
+   private:
+    /// \brief Read from a segment
+    ///
+    /// \param[in] buffer The segment
+    /// \return bool false if the segment is empty
+    bool
+    Start(const Buffer &buffer) {
+      if (!buffer || buffer->empty()) { return false; }
+      // The get area is never written to, so the buffer stays
+      // immutable
+      char *data = const_cast<char *>(buffer->data());
+      setg(data, data, data + buffer->size());
+      return true;
+    }
+
+    /// \brief Read from the second segment, if not already
+    /// \return bool false if there is nothing more to read
+    bool
+    Next(void) {
+      if (second_) { return false; }
+      second_ = true;
+      return Start(payload_.body_);
+    }
+
+    const Payload payload_;  ///< Holds on to the segments
+    bool          second_;   ///< Reading the second segment
+  };
+
+}  // namespace fidi
+
+#endif /* FIDI_PAYLOAD_H */
+
+//
+// fidi_payload.h ends here
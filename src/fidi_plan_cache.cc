@@ -0,0 +1,109 @@
+// fidi_plan_cache.cc ---  -*- mode: c++; -*-
+
+// Copyright 2018-2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied.  See the License for the specific language governing
+// permissions and limitations under the License.
+
+/// \file
+/// \ingroup app
+///
+/// This file provides the implementation of the cache of parsed
+/// request plans for the fidi (φίδι) HTTP server.
+
+// Code:
+
+#include "src/fidi_plan_cache.h"
+#include <iterator>
+#include <utility>
+
+std::size_t fidi::PlanCache::configured_capacity_ = 1024;
+
+fidi::PlanCache::PlanCache(std::size_t capacity) :
+    capacity_(capacity),
+    shard_capacity_((capacity + kShards - 1) / kShards),
+    shards_(),
+    hits_(0),
+    misses_(0),
+    evictions_(0) {}
+
+void
+fidi::PlanCache::Configure(std::size_t capacity) {
+  configured_capacity_ = capacity;
+}
+
+fidi::PlanCache &
+fidi::PlanCache::instance(void) {
+  static fidi::PlanCache cache(configured_capacity_);
+  return cache;
+}
+
+fidi::PlanCache::PlanPtr
+fidi::PlanCache::Lookup(std::size_t key, std::string_view body) {
+  if (!enabled()) { return nullptr; }
+  Shard &                     shard = ShardFor(key);
+  std::lock_guard<std::mutex> lock(shard.mtx);
+  auto                        range = shard.index.equal_range(key);
+  for (auto it = range.first; it != range.second; ++it) {
+    if (it->second->body == body) {
+      // Move the entry to the front of the recency list
+      shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+      hits_++;
+      return it->second->plan;
+    }
+  }
+  misses_++;
+  return nullptr;
+}
+
+void
+fidi::PlanCache::Insert(std::size_t key, std::string body, PlanPtr plan) {
+  if (!enabled() || !plan) { return; }
+  Shard &                     shard = ShardFor(key);
+  std::lock_guard<std::mutex> lock(shard.mtx);
+  // Another request may have parsed the same body meanwhile
+  auto range = shard.index.equal_range(key);
+  for (auto it = range.first; it != range.second; ++it) {
+    if (it->second->body == body) { return; }
+  }
+  while (!shard.lru.empty() && shard.lru.size() >= shard_capacity_) {
+    auto victim = std::prev(shard.lru.end());
+    auto vrange = shard.index.equal_range(victim->key);
+    for (auto it = vrange.first; it != vrange.second; ++it) {
+      if (it->second == victim) {
+        shard.index.erase(it);
+        break;
+      }
+    }
+    shard.lru.erase(victim);
+    evictions_++;
+  }
+  shard.lru.push_front(Entry{key, std::move(body), std::move(plan)});
+  shard.index.emplace(key, shard.lru.begin());
+}
+
+fidi::PlanCache::Stats
+fidi::PlanCache::get_stats(void) {
+  Stats stats;
+  stats.hits      = hits_.load();
+  stats.misses    = misses_.load();
+  stats.evictions = evictions_.load();
+  stats.entries   = 0;
+  for (auto &shard : shards_) {
+    std::lock_guard<std::mutex> lock(shard.mtx);
+    stats.entries += shard.lru.size();
+  }
+  return stats;
+}
+
+//
+// fidi_plan_cache.cc ends here
@@ -0,0 +1,184 @@
+// fidi_plan_cache.h ---  -*- mode: c++; -*-
+
+// Copyright 2018-2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied.  See the License for the specific language governing
+// permissions and limitations under the License.
+
+/// \file
+/// \ingroup app
+///
+/// This file contains the cache of parsed request plans used by the
+/// fidi (φίδι) HTTP server to avoid parsing the same request body
+/// over and over again.
+
+// Code:
+
+#ifndef FIDI_PLAN_CACHE_H
+#  define FIDI_PLAN_CACHE_H
+
+#  include <array>
+#  include <atomic>
+#  include <cstddef>
+#  include <cstdint>
+#  include <functional>
+#  include <list>
+#  include <memory>
+#  include <mutex>
+#  include <string>
+#  include <string_view>
+#  include <unordered_map>
+
+#  include "src/fidi_driver.h"
+
+namespace fidi {
+
+  /// \brief A bounded LRU cache of parsed requests, keyed by body
+  ///
+  /// Load tests tend to replay a handful of request bodies many
+  /// times, and each one is lexed and parsed in full, blobs and all,
+  /// every time. This cache maps a hash of the request body to the
+  /// fidi::Driver::Plan produced by parsing and sanity checking it,
+  /// so a repeated body only costs a hash and a string compare. The
+  /// full body is stored with each entry and compared on lookup, so
+  /// a hash collision is just a miss.
+  ///
+  /// The cache is split into shards, each with its own lock and
+  /// recency list, so that concurrent requests rarely contend. The
+  /// plans are immutable once cached, and shared between the
+  /// requests using them.
+  class PlanCache {
+   public:
+    /// Cached plans are shared, and never modified
+    typedef std::shared_ptr<const fidi::Driver::Plan> PlanPtr;
+
+    /// A snapshot of the cache counters
+    struct Stats {
+      std::uint64_t hits;       ///< Lookups that found a plan
+      std::uint64_t misses;     ///< Lookups that did not
+      std::uint64_t evictions;  ///< Plans dropped to make room
+      std::size_t   entries;    ///< Plans cached right now
+    };
+
+    /// The copy constructor is not used, so declutter.
+    PlanCache(const PlanCache &) = delete;
+    /// The assignment operator is also not used, so cleaned up.
+    PlanCache &operator=(const PlanCache &) = delete;
+    /// The move operations are unused, and cleaned up.
+    PlanCache(PlanCache &&) = delete;
+    PlanCache &operator=(PlanCache &&) = delete;
+
+    /// Destructor. The members clean themselves
+    ~PlanCache() {}
+
+    /// \brief Set the size of the cache
+    ///
+    /// This only has effect if called before the first call to
+    /// instance().
+    ///
+    /// \param[in] capacity The maximum number of cached plans (0
+    ///            disables the cache)
+    static void Configure(std::size_t capacity);
+
+    /// \brief Get the process wide plan cache, creating it if needed
+    /// \return PlanCache the shared cache
+    static PlanCache &instance(void);
+
+    /// \brief Is the cache in use?
+    /// \return bool true if plans are being cached
+    bool
+    enabled(void) const {
+      return capacity_ > 0;
+    }
+
+    /// \brief Hash a request body
+    ///
+    /// \param[in] body The request body
+    /// \return size_t The key to look the body up with
+    static std::size_t
+    Hash(std::string_view body) {
+      return std::hash<std::string_view>{}(body);
+    }
+
+    /// \brief Look up the plan for a request body
+    ///
+    /// \param[in] key The hash of the body, from Hash()
+    /// \param[in] body The request body
+    /// \return PlanPtr The cached plan, or null if there is none
+    PlanPtr Lookup(std::size_t key, std::string_view body);
+
+    /// \brief Cache the plan for a request body
+    ///
+    /// Evicts the least recently used plan in the shard if it is
+    /// full.
+    ///
+    /// \param[in] key The hash of the body, from Hash()
+    /// \param[in] body The request body
+    /// \param[in] plan The plan produced by parsing the body
+    void Insert(std::size_t key, std::string body, PlanPtr plan);
+
+    /// \brief Return a snapshot of the cache counters
+    /// \return Stats the current counter values
+    Stats get_stats(void);
+
+   private:
+    /// A cached plan and the body it was parsed from
+    struct Entry {
+      std::size_t key;   ///< The hash of the body
+      std::string body;  ///< The body, to rule out collisions
+      PlanPtr     plan;  ///< The parsed plan
+    };
+
+    /// One independently locked part of the cache
+    struct Shard {
+      Shard() : mtx(), lru(), index() {}
+
+      std::mutex       mtx;  ///< Protects the members below
+      std::list<Entry> lru;  ///< Entries, most recently used first
+      std::unordered_multimap<std::size_t, std::list<Entry>::iterator>
+          index;  ///< Entries keyed by body hash
+    };
+
+    static constexpr std::size_t kShards = 16;  ///< Number of shards
+
+    /// \brief Constructor, only called by instance()
+    ///
+    /// \param[in] capacity The maximum number of cached plans
+    explicit PlanCache(std::size_t capacity);
+
+    /// \brief Pick the shard for a key
+    ///
+    /// \param[in] key The hash of the body
+    /// \return Shard the shard holding that key
+    Shard &
+    ShardFor(std::size_t key) {
+      // The low bits pick the hash bucket, so use the high ones here
+      return shards_[(key >> (sizeof(key) * 8 - 8)) % kShards];
+    }
+
+    static std::size_t configured_capacity_;  ///< Set by Configure()
+
+    const std::size_t capacity_;        ///< Maximum number of plans
+    const std::size_t shard_capacity_;  ///< Maximum plans in each shard
+    std::array<Shard, kShards> shards_;  ///< The cache shards
+
+    std::atomic<std::uint64_t> hits_;       ///< Lookups that found a plan
+    std::atomic<std::uint64_t> misses_;     ///< Lookups that did not
+    std::atomic<std::uint64_t> evictions_;  ///< Plans dropped
+  };
+
+}  // namespace fidi
+
+#endif /* FIDI_PLAN_CACHE_H */
+
+//
+// fidi_plan_cache.h ends here
@@ -0,0 +1,151 @@
+// fidi_random.h ---  -*- mode: c++; -*-
+
+// Copyright 2018-2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied.  See the License for the specific language governing
+// permissions and limitations under the License.
+
+/// \file
+/// \ingroup app
+///
+/// This file contains the pseudo random number generator the fidi
+/// (φίδι) HTTP server samples its delays with.
+
+// Code:
+
+#ifndef FIDI_RANDOM_H
+#  define FIDI_RANDOM_H
+
+#  include <cstdint>
+#  include <random>
+#  include <string>
+
+namespace fidi {
+
+  /// \brief A small, fast pseudo random number generator
+  ///
+  /// This is xoshiro256**, which takes a handful of instructions per
+  /// number, and keeps its state in four words, so every request may
+  /// have its own. It is seeded through splitmix64, so that any seed,
+  /// even zero, or seeds that differ in a single bit, give unrelated
+  /// sequences. It is not for cryptography.
+  class Random {
+   public:
+    /// \brief Constructor
+    ///
+    /// \param[in] seed The seed
+    explicit Random(std::uint64_t seed = 0) : state_() { Seed(seed); }
+
+    /// The copy constructor is not used, so declutter.
+    Random(const Random &) = delete;
+    /// The assignment operator is also not used, so cleaned up.
+    Random &operator=(const Random &) = delete;
+    /// The move operations are unused, and cleaned up.
+    Random(Random &&) = delete;
+    Random &operator=(Random &&) = delete;
+
+    /// \brief Start the sequence for a seed over
+    ///
+    /// \param[in] seed The seed
+    void
+    Seed(std::uint64_t seed) {
+      for (auto &word : state_) {
+        seed += 0x9e3779b97f4a7c15ULL;
+        word = Mix(seed);
+      }
+    }
+
+    /// \brief The next number in the sequence
+    /// \return uint64_t 64 random bits
+    std::uint64_t
+    Next(void) {
+      std::uint64_t result = Rotate(state_[1] * 5, 7) * 9;
+      std::uint64_t shifted = state_[1] << 17;
+      state_[2] ^= state_[0];
+      state_[3] ^= state_[1];
+      state_[1] ^= state_[2];
+      state_[0] ^= state_[3];
+      state_[2] ^= shifted;
+      state_[3] = Rotate(state_[3], 45);
+      return result;
+    }
+
+    /// \brief A number spread evenly over [0, 1)
+    /// \return double The number
+    double
+    NextDouble(void) {
+      return static_cast<double>(Next() >> 11) * (1.0 / 9007199254740992.0);
+    }
+
+    /// \brief The splitmix64 finalizer, which scrambles the bits of a word
+    ///
+    /// \param[in] word The word
+    /// \return uint64_t The scrambled word
+    static std::uint64_t
+    Mix(std::uint64_t word) {
+      word = (word ^ (word >> 30)) * 0xbf58476d1ce4e5b9ULL;
+      word = (word ^ (word >> 27)) * 0x94d049bb133111ebULL;
+      return word ^ (word >> 31);
+    }
+
+    /// \brief Derive a seed from another, and a key
+    ///
+    /// The key is hashed with FNV-1a, rather than std::hash, so that
+    /// a seed gives the same derived seeds with any build.
+    ///
+    /// \param[in] seed The seed derived from
+    /// \param[in] key What the derived seed is for
+    /// \return uint64_t The derived seed
+    static std::uint64_t
+    Derive(std::uint64_t seed, const std::string &key) {
+      std::uint64_t hash = 0xcbf29ce484222325ULL;
+      for (unsigned char c : key) {
+        hash ^= c;
+        hash *= 0x100000001b3ULL;
+      }
+      return Mix(seed ^ Mix(hash));
+    }
+
+    /// \brief A generator for this thread, seeded from the system
+    ///
+    /// This is for when the request gives no seed, to seed the
+    /// generator of each request cheaply.
+    ///
+    /// \return Random The generator of this thread
+    static Random &
+    ThreadLocal(void) {
+      thread_local Random random(
+          (static_cast<std::uint64_t>(std::random_device()()) << 32) ^
+          std::random_device()());
+      return random;
+    }
+
+   private:
+    /// \brief Rotate a word left
+    ///
+    /// \param[in] word The word
+    /// \param[in] bits How far to rotate, less than 64
+    /// \return uint64_t The rotated word
+    static std::uint64_t
+    Rotate(std::uint64_t word, int bits) {
+      return (word << bits) | (word >> (64 - bits));
+    }
+
+    std::uint64_t state_[4];  ///< The state of the generator
+  };
+
+}  // namespace fidi
+
+#endif /* FIDI_RANDOM_H */
+
+//
+// fidi_random.h ends here
@@ -20,30 +20,102 @@
 /// This file provides the implementation of the request handling
 /// functionality for the fidi (φίδι) HTTP server. This creates
 /// multiple instances of the fidi::AppCaller class to actually make
-/// downstream calls. This sets up a priority queue, a threadpool, and
-/// a task manager to handle calls in parallel and in sequence.
+/// downstream calls, which are run in parallel and in sequence by the
+/// process wide executor.
 
 // Code:
 
 #include "src/fidi_request_handler.h"
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <sstream>
+#include <string>
+#include "src/fidi_filler.h"
+#include "src/fidi_logging.h"
+#include "src/fidi_metrics.h"
+#include "src/fidi_node_table_cache.h"
+#include "src/fidi_trace.h"
+
+namespace {
+  /// \brief Append a metric to a Server-Timing header
+  ///
+  /// \param[in] name The name of the metric
+  /// \param[in] duration The time taken
+  /// \param[in,out] header The header being built
+  void
+  AppendTiming(const char *name, std::chrono::steady_clock::duration duration,
+               std::string *header) {
+    char metric[64];
+    // The duration is in milliseconds, which may be fractional
+    std::snprintf(metric, sizeof(metric), "%s%s;dur=%.3f",
+                  header->empty() ? "" : ", ", name,
+                  std::chrono::duration<double, std::milli>(duration).count());
+    header->append(metric);
+  }
+}  // namespace
 
 void
 fidi::FidiRequestHandler::handleRequest(Poco::Net::HTTPServerRequest & req,
                                         Poco::Net::HTTPServerResponse &resp) {
-  Poco::Logger::get("ConsoleLogger")
-      .information("Request from " + req.clientAddress().toString());
+  auto start = std::chrono::steady_clock::now();
+
+  // Every response says where the time went, so that the load tools
+  // can tell the overhead of fidi from the behaviour modeled
+  std::chrono::steady_clock::duration parse_time{};
+  std::chrono::steady_clock::duration check_time{};
+  bool                                executed = false;
+  auto set_server_timing = [&] {
+    std::string header;
+    header.reserve(128);
+    auto total = std::chrono::steady_clock::now() - start;
+    if (parse_time.count() != 0) { AppendTiming("parse", parse_time, &header); }
+    if (check_time.count() != 0) { AppendTiming("check", check_time, &header); }
+    if (executed) {
+      if (driver_.get_cpu_time().count() != 0) {
+        AppendTiming("cpu", driver_.get_cpu_time(), &header);
+      }
+      AppendTiming("predelay", driver_.get_predelay_time(), &header);
+      int stage = 0;
+      for (auto const &stage_time : driver_.get_stage_times()) {
+        std::string name("stage" + std::to_string(++stage));
+        AppendTiming(name.c_str(), stage_time, &header);
+      }
+      AppendTiming("postdelay", driver_.get_postdelay_time(), &header);
+      auto overhead = total - driver_.GetModeledTime();
+      if (overhead.count() < 0) { overhead = overhead.zero(); }
+      AppendTiming("overhead", overhead, &header);
+    }
+    AppendTiming("total", total, &header);
+    resp.set("Server-Timing", header);
+  };
+
+  if (fidi::Log::Console().information()) {
+    fidi::Log::Console().information("Request from " +
+                                     req.clientAddress().toString());
+  }
   bool failed = false;
-  resp.setChunkedTransferEncoding(true);
   resp.setContentType("text/html");
-  Poco::URI uri(req.getURI());
+  Poco::URI      uri(req.getURI());
+  fidi::Metrics &metrics = fidi::Metrics::instance();
+  // The metrics are scraped even while the node is made unresponsive,
+  // which is when they are most wanted
+  if (uri.getPath().compare("/metrics") == 0) {
+    std::string text(metrics.Export());
+    resp.setContentType(fidi::Metrics::kContentType);
+    set_server_timing();
+    resp.sendBuffer(text.data(), text.size());
+    return;
+  }
+
   // exit immediately if we are unresponsive
   if (!driver_.IsResponsive()) { return; }
-  // In all other cases we send a response back
-  std::ostream &response_stream = resp.send();
 
+  // The page is put together first, and sent once the status is
+  // known, since the status can not be changed once sending starts
+  std::ostringstream response_stream;
   if (uri.getPath().compare("/healthz") == 0) {
-    Poco::Logger::get("FileLogger").trace("Healthz");
-    // TODO: Check for and set a not OK status if we are not healthy
+    fidi::Log::File().trace("Healthz");
     response_stream << "<html><head><title>Fidi  (φίδι) -- a service mock "
                        "instance\n</title></head>\n"
                        "<body>\n";
@@ -55,9 +127,51 @@ fidi::FidiRequestHandler::handleRequest(Poco::Net::HTTPServerRequest & req,
       response_stream << "Failure\n";
     }
     response_stream << "</body></html>";
-    response_stream.flush();
+    std::string page(response_stream.str());
+    set_server_timing();
+    resp.sendBuffer(page.data(), page.size());
+    return;
+  }
+
+  // Handling the request is a span of the trace of the caller, if
+  // any, or else the root of a new one
+  fidi::Tracer &     tracer = fidi::Tracer::instance();
+  fidi::TraceContext parent;
+  fidi::TraceContext::Parse(req.get(fidi::Tracer::kHeader, ""), &parent);
+  fidi::TraceContext span = tracer.StartSpan(parent);
+  driver_.set_trace(span);
+  auto record_span = [&] {
+    if (!tracer.enabled()) { return; }
+    tracer.Record(node_.get_name(), span, parent.span_id, "handle", start,
+                  std::chrono::steady_clock::now(),
+                  {{"status", std::to_string(static_cast<int>(
+                                  resp.getStatus()))}});
+  };
+
+  try {
+    driver_.set_content_type(req.getContentType());
+    driver_.set_node_table(req.get(fidi::NodeTableCache::kHeader, ""));
+    driver_.set_seed(req.get(fidi::AppCaller::kSeedHeader, ""));
+    driver_.Parse(req.stream());
+    parse_time = std::chrono::steady_clock::now() - start;
+    metrics.RecordPhase(fidi::Metrics::Phase::kParse, parse_time);
+  } catch (std::bad_alloc &ba) {
+    std::cerr << "Got memory error: " << ba.what() << "\n";
+    std::cerr.flush();
+    return;
+  }  // Fail fast on OOM
+
+  if (driver_.get_missing_nodes()) {
+    // Ask the caller to send the request again, with the node table
+    static const std::string unknown("Unknown node table\n");
+    resp.setStatus(Poco::Net::HTTPResponse::HTTP_PRECONDITION_FAILED);
+    set_server_timing();
+    resp.sendBuffer(unknown.data(), unknown.size());
+    metrics.RecordRequest(std::chrono::steady_clock::now() - start);
+    record_span();
     return;
   }
+
   response_stream << "<html><head><title>Fidi  (φίδι) -- a service mock "
                      "instance\n</title></head>\n"
                      "<body>\n"
@@ -70,14 +184,6 @@ fidi::FidiRequestHandler::handleRequest(Poco::Net::HTTPServerRequest & req,
                   << "</p>\n"
                      "<p>URI: "
                   << req.getURI() << "</p>\n";
-  try {
-    driver_.Parse(req.stream());
-  } catch (std::bad_alloc &ba) {
-    std::cerr << "Got memory error: " << ba.what() << "\n";
-    std::cerr.flush();
-    return;
-  }  // Fail fast on OOM
-
   auto parse_errors = driver_.get_errors();
   if (parse_errors.first != 0) {
     // take action to return errors
@@ -85,36 +191,57 @@ fidi::FidiRequestHandler::handleRequest(Poco::Net::HTTPServerRequest & req,
     resp.setStatus(Poco::Net::HTTPResponse::HTTP_BAD_REQUEST);
     response_stream << "    <h2>Parse Syntax Errors</h2>\n\n\n"
                     << parse_errors.second;
-    Poco::Logger::get("ConsoleLogger").error("Errors " + parse_errors.second);
-    Poco::Logger::get("FileLogger").error("Errors " + parse_errors.second);
+    fidi::Log::Console().error("Errors " + parse_errors.second);
+    fidi::Log::File().error("Errors " + parse_errors.second);
     failed = true;
   }
   std::string warning_message;
+  auto        checked = std::chrono::steady_clock::now();
   int         warning = driver_.SanityChecks(&warning_message);
+  check_time          = std::chrono::steady_clock::now() - checked;
+  metrics.RecordPhase(fidi::Metrics::Phase::kSanityCheck, check_time);
   if (warning) {
     resp.setStatus(Poco::Net::HTTPResponse::HTTP_BAD_REQUEST);
     response_stream << "    <h2>Warning</h2>\n\n\n" << warning_message;
-    Poco::Logger::get("ConsoleLogger").warning("Warnings " + warning_message);
-    Poco::Logger::get("FileLogger").warning("Warnings " + warning_message);
+    fidi::Log::Console().warning("Warnings " + warning_message);
+    fidi::Log::File().warning("Warnings " + warning_message);
     failed = true;
   }
+  std::uint64_t size = 0;
   if (!failed) {
     driver_.set_resp(resp);
     try {
-      Poco::Logger::get("ConsoleLogger").trace("Request parsed OK.");
+      fidi::Log::Console().trace("Request parsed OK.");
       driver_.Execute(response_stream);
+      executed = true;
     } catch (std::bad_alloc &ba) {
       std::cerr << "Got memory error: " << ba.what() << "\n";
       std::cerr.flush();
       return;
     }  // Fail fast on OOM
   }
-  response_stream << "</body></html>";
-  response_stream.flush();
 
-  Poco::Logger::get("FileLogger")
-      .trace("Response sent for count=" + std::to_string(count_) +
-             " and URI=" + req.getURI() + "\n");
+  if (!failed && driver_.GetResponseSize(&size)) {
+    // A body of exactly the size asked for, streamed from the shared
+    // filler rather than formatted
+    resp.setContentType("application/octet-stream");
+    resp.setContentLength64(static_cast<Poco::Int64>(size));
+    set_server_timing();
+    fidi::Filler::instance().Write(resp.send(), size).flush();
+  } else {
+    response_stream << "</body></html>";
+    std::string page(response_stream.str());
+    set_server_timing();
+    resp.sendBuffer(page.data(), page.size());
+  }
+  metrics.RecordRequest(std::chrono::steady_clock::now() - start);
+  record_span();
+
+  if (fidi::Log::File().trace()) {
+    fidi::Log::File().trace("Response sent for count=" +
+                            std::to_string(count_) + " and URI=" +
+                            req.getURI() + "\n");
+  }
 }
 
 //
@@ -37,8 +37,13 @@ namespace fidi {
   /// \brief This class handles HTTP requests made to  fidi (φίδι)
   class FidiRequestHandler : public Poco::Net::HTTPRequestHandler {
    public:
-    /// The default constructor. Calls the base class constructor
-    FidiRequestHandler() : driver_(){};
+    /// \brief Constructor
+    ///
+    /// \param[in] node The node the request was sent to
+    explicit FidiRequestHandler(fidi::NodeState &node) :
+        driver_(), node_(node) {
+      driver_.set_node(&node);
+    }
 
     /// The copy constructor is not used, so decluttering.
     FidiRequestHandler(const FidiRequestHandler &) = delete;
@@ -68,10 +73,10 @@ namespace fidi {
     /// check the same as it did for parse errors (return
     /// HTTP_BAD_REQUEST).
     ///
-    /// After than, this sets up a priority queue, a thread pool, and a
-    /// task manager to handle calls in parallel and in sequence. This
-    /// creates multiple instances of the fidi::AppCaller class to
-    /// actually make downstream calls.
+    /// After than, this walks the priority queue, handing calls to the
+    /// shared fidi::Executor to handle them in parallel and in
+    /// sequence. This creates multiple instances of the fidi::AppCaller
+    /// class to actually make downstream calls.
     ///
     /// \param[in] req The HTTP request
     /// \param[in, out] resp The HTTP response
@@ -79,8 +84,9 @@ namespace fidi {
                                Poco::Net::HTTPServerResponse &resp);
 
    private:
-    int       count_ = 0;  ///< The number of requests handled
-    AppDriver driver_;     ///< The HTTP server parser driver
+    int              count_ = 0;  ///< The number of requests handled
+    AppDriver        driver_;     ///< The HTTP server parser driver
+    fidi::NodeState &node_;       ///< The node the request was sent to
   };
 }  // namespace fidi
 #endif /* FIDI_REQUEST_HANDLER_H */
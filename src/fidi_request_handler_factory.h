@@ -25,6 +25,7 @@
 #  define FIDI_REQUEST_HANDLER_FACTORY_H
 
 #  include <Poco/Net/HTTPRequestHandlerFactory.h>
+#  include "src/fidi_executor.h"
 #  include "src/fidi_request_handler.h"
 
 // The UNUSED macro won't work for arguments which contain
@@ -49,11 +50,19 @@ namespace fidi {
   ///
   /// This implements the interface required by the server
   /// application, and implements the createRequestHandler method.
+  /// There is one factory for each node hosted, and the handlers it
+  /// creates handle requests to that node.
   class FidiRequestHandlerFactory
       : public Poco::Net::HTTPRequestHandlerFactory {
    public:
-    /// The default constructor
-    FidiRequestHandlerFactory() = default;
+    /// \brief Constructor
+    ///
+    /// \param[in] node The node requests are sent to, which must
+    ///            outlive the factory
+    /// \param[in] cpu The CPU to pin the threads handling requests
+    ///            to, or -1 to leave them be
+    explicit FidiRequestHandlerFactory(fidi::NodeState &node, int cpu = -1) :
+        node_(node), cpu_(cpu) {}
 
     /// The copy constructor is not used, so decluttering.
     FidiRequestHandlerFactory(const FidiRequestHandlerFactory&) = delete;
@@ -72,7 +81,7 @@ namespace fidi {
     FidiRequestHandlerFactory(FidiRequestHandlerFactory&&) = delete;
     FidiRequestHandlerFactory& operator=(FidiRequestHandlerFactory&&) = delete;
 
-    /// Destructor -- we have no data members
+    /// Destructor -- the node is not ours to clean up
     virtual ~FidiRequestHandlerFactory(){};
 
     /// \brief This is the one required method.
@@ -80,8 +89,14 @@ namespace fidi {
     /// \return FidiRequestHandler We just return a new request handler
     virtual Poco::Net::HTTPRequestHandler*
     createRequestHandler(const Poco::Net::HTTPServerRequest& UNUSED(req)) {
-      return new FidiRequestHandler;
+      // This runs in the thread that is to handle the request
+      if (cpu_ >= 0) { fidi::Executor::PinThread(cpu_); }
+      return new FidiRequestHandler(node_);
     }
+
+   private:
+    fidi::NodeState& node_;  ///< The node requests are sent to
+    int              cpu_;   ///< The CPU threads are pinned to, or -1
   };
 }  // namespace fidi
 #endif /* FIDI_REQUEST_HANDLER_FACTORY_H */
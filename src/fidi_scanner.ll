@@ -119,6 +119,7 @@ COMMENT [/][*][^*]*[*]+([^*/][^*]*[*]+)*[/]
                              }
 <INITIAL,EDGEDEF>"]"        {return token::CBRACKET;}
 <INITIAL,EDGEDEF>","        {return token::COMMA;}
+<EDGEDEF>"|"                {return token::PIPE;}
 
 <INITIAL,EDGEDEF>{NUMBER}+  {yylval->build<int>( std::atoi(yytext) );
                              return token::NUMBER;}
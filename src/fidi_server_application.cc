@@ -26,23 +26,132 @@
 #include <sys/types.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <memory>
+#include <sstream>
+#include <thread>
+
 #include "src/fidi_server_application.h"
+#include "src/fidi_async_client.h"
+#include "src/fidi_bulkhead.h"
+#include "src/fidi_cpu_burn.h"
+#include "src/fidi_filler.h"
+#include "src/fidi_health.h"
+#include "src/fidi_local_dispatch.h"
+#include "src/fidi_logging.h"
+#include "src/fidi_trace.h"
+
+namespace {
+  /// \brief The host name, for naming the nodes hosted
+  /// \return string The host name, or localhost if it is not known
+  std::string
+  HostName(void) {
+    char host[256] = {0};
+    if (gethostname(host, sizeof(host) - 1) != 0) {
+      std::strcpy(host, "localhost");
+    }
+    return host;
+  }
+}  // namespace
 
 int
 fidi::FidiServerApplication::main(const std::vector<std::string>&) {
-  Poco::Net::HTTPServer server(new FidiRequestHandlerFactory,
-                               Poco::Net::ServerSocket(port_),
-                               new Poco::Net::HTTPServerParams);
   if (!help_requested_) {
-    server.start();
-    Poco::Logger::get("ConsoleLogger").information("Fidi Server Started");
-    Poco::Logger::get("FileLogger").information("Fidi Server Started");
+    if (ports_.empty()) { ports_.push_back(port_); }
+
+    // Each port is a node of its own, but they all share the threads
+    // handling requests, the executor and the logs. Nodes are named,
+    // in spans, by host name and port.
+    //
+    // With more than one acceptor, each port is listened on by as
+    // many sockets, bound with SO_REUSEPORT so that the kernel spreads
+    // the connections over them, each with its own dispatcher and its
+    // own pool of threads, pinned to a CPU if asked.
+    //
+    // The dispatcher of each port keeps one thread of its pool for as
+    // long as the server runs, so each pool has a thread for every
+    // port on top of the threads shared by the ports.
+    int port_count = static_cast<int>(ports_.size());
+    int cores = static_cast<int>(
+        std::max(1U, std::thread::hardware_concurrency()));
+    int acceptors = acceptors_ > 0 ? acceptors_ : cores;
+    std::string                                   host(HostName());
+    std::vector<std::unique_ptr<fidi::NodeState>> nodes;
+    std::vector<std::unique_ptr<Poco::ThreadPool>> pools;
+    for (int i = 0; i < acceptors; ++i) {
+      pools.push_back(std::make_unique<Poco::ThreadPool>(
+          2, port_count + server_threads_));
+    }
+    std::vector<std::unique_ptr<Poco::Net::HTTPServer>> servers;
+    for (auto port : ports_) {
+      nodes.push_back(std::make_unique<fidi::NodeState>(
+          host + ":" + std::to_string(port)));
+      fidi::LocalDispatch::instance().Register(host, port, nodes.back().get());
+      for (int i = 0; i < acceptors; ++i) {
+        Poco::Net::ServerSocket socket;
+        socket.bind(Poco::Net::SocketAddress(port), true, acceptors > 1);
+        socket.listen(listen_backlog_);
+        Poco::Net::HTTPServerParams* params = new Poco::Net::HTTPServerParams;
+        params->setMaxThreads(server_threads_);
+        params->setMaxQueued(max_queued_);
+        params->setMaxKeepAliveRequests(keep_alive_requests_);
+        params->setKeepAliveTimeout(Poco::Timespan(keep_alive_timeout_, 0));
+        servers.push_back(std::make_unique<Poco::Net::HTTPServer>(
+            new FidiRequestHandlerFactory(*nodes.back(),
+                                          pin_threads_ ? i % cores : -1),
+            *pools[static_cast<std::size_t>(i)], socket, params));
+      }
+    }
+    for (auto& server : servers) { server->start(); }
+    std::string started("Fidi Server Started");
+    if (ports_.size() > 1) {
+      started.append(" on ")
+          .append(std::to_string(ports_.size()))
+          .append(" ports");
+    }
+    if (acceptors > 1) {
+      started.append(" with ")
+          .append(std::to_string(acceptors))
+          .append(" acceptors");
+    }
+    Poco::Logger::get("ConsoleLogger").information(started);
+    Poco::Logger::get("FileLogger").information(started);
     // Wait for a control C
     waitForTerminationRequest();
     Poco::Logger::get("ConsoleLogger")
         .information("Fidi Server Shutting Down...");
     Poco::Logger::get("FileLogger").information("Fidi Server Shutting Down...");
-    server.stop();
+    for (auto& server : servers) { server->stop(); }
+
+    auto stats = fidi::Executor::instance().get_stats();
+    Poco::Logger::get("FileLogger")
+        .information(
+            "Downstream calls: " + std::to_string(stats.completed) + " of " +
+            std::to_string(stats.submitted) + " completed, queue wait " +
+            std::to_string(stats.queue_wait_usec) + "us total, " +
+            std::to_string(stats.max_queue_wait_usec) + "us max");
+    auto pool_stats = fidi::SessionPool::instance().get_stats();
+    Poco::Logger::get("FileLogger")
+        .information("Connections: " + std::to_string(pool_stats.created) +
+                     " opened, " + std::to_string(pool_stats.reused) +
+                     " reuses, " + std::to_string(pool_stats.dropped) +
+                     " dropped");
+    auto cache_stats = fidi::PlanCache::instance().get_stats();
+    Poco::Logger::get("FileLogger")
+        .information("Plan cache: " + std::to_string(cache_stats.hits) +
+                     " hits, " + std::to_string(cache_stats.misses) +
+                     " misses, " + std::to_string(cache_stats.evictions) +
+                     " evictions");
+    auto table_stats = fidi::NodeTableCache::instance().get_stats();
+    Poco::Logger::get("FileLogger")
+        .information("Node tables: " + std::to_string(table_stats.omitted) +
+                     " calls sent without, " +
+                     std::to_string(table_stats.resent) + " sent again, " +
+                     std::to_string(table_stats.hits) + " filled in, " +
+                     std::to_string(table_stats.misses) + " unknown");
+    fidi::Executor::instance().Shutdown();
   }
   return Poco::Util::Application::EXIT_OK;
 }
@@ -59,10 +168,17 @@ fidi::FidiServerApplication::CreateConsoleLogger(void) {
   console_formatting_channel_p->setChannel(console_channel_p);
   console_formatting_channel_p->open();
 
+  // With async logging, the background thread does the formatting
+  // and the writing
+  Poco::AutoPtr<Poco::Channel> console_p(console_formatting_channel_p.get(),
+                                         true);
+  if (async_logging_) {
+    console_p = new fidi::RingChannel(console_formatting_channel_p);
+  }
+
   // The logger itself
-  Poco::Logger& console_logger =
-      Poco::Logger::create("ConsoleLogger", console_formatting_channel_p,
-                           Poco::Message::PRIO_INFORMATION);
+  Poco::Logger& console_logger = Poco::Logger::create(
+      "ConsoleLogger", console_p, Poco::Message::PRIO_INFORMATION);
   console_logger.trace("Console logger initialized.");
 }
 
@@ -103,10 +219,15 @@ fidi::FidiServerApplication::CreateFileLogger(void) {
   file_formatting_channel_p->setChannel(file_channel_p);
   file_formatting_channel_p->open();
 
+  Poco::AutoPtr<Poco::Channel> file_p(file_formatting_channel_p.get(), true);
+  if (async_logging_) {
+    file_p = new fidi::RingChannel(file_formatting_channel_p);
+  }
+
   // Then create two Logger objects - one for
   // each channel chain.
-  Poco::Logger& file_logger = Poco::Logger::create(
-      "FileLogger", file_formatting_channel_p, Poco::Message::PRIO_DEBUG);
+  Poco::Logger& file_logger =
+      Poco::Logger::create("FileLogger", file_p, Poco::Message::PRIO_DEBUG);
   file_logger.trace("File logger initialized.");
 }
 void
@@ -116,8 +237,27 @@ fidi::FidiServerApplication::initialize(Poco::Util::Application& self) {
   if (!help_requested_) {
     // set up two channel chains - one to the
     // console and the other one to a log file.
+    if (async_logging_) { fidi::AsyncLog::Configure(log_ring_size_); }
     CreateConsoleLogger();
     CreateFileLogger();
+    fidi::Log::CacheLoggers();
+    fidi::Executor::Configure(call_threads_, call_queue_depth_);
+    fidi::SessionPool::Configure(max_idle_connections_,
+                                 max_connections_per_host_,
+                                 prewarm_connections_);
+    fidi::Bulkhead::Configure(max_in_flight_);
+    fidi::AsyncClient::Configure(async_call_threads_, max_idle_connections_);
+    fidi::PlanCache::Configure(plan_cache_size_);
+    fidi::NodeTableCache::Configure(node_table_cache_size_,
+                                    share_node_tables_);
+    fidi::Tracer::Configure(trace_file_);
+    fidi::LocalDispatch::Configure(
+        in_process_calls_, std::chrono::microseconds(in_process_delay_usec_),
+        in_process_threads_);
+    // Fill the response filler now, rather than in the first request
+    (void)fidi::Filler::instance();
+    // Likewise calibrate the CPU work while the machine is quiet
+    (void)fidi::CpuBurn::instance();
 
     Poco::Logger::get("ConsoleLogger").trace("Fidi Server initialized.");
     Poco::Logger::get("FileLogger")
@@ -128,6 +268,15 @@ fidi::FidiServerApplication::initialize(Poco::Util::Application& self) {
 void
 fidi::FidiServerApplication::uninitialize() {
   Poco::Util::ServerApplication::uninitialize();
+  if (async_logging_ && !help_requested_) {
+    // Write out what is still queued while the channels are open
+    fidi::AsyncLog::instance().Shutdown();
+    auto log_stats = fidi::AsyncLog::instance().get_stats();
+    if (log_stats.dropped > 0) {
+      std::cerr << "Log messages dropped: " << log_stats.dropped << " of "
+                << log_stats.written + log_stats.dropped << "\n";
+    }
+  }
   Poco::Logger::shutdown();
 }
 
@@ -171,6 +320,294 @@ fidi::FidiServerApplication::defineOptions(Poco::Util::OptionSet& options) {
           .callback(Poco::Util::OptionCallback<fidi::FidiServerApplication>(
               this, &fidi::FidiServerApplication::set_port)));
 
+  options.addOption(
+      Poco::Util::Option("ports", "",
+                         "local ports to listen on, one node on each, like "
+                         "9001-9200")
+          .required(false)
+          .repeatable(false)
+          .argument("<ports>")
+          .binding("server.ports")
+          .callback(Poco::Util::OptionCallback<fidi::FidiServerApplication>(
+              this, &fidi::FidiServerApplication::SetPorts)));
+
+  options.addOption(
+      Poco::Util::Option("server-threads", "",
+                         "number of threads handling requests, per acceptor")
+          .required(false)
+          .repeatable(false)
+          .argument("<threads>")
+          .binding("server.threads")
+          .validator(new Poco::Util::IntValidator(1, 65535))
+          .callback(Poco::Util::OptionCallback<fidi::FidiServerApplication>(
+              this, &fidi::FidiServerApplication::SetServerThreads)));
+
+  options.addOption(
+      Poco::Util::Option("acceptors", "",
+                         "sockets listening on each port, with SO_REUSEPORT "
+                         "(0 for one per core)")
+          .required(false)
+          .repeatable(false)
+          .argument("<count>")
+          .binding("server.acceptors")
+          .validator(new Poco::Util::IntValidator(0, 4096))
+          .callback(Poco::Util::OptionCallback<fidi::FidiServerApplication>(
+              this, &fidi::FidiServerApplication::SetAcceptors)));
+
+  options.addOption(
+      Poco::Util::Option("pin-threads", "",
+                         "pin the threads of each acceptor to a CPU")
+          .required(false)
+          .repeatable(false)
+          .callback(Poco::Util::OptionCallback<fidi::FidiServerApplication>(
+              this, &fidi::FidiServerApplication::HandlePinThreads)));
+
+  options.addOption(
+      Poco::Util::Option("listen-backlog", "",
+                         "connections the kernel queues on each socket")
+          .required(false)
+          .repeatable(false)
+          .argument("<count>")
+          .binding("server.listen_backlog")
+          .validator(new Poco::Util::IntValidator(
+              1, std::numeric_limits<int>::max()))
+          .callback(Poco::Util::OptionCallback<fidi::FidiServerApplication>(
+              this, &fidi::FidiServerApplication::SetListenBacklog)));
+
+  options.addOption(
+      Poco::Util::Option("max-queued", "",
+                         "accepted connections queued for a thread, per "
+                         "acceptor")
+          .required(false)
+          .repeatable(false)
+          .argument("<count>")
+          .binding("server.max_queued")
+          .validator(new Poco::Util::IntValidator(
+              1, std::numeric_limits<int>::max()))
+          .callback(Poco::Util::OptionCallback<fidi::FidiServerApplication>(
+              this, &fidi::FidiServerApplication::SetMaxQueued)));
+
+  options.addOption(
+      Poco::Util::Option("keep-alive-requests", "",
+                         "requests served on a connection before it is "
+                         "closed (0 for no limit)")
+          .required(false)
+          .repeatable(false)
+          .argument("<count>")
+          .binding("server.keep_alive_requests")
+          .validator(new Poco::Util::IntValidator(
+              0, std::numeric_limits<int>::max()))
+          .callback(Poco::Util::OptionCallback<fidi::FidiServerApplication>(
+              this, &fidi::FidiServerApplication::SetKeepAliveRequests)));
+
+  options.addOption(
+      Poco::Util::Option("keep-alive-timeout", "",
+                         "seconds an idle connection is kept open")
+          .required(false)
+          .repeatable(false)
+          .argument("<seconds>")
+          .binding("server.keep_alive_timeout")
+          .validator(new Poco::Util::IntValidator(
+              1, std::numeric_limits<int>::max()))
+          .callback(Poco::Util::OptionCallback<fidi::FidiServerApplication>(
+              this, &fidi::FidiServerApplication::SetKeepAliveTimeout)));
+
+  options.addOption(
+      Poco::Util::Option("call-threads", "t",
+                         "number of threads making downstream calls")
+          .required(false)
+          .repeatable(false)
+          .argument("<threads>")
+          .binding("calls.threads")
+          .validator(new Poco::Util::IntValidator(1, 65535))
+          .callback(Poco::Util::OptionCallback<fidi::FidiServerApplication>(
+              this, &fidi::FidiServerApplication::SetCallThreads)));
+
+  options.addOption(
+      Poco::Util::Option("call-queue-depth", "q",
+                         "maximum number of queued downstream calls")
+          .required(false)
+          .repeatable(false)
+          .argument("<depth>")
+          .binding("calls.queue_depth")
+          .validator(new Poco::Util::IntValidator(
+              1, std::numeric_limits<int>::max()))
+          .callback(Poco::Util::OptionCallback<fidi::FidiServerApplication>(
+              this, &fidi::FidiServerApplication::SetCallQueueDepth)));
+
+  options.addOption(
+      Poco::Util::Option("max-idle-connections", "",
+                         "idle keep-alive connections kept per destination")
+          .required(false)
+          .repeatable(false)
+          .argument("<count>")
+          .binding("connections.max_idle")
+          .validator(new Poco::Util::IntValidator(
+              0, std::numeric_limits<int>::max()))
+          .callback(Poco::Util::OptionCallback<fidi::FidiServerApplication>(
+              this, &fidi::FidiServerApplication::SetMaxIdleConnections)));
+
+  options.addOption(
+      Poco::Util::Option("max-connections-per-host", "",
+                         "live connections allowed per destination (0 for "
+                         "no limit)")
+          .required(false)
+          .repeatable(false)
+          .argument("<count>")
+          .binding("connections.max_per_host")
+          .validator(new Poco::Util::IntValidator(
+              0, std::numeric_limits<int>::max()))
+          .callback(Poco::Util::OptionCallback<fidi::FidiServerApplication>(
+              this, &fidi::FidiServerApplication::SetMaxConnectionsPerHost)));
+
+  options.addOption(
+      Poco::Util::Option("max-in-flight", "",
+                         "downstream calls in flight allowed per "
+                         "destination, the rest queued (0 for no limit)")
+          .required(false)
+          .repeatable(false)
+          .argument("<count>")
+          .binding("calls.max_in_flight")
+          .validator(new Poco::Util::IntValidator(
+              0, std::numeric_limits<int>::max()))
+          .callback(Poco::Util::OptionCallback<fidi::FidiServerApplication>(
+              this, &fidi::FidiServerApplication::SetMaxInFlight)));
+
+  options.addOption(
+      Poco::Util::Option("async-call-threads", "",
+                         "threads making downstream calls with non-blocking "
+                         "sockets (0 for blocking calls)")
+          .required(false)
+          .repeatable(false)
+          .argument("<threads>")
+          .binding("calls.async_threads")
+          .validator(new Poco::Util::IntValidator(0, 1024))
+          .callback(Poco::Util::OptionCallback<fidi::FidiServerApplication>(
+              this, &fidi::FidiServerApplication::SetAsyncCallThreads)));
+
+  options.addOption(
+      Poco::Util::Option("prewarm-connections", "",
+                         "open connections to the nodes of each request "
+                         "ahead of use")
+          .required(false)
+          .repeatable(false)
+          .callback(Poco::Util::OptionCallback<fidi::FidiServerApplication>(
+              this, &fidi::FidiServerApplication::HandlePrewarm)));
+
+  options.addOption(
+      Poco::Util::Option("async-delays", "",
+                         "park modeled delays on a timer wheel instead of "
+                         "sleeping; the server thread still waits for the "
+                         "response")
+          .required(false)
+          .repeatable(false)
+          .callback(Poco::Util::OptionCallback<fidi::FidiServerApplication>(
+              this, &fidi::FidiServerApplication::HandleAsyncDelays)));
+
+  options.addOption(
+      Poco::Util::Option("binary-calls", "",
+                         "send downstream payloads in the binary wire format")
+          .required(false)
+          .repeatable(false)
+          .callback(Poco::Util::OptionCallback<fidi::FidiServerApplication>(
+              this, &fidi::FidiServerApplication::HandleBinaryCalls)));
+
+  options.addOption(
+      Poco::Util::Option("plan-cache-size", "",
+                         "number of parsed request bodies cached (0 "
+                         "disables the cache)")
+          .required(false)
+          .repeatable(false)
+          .argument("<count>")
+          .binding("parser.plan_cache_size")
+          .validator(new Poco::Util::IntValidator(
+              0, std::numeric_limits<int>::max()))
+          .callback(Poco::Util::OptionCallback<fidi::FidiServerApplication>(
+              this, &fidi::FidiServerApplication::SetPlanCacheSize)));
+
+  options.addOption(
+      Poco::Util::Option("node-table-cache-size", "",
+                         "number of node tables received that are kept")
+          .required(false)
+          .repeatable(false)
+          .argument("<count>")
+          .binding("nodes.cache_size")
+          .validator(new Poco::Util::IntValidator(
+              0, std::numeric_limits<int>::max()))
+          .callback(Poco::Util::OptionCallback<fidi::FidiServerApplication>(
+              this, &fidi::FidiServerApplication::SetNodeTableCacheSize)));
+
+  options.addOption(
+      Poco::Util::Option("share-node-tables", "",
+                         "send each node table only once to each "
+                         "destination")
+          .required(false)
+          .repeatable(false)
+          .callback(Poco::Util::OptionCallback<fidi::FidiServerApplication>(
+              this, &fidi::FidiServerApplication::HandleShareNodeTables)));
+
+  options.addOption(
+      Poco::Util::Option("async-logging", "",
+                         "write log messages from a background thread")
+          .required(false)
+          .repeatable(false)
+          .callback(Poco::Util::OptionCallback<fidi::FidiServerApplication>(
+              this, &fidi::FidiServerApplication::HandleAsyncLogging)));
+
+  options.addOption(
+      Poco::Util::Option("log-ring-size", "",
+                         "log messages each thread may queue, with "
+                         "--async-logging")
+          .required(false)
+          .repeatable(false)
+          .argument("<count>")
+          .binding("logging.ring_size")
+          .validator(new Poco::Util::IntValidator(
+              1, std::numeric_limits<int>::max()))
+          .callback(Poco::Util::OptionCallback<fidi::FidiServerApplication>(
+              this, &fidi::FidiServerApplication::SetLogRingSize)));
+
+  options.addOption(
+      Poco::Util::Option("trace-file", "",
+                         "record spans of traced requests in this file")
+          .required(false)
+          .repeatable(false)
+          .argument("<trace_file>")
+          .binding("tracing.file")
+          .callback(Poco::Util::OptionCallback<fidi::FidiServerApplication>(
+              this, &fidi::FidiServerApplication::SetTraceFile)));
+
+  options.addOption(
+      Poco::Util::Option("in-process-calls", "",
+                         "call nodes hosted by this process without HTTP")
+          .required(false)
+          .repeatable(false)
+          .callback(Poco::Util::OptionCallback<fidi::FidiServerApplication>(
+              this, &fidi::FidiServerApplication::HandleInProcessCalls)));
+
+  options.addOption(
+      Poco::Util::Option("in-process-delay-usec", "",
+                         "modeled network delay added to in-process calls")
+          .required(false)
+          .repeatable(false)
+          .argument("<usec>")
+          .binding("calls.in_process_delay_usec")
+          .validator(new Poco::Util::IntValidator(
+              0, std::numeric_limits<int>::max()))
+          .callback(Poco::Util::OptionCallback<fidi::FidiServerApplication>(
+              this, &fidi::FidiServerApplication::SetInProcessDelay)));
+
+  options.addOption(
+      Poco::Util::Option("in-process-threads", "",
+                         "most threads handling in-process calls")
+          .required(false)
+          .repeatable(false)
+          .argument("<threads>")
+          .binding("calls.in_process_threads")
+          .validator(new Poco::Util::IntValidator(1, 65535))
+          .callback(Poco::Util::OptionCallback<fidi::FidiServerApplication>(
+              this, &fidi::FidiServerApplication::SetInProcessThreads)));
+
   options.addOption(
       Poco::Util::Option("version", "v", "display version number")
           .required(false)
@@ -195,8 +632,8 @@ fidi::FidiServerApplication::HandleHelp(const std::string&,
   help_formatter.setCommand(commandName());
   help_formatter.setUsage("OPTIONS");
   help_formatter.setHeader(
-      "fidi service mocker (this instance mocks a single node in the service "
-      "being mocked).");
+      "fidi service mocker (this instance mocks a node, or with --ports "
+      "several nodes, of the service being mocked).");
   help_formatter.format(std::cout);
   stopOptionsProcessing();
   help_requested_ = true;
@@ -209,6 +646,89 @@ fidi::FidiServerApplication::set_port(const std::string&,
   port_ = static_cast<Poco::UInt16>(std::stoi(value));
 }
 
+void
+fidi::FidiServerApplication::SetPorts(const std::string&,
+                                      const std::string& value) {
+  ports_.clear();
+  std::istringstream list(value);
+  std::string        item;
+  while (std::getline(list, item, ',')) {
+    std::size_t dash  = item.find('-');
+    std::size_t used  = 0;
+    long        first = 0;
+    long        last  = 0;
+    try {
+      first = std::stol(item, &used);
+      last  = first;
+      if (dash != std::string::npos && used == dash) {
+        std::string rest(item, dash + 1);
+        last = std::stol(rest, &used);
+        used += dash + 1;
+      }
+    } catch (std::exception&) {
+      used = 0;
+    }
+    if (used == 0 || used != item.size() || first < 1 || last < first ||
+        last > std::numeric_limits<Poco::UInt16>::max()) {
+      throw Poco::Util::InvalidArgumentException("Bad port list: " + value);
+    }
+    for (long port = first; port <= last; ++port) {
+      ports_.push_back(static_cast<Poco::UInt16>(port));
+    }
+  }
+  if (ports_.empty()) {
+    throw Poco::Util::InvalidArgumentException("Bad port list: " + value);
+  }
+}
+
+void
+fidi::FidiServerApplication::SetServerThreads(const std::string&,
+                                              const std::string& value) {
+  // The validator above should ensure this is indeed an int
+  server_threads_ = std::stoi(value);
+}
+
+void
+fidi::FidiServerApplication::SetAcceptors(const std::string&,
+                                          const std::string& value) {
+  // The validator above should ensure this is indeed an int
+  acceptors_ = std::stoi(value);
+}
+
+void
+fidi::FidiServerApplication::HandlePinThreads(const std::string&,
+                                              const std::string&) {
+  pin_threads_ = true;
+}
+
+void
+fidi::FidiServerApplication::SetListenBacklog(const std::string&,
+                                              const std::string& value) {
+  // The validator above should ensure this is indeed an int
+  listen_backlog_ = std::stoi(value);
+}
+
+void
+fidi::FidiServerApplication::SetMaxQueued(const std::string&,
+                                          const std::string& value) {
+  // The validator above should ensure this is indeed an int
+  max_queued_ = std::stoi(value);
+}
+
+void
+fidi::FidiServerApplication::SetKeepAliveRequests(const std::string&,
+                                                  const std::string& value) {
+  // The validator above should ensure this is indeed an int
+  keep_alive_requests_ = std::stoi(value);
+}
+
+void
+fidi::FidiServerApplication::SetKeepAliveTimeout(const std::string&,
+                                                 const std::string& value) {
+  // The validator above should ensure this is indeed an int
+  keep_alive_timeout_ = std::stoi(value);
+}
+
 void
 fidi::FidiServerApplication::SetLogDirectory(const std::string&,
                                              const std::string& value) {
@@ -221,5 +741,124 @@ fidi::FidiServerApplication::SetLogFile(const std::string&,
   log_file_ = value;
 }
 
+void
+fidi::FidiServerApplication::SetCallThreads(const std::string&,
+                                            const std::string& value) {
+  // The validator above should ensure this is indeed an int
+  call_threads_ = static_cast<std::size_t>(std::stoul(value));
+}
+
+void
+fidi::FidiServerApplication::SetCallQueueDepth(const std::string&,
+                                               const std::string& value) {
+  // The validator above should ensure this is indeed an int
+  call_queue_depth_ = static_cast<std::size_t>(std::stoul(value));
+}
+
+void
+fidi::FidiServerApplication::SetMaxIdleConnections(const std::string&,
+                                                   const std::string& value) {
+  // The validator above should ensure this is indeed an int
+  max_idle_connections_ = static_cast<std::size_t>(std::stoul(value));
+}
+
+void
+fidi::FidiServerApplication::SetMaxConnectionsPerHost(
+    const std::string&, const std::string& value) {
+  // The validator above should ensure this is indeed an int
+  max_connections_per_host_ = static_cast<std::size_t>(std::stoul(value));
+}
+
+void
+fidi::FidiServerApplication::SetMaxInFlight(const std::string&,
+                                            const std::string& value) {
+  // The validator above should ensure this is indeed an int
+  max_in_flight_ = static_cast<std::size_t>(std::stoul(value));
+}
+
+void
+fidi::FidiServerApplication::SetAsyncCallThreads(const std::string&,
+                                                 const std::string& value) {
+  // The validator above should ensure this is indeed an int
+  async_call_threads_ = static_cast<std::size_t>(std::stoul(value));
+}
+
+void
+fidi::FidiServerApplication::HandlePrewarm(const std::string&,
+                                           const std::string&) {
+  prewarm_connections_ = true;
+}
+
+void
+fidi::FidiServerApplication::HandleAsyncDelays(const std::string&,
+                                               const std::string&) {
+  fidi::AppDriver::set_async_delays(true);
+}
+
+void
+fidi::FidiServerApplication::HandleBinaryCalls(const std::string&,
+                                               const std::string&) {
+  fidi::AppDriver::set_binary_calls(true);
+}
+
+void
+fidi::FidiServerApplication::SetPlanCacheSize(const std::string&,
+                                              const std::string& value) {
+  // The validator above should ensure this is indeed an int
+  plan_cache_size_ = static_cast<std::size_t>(std::stoul(value));
+}
+
+void
+fidi::FidiServerApplication::SetNodeTableCacheSize(const std::string&,
+                                                   const std::string& value) {
+  // The validator above should ensure this is indeed an int
+  node_table_cache_size_ = static_cast<std::size_t>(std::stoul(value));
+}
+
+void
+fidi::FidiServerApplication::HandleShareNodeTables(const std::string&,
+                                                   const std::string&) {
+  share_node_tables_ = true;
+}
+
+void
+fidi::FidiServerApplication::HandleAsyncLogging(const std::string&,
+                                                const std::string&) {
+  async_logging_ = true;
+}
+
+void
+fidi::FidiServerApplication::SetLogRingSize(const std::string&,
+                                            const std::string& value) {
+  // The validator above should ensure this is indeed an int
+  log_ring_size_ = static_cast<std::size_t>(std::stoul(value));
+}
+
+void
+fidi::FidiServerApplication::SetTraceFile(const std::string&,
+                                          const std::string& value) {
+  trace_file_ = value;
+}
+
+void
+fidi::FidiServerApplication::HandleInProcessCalls(const std::string&,
+                                                  const std::string&) {
+  in_process_calls_ = true;
+}
+
+void
+fidi::FidiServerApplication::SetInProcessDelay(const std::string&,
+                                               const std::string& value) {
+  // The validator above should ensure this is indeed an int
+  in_process_delay_usec_ = std::stol(value);
+}
+
+void
+fidi::FidiServerApplication::SetInProcessThreads(const std::string&,
+                                                 const std::string& value) {
+  // The validator above should ensure this is indeed an int
+  in_process_threads_ = static_cast<std::size_t>(std::stoul(value));
+}
+
 //
 // fidi_server_application.cc ends here
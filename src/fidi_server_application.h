@@ -36,7 +36,9 @@
 #  include <Poco/Net/HTTPRequestHandlerFactory.h>
 #  include <Poco/Net/HTTPServer.h>
 #  include <Poco/Net/ServerSocket.h>
+#  include <Poco/Net/SocketAddress.h>
 #  include <Poco/PatternFormatter.h>
+#  include <Poco/ThreadPool.h>
 #  include <Poco/Types.h>
 #  include <Poco/Util/HelpFormatter.h>
 #  include <Poco/Util/IntValidator.h>
@@ -48,12 +50,19 @@
 #  include <string>
 #  include <vector>
 
+#  include "src/fidi_executor.h"
+#  include "src/fidi_node_table_cache.h"
+#  include "src/fidi_plan_cache.h"
 #  include "src/fidi_request_handler_factory.h"
+#  include "src/fidi_session_pool.h"
 
 namespace fidi {
   /// \brief The fidi (φίδι) HTTP server application
   ///
-  /// This is the core of the HTTP server application.
+  /// This is the core of the HTTP server application. It hosts one
+  /// node of the service being mocked on each port it listens on
+  /// (see fidi::NodeState), all of them sharing one pool of threads
+  /// handling requests.
   class FidiServerApplication : public Poco::Util::ServerApplication {
    public:
     /// \brief Default constructor
@@ -62,7 +71,31 @@ namespace fidi {
     FidiServerApplication() :
         Poco::Util::ServerApplication(),
         help_requested_(false),
-        port_(9001){};
+        port_(9001),
+        ports_(),
+        server_threads_(16),
+        acceptors_(1),
+        pin_threads_(false),
+        listen_backlog_(64),
+        max_queued_(64),
+        keep_alive_requests_(0),
+        keep_alive_timeout_(10),
+        call_threads_(128),
+        call_queue_depth_(4096),
+        max_idle_connections_(8),
+        max_connections_per_host_(0),
+        max_in_flight_(0),
+        async_call_threads_(0),
+        prewarm_connections_(false),
+        plan_cache_size_(1024),
+        node_table_cache_size_(64),
+        share_node_tables_(false),
+        async_logging_(false),
+        log_ring_size_(256),
+        trace_file_(),
+        in_process_calls_(false),
+        in_process_delay_usec_(0),
+        in_process_threads_(256){};
 
     /// The copy constructor is not used, so decluttering.
     FidiServerApplication(const FidiServerApplication&) = delete;
@@ -137,6 +170,60 @@ namespace fidi {
     /// \param[in] value A port number in string form
     void set_port(const std::string& name, const std::string& value);
 
+    /// \brief Set the ports the server listens on, one node on each
+    ///
+    /// \param[in] name the name of the option (ports, ignored)
+    /// \param[in] value A comma separated list of port numbers, or
+    ///            ranges of them, like 9001-9200
+    /// \throw Poco::Util::InvalidArgumentException if the list is bad
+    void SetPorts(const std::string& name, const std::string& value);
+
+    /// \brief Set the number of threads handling requests
+    ///
+    /// \param[in] name the name of the option (server-threads, ignored)
+    /// \param[in] value The number of threads in string form
+    void SetServerThreads(const std::string& name, const std::string& value);
+
+    /// \brief Set the number of sockets listening on each port
+    ///
+    /// \param[in] name the name of the option (acceptors, ignored)
+    /// \param[in] value The number of sockets in string form, 0 for
+    ///            one for each core
+    void SetAcceptors(const std::string& name, const std::string& value);
+
+    /// \brief Respond to the command line option --pin-threads
+    ///
+    /// \param[in] name the name of the option (pin-threads, ignored)
+    /// \param[in] value (ignored)
+    void HandlePinThreads(const std::string& name, const std::string& value);
+
+    /// \brief Set the backlog of connections of each listening socket
+    ///
+    /// \param[in] name the name of the option (listen-backlog, ignored)
+    /// \param[in] value The number of connections in string form
+    void SetListenBacklog(const std::string& name, const std::string& value);
+
+    /// \brief Set the number of connections queued for a thread
+    ///
+    /// \param[in] name the name of the option (max-queued, ignored)
+    /// \param[in] value The number of connections in string form
+    void SetMaxQueued(const std::string& name, const std::string& value);
+
+    /// \brief Set the number of requests served on each connection
+    ///
+    /// \param[in] name the name of the option (keep-alive-requests,
+    ///            ignored)
+    /// \param[in] value The number of requests in string form
+    void SetKeepAliveRequests(const std::string& name,
+                              const std::string& value);
+
+    /// \brief Set how long an idle connection is kept open
+    ///
+    /// \param[in] name the name of the option (keep-alive-timeout, ignored)
+    /// \param[in] value The number of seconds in string form
+    void SetKeepAliveTimeout(const std::string& name,
+                             const std::string& value);
+
     /// \brief Set the logging directory based on --log-dir option
     ///
     /// \param[in] name the name of the option (log-fir, ignored)
@@ -149,6 +236,126 @@ namespace fidi {
     /// \param[in] value File name for the log file (created if needed).
     void SetLogFile(const std::string& name, const std::string& value);
 
+    /// \brief Set the number of downstream call worker threads
+    ///
+    /// \param[in] name the name of the option (call-threads, ignored)
+    /// \param[in] value The number of threads in string form
+    void SetCallThreads(const std::string& name, const std::string& value);
+
+    /// \brief Set the depth of the downstream call queue
+    ///
+    /// \param[in] name the name of the option (call-queue-depth, ignored)
+    /// \param[in] value The maximum number of queued calls in string form
+    void SetCallQueueDepth(const std::string& name, const std::string& value);
+
+    /// \brief Set the idle connections kept per destination
+    ///
+    /// \param[in] name the name of the option (max-idle-connections, ignored)
+    /// \param[in] value The number of connections in string form
+    void SetMaxIdleConnections(const std::string& name,
+                               const std::string& value);
+
+    /// \brief Set the live connections allowed per destination
+    ///
+    /// \param[in] name the name of the option (max-connections-per-host,
+    ///            ignored)
+    /// \param[in] value The number of connections in string form
+    void SetMaxConnectionsPerHost(const std::string& name,
+                                  const std::string& value);
+
+    /// \brief Set the downstream calls in flight allowed per destination
+    ///
+    /// \param[in] name the name of the option (max-in-flight, ignored)
+    /// \param[in] value The number of calls in string form
+    void SetMaxInFlight(const std::string& name, const std::string& value);
+
+    /// \brief Set the number of threads of the event driven client
+    ///
+    /// \param[in] name the name of the option (async-call-threads,
+    ///            ignored)
+    /// \param[in] value The number of threads in string form
+    void SetAsyncCallThreads(const std::string& name,
+                             const std::string& value);
+
+    /// \brief Respond to the command line option --prewarm-connections
+    ///
+    /// \param[in] name the name of the option (prewarm-connections, ignored)
+    /// \param[in] value (ignored)
+    void HandlePrewarm(const std::string& name, const std::string& value);
+
+    /// \brief Respond to the command line option --async-delays
+    ///
+    /// \param[in] name the name of the option (async-delays, ignored)
+    /// \param[in] value (ignored)
+    void HandleAsyncDelays(const std::string& name, const std::string& value);
+
+    /// \brief Respond to the command line option --binary-calls
+    ///
+    /// \param[in] name the name of the option (binary-calls, ignored)
+    /// \param[in] value (ignored)
+    void HandleBinaryCalls(const std::string& name, const std::string& value);
+
+    /// \brief Set the number of parsed requests cached
+    ///
+    /// \param[in] name the name of the option (plan-cache-size, ignored)
+    /// \param[in] value The number of cached plans in string form
+    void SetPlanCacheSize(const std::string& name, const std::string& value);
+
+    /// \brief Set the number of node tables received that are kept
+    ///
+    /// \param[in] name the name of the option (node-table-cache-size,
+    ///            ignored)
+    /// \param[in] value The number of node tables in string form
+    void SetNodeTableCacheSize(const std::string& name,
+                               const std::string& value);
+
+    /// \brief Respond to the command line option --share-node-tables
+    ///
+    /// \param[in] name the name of the option (share-node-tables, ignored)
+    /// \param[in] value (ignored)
+    void HandleShareNodeTables(const std::string& name,
+                               const std::string& value);
+
+    /// \brief Respond to the command line option --async-logging
+    ///
+    /// \param[in] name the name of the option (async-logging, ignored)
+    /// \param[in] value (ignored)
+    void HandleAsyncLogging(const std::string& name, const std::string& value);
+
+    /// \brief Set the number of log messages each thread may queue
+    ///
+    /// \param[in] name the name of the option (log-ring-size, ignored)
+    /// \param[in] value The number of messages in string form
+    void SetLogRingSize(const std::string& name, const std::string& value);
+
+    /// \brief Set the file spans are recorded in
+    ///
+    /// \param[in] name the name of the option (trace-file, ignored)
+    /// \param[in] value The path of the span file (created if needed)
+    void SetTraceFile(const std::string& name, const std::string& value);
+
+    /// \brief Respond to the command line option --in-process-calls
+    ///
+    /// \param[in] name the name of the option (in-process-calls, ignored)
+    /// \param[in] value (ignored)
+    void HandleInProcessCalls(const std::string& name,
+                              const std::string& value);
+
+    /// \brief Set the modeled network delay of in-process calls
+    ///
+    /// \param[in] name the name of the option (in-process-delay-usec,
+    ///            ignored)
+    /// \param[in] value The delay in microseconds, in string form
+    void SetInProcessDelay(const std::string& name, const std::string& value);
+
+    /// \brief Set the most threads handling in-process calls
+    ///
+    /// \param[in] name the name of the option (in-process-threads,
+    ///            ignored)
+    /// \param[in] value The number of threads, in string form
+    void SetInProcessThreads(const std::string& name,
+                             const std::string& value);
+
    private:
     /// Internal helper function to create a console logger
     void CreateConsoleLogger(void);
@@ -159,9 +366,43 @@ namespace fidi {
     bool help_requested_;          ///< Stores where --help was on the
                                    ///< command line
     Poco::UInt16 port_    = 9001;  ///< The port the server listens on
+    std::vector<Poco::UInt16> ports_;  ///< The ports, if more than one
+    int server_threads_ = 16;  ///< Threads handling requests, per acceptor
+    int acceptors_      = 1;   ///< Sockets on each port, 0 for one per core
+    bool pin_threads_   = false;  ///< Pin each acceptor's threads to a CPU
+    int listen_backlog_ = 64;  ///< Connections the kernel queues
+    int max_queued_     = 64;  ///< Connections queued for a thread
+    int keep_alive_requests_ = 0;  ///< Requests per connection, 0 no limit
+    int keep_alive_timeout_  = 10;  ///< Seconds an idle connection is kept
     std::string  log_dir_ = ".";   ///< The directory used for logging, default
                                    ///< current working directgory
     std::string log_file_ = "fidi_server.log";  ///< The log file name
+    std::size_t call_threads_ = 128;  ///< Downstream call worker threads
+    std::size_t call_queue_depth_ =
+        4096;  ///< Maximum number of queued downstream calls
+    std::size_t max_idle_connections_ =
+        8;  ///< Idle keep-alive connections kept per destination
+    std::size_t max_connections_per_host_ =
+        0;  ///< Live connections per destination (0 is unlimited)
+    std::size_t max_in_flight_ =
+        0;  ///< Calls in flight per destination (0 is unlimited)
+    std::size_t async_call_threads_ =
+        0;  ///< Event driven client threads (0 makes blocking calls)
+    bool prewarm_connections_ =
+        false;  ///< Open connections to request nodes ahead of use
+    std::size_t plan_cache_size_ =
+        1024;  ///< Parsed request plans cached (0 disables the cache)
+    std::size_t node_table_cache_size_ =
+        64;  ///< Node tables received that are kept for later requests
+    bool share_node_tables_ =
+        false;  ///< Leave node tables out of calls when possible
+    bool async_logging_ = false;  ///< Write logs from a background thread
+    std::size_t log_ring_size_ =
+        256;  ///< Log messages each thread may queue, with async logging
+    std::string trace_file_;  ///< Where spans are recorded, if anywhere
+    bool in_process_calls_ = false;  ///< Call local nodes without HTTP
+    long in_process_delay_usec_ = 0;  ///< Modeled network delay, in-process
+    std::size_t in_process_threads_ = 256;  ///< Most in-process threads
   };
 }  // namespace fidi
 
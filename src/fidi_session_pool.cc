@@ -0,0 +1,169 @@
+// fidi_session_pool.cc ---  -*- mode: c++; -*-
+
+// Copyright 2018-2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied.  See the License for the specific language governing
+// permissions and limitations under the License.
+
+/// \file
+/// \ingroup app
+///
+/// This file provides the implementation of the keep-alive HTTP
+/// client session pool for the fidi (φίδι) HTTP server.
+
+// Code:
+
+#include "src/fidi_session_pool.h"
+
+#include <Poco/Exception.h>
+#include <Poco/Logger.h>
+#include <Poco/Net/HTTPRequest.h>
+#include <Poco/Net/HTTPResponse.h>
+#include <Poco/NullStream.h>
+#include <Poco/StreamCopier.h>
+
+#include "src/fidi_executor.h"
+#include "src/fidi_logging.h"
+
+std::size_t fidi::SessionPool::configured_max_idle_     = 8;
+std::size_t fidi::SessionPool::configured_max_per_host_ = 0;
+bool        fidi::SessionPool::configured_prewarm_      = false;
+
+fidi::SessionPool::SessionPool(std::size_t max_idle, std::size_t max_per_host,
+                               bool prewarm) :
+    max_idle_(max_idle),
+    max_per_host_(max_per_host),
+    prewarm_(prewarm),
+    mtx_(),
+    destinations_(),
+    created_(0),
+    reused_(0),
+    dropped_(0) {}
+
+void
+fidi::SessionPool::Configure(std::size_t max_idle, std::size_t max_per_host,
+                             bool prewarm) {
+  configured_max_idle_     = max_idle;
+  configured_max_per_host_ = max_per_host;
+  configured_prewarm_      = prewarm;
+}
+
+fidi::SessionPool &
+fidi::SessionPool::instance(void) {
+  static fidi::SessionPool pool(configured_max_idle_, configured_max_per_host_,
+                                configured_prewarm_);
+  return pool;
+}
+
+fidi::SessionPool::Destination &
+fidi::SessionPool::Lookup(const std::string &host, Poco::UInt16 port) {
+  std::string key(host);
+  key.append(":").append(std::to_string(port));
+  auto it = destinations_.find(key);
+  if (it == destinations_.end()) {
+    it = destinations_.emplace(key, std::make_unique<Destination>()).first;
+  }
+  return *(it->second);
+}
+
+fidi::SessionPool::Session
+fidi::SessionPool::Acquire(const std::string &host, Poco::UInt16 port) {
+  std::unique_lock<std::mutex> lock(mtx_);
+  Destination &               destination = Lookup(host, port);
+  if (max_per_host_ > 0) {
+    destination.cv.wait(lock, [&] {
+      return !destination.idle.empty() || destination.live < max_per_host_;
+    });
+  }
+  if (!destination.idle.empty()) {
+    Session session = std::move(destination.idle.back());
+    destination.idle.pop_back();
+    reused_++;
+    return session;
+  }
+  destination.live++;
+  lock.unlock();
+
+  created_++;
+  Session session = std::make_unique<Poco::Net::HTTPClientSession>(host, port);
+  session->setKeepAlive(true);
+  return session;
+}
+
+void
+fidi::SessionPool::Release(const std::string &host, Poco::UInt16 port,
+                           Session session, bool reusable) {
+  std::unique_lock<std::mutex> lock(mtx_);
+  Destination &               destination = Lookup(host, port);
+  if (reusable && session && destination.idle.size() < max_idle_) {
+    destination.idle.push_back(std::move(session));
+  } else {
+    dropped_++;
+    if (destination.live > 0) { destination.live--; }
+    lock.unlock();
+    session.reset();  // Close the connection outside the lock
+    lock.lock();
+  }
+  destination.cv.notify_one();
+}
+
+void
+fidi::SessionPool::Prewarm(const std::string &host, Poco::UInt16 port) {
+  {
+    std::lock_guard<std::mutex> lock(mtx_);
+    Destination &               destination = Lookup(host, port);
+    if (destination.live > 0 || destination.warming) { return; }
+    destination.warming = true;
+  }
+  fidi::Executor::instance().Submit([this, host, port] {
+    Session session  = Acquire(host, port);
+    bool    reusable = false;
+    try {
+      // A health check is the cheapest request every fidi_app answers
+      Poco::Net::HTTPRequest req(Poco::Net::HTTPRequest::HTTP_GET, "/healthz",
+                                 Poco::Net::HTTPMessage::HTTP_1_1);
+      req.setKeepAlive(true);
+      session->sendRequest(req);
+      Poco::Net::HTTPResponse res;
+      std::istream &          rs = session->receiveResponse(res);
+      Poco::NullOutputStream  discard;
+      Poco::StreamCopier::copyStream(rs, discard);
+      reusable = res.getKeepAlive();
+    } catch (Poco::Exception &ex) {
+      if (fidi::Log::File().debug()) {
+        fidi::Log::File().debug("Pre-warming " + host + ":" +
+                                std::to_string(port) +
+                                " failed: " + ex.displayText());
+      }
+    }
+    Release(host, port, std::move(session), reusable);
+    std::lock_guard<std::mutex> lock(mtx_);
+    Lookup(host, port).warming = false;
+  });
+}
+
+fidi::SessionPool::Stats
+fidi::SessionPool::get_stats(void) {
+  Stats stats;
+  stats.created = created_.load();
+  stats.reused  = reused_.load();
+  stats.dropped = dropped_.load();
+  stats.idle    = 0;
+  std::lock_guard<std::mutex> lock(mtx_);
+  for (auto const &[key, destination] : destinations_) {
+    stats.idle += destination->idle.size();
+  }
+  return stats;
+}
+
+//
+// fidi_session_pool.cc ends here
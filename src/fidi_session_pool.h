@@ -0,0 +1,185 @@
+// fidi_session_pool.h ---  -*- mode: c++; -*-
+
+// Copyright 2018-2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied.  See the License for the specific language governing
+// permissions and limitations under the License.
+
+/// \file
+/// \ingroup app
+///
+/// This file contains the keep-alive HTTP client session pool used by
+/// the fidi (φίδι) HTTP server when making downstream calls.
+
+// Code:
+
+#ifndef FIDI_SESSION_POOL_H
+#  define FIDI_SESSION_POOL_H
+
+#  include <atomic>
+#  include <condition_variable>
+#  include <cstddef>
+#  include <cstdint>
+#  include <map>
+#  include <memory>
+#  include <mutex>
+#  include <string>
+#  include <vector>
+
+#  include <Poco/Net/HTTPClientSession.h>
+#  include <Poco/Types.h>
+
+namespace fidi {
+
+  /// \brief A per destination pool of keep-alive HTTP client sessions
+  ///
+  /// Creating a new HTTP session for every downstream call costs a
+  /// TCP handshake per call, and in deep fan-out topologies can
+  /// exhaust the ephemeral ports. This pool keeps idle sessions,
+  /// keyed by host:port, so that later calls to the same destination
+  /// can reuse the connection. A session is only returned to the pool
+  /// if the response was fully drained and the server agreed to keep
+  /// the connection alive.
+  ///
+  /// The pool may also limit the number of live sessions to each
+  /// destination; callers block until a session is released once the
+  /// limit is reached.
+  class SessionPool {
+   public:
+    /// Sessions are handed out, and returned, as unique pointers
+    typedef std::unique_ptr<Poco::Net::HTTPClientSession> Session;
+
+    /// A snapshot of the pool counters
+    struct Stats {
+      std::uint64_t created;  ///< Sessions created (connections opened)
+      std::uint64_t reused;   ///< Sessions handed out from the idle list
+      std::uint64_t dropped;  ///< Sessions discarded after use
+      std::size_t   idle;     ///< Idle sessions currently pooled
+    };
+
+    /// The copy constructor is not used, so declutter.
+    SessionPool(const SessionPool &) = delete;
+    /// The assignment operator is also not used, so cleaned up.
+    SessionPool &operator=(const SessionPool &) = delete;
+    /// The move operations are unused, and cleaned up.
+    SessionPool(SessionPool &&) = delete;
+    SessionPool &operator=(SessionPool &&) = delete;
+
+    /// Destructor. The pooled sessions close themselves.
+    ~SessionPool() {}
+
+    /// \brief Set the pool limits
+    ///
+    /// This only has effect if called before the first call to
+    /// instance().
+    ///
+    /// \param[in] max_idle Idle sessions kept per destination
+    /// \param[in] max_per_host Live sessions allowed per destination
+    ///            (0 means unlimited)
+    /// \param[in] prewarm Whether to pre-warm connections to the nodes
+    ///            named in each request
+    static void Configure(std::size_t max_idle, std::size_t max_per_host,
+                          bool prewarm);
+
+    /// \brief Get the process wide session pool, creating it if needed
+    /// \return SessionPool the shared pool
+    static SessionPool &instance(void);
+
+    /// \brief Get a session to a destination
+    ///
+    /// Hands out an idle session if there is one, otherwise creates a
+    /// new one. If the destination already has the maximum number of
+    /// live sessions, this blocks until one is released.
+    ///
+    /// \param[in] host The destination host
+    /// \param[in] port The destination port
+    /// \return Session A session connected, or ready to connect, to host:port
+    Session Acquire(const std::string &host, Poco::UInt16 port);
+
+    /// \brief Return a session to the pool
+    ///
+    /// \param[in] host The destination host
+    /// \param[in] port The destination port
+    /// \param[in] session The session being returned
+    /// \param[in] reusable True if the response was drained and the
+    ///            connection may be kept alive
+    void Release(const std::string &host, Poco::UInt16 port, Session session,
+                 bool reusable);
+
+    /// \brief Open a connection to a destination in the background
+    ///
+    /// If there are no sessions, idle or in use, to the destination,
+    /// this queues a health check to it on the executor, so that the
+    /// connection is ready by the time a call needs it.
+    ///
+    /// \param[in] host The destination host
+    /// \param[in] port The destination port
+    void Prewarm(const std::string &host, Poco::UInt16 port);
+
+    /// \brief Should requests pre-warm connections to their nodes
+    /// \return bool true if pre-warming was configured
+    bool get_prewarm(void) const { return prewarm_; }
+
+    /// \brief Return a snapshot of the pool counters
+    /// \return Stats the current counter values
+    Stats get_stats(void);
+
+   private:
+    /// The pooled state for a single host:port
+    struct Destination {
+      Destination() : idle(), live(0), warming(false), cv() {}
+
+      std::vector<Session>    idle;     ///< Sessions ready for reuse
+      std::size_t             live;     ///< Sessions idle or in use
+      bool                    warming;  ///< A pre-warm is in flight
+      std::condition_variable cv;       ///< Signalled on release
+    };
+
+    /// \brief Constructor, only called by instance()
+    ///
+    /// \param[in] max_idle Idle sessions kept per destination
+    /// \param[in] max_per_host Live sessions allowed per destination
+    /// \param[in] prewarm Whether to pre-warm connections
+    SessionPool(std::size_t max_idle, std::size_t max_per_host, bool prewarm);
+
+    /// \brief Find or create the pool state for a destination
+    ///
+    /// Must be called with the mutex held.
+    ///
+    /// \param[in] host The destination host
+    /// \param[in] port The destination port
+    /// \return Destination the state for host:port
+    Destination &Lookup(const std::string &host, Poco::UInt16 port);
+
+    static std::size_t configured_max_idle_;      ///< Set by Configure()
+    static std::size_t configured_max_per_host_;  ///< Set by Configure()
+    static bool        configured_prewarm_;       ///< Set by Configure()
+
+    const std::size_t max_idle_;      ///< Idle sessions kept per destination
+    const std::size_t max_per_host_;  ///< Live session limit (0 unlimited)
+    const bool        prewarm_;       ///< Pre-warm connections to nodes
+
+    std::mutex mtx_;  ///< Protects the destinations
+    std::map<std::string, std::unique_ptr<Destination>>
+        destinations_;  ///< Pool state keyed by host:port
+
+    std::atomic<std::uint64_t> created_;  ///< Sessions created
+    std::atomic<std::uint64_t> reused_;   ///< Sessions reused
+    std::atomic<std::uint64_t> dropped_;  ///< Sessions discarded
+  };
+
+}  // namespace fidi
+
+#endif /* FIDI_SESSION_POOL_H */
+
+//
+// fidi_session_pool.h ends here
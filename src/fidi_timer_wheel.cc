@@ -0,0 +1,158 @@
+// fidi_timer_wheel.cc ---  -*- mode: c++; -*-
+
+// Copyright 2018-2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied.  See the License for the specific language governing
+// permissions and limitations under the License.
+
+/// \file
+/// \ingroup app
+///
+/// This file provides the implementation of the hierarchical timer
+/// wheel used by the fidi (φίδι) HTTP server.
+
+// Code:
+
+#include "src/fidi_timer_wheel.h"
+#include <algorithm>
+#include "src/fidi_executor.h"
+
+fidi::TimerWheel::TimerWheel() :
+    epoch_(std::chrono::steady_clock::now()),
+    mtx_(),
+    cv_(),
+    wheels_(),
+    live_(),
+    current_(0),
+    next_id_(1),
+    stopping_(false),
+    thread_() {
+  thread_ = std::thread(&fidi::TimerWheel::Run, this);
+}
+
+fidi::TimerWheel::~TimerWheel() { Shutdown(); }
+
+fidi::TimerWheel &
+fidi::TimerWheel::instance(void) {
+  static fidi::TimerWheel wheel;
+  return wheel;
+}
+
+std::uint64_t
+fidi::TimerWheel::Now(void) const {
+  return static_cast<std::uint64_t>(
+      std::chrono::duration_cast<std::chrono::milliseconds>(
+          std::chrono::steady_clock::now() - epoch_)
+          .count());
+}
+
+void
+fidi::TimerWheel::Place(Timer timer) {
+  if (timer.expiry < current_) { timer.expiry = current_; }
+  // Use the innermost wheel in which the expiry and the current tick
+  // share all the higher order bits. Anything further out than the
+  // outermost wheel waits there, and is looked at again each time
+  // that wheel comes around.
+  std::size_t level = 0;
+  while (level < kLevels - 1 &&
+         (timer.expiry >> (kSlotBits * (level + 1))) !=
+             (current_ >> (kSlotBits * (level + 1)))) {
+    level++;
+  }
+  std::size_t slot = (timer.expiry >> (kSlotBits * level)) & kSlotMask;
+  wheels_[level][slot].push_back(std::move(timer));
+}
+
+void
+fidi::TimerWheel::Tick(std::vector<Timer> *expired) {
+  current_++;
+  // Cascade the outer wheels whose slot just changed, outermost last
+  for (std::size_t level = 1; level < kLevels; ++level) {
+    if ((current_ & ((std::uint64_t{1} << (kSlotBits * level)) - 1)) != 0) {
+      break;
+    }
+    std::size_t        slot = (current_ >> (kSlotBits * level)) & kSlotMask;
+    std::vector<Timer> cascading;
+    cascading.swap(wheels_[level][slot]);
+    for (auto &timer : cascading) {
+      if (live_.count(timer.id) != 0) { Place(std::move(timer)); }
+    }
+  }
+
+  std::vector<Timer> due;
+  due.swap(wheels_[0][current_ & kSlotMask]);
+  for (auto &timer : due) {
+    if (live_.erase(timer.id) != 0) { expired->push_back(std::move(timer)); }
+  }
+}
+
+fidi::TimerWheel::TimerId
+fidi::TimerWheel::Schedule(std::chrono::milliseconds delay,
+                           std::function<void()>     callback) {
+  std::lock_guard<std::mutex> lock(mtx_);
+  // The thread does not tick while idle, so catch up first
+  if (live_.empty()) { current_ = std::max(current_, Now()); }
+  TimerId id    = next_id_++;
+  auto    ticks = static_cast<std::uint64_t>(std::max<long long>(
+      static_cast<long long>(delay.count()), 0));
+  // Round up the partial tick we are part way through, so timers
+  // never fire early
+  Place(Timer{id, std::max(current_, Now()) + ticks + 1, std::move(callback)});
+  live_.insert(id);
+  cv_.notify_one();
+  return id;
+}
+
+bool
+fidi::TimerWheel::Cancel(TimerId id) {
+  std::lock_guard<std::mutex> lock(mtx_);
+  // The timer itself stays in its slot, and is dropped when reached
+  return live_.erase(id) != 0;
+}
+
+void
+fidi::TimerWheel::Run(void) {
+  std::unique_lock<std::mutex> lock(mtx_);
+  while (!stopping_) {
+    if (live_.empty()) {
+      cv_.wait(lock, [this] { return stopping_ || !live_.empty(); });
+      continue;
+    }
+    std::vector<Timer> expired;
+    auto               target = Now();
+    while (current_ < target) { Tick(&expired); }
+    if (!expired.empty()) {
+      lock.unlock();
+      for (auto &timer : expired) {
+        // Never wait for room in the queue; later timers would stall
+        fidi::Executor::instance().Post(std::move(timer.callback));
+      }
+      lock.lock();
+      continue;
+    }
+    cv_.wait_until(lock, epoch_ + std::chrono::milliseconds(current_ + 1));
+  }
+}
+
+void
+fidi::TimerWheel::Shutdown(void) {
+  {
+    std::lock_guard<std::mutex> lock(mtx_);
+    if (stopping_) { return; }
+    stopping_ = true;
+  }
+  cv_.notify_all();
+  if (thread_.joinable()) { thread_.join(); }
+}
+
+//
+// fidi_timer_wheel.cc ends here
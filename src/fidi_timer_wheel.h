@@ -0,0 +1,149 @@
+// fidi_timer_wheel.h ---  -*- mode: c++; -*-
+
+// Copyright 2018-2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied.  See the License for the specific language governing
+// permissions and limitations under the License.
+
+/// \file
+/// \ingroup app
+///
+/// This file contains a hierarchical timer wheel, used by the fidi
+/// (φίδι) HTTP server to time modeled delays with one thread for the
+/// whole process, instead of a thread sleeping through each delay.
+
+// Code:
+
+#ifndef FIDI_TIMER_WHEEL_H
+#  define FIDI_TIMER_WHEEL_H
+
+#  include <array>
+#  include <chrono>
+#  include <condition_variable>
+#  include <cstddef>
+#  include <cstdint>
+#  include <functional>
+#  include <mutex>
+#  include <thread>
+#  include <unordered_set>
+#  include <vector>
+
+namespace fidi {
+
+  /// \brief A hierarchical timer wheel with millisecond resolution
+  ///
+  /// Timers are placed in one of four wheels of 64 slots each,
+  /// depending on how far in the future they expire; the innermost
+  /// wheel covers the next 64 milliseconds, the next one the next 4
+  /// seconds, and so on. As time advances, timers in the outer wheels
+  /// cascade into the inner ones, and timers in the current slot of
+  /// the innermost wheel fire. Scheduling and cancelling are constant
+  /// time, and a single thread drives every pending timer in the
+  /// process.
+  ///
+  /// Expired callbacks are not run on the timer thread; they are
+  /// posted to the fidi::Executor, which never blocks the timer
+  /// thread, even when its queue is full.
+  class TimerWheel {
+   public:
+    /// Identifies a scheduled timer, for cancelling it
+    typedef std::uint64_t TimerId;
+
+    /// The copy constructor is not used, so declutter.
+    TimerWheel(const TimerWheel &) = delete;
+    /// The assignment operator is also not used, so cleaned up.
+    TimerWheel &operator=(const TimerWheel &) = delete;
+    /// The move operations are unused, and cleaned up.
+    TimerWheel(TimerWheel &&) = delete;
+    TimerWheel &operator=(TimerWheel &&) = delete;
+
+    /// Destructor. Stops the timer thread; pending timers never fire.
+    ~TimerWheel();
+
+    /// \brief Get the process wide timer wheel, creating it if needed
+    /// \return TimerWheel the shared timer wheel
+    static TimerWheel &instance(void);
+
+    /// \brief Run a callback after a delay
+    ///
+    /// \param[in] delay How long to wait before running the callback
+    /// \param[in] callback The work to do once the delay has expired
+    /// \return TimerId An identifier that may be passed to Cancel()
+    TimerId Schedule(std::chrono::milliseconds delay,
+                     std::function<void()>     callback);
+
+    /// \brief Cancel a pending timer
+    ///
+    /// \param[in] id The identifier returned by Schedule()
+    /// \return bool true if the timer was pending, and will not fire
+    bool Cancel(TimerId id);
+
+    /// \brief Stop the timer thread
+    void Shutdown(void);
+
+   private:
+    /// A single pending timer
+    struct Timer {
+      TimerId               id;      ///< Identifier handed to the caller
+      std::uint64_t         expiry;  ///< The tick on which to fire
+      std::function<void()> callback;  ///< What to run on expiry
+    };
+
+    static constexpr std::size_t kLevels    = 4;   ///< Number of wheels
+    static constexpr std::size_t kSlotBits  = 6;   ///< log2 of the slots
+    static constexpr std::size_t kSlots     = 64;  ///< Slots per wheel
+    static constexpr std::size_t kSlotMask  = kSlots - 1;  ///< Slot bits
+
+    /// Constructor, only called by instance(). Starts the timer thread.
+    TimerWheel();
+
+    /// \brief Put a timer in the slot matching its expiry
+    ///
+    /// Must be called with the mutex held.
+    ///
+    /// \param[in] timer The timer to place
+    void Place(Timer timer);
+
+    /// \brief Advance the wheel by one tick
+    ///
+    /// Cascades the outer wheels as needed, and moves the expired
+    /// timers to the list passed in. Must be called with the mutex
+    /// held.
+    ///
+    /// \param[in,out] expired Where to put the timers that fired
+    void Tick(std::vector<Timer> *expired);
+
+    /// \brief Return the tick corresponding to the current time
+    /// \return uint64_t ticks elapsed since the wheel was created
+    std::uint64_t Now(void) const;
+
+    /// The body of the timer thread
+    void Run(void);
+
+    const std::chrono::steady_clock::time_point epoch_;  ///< Tick zero
+    std::mutex              mtx_;      ///< Protects everything below
+    std::condition_variable cv_;       ///< Wakes the timer thread
+    std::array<std::array<std::vector<Timer>, kSlots>, kLevels>
+                                wheels_;    ///< The timer slots
+    std::unordered_set<TimerId> live_;      ///< Timers not yet fired
+    std::uint64_t               current_;   ///< The last tick processed
+    TimerId                     next_id_;   ///< The next identifier
+    bool                        stopping_;  ///< Set by Shutdown()
+    std::thread                 thread_;    ///< The timer thread
+  };
+
+}  // namespace fidi
+
+#endif /* FIDI_TIMER_WHEEL_H */
+
+//
+// fidi_timer_wheel.h ends here
@@ -0,0 +1,205 @@
+// fidi_trace.cc ---  -*- mode: c++; -*-
+
+// Copyright 2018-2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied.  See the License for the specific language governing
+// permissions and limitations under the License.
+
+/// \file
+/// \ingroup app
+///
+/// This file provides the implementation of the trace context, and
+/// of the span file, of the fidi (φίδι) HTTP server.
+
+// Code:
+
+#include "src/fidi_trace.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <random>
+
+std::string fidi::Tracer::configured_path_;
+
+namespace {
+  /// \brief Is this a string of lower case hex digits, not all zero?
+  ///
+  /// \param[in] id The string
+  /// \param[in] digits The length it must have
+  /// \return bool true if it is a valid id
+  bool
+  ValidId(const std::string &id, std::size_t digits) {
+    if (id.size() != digits) { return false; }
+    bool non_zero = false;
+    for (char c : id) {
+      bool digit = (c >= '0' && c <= '9') || (c >= 'a' && c <= 'f');
+      if (!digit) { return false; }
+      if (c != '0') { non_zero = true; }
+    }
+    return non_zero;
+  }
+
+  /// \brief Append a string as a JSON string
+  ///
+  /// \param[in] value The string
+  /// \param[in,out] out The text to append to
+  void
+  AppendJson(const std::string &value, std::string *out) {
+    out->push_back('"');
+    for (char c : value) {
+      if (c == '"' || c == '\\') {
+        out->push_back('\\');
+        out->push_back(c);
+      } else if (static_cast<unsigned char>(c) < 0x20) {
+        out->push_back(' ');
+      } else {
+        out->push_back(c);
+      }
+    }
+    out->push_back('"');
+  }
+}  // namespace
+
+bool
+fidi::TraceContext::Parse(const std::string &header, TraceContext *context) {
+  // version-trace_id-span_id-flags, with version 00
+  if (header.size() < 55 || header.compare(0, 3, "00-") != 0 ||
+      header[35] != '-' || header[52] != '-') {
+    return false;
+  }
+  std::string trace_id(header, 3, 32);
+  std::string span_id(header, 36, 16);
+  std::string flags(header, 53, 2);
+  if (!ValidId(trace_id, 32) || !ValidId(span_id, 16) ||
+      flags.find_first_not_of("0123456789abcdef") != std::string::npos) {
+    return false;
+  }
+  context->trace_id = trace_id;
+  context->span_id  = span_id;
+  context->sampled  = (std::stoi(flags, nullptr, 16) & 1) != 0;
+  return true;
+}
+
+std::string
+fidi::TraceContext::Header(void) const {
+  return "00-" + trace_id + "-" + span_id + (sampled ? "-01" : "-00");
+}
+
+fidi::Tracer::Tracer() : fd_(-1) {
+  if (configured_path_.empty()) { return; }
+  fd_ = ::open(configured_path_.c_str(),
+               O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+  if (fd_ < 0) {
+    std::cerr << "Could not open span file " << configured_path_ << ": "
+              << std::strerror(errno) << "\n";
+  }
+}
+
+fidi::Tracer::~Tracer() {
+  if (fd_ >= 0) { ::close(fd_); }
+}
+
+void
+fidi::Tracer::Configure(const std::string &path) {
+  configured_path_ = path;
+}
+
+fidi::Tracer &
+fidi::Tracer::instance(void) {
+  static fidi::Tracer tracer;
+  return tracer;
+}
+
+std::string
+fidi::Tracer::RandomId(std::size_t digits) {
+  static const char            hex[] = "0123456789abcdef";
+  thread_local std::mt19937_64 engine(std::random_device{}());
+  std::string                  id;
+  while (id.size() < digits) {
+    std::uint64_t bits = engine();
+    for (int i = 0; i < 16 && id.size() < digits; ++i, bits >>= 4) {
+      id.push_back(hex[bits & 0xf]);
+    }
+  }
+  // An id of all zeros is invalid
+  if (id.find_first_not_of('0') == std::string::npos) { id.back() = '1'; }
+  return id;
+}
+
+fidi::TraceContext
+fidi::Tracer::StartSpan(const TraceContext &parent) const {
+  if (!enabled()) { return parent; }
+  TraceContext span;
+  if (parent.valid()) {
+    span.trace_id = parent.trace_id;
+    span.sampled  = parent.sampled;
+  } else {
+    span.trace_id = RandomId(32);
+    span.sampled  = true;
+  }
+  span.span_id = RandomId(16);
+  return span;
+}
+
+void
+fidi::Tracer::Record(const std::string &node, const TraceContext &span,
+                     const std::string &                   parent_id,
+                     const std::string &                   name,
+                     std::chrono::steady_clock::time_point start,
+                     std::chrono::steady_clock::time_point end,
+                     const Attributes &attributes) const {
+  if (!enabled() || !span.valid() || !span.sampled) { return; }
+  // Spans from different instances are lined up by wall clock time
+  auto age        = std::chrono::steady_clock::now() - start;
+  auto wall_start = std::chrono::system_clock::now() -
+                    std::chrono::duration_cast<
+                        std::chrono::system_clock::duration>(age);
+  auto start_us = std::chrono::duration_cast<std::chrono::microseconds>(
+                      wall_start.time_since_epoch())
+                      .count();
+  auto duration_us =
+      std::chrono::duration_cast<std::chrono::microseconds>(end - start)
+          .count();
+
+  std::string line("{\"trace\":");
+  line.reserve(256);
+  AppendJson(span.trace_id, &line);
+  line.append(",\"span\":");
+  AppendJson(span.span_id, &line);
+  line.append(",\"parent\":");
+  AppendJson(parent_id, &line);
+  line.append(",\"node\":");
+  AppendJson(node, &line);
+  line.append(",\"name\":");
+  AppendJson(name, &line);
+  line.append(",\"start_us\":")
+      .append(std::to_string(start_us))
+      .append(",\"duration_us\":")
+      .append(std::to_string(duration_us));
+  for (auto const &[key, value] : attributes) {
+    line.push_back(',');
+    AppendJson(key, &line);
+    line.push_back(':');
+    AppendJson(value, &line);
+  }
+  line.append("}\n");
+  // One write, so that the line is appended whole
+  if (::write(fd_, line.data(), line.size()) < 0) { return; }
+}
+
+//
+// fidi_trace.cc ends here
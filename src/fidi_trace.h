@@ -0,0 +1,164 @@
+// fidi_trace.h ---  -*- mode: c++; -*-
+
+// Copyright 2018-2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied.  See the License for the specific language governing
+// permissions and limitations under the License.
+
+/// \file
+/// \ingroup app
+///
+/// This file contains the trace context propagated between the
+/// instances of the fidi (φίδι) HTTP server, and the span file each
+/// instance records its part of a request in.
+
+// Code:
+
+#ifndef FIDI_TRACE_H
+#  define FIDI_TRACE_H
+
+#  include <chrono>
+#  include <string>
+#  include <utility>
+#  include <vector>
+
+namespace fidi {
+
+  /// \brief The trace a request belongs to, and the span that sent it
+  ///
+  /// This is carried from instance to instance in a W3C Trace Context
+  /// `traceparent` header, of the form
+  /// `00-<32 hex trace id>-<16 hex span id>-<2 hex flags>`.
+  struct TraceContext {
+    /// The default constructor, no trace
+    TraceContext() : trace_id(), span_id(), sampled(false) {}
+
+    /// \brief Parse a traceparent header
+    ///
+    /// \param[in] header The value of the header
+    /// \param[out] context The trace context, if the header is valid
+    /// \return bool false if the header is missing or malformed
+    static bool Parse(const std::string &header, TraceContext *context);
+
+    /// \brief Format a traceparent header
+    /// \return string The value of the header
+    std::string Header(void) const;
+
+    /// \brief Is this part of a trace?
+    /// \return bool true if there is a trace id
+    bool
+    valid(void) const {
+      return !trace_id.empty();
+    }
+
+    std::string trace_id;  ///< 32 lower case hex digits
+    std::string span_id;   ///< 16 lower case hex digits
+    bool        sampled;   ///< Whether spans are to be recorded
+  };
+
+  /// \brief Records spans in an append-only file, one JSON object a line
+  ///
+  /// Each instance records a span for handling each request, one for
+  /// each delay, and one for each downstream call, so the whole
+  /// cascade can be put back together from the files of all the
+  /// instances (see fidi_trace_merge(1)). Each span is written with a
+  /// single write(2) to a file opened for appending, so lines from
+  /// concurrent requests are never interleaved.
+  ///
+  /// With no span file configured, nothing is recorded, but trace
+  /// contexts are still passed on, so that instances which do record
+  /// spans further down still join up with those further up.
+  class Tracer {
+   public:
+    /// The name of the header carrying the trace context
+    static constexpr const char *kHeader = "traceparent";
+
+    /// Extra attributes of a span, as names and values
+    typedef std::vector<std::pair<std::string, std::string>> Attributes;
+
+    /// The copy constructor is not used, so declutter.
+    Tracer(const Tracer &) = delete;
+    /// The assignment operator is also not used, so cleaned up.
+    Tracer &operator=(const Tracer &) = delete;
+    /// The move operations are unused, and cleaned up.
+    Tracer(Tracer &&) = delete;
+    Tracer &operator=(Tracer &&) = delete;
+
+    /// Destructor. Closes the span file
+    ~Tracer();
+
+    /// \brief Set the span file
+    ///
+    /// This only has effect if called before the first call to
+    /// instance().
+    ///
+    /// \param[in] path The span file, or empty to record nothing
+    static void Configure(const std::string &path);
+
+    /// \brief Get the process wide tracer, creating it if needed
+    /// \return Tracer the shared tracer
+    static Tracer &instance(void);
+
+    /// \brief Are spans being recorded?
+    /// \return bool true if the span file is open
+    bool
+    enabled(void) const {
+      return fd_ >= 0;
+    }
+
+    /// \brief Start a new span
+    ///
+    /// The span is a child of the parent, or the root of a new trace
+    /// if the parent is not valid. If spans are not being recorded,
+    /// the parent is returned unchanged, to be passed on as is.
+    ///
+    /// \param[in] parent The context of the parent span
+    /// \return TraceContext The context of the new span
+    TraceContext StartSpan(const TraceContext &parent) const;
+
+    /// \brief Record a finished span
+    ///
+    /// \param[in] node The node the span is recorded under, host:port
+    /// \param[in] span The context of the span
+    /// \param[in] parent_id The span id of its parent, may be empty
+    /// \param[in] name What the span was
+    /// \param[in] start When it started
+    /// \param[in] end When it ended
+    /// \param[in] attributes Anything else to record
+    void Record(const std::string &node, const TraceContext &span,
+                const std::string &                   parent_id,
+                const std::string &                   name,
+                std::chrono::steady_clock::time_point start,
+                std::chrono::steady_clock::time_point end,
+                const Attributes &attributes = Attributes()) const;
+
+   private:
+    /// Constructor, only called by instance()
+    Tracer();
+
+    /// \brief A random id
+    ///
+    /// \param[in] digits The number of hex digits
+    /// \return string The id
+    static std::string RandomId(std::size_t digits);
+
+    static std::string configured_path_;  ///< Set by Configure()
+
+    int fd_;  ///< The span file, or -1
+  };
+
+}  // namespace fidi
+
+#endif /* FIDI_TRACE_H */
+
+//
+// fidi_trace.h ends here
@@ -0,0 +1,327 @@
+// fidi_trace_merge.cc ---  -*- mode: c++; -*-
+
+// Copyright 2018-2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied.  See the License for the specific language governing
+// permissions and limitations under the License.
+
+/// \file
+/// \ingroup app
+///
+/// This is the main file of the fidi (φίδι) span merge tool. It
+/// reads the span files recorded by fidi_app instances with
+/// --trace-file, and writes the spans out as a single Chrome trace
+/// event file, which chrome://tracing, or Perfetto, show as a
+/// waterfall: one process per instance, the requests it handled, with
+/// their delays, on one set of tracks, and the calls it made on
+/// another, with arrows from each call to its handling by the
+/// instance called.
+
+// Code:
+
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace {
+  /// A span, as the names and values of its JSON object
+  typedef std::map<std::string, std::string> Span;
+
+  /// \brief Parse a span, one flat JSON object
+  ///
+  /// Only what fidi::Tracer writes is understood: string values, and
+  /// numbers, with no nested objects or arrays.
+  ///
+  /// \param[in] line The line from the span file
+  /// \param[out] span The names and values
+  /// \return bool false if the line is not a span
+  bool
+  ParseSpan(const std::string &line, Span *span) {
+    std::size_t pos = 0;
+    auto        skip_blanks = [&] {
+      while (pos < line.size() &&
+             std::isspace(static_cast<unsigned char>(line[pos]))) {
+        pos++;
+      }
+    };
+    auto read_string = [&](std::string *out) {
+      if (pos >= line.size() || line[pos] != '"') { return false; }
+      for (pos++; pos < line.size() && line[pos] != '"'; pos++) {
+        if (line[pos] == '\\' && pos + 1 < line.size()) { pos++; }
+        out->push_back(line[pos]);
+      }
+      if (pos >= line.size()) { return false; }
+      pos++;
+      return true;
+    };
+
+    skip_blanks();
+    if (pos >= line.size() || line[pos++] != '{') { return false; }
+    for (;;) {
+      std::string key;
+      std::string value;
+      skip_blanks();
+      if (!read_string(&key)) { return false; }
+      skip_blanks();
+      if (pos >= line.size() || line[pos++] != ':') { return false; }
+      skip_blanks();
+      if (pos < line.size() && line[pos] == '"') {
+        if (!read_string(&value)) { return false; }
+      } else {
+        std::size_t end = line.find_first_of(",}", pos);
+        if (end == std::string::npos) { return false; }
+        value = line.substr(pos, end - pos);
+        pos   = end;
+      }
+      (*span)[key] = value;
+      skip_blanks();
+      if (pos >= line.size()) { return false; }
+      if (line[pos] == '}') { break; }
+      if (line[pos++] != ',') { return false; }
+    }
+    return span->count("span") != 0 && span->count("node") != 0 &&
+           span->count("start_us") != 0;
+  }
+
+  /// \brief Quote a string for JSON
+  ///
+  /// \param[in] value The string
+  /// \return string The string, quoted
+  std::string
+  Quote(const std::string &value) {
+    std::string quoted("\"");
+    for (char c : value) {
+      if (c == '"' || c == '\\') { quoted.push_back('\\'); }
+      quoted.push_back(c);
+    }
+    return quoted.append("\"");
+  }
+
+  /// \brief A number from a span
+  ///
+  /// \param[in] span The span
+  /// \param[in] key The name of the value
+  /// \return long long The value, or 0
+  long long
+  Number(const Span &span, const std::string &key) {
+    auto it = span.find(key);
+    return it == span.end() ? 0 : std::atoll(it->second.c_str());
+  }
+
+  /// \brief A string from a span
+  ///
+  /// \param[in] span The span
+  /// \param[in] key The name of the value
+  /// \return string The value, or empty
+  std::string
+  Value(const Span &span, const std::string &key) {
+    auto it = span.find(key);
+    return it == span.end() ? std::string() : it->second;
+  }
+
+  /// \brief The tracks of one instance, filled in greedily
+  ///
+  /// A span goes on the first track that is free by the time it
+  /// starts, so overlapping spans, like calls made in parallel, are
+  /// shown side by side rather than on top of each other.
+  class Tracks {
+   public:
+    /// \brief Constructor
+    ///
+    /// \param[in] first_tid The thread id of the first track
+    explicit Tracks(int first_tid) : first_tid_(first_tid), free_at_() {}
+
+    /// \brief Find a track for a span
+    ///
+    /// \param[in] start When the span starts
+    /// \param[in] end When it ends
+    /// \param[out] added Set if a new track was needed
+    /// \return int The thread id of the track
+    int
+    Place(long long start, long long end, bool *added) {
+      *added = false;
+      for (std::size_t i = 0; i < free_at_.size(); ++i) {
+        if (free_at_[i] <= start) {
+          free_at_[i] = end;
+          return first_tid_ + static_cast<int>(i);
+        }
+      }
+      free_at_.push_back(end);
+      *added = true;
+      return first_tid_ + static_cast<int>(free_at_.size() - 1);
+    }
+
+   private:
+    int                    first_tid_;  ///< The thread id of the first track
+    std::vector<long long> free_at_;    ///< When each track is next free
+  };
+
+  /// The first thread id of the tracks for calls
+  constexpr int kCallTracks = 1000;
+}  // namespace
+
+/// \brief  Main function
+///
+/// \details Read every span file named on the command line, keep the
+/// spans of the trace asked for, if any, and write them all out in
+/// the Chrome trace event format.
+///
+/// \param[in]  argc number of arguments
+/// \param[in]  argv An array of character pointers containing the arguments
+///
+/// \return an integer 0 upon exit success
+int
+main(const int argc, const char **argv) {
+  std::string              trace;
+  std::vector<std::string> files;
+  for (int i = 1; i < argc; ++i) {
+    if (std::strncmp(argv[i], "-h", 2) == 0 ||
+        std::strncmp(argv[i], "--h", 3) == 0) {
+      std::cout << "Usage: fidi_trace_merge [--trace=<id>] <span file>...\n\n"
+                << "Writes the spans, as Chrome trace events, to the "
+                   "standard output.\n";
+      return EXIT_SUCCESS;
+    }
+    if (std::strncmp(argv[i], "--trace=", 8) == 0) {
+      trace = argv[i] + 8;
+    } else {
+      files.push_back(argv[i]);
+    }
+  }
+  if (files.empty()) {
+    std::cerr << "Usage: fidi_trace_merge [--trace=<id>] <span file>...\n";
+    return EXIT_FAILURE;
+  }
+
+  std::vector<Span> spans;
+  long              skipped = 0;
+  for (auto const &file : files) {
+    std::ifstream in(file);
+    if (!in) {
+      std::cerr << "Unknown file: " << file << "\n";
+      return EXIT_FAILURE;
+    }
+    std::string line;
+    while (std::getline(in, line)) {
+      Span span;
+      if (!ParseSpan(line, &span)) {
+        skipped++;
+        continue;
+      }
+      if (trace.empty() || Value(span, "trace") == trace) {
+        spans.push_back(std::move(span));
+      }
+    }
+  }
+  if (skipped > 0) { std::cerr << "Skipped " << skipped << " bad lines\n"; }
+  std::stable_sort(spans.begin(), spans.end(),
+                   [](const Span &a, const Span &b) {
+                     return Number(a, "start_us") < Number(b, "start_us");
+                   });
+
+  std::map<std::string, int>                 pids;
+  std::map<int, std::pair<Tracks, Tracks>>   tracks;
+  std::map<std::string, std::pair<int, int>> placed;  // span: pid, tid
+  std::vector<std::string>                   events;
+  auto thread_name = [&](int pid, int tid, const std::string &name) {
+    events.push_back("{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":" +
+                     std::to_string(pid) + ",\"tid\":" + std::to_string(tid) +
+                     ",\"args\":{\"name\":" + Quote(name) + "}}");
+  };
+
+  for (auto const &span : spans) {
+    std::string node = Value(span, "node");
+    auto        pid_it = pids.find(node);
+    if (pid_it == pids.end()) {
+      int pid = static_cast<int>(pids.size()) + 1;
+      pid_it  = pids.emplace(node, pid).first;
+      tracks.emplace(pid, std::make_pair(Tracks(1), Tracks(kCallTracks)));
+      events.push_back("{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":" +
+                       std::to_string(pid) + ",\"args\":{\"name\":" +
+                       Quote(node) + "}}");
+    }
+    int       pid   = pid_it->second;
+    long long start = Number(span, "start_us");
+    long long end   = start + Number(span, "duration_us");
+    std::string name = Value(span, "name");
+
+    // Delays go on the track of the request they are part of, calls
+    // on tracks of their own
+    int  tid   = 0;
+    bool added = false;
+    auto parent = placed.find(Value(span, "parent"));
+    bool is_call = name.compare(0, 5, "call ") == 0;
+    if (!is_call && name != "handle" && parent != placed.end() &&
+        parent->second.first == pid) {
+      tid = parent->second.second;
+    } else if (is_call) {
+      tid = tracks.at(pid).second.Place(start, end, &added);
+      if (added) {
+        thread_name(pid, tid,
+                    "calls " + std::to_string(tid - kCallTracks + 1));
+      }
+    } else {
+      tid = tracks.at(pid).first.Place(start, end, &added);
+      if (added) { thread_name(pid, tid, "requests " + std::to_string(tid)); }
+    }
+    placed[Value(span, "span")] = std::make_pair(pid, tid);
+
+    std::string event("{\"name\":" + Quote(name) +
+                      ",\"cat\":\"fidi\",\"ph\":\"X\",\"ts\":" +
+                      std::to_string(start) + ",\"dur\":" +
+                      std::to_string(end - start) + ",\"pid\":" +
+                      std::to_string(pid) + ",\"tid\":" +
+                      std::to_string(tid) + ",\"args\":{");
+    bool first = true;
+    for (auto const &[key, value] : span) {
+      if (key == "name" || key == "node" || key == "start_us" ||
+          key == "duration_us") {
+        continue;
+      }
+      event.append(first ? "" : ",").append(Quote(key)).append(":").append(
+          Quote(value));
+      first = false;
+    }
+    events.push_back(event.append("}}"));
+
+    // An arrow from a call to its handling by the instance called
+    if (name == "handle" && parent != placed.end()) {
+      std::string id = Quote(Value(span, "span"));
+      events.push_back("{\"name\":\"call\",\"cat\":\"fidi\",\"ph\":\"s\","
+                       "\"id\":" + id + ",\"ts\":" +
+                       std::to_string(start) + ",\"pid\":" +
+                       std::to_string(parent->second.first) + ",\"tid\":" +
+                       std::to_string(parent->second.second) + "}");
+      events.push_back("{\"name\":\"call\",\"cat\":\"fidi\",\"ph\":\"f\","
+                       "\"bp\":\"e\",\"id\":" + id + ",\"ts\":" +
+                       std::to_string(start) + ",\"pid\":" +
+                       std::to_string(pid) + ",\"tid\":" +
+                       std::to_string(tid) + "}");
+    }
+  }
+
+  std::cout << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+  for (std::size_t i = 0; i < events.size(); ++i) {
+    std::cout << events[i] << (i + 1 < events.size() ? ",\n" : "\n");
+  }
+  std::cout << "]}\n";
+  return EXIT_SUCCESS;
+}
+
+//
+// fidi_trace_merge.cc ends here
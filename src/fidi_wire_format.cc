@@ -0,0 +1,341 @@
+// fidi_wire_format.cc ---  -*- mode: c++; -*-
+
+// Copyright 2018-2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied.  See the License for the specific language governing
+// permissions and limitations under the License.
+
+/// \file
+/// \ingroup inputhandling
+///
+/// This file provides the implementation of the binary wire format
+/// for fidi (φίδι) requests, and of the driver that converts text
+/// requests to it.
+
+// Code:
+
+#include "src/fidi_wire_format.h"
+#include <cstring>
+#include <sstream>
+
+namespace {
+  /// The first four bytes of every binary message
+  constexpr char kMagic[] = {'F', 'I', 'D', 'B'};
+
+  /// \brief Append a little endian uint32 to a buffer
+  ///
+  /// \param[in,out] out The buffer to append to
+  /// \param[in] value The value to append
+  void
+  PutU32(std::string *out, std::uint32_t value) {
+    for (int shift = 0; shift < 32; shift += 8) {
+      out->push_back(static_cast<char>((value >> shift) & 0xff));
+    }
+  }
+
+  /// \brief Append a length prefixed string to a buffer
+  ///
+  /// \param[in,out] out The buffer to append to
+  /// \param[in] value The string to append
+  void
+  PutString(std::string *out, std::string_view value) {
+    PutU32(out, static_cast<std::uint32_t>(value.size()));
+    out->append(value);
+  }
+
+  /// \brief Append an attribute list to a buffer
+  ///
+  /// \param[in,out] out The buffer to append to
+  /// \param[in] attributes The key value pairs to append
+  void
+  PutAttributes(std::string *                             out,
+                const std::map<std::string, std::string> &attributes) {
+    PutU32(out, static_cast<std::uint32_t>(attributes.size()));
+    for (auto const &[key, value] : attributes) {
+      PutString(out, key);
+      PutString(out, value);
+    }
+  }
+
+  /// \brief Walks a buffer, checking every read against its end
+  class Reader {
+   public:
+    /// \brief Start reading at the beginning of a buffer
+    ///
+    /// \param[in] data The buffer to read
+    explicit Reader(std::string_view data) : data_(data), pos_(0) {}
+
+    /// \brief Read a little endian uint32
+    ///
+    /// \param[out] value Where to store the value
+    /// \return bool false if the buffer is too short
+    bool
+    U32(std::uint32_t *value) {
+      if (data_.size() - pos_ < 4) { return false; }
+      *value = 0;
+      for (int i = 3; i >= 0; --i) {
+        std::size_t at = pos_ + static_cast<std::size_t>(i);
+        *value         = (*value << 8) | static_cast<unsigned char>(data_[at]);
+      }
+      pos_ += 4;
+      return true;
+    }
+
+    /// \brief Read a length prefixed string, without copying it
+    ///
+    /// \param[out] value A view of the string in the buffer
+    /// \return bool false if the buffer is too short
+    bool
+    View(std::string_view *value) {
+      std::uint32_t size = 0;
+      if (!U32(&size) || data_.size() - pos_ < size) { return false; }
+      *value = data_.substr(pos_, size);
+      pos_ += size;
+      return true;
+    }
+
+    /// \brief Read a length prefixed string
+    ///
+    /// \param[out] value A copy of the string
+    /// \return bool false if the buffer is too short
+    bool
+    String(std::string *value) {
+      std::string_view view;
+      if (!View(&view)) { return false; }
+      value->assign(view);
+      return true;
+    }
+
+    /// \brief Read an attribute list
+    ///
+    /// \param[out] attributes The key value pairs read
+    /// \return bool false if the buffer is too short
+    bool
+    Attributes(std::map<std::string, std::string> *attributes) {
+      std::uint32_t count = 0;
+      if (!U32(&count)) { return false; }
+      for (std::uint32_t i = 0; i < count; ++i) {
+        std::string key;
+        std::string value;
+        if (!String(&key) || !String(&value)) { return false; }
+        (*attributes)[key] = value;
+      }
+      return true;
+    }
+
+    /// \brief Skip over bytes in the buffer
+    ///
+    /// \param[in] size The number of bytes to skip
+    /// \return bool false if the buffer is too short
+    bool
+    Skip(std::size_t size) {
+      if (data_.size() - pos_ < size) { return false; }
+      pos_ += size;
+      return true;
+    }
+
+    /// \brief The offset of the next byte to be read
+    /// \return size_t the read position
+    std::size_t
+    position(void) const {
+      return pos_;
+    }
+
+   private:
+    std::string_view data_;  ///< The buffer being read
+    std::size_t      pos_;   ///< The read position
+  };
+}  // namespace
+
+bool
+fidi::WireFormat::IsBinary(std::string_view body) {
+  return body.size() >= kHeaderSize &&
+         std::memcmp(body.data(), kMagic, sizeof(kMagic)) == 0;
+}
+
+std::string
+fidi::WireFormat::EncodePrefix(
+    const std::map<std::string, std::map<std::string, std::string>> &nodes) {
+  std::string prefix(kMagic, sizeof(kMagic));
+  prefix.push_back(static_cast<char>(kVersion));
+  prefix.append(3, '\0');
+
+  std::string table;
+  PutU32(&table, static_cast<std::uint32_t>(nodes.size()));
+  for (auto const &[name, attributes] : nodes) {
+    PutString(&table, name);
+    PutAttributes(&table, attributes);
+  }
+  PutU32(&prefix, static_cast<std::uint32_t>(table.size()));
+  prefix.append(table);
+  return prefix;
+}
+
+std::string
+fidi::WireFormat::EncodeRequest(
+    const std::map<std::string, std::string> &attributes,
+    const std::vector<EncodedEdge> &          edges) {
+  std::string body;
+  PutAttributes(&body, attributes);
+  PutU32(&body, static_cast<std::uint32_t>(edges.size()));
+  std::uint32_t offset = 0;
+  for (auto const &edge : edges) {
+    PutString(&body, edge.name);
+    PutU32(&body, static_cast<std::uint32_t>(edge.repeat));
+    PutU32(&body, static_cast<std::uint32_t>(edge.sequence));
+    PutAttributes(&body, edge.options);
+    PutU32(&body, offset);
+    PutU32(&body, static_cast<std::uint32_t>(edge.request.size()));
+    offset += static_cast<std::uint32_t>(edge.request.size());
+  }
+  for (auto const &edge : edges) { body.append(edge.request); }
+
+  std::string request;
+  request.reserve(body.size() + 4);
+  PutU32(&request, static_cast<std::uint32_t>(body.size()));
+  request.append(body);
+  return request;
+}
+
+bool
+fidi::WireFormat::Decode(std::string_view body, Message *message,
+                         std::string *error) {
+  if (!IsBinary(body)) {
+    error->append("Not a binary fidi request\n");
+    return false;
+  }
+  if (static_cast<std::uint8_t>(body[sizeof(kMagic)]) != kVersion) {
+    error->append("Unsupported binary fidi request version\n");
+    return false;
+  }
+
+  Reader        reader(body);
+  std::uint32_t size  = 0;
+  std::uint32_t count = 0;
+  reader.Skip(kHeaderSize);
+  if (!reader.U32(&size) || body.size() - reader.position() < size) {
+    error->append("Truncated node table\n");
+    return false;
+  }
+  std::size_t nodes_end = reader.position() + size;
+  message->prefix       = body.substr(0, nodes_end);
+  Reader nodes(body.substr(reader.position(), size));
+  if (!nodes.U32(&count)) {
+    error->append("Truncated node table\n");
+    return false;
+  }
+  for (std::uint32_t i = 0; i < count; ++i) {
+    std::pair<std::string, std::map<std::string, std::string>> node;
+    if (!nodes.String(&node.first) || !nodes.Attributes(&node.second)) {
+      error->append("Truncated node definition\n");
+      return false;
+    }
+    message->nodes.push_back(std::move(node));
+  }
+
+  reader.Skip(size);
+  if (!reader.U32(&size) || body.size() - reader.position() != size) {
+    error->append("Request length does not match the message\n");
+    return false;
+  }
+  std::string_view request = body.substr(reader.position());
+  Reader           top(request);
+  if (!top.Attributes(&message->attributes) || !top.U32(&count)) {
+    error->append("Truncated request\n");
+    return false;
+  }
+  std::vector<std::pair<std::uint32_t, std::uint32_t>> slices;
+  for (std::uint32_t i = 0; i < count; ++i) {
+    Edge          edge{"", 0, 0, {}, std::string_view()};
+    std::uint32_t repeat   = 0;
+    std::uint32_t sequence = 0;
+    std::uint32_t offset   = 0;
+    std::uint32_t length   = 0;
+    if (!top.String(&edge.name) || !top.U32(&repeat) || !top.U32(&sequence) ||
+        !top.Attributes(&edge.options) || !top.U32(&offset) ||
+        !top.U32(&length)) {
+      error->append("Truncated edge definition\n");
+      return false;
+    }
+    edge.repeat   = static_cast<int>(repeat);
+    edge.sequence = static_cast<int>(sequence);
+    message->edges.push_back(std::move(edge));
+    slices.emplace_back(offset, length);
+  }
+
+  // The sub-requests follow the edge index
+  std::string_view subrequests = request.substr(top.position());
+  for (std::size_t i = 0; i < slices.size(); ++i) {
+    auto [offset, length] = slices[i];
+    if (offset > subrequests.size() || subrequests.size() - offset < length) {
+      error->append("Sub-request for ")
+          .append(message->edges[i].name)
+          .append(" lies outside the request\n");
+      return false;
+    }
+    message->edges[i].request = subrequests.substr(offset, length);
+  }
+  return true;
+}
+
+fidi::WireEncoder::~WireEncoder() {
+  delete scanner_;
+  scanner_ = nullptr;
+  delete parser_;
+  parser_ = nullptr;
+}
+
+void
+fidi::WireEncoder::ParseHelper(std::istream &stream) {
+  delete parser_;
+  fidi::Driver::ParseHelper(stream);
+  parser_ = new fidi::Parser((*scanner_) /* scanner */, (*this) /* driver */);
+  const int accept(0);
+  if (parser_->parse() != accept) { nerrors_++; }
+}
+
+bool
+fidi::WireEncoder::EncodeRequest(std::string *request) {
+  bool                                 clean = (nerrors_ == 0);
+  std::vector<WireFormat::EncodedEdge> edges;
+  while (!edge_attributes_.empty()) {
+    auto const &            call = edge_attributes_.top();
+    WireFormat::EncodedEdge edge{call.name, call.edge_attr.first,
+                                 call.edge_attr.second, call.options,
+                                 std::string()};
+    clean = EncodeBlob(call.blob, &edge.request) && clean;
+    edges.push_back(std::move(edge));
+    edge_attributes_.pop();
+  }
+  *request = WireFormat::EncodeRequest(top_attributes_, edges);
+  return clean;
+}
+
+bool
+fidi::WireEncoder::EncodeBlob(const std::string &payload,
+                              std::string *      request) {
+  fidi::WireEncoder  sub_driver;
+  std::istringstream iss(payload);
+  sub_driver.Parse(iss);
+  return sub_driver.EncodeRequest(request);
+}
+
+std::ostream &
+fidi::WireEncoder::Execute(std::ostream &stream) {
+  std::string request;
+  EncodeRequest(&request);
+  stream << WireFormat::EncodePrefix(nodes_) << request;
+  return stream;
+}
+
+//
+// fidi_wire_format.cc ends here
@@ -0,0 +1,203 @@
+// fidi_wire_format.h ---  -*- mode: c++; -*-
+
+// Copyright 2018-2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied.  See the License for the specific language governing
+// permissions and limitations under the License.
+
+/// \file
+/// \ingroup inputhandling
+///
+/// This file contains the pre-parsed binary encoding of fidi (φίδι)
+/// requests, which may be used instead of the text form between
+/// fidi_app instances, and a parser driver that converts the text
+/// form into it.
+
+// Code:
+
+#ifndef FIDI_WIRE_FORMAT_H
+#  define FIDI_WIRE_FORMAT_H
+
+#  include <cstdint>
+#  include <iostream>
+#  include <map>
+#  include <string>
+#  include <string_view>
+#  include <utility>
+#  include <vector>
+
+#  include "src/fidi_driver.h"
+
+namespace fidi {
+
+  /// \brief Encode and decode the binary wire format
+  ///
+  /// A message in the binary wire format is laid out as follows. All
+  /// integers are little endian, and a string is a uint32 length
+  /// followed by that many bytes.
+  ///
+  ///     message   := header nodes request
+  ///     header    := "FIDB" version:u8 0:u8 0:u16
+  ///     nodes     := length:u32 count:u32 { name:str attrs }*
+  ///     request   := length:u32 attrs count:u32 { edge }* sub-requests
+  ///     attrs     := count:u32 { key:str value:str }*
+  ///     edge      := name:str repeat:i32 sequence:i32 attrs offset:u32
+  ///                  size:u32
+  ///
+  /// The sub-requests are the requests for each edge, each a
+  /// complete request in its own right, laid end to end; the offset
+  /// and size of each edge index into them. So, the payload for a
+  /// downstream call is the header and nodes of the incoming message,
+  /// unchanged, followed by the slice for the edge, also unchanged.
+  /// Neither the node table nor the sub-request is decoded or
+  /// re-encoded on the way through; only the top level of each
+  /// request is ever decoded.
+  ///
+  /// The header and nodes come first so that, just like the text
+  /// form, the payload for a call is the common prefix, kept in
+  /// Driver::node_glob_, followed by the payload for the edge.
+  class WireFormat {
+   public:
+    /// The Content-Type of requests in the binary wire format
+    static constexpr const char *kContentType = "application/x-fidi-binary";
+
+    /// An edge in a decoded request
+    struct Edge {
+      std::string      name;      ///< Name of the destination node
+      int              repeat;    ///< The repeat count
+      int              sequence;  ///< The sequence number
+      std::map<std::string, std::string> options;  ///< Other attributes
+      std::string_view request;   ///< The encoded sub-request
+    };
+
+    /// The top level of a decoded message
+    ///
+    /// The string views point into the buffer that was decoded.
+    struct Message {
+      /// The default constructor, an empty message
+      Message() : prefix(), nodes(), attributes(), edges() {}
+
+      std::string_view prefix;  ///< The header and node table, as is
+      /// The nodes, and their attributes, in order
+      std::vector<std::pair<std::string, std::map<std::string, std::string>>>
+          nodes;
+      std::map<std::string, std::string> attributes;  ///< Top attributes
+      std::vector<Edge>                  edges;       ///< The calls
+    };
+
+    /// An edge to be encoded
+    struct EncodedEdge {
+      std::string name;      ///< Name of the destination node
+      int         repeat;    ///< The repeat count
+      int         sequence;  ///< The sequence number
+      std::map<std::string, std::string> options;  ///< Other attributes
+      std::string request;   ///< The sub-request, from EncodeRequest()
+    };
+
+    /// \brief Does a buffer look like a binary wire format message?
+    ///
+    /// \param[in] body The buffer to check
+    /// \return bool true if the buffer starts with the magic number
+    static bool IsBinary(std::string_view body);
+
+    /// \brief Encode the header and the node table
+    ///
+    /// \param[in] nodes The nodes, and their attributes
+    /// \return string The prefix for messages using these nodes
+    static std::string EncodePrefix(
+        const std::map<std::string, std::map<std::string, std::string>>
+            &nodes);
+
+    /// \brief Encode a request, given its already encoded sub-requests
+    ///
+    /// \param[in] attributes The attributes of the request
+    /// \param[in] edges The calls made by the request
+    /// \return string The encoded request
+    static std::string EncodeRequest(
+        const std::map<std::string, std::string> &attributes,
+        const std::vector<EncodedEdge> &          edges);
+
+    /// \brief Decode the top level of a message
+    ///
+    /// The sub-requests are checked to lie within the message, but
+    /// are not themselves decoded.
+    ///
+    /// \param[in] body The message
+    /// \param[out] message The decoded message
+    /// \param[out] error A description of what is wrong, on failure
+    /// \return bool true if the message was decoded
+    static bool Decode(std::string_view body, Message *message,
+                       std::string *error);
+
+   private:
+    static constexpr std::uint8_t kVersion    = 2;  ///< Format version
+    static constexpr std::size_t  kHeaderSize = 8;  ///< Magic and version
+  };
+
+  /// \brief A parser driver that converts text requests to binary
+  ///
+  /// This class parses a request in the text form, and encodes it in
+  /// the fidi::WireFormat. Like the linter, it has to parse the
+  /// payload of every call in turn, with a new driver for each, since
+  /// the sub-requests are encoded too.
+  class WireEncoder : public Driver {
+   public:
+    /// The default constructor
+    WireEncoder() : Driver(), parser_(nullptr) {}
+
+    /// The copy constructor is unused, and deleted
+    WireEncoder(const WireEncoder &) = delete;
+    /// The assignment operator is also not used.
+    WireEncoder &operator=(const WireEncoder &) = delete;
+    /// The move operations are unused, and cleaned up.
+    WireEncoder(WireEncoder &&) = delete;
+    WireEncoder &operator=(WireEncoder &&) = delete;
+
+    /// Destructor. Cleans up the scanner and the parser.
+    virtual ~WireEncoder();
+
+    /// \brief run the parser on the input stream
+    ///
+    /// \param[in, out] stream the input stream with the request.
+    void ParseHelper(std::istream &stream);
+
+    /// \brief Write the whole message in the binary format
+    ///
+    /// \param[in,out] stream The stream to write the message to
+    std::ostream &Execute(std::ostream &stream);
+
+    /// \brief Encode the request parsed, and all its sub-requests
+    ///
+    /// This consumes the calls, so may only be called once.
+    ///
+    /// \param[out] request The encoded request
+    /// \return bool true if every sub-request parsed cleanly
+    bool EncodeRequest(std::string *request);
+
+    /// \brief Encode a payload given in the text form
+    ///
+    /// \param[in] payload A request payload in the text form
+    /// \param[out] request The encoded request
+    /// \return bool true if the payload, and all its sub-requests,
+    ///         parsed cleanly
+    static bool EncodeBlob(const std::string &payload, std::string *request);
+
+   private:
+    fidi::Parser *parser_ = nullptr;  ///< The parser for this request
+  };
+
+}  // namespace fidi
+
+#endif /* FIDI_WIRE_FORMAT_H */
+
+//
+// fidi_wire_format.h ends here